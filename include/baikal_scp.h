@@ -23,6 +23,13 @@
 #define BAIKAL_SCP_IOCTL_CMD_FLASH_READ   (BAIKAL_SCP_IOCTL_CMD_START + 11)
 #define BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE  (BAIKAL_SCP_IOCTL_CMD_START + 12)
 #define BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE  (BAIKAL_SCP_IOCTL_CMD_START + 13)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_STATS  (BAIKAL_SCP_IOCTL_CMD_START + 14)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_COPY   (BAIKAL_SCP_IOCTL_CMD_START + 15)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_FILL   (BAIKAL_SCP_IOCTL_CMD_START + 16)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_PRIORITY (BAIKAL_SCP_IOCTL_CMD_START + 17)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_READ2  (BAIKAL_SCP_IOCTL_CMD_START + 18)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE2 (BAIKAL_SCP_IOCTL_CMD_START + 19)
+#define BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE2 (BAIKAL_SCP_IOCTL_CMD_START + 20)
 
 /* ---------------------------------------------------------------------------------- */
 
@@ -36,21 +43,71 @@ struct baikal_scp_ioctl_flash_info {
 	unsigned total_size;
 };
 
+/*
+ * The driver splits flash operations into SMC buffer sized chunks. On return
+ * (including failure) the "done" field is set to the number of bytes from
+ * the beginning of the request that were completed, so the caller can resume
+ * the operation from offset + done.
+ *
+ * The "done" field is only exchanged by the READ2, WRITE2 and ERASE2
+ * commands (driver 1.6.0 and later). The original READ, WRITE and ERASE
+ * commands are still served with the structures truncated before the
+ * "done" field, as they were used by the older applications.
+ */
+
 struct baikal_scp_ioctl_flash_read {
 	unsigned offset;
 	unsigned size;
 	void *data;
+	unsigned done;
 };
 
 struct baikal_scp_ioctl_flash_write {
 	unsigned offset;
 	unsigned size;
 	void *data;
+	unsigned done;
 };
 
 struct baikal_scp_ioctl_flash_erase {
 	unsigned offset;
 	unsigned size;
+	unsigned done;
+};
+
+/*
+ * Copy and fill run entirely in the driver. The destination area must
+ * be sector aligned and the source must not overlap it, each destination
+ * sector is erased before it is written. The "done" field only counts
+ * the completed sectors.
+ */
+
+struct baikal_scp_ioctl_flash_copy {
+	unsigned src;
+	unsigned dst;
+	unsigned size;
+	unsigned done;
+};
+
+struct baikal_scp_ioctl_flash_fill {
+	unsigned offset;
+	unsigned size;
+	unsigned pattern; /* Byte value, 0x00-0xff */
+	unsigned done;
+};
+
+/*
+ * Reads of an interactive user are not throttled by the duty cycle limit
+ * ("duty_smc_us" module parameter). The setting applies to the reads made
+ * through the same opened device file only and is kept until it is closed.
+ */
+struct baikal_scp_ioctl_flash_priority {
+	unsigned interactive;
+};
+
+/* Driver-wide counters since the driver was loaded */
+struct baikal_scp_ioctl_flash_stats {
+	unsigned long long smc_calls;
 };
 
 /* ---------------------------------------------------------------------------------- */
@@ -76,6 +133,13 @@ struct baikal_scp_ioctl_flash_erase {
 		 sizeof(struct baikal_scp_ioctl_flash_read *) \
 	)
 
+#define BAIKAL_SCP_IOCTL_FLASH_READ2 \
+	_IOC(_IOC_WRITE | _IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_READ2, \
+		 sizeof(struct baikal_scp_ioctl_flash_read *) \
+	)
+
 #define BAIKAL_SCP_IOCTL_FLASH_WRITE \
 	_IOC(_IOC_WRITE, \
 		 BAIKAL_SCP_IOCTL_MAGIC, \
@@ -83,6 +147,13 @@ struct baikal_scp_ioctl_flash_erase {
 		 sizeof(struct baikal_scp_ioctl_flash_write *) \
 	)
 
+#define BAIKAL_SCP_IOCTL_FLASH_WRITE2 \
+	_IOC(_IOC_WRITE | _IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE2, \
+		 sizeof(struct baikal_scp_ioctl_flash_write *) \
+	)
+
 #define BAIKAL_SCP_IOCTL_FLASH_ERASE \
 	_IOC(_IOC_WRITE, \
 		 BAIKAL_SCP_IOCTL_MAGIC, \
@@ -90,6 +161,41 @@ struct baikal_scp_ioctl_flash_erase {
 		 sizeof(struct baikal_scp_ioctl_flash_erase *) \
 	)
 
+#define BAIKAL_SCP_IOCTL_FLASH_ERASE2 \
+	_IOC(_IOC_WRITE | _IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE2, \
+		 sizeof(struct baikal_scp_ioctl_flash_erase *) \
+	)
+
+#define BAIKAL_SCP_IOCTL_FLASH_STATS \
+	_IOC(_IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_STATS, \
+		 sizeof(struct baikal_scp_ioctl_flash_stats *) \
+	)
+
+#define BAIKAL_SCP_IOCTL_FLASH_COPY \
+	_IOC(_IOC_WRITE | _IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_COPY, \
+		 sizeof(struct baikal_scp_ioctl_flash_copy *) \
+	)
+
+#define BAIKAL_SCP_IOCTL_FLASH_FILL \
+	_IOC(_IOC_WRITE | _IOC_READ, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_FILL, \
+		 sizeof(struct baikal_scp_ioctl_flash_fill *) \
+	)
+
+#define BAIKAL_SCP_IOCTL_FLASH_PRIORITY \
+	_IOC(_IOC_WRITE, \
+		 BAIKAL_SCP_IOCTL_MAGIC, \
+		 BAIKAL_SCP_IOCTL_CMD_FLASH_PRIORITY, \
+		 sizeof(struct baikal_scp_ioctl_flash_priority *) \
+	)
+
 /* ---------------------------------------------------------------------------------- */
 
 #endif /* BAIKAL_SCP_H */
@@ -75,6 +75,27 @@ int baikal_scp_init(void);
  */
 void baikal_scp_deinit(void);
 
+/**
+ * Release the device (or the connection to the flash service daemon) held
+ * by the library, so the other processes can open the device. The flash
+ * operation counters are kept. No requests can be made until
+ * baikal_scp_resume() is called.
+ */
+int baikal_scp_suspend(void);
+
+/**
+ * Open the device (or connect to the daemon) again after baikal_scp_suspend().
+ * The open is retried as by baikal_scp_open(), EBUSY is returned if the
+ * device is still held by another process.
+ */
+int baikal_scp_resume(void);
+
+/**
+ * Mark the requests of the library as background (see
+ * baikal_scp_handle_set_background())
+ */
+int baikal_scp_set_background(int background);
+
 /**
  * Retrieve version information
  */
@@ -88,8 +109,11 @@ int baikal_scp_flash_info(baikal_scp_flash_info_t *info);
 /**
  * Read data from flash
  *
- * @param[in] offset Flash offset (must be aligned to 64 bytes)
- * @param[in] size   Read size in bytes (must be aligned to 64 bytes)
+ * Offset and size may be unaligned, the partial units
+ * at the edges are read as a whole.
+ *
+ * @param[in] offset Flash offset
+ * @param[in] size   Read size in bytes
  * @param[in] dst    Pointer to the destination buffer
  *                   (size of the buffer must baikal greater or equal @param size)
  * @param[in] cb     Pointer to the progress callback function
@@ -102,10 +126,13 @@ int baikal_scp_flash_read(
 );
 
 /**
- * Write data to flash
+ * Write data to flash (the area must be erased before)
+ *
+ * Offset and size may be unaligned, the partial units at the edges
+ * are padded with 0xff, so the neighbouring data is not changed.
  *
- * @param[in] offset Flash offset (must be aligned to 64 bytes)
- * @param[in] size   Write size in bytes (must be aligned to 64 bytes)
+ * @param[in] offset Flash offset
+ * @param[in] size   Write size in bytes
  * @param[in] dst    Pointer to the buffer with data
  *                   (size of the buffer must baikal greater or equal @param size)
  * @param[in] cb     Pointer to the progress callback function
@@ -120,8 +147,12 @@ int baikal_scp_flash_write(
 /**
  * Erase data on flash
  *
- * @param[in] offset Flash offset (must be aligned to 64 bytes)
- * @param[in] size   Erase size in bytes (must be aligned to 64 bytes)
+ * Offset and size may be unaligned. The neighbouring data in the partial
+ * units at the edges is preserved (the sectors containing the edges are
+ * rewritten when required).
+ *
+ * @param[in] offset Flash offset
+ * @param[in] size   Erase size in bytes
  * @param[in] cb     Pointer to the progress callback function
  */
 int baikal_scp_flash_erase(
@@ -131,12 +162,864 @@ int baikal_scp_flash_erase(
 );
 
 /**
- * Get size and offset required alignment size
+ * Copy flash area to another flash area
+ *
+ * The data is copied by the driver and is not transferred to the process
+ * (with older drivers it is read and written back by the library).
+ * The destination must cover whole sectors, each of them is erased before
+ * it is written. The source must be aligned to the programming unit and
+ * must not overlap the destination.
+ *
+ * The driver relies on the firmware programming the data left in its buffer
+ * by the preceding flash read, which the firmware interface does not
+ * guarantee. Each copied sector is therefore compared with the source by
+ * the SHA-256 digests (the data is read back, by the daemon if it is
+ * running). If they differ, the sector and the following sectors are read
+ * and written back by the library.
+ *
+ * @param[in] src  Source flash offset
+ * @param[in] dst  Destination flash offset (sector aligned)
+ * @param[in] size Size in bytes (multiple of the sector size)
+ * @param[in] cb   Pointer to the progress callback function
+ */
+int baikal_scp_flash_copy(
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress_cb_t cb
+);
+
+/**
+ * Fill flash area with the pattern byte
+ *
+ * The area is erased and written by the driver sector by sector
+ * (see baikal_scp_flash_copy()). Filling with 0xff only erases the area.
+ *
+ * @param[in] offset  Flash offset (sector aligned)
+ * @param[in] size    Size in bytes (multiple of the sector size)
+ * @param[in] pattern Pattern byte
+ * @param[in] cb      Pointer to the progress callback function
+ */
+int baikal_scp_flash_fill(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress_cb_t cb
+);
+
+/**
+ * Get flash programming unit size. Requests with offset and size aligned
+ * to it are transferred directly, without handling of the partial units.
  *
  * @return Alignment size
  */
 unsigned int baikal_scp_flash_alignment(void);
 
+/**
+ * Flash request types of the per request type counters
+ */
+typedef enum baikal_scp_stats_op {
+	BAIKAL_SCP_STATS_READ = 0,
+	BAIKAL_SCP_STATS_WRITE,
+	BAIKAL_SCP_STATS_ERASE,
+	BAIKAL_SCP_STATS_COPY,
+	BAIKAL_SCP_STATS_FILL,
+	BAIKAL_SCP_STATS_OPS
+} baikal_scp_stats_op_t;
+
+/**
+ * Number of request latency histogram buckets. Bucket i counts the requests
+ * completed in less than 10^(i+1) microseconds (below 10 us, 100 us, 1 ms,
+ * 10 ms, 100 ms and 1 s), the last bucket counts the longer requests.
+ */
+#define BAIKAL_SCP_STATS_HIST_BUCKETS 7
+
+/**
+ * Counters of a single flash request type
+ */
+typedef struct baikal_scp_stats_entry {
+	unsigned long long requests; /* Requests (ioctl, pread/pwrite or daemon requests) issued */
+	unsigned long long errors;   /* Requests that failed or completed partially */
+	unsigned long long retries;  /* Partially completed requests that were resumed */
+	unsigned long long bytes;    /* Bytes completed */
+	unsigned long long total_ns; /* Cumulative request latency (monotonic clock) */
+	unsigned long long max_ns;   /* Maximum request latency */
+	unsigned long long hist[BAIKAL_SCP_STATS_HIST_BUCKETS];
+} baikal_scp_stats_entry_t;
+
+/**
+ * Flash operation counters structure. The totals are derived from the
+ * per request type counters.
+ */
+typedef struct baikal_scp_flash_counters {
+	unsigned long long ioctls;  /* Flash read/write/erase requests (ioctl or pread/pwrite) issued to the driver */
+	unsigned long long retries; /* Partially completed requests that were resumed */
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	unsigned long long bytes_erased;
+	baikal_scp_stats_entry_t op[BAIKAL_SCP_STATS_OPS]; /* Indexed by baikal_scp_stats_op_t */
+} baikal_scp_flash_counters_t;
+
+/**
+ * Retrieve flash operation counters accumulated since library initialization
+ */
+int baikal_scp_flash_counters(baikal_scp_flash_counters_t *counters);
+
+/**
+ * Retrieve the number of SMC calls made by the driver since it was loaded.
+ * The counter is driver-wide, it includes the calls made for all processes.
+ * Returns EOPNOTSUPP if the driver does not provide the counter.
+ */
+int baikal_scp_flash_smc_calls(unsigned long long *calls);
+
+/**
+ * Mark the reads of this process as interactive (non-zero) or background
+ * (zero, the default). Interactive reads are not throttled by the SMC duty
+ * cycle limit of the driver, writes and erases always are. Returns
+ * EOPNOTSUPP if the driver does not support the request or the flash is
+ * accessed through the flash service daemon.
+ */
+int baikal_scp_flash_set_interactive(int interactive);
+
+/**
+ * Set the size of the requests long flash operations of the type are split
+ * into, e.g. the best request size measured by baikal-scp-flash --benchmark.
+ * The size must be aligned to the programming unit and must not exceed
+ * 1 MiB, 0 restores the default size. Requests sent to the flash service
+ * daemon keep their fixed size.
+ */
+int baikal_scp_flash_set_part_size(baikal_scp_flash_operation_t op, unsigned int size);
+
+/* ---------------------------------------------------------------------------------- */
+
+/**
+ * Library handle
+ *
+ * Each handle has its own device file descriptor, cached flash geometry,
+ * transfer buffers and operation counters. Different handles may be used
+ * concurrently from different threads, a single handle must not.
+ * The functions above work with the default handle created by baikal_scp_init().
+ *
+ * If the device is held by the flash service daemon (baikal-scpd), the
+ * handle is connected to the daemon socket and all requests are served
+ * by the daemon. The counters then count the requests sent to the daemon.
+ */
+typedef struct baikal_scp_handle baikal_scp_handle_t;
+
+/**
+ * Flash operation progress callback function with user data
+ */
+typedef void (*baikal_scp_flash_progress_ex_cb_t)
+	(const baikal_scp_flash_progress_info_t *progress_info, void *user);
+
+/**
+ * Open new library handle
+ *
+ * If the device is briefly held by another process (e.g. by a background
+ * scrub between its requests), the open is retried for up to a second.
+ * EBUSY is returned if the device is still held after the retries,
+ * ENODEV if it can not be opened for another reason.
+ *
+ * @param[out] handle Pointer to the variable receiving the handle
+ */
+int baikal_scp_open(baikal_scp_handle_t **handle);
+
+/**
+ * Close library handle and free its resources
+ */
+void baikal_scp_close(baikal_scp_handle_t *handle);
+
+/**
+ * Mark the requests of the handle as background (non-zero) or normal
+ * (zero, the default). The flash service daemon serves the background
+ * requests only when no other request is queued. A background user
+ * opening the device directly should suspend the handle between its
+ * requests (see baikal_scp_handle_suspend()), so the other processes
+ * can open the device.
+ */
+int baikal_scp_handle_set_background(
+	baikal_scp_handle_t *handle,
+	int background
+);
+
+/**
+ * Release the device held by the handle (see baikal_scp_suspend())
+ */
+int baikal_scp_handle_suspend(baikal_scp_handle_t *handle);
+
+/**
+ * Open the device for the suspended handle again (see baikal_scp_resume())
+ */
+int baikal_scp_handle_resume(baikal_scp_handle_t *handle);
+
+/**
+ * Retrieve version information (see baikal_scp_version())
+ */
+int baikal_scp_handle_version(
+	baikal_scp_handle_t *handle,
+	baikal_scp_version_info_t *version_info
+);
+
+/**
+ * Retrieve flash information (see baikal_scp_flash_info())
+ *
+ * Flash geometry is requested from the driver only once per handle.
+ */
+int baikal_scp_handle_flash_info(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_info_t *info
+);
+
+/**
+ * Read data from flash (see baikal_scp_flash_read())
+ *
+ * @param[in] user User data passed to the progress callback function
+ */
+int baikal_scp_handle_flash_read(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	void *dst,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+);
+
+/**
+ * Write data to flash (see baikal_scp_flash_write())
+ *
+ * @param[in] user User data passed to the progress callback function
+ */
+int baikal_scp_handle_flash_write(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+);
+
+/**
+ * Erase data on flash (see baikal_scp_flash_erase())
+ *
+ * @param[in] user User data passed to the progress callback function
+ */
+int baikal_scp_handle_flash_erase(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+);
+
+/**
+ * Retrieve flash operation counters accumulated since the handle was opened
+ */
+int baikal_scp_handle_flash_counters(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_counters_t *counters
+);
+
+
+/**
+ * Copy flash area (see baikal_scp_flash_copy())
+ *
+ * @param[in] user User data passed to the progress callback function
+ */
+int baikal_scp_handle_flash_copy(
+	baikal_scp_handle_t *handle,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+);
+
+/**
+ * Fill flash area with the pattern byte (see baikal_scp_flash_fill())
+ *
+ * @param[in] user User data passed to the progress callback function
+ */
+int baikal_scp_handle_flash_fill(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+);
+
+/**
+ * Retrieve the number of SMC calls made by the driver since it was loaded
+ */
+int baikal_scp_handle_flash_smc_calls(
+	baikal_scp_handle_t *handle,
+	unsigned long long *calls
+);
+
+/**
+ * Mark the reads of the handle as interactive or background
+ * (see baikal_scp_flash_set_interactive())
+ */
+int baikal_scp_handle_flash_set_interactive(
+	baikal_scp_handle_t *handle,
+	int interactive
+);
+
+/**
+ * Set the request size of the handle for the operation type
+ * (see baikal_scp_flash_set_part_size())
+ */
+int baikal_scp_handle_flash_set_part_size(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int size
+);
+
+/* ---------------------------------------------------------------------------------- */
+
+/**
+ * Flash operation phase enumeration (progress reporting v2)
+ *
+ * The phase is set by the caller, so the reads done to compare
+ * or verify the data are reported separately from plain reads.
+ */
+typedef enum {
+	BAIKAL_SCP_FLASH_PHASE_READ = 0,
+	BAIKAL_SCP_FLASH_PHASE_ERASE,
+	BAIKAL_SCP_FLASH_PHASE_WRITE,
+	BAIKAL_SCP_FLASH_PHASE_VERIFY,
+	BAIKAL_SCP_FLASH_PHASE_COMPARE,
+} baikal_scp_flash_phase_t;
+
+/**
+ * Flash phase progress information structure (progress reporting v2)
+ */
+typedef struct baikal_scp_flash_progress2_info {
+	baikal_scp_flash_phase_t     phase;
+	baikal_scp_flash_operation_t operation; /* Operation of the current request */
+	unsigned int       offset;    /* Flash offset reached by the current request */
+	unsigned long long size;      /* Total bytes of the phase */
+	unsigned long long bytes;     /* Bytes of the phase completed */
+	unsigned int       percent;
+	double             timestamp; /* CLOCK_MONOTONIC time, seconds */
+	double             elapsed;   /* Time since the phase begin, seconds */
+	double             rate;      /* Throughput since the previous callback, bytes/s */
+	double             avg_rate;  /* Throughput since the phase begin, bytes/s */
+	double             eta;       /* Estimated time left, seconds (-1 if unknown) */
+	int                final;     /* Set for the last callback of the phase */
+} baikal_scp_flash_progress2_info_t;
+
+/**
+ * Flash phase progress callback function (progress reporting v2)
+ */
+typedef void (*baikal_scp_flash_progress2_cb_t)
+	(const baikal_scp_flash_progress2_info_t *progress_info, void *user);
+
+/**
+ * Flash phase progress structure (progress reporting v2)
+ *
+ * A phase may consist of several flash requests. The callback is invoked
+ * when the phase begins, at most max_rate times per second while
+ * the requests progress, and when the phase ends.
+ */
+typedef struct baikal_scp_flash_progress2 {
+	/* Set by the caller */
+	baikal_scp_flash_progress2_cb_t cb;
+	void        *user;
+	unsigned int max_rate; /* Callbacks per second, 0 for no limit */
+
+	/* Internal state */
+	baikal_scp_flash_progress2_info_t info;
+	double       begin;      /* Timestamp of the phase begin */
+	double       last;       /* Timestamp of the last callback */
+	unsigned long long last_bytes;
+	unsigned long long request_base; /* Phase bytes before the current request */
+	unsigned int request_offset;
+	unsigned int request_size;
+	unsigned int request_bytes;
+} baikal_scp_flash_progress2_t;
+
+/**
+ * Begin the phase of the specified total size in bytes
+ */
+void baikal_scp_flash_progress2_begin(
+	baikal_scp_flash_progress2_t *progress,
+	baikal_scp_flash_phase_t phase,
+	unsigned long long size
+);
+
+/**
+ * End the phase. The final callback is invoked regardless of the rate limit.
+ */
+void baikal_scp_flash_progress2_end(baikal_scp_flash_progress2_t *progress);
+
+/**
+ * Progress callback for the handle API: pass it as the callback function
+ * and the progress structure as the user data to the handle functions
+ */
+void baikal_scp_flash_progress2_cb(
+	const baikal_scp_flash_progress_info_t *progress_info,
+	void *user
+);
+
+/**
+ * Read, write and erase data on flash reporting the phase progress
+ * (see baikal_scp_flash_read(), baikal_scp_flash_write() and
+ * baikal_scp_flash_erase()). The progress may be NULL.
+ */
+int baikal_scp_flash_read2(
+	unsigned int offset,
+	unsigned int size,
+	void *dst,
+	baikal_scp_flash_progress2_t *progress
+);
+
+int baikal_scp_flash_write2(
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	baikal_scp_flash_progress2_t *progress
+);
+
+int baikal_scp_flash_erase2(
+	unsigned int offset,
+	unsigned int size,
+	baikal_scp_flash_progress2_t *progress
+);
+
+/**
+ * Copy and fill flash area reporting the phase progress (see
+ * baikal_scp_flash_copy() and baikal_scp_flash_fill()). The progress may be NULL.
+ */
+int baikal_scp_flash_copy2(
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress2_t *progress
+);
+
+int baikal_scp_flash_fill2(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress2_t *progress
+);
+
+/* ---------------------------------------------------------------------------------- */
+
+/**
+ * Buffered flash update session
+ *
+ * Writes are accumulated in memory, overlapping and adjacent writes are
+ * merged. On flush each touched sector is programmed once: without erase
+ * when the new data only clears bits of the current contents, otherwise
+ * by a single read, erase and write of the sector.
+ */
+typedef struct baikal_scp_flash_session baikal_scp_flash_session_t;
+
+/**
+ * Begin buffered flash update session (default handle)
+ */
+int baikal_scp_flash_session_begin(baikal_scp_flash_session_t **session);
+
+/**
+ * Begin buffered flash update session on the handle
+ */
+int baikal_scp_handle_flash_session_begin(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_session_t **session
+);
+
+/**
+ * Add data to the session. Nothing is written to flash until
+ * baikal_scp_flash_session_flush() is called.
+ *
+ * @param[in] offset Flash offset (no alignment required)
+ * @param[in] size   Data size in bytes (no alignment required)
+ * @param[in] data   Pointer to the data
+ */
+int baikal_scp_flash_session_write(
+	baikal_scp_flash_session_t *session,
+	unsigned int offset,
+	unsigned int size,
+	const void *data
+);
+
+/**
+ * Program all accumulated data to flash. On success the session is empty
+ * and may be used for the next updates. On failure the data is kept,
+ * so flush can be retried (sectors already programmed are skipped).
+ *
+ * @param[out] sectors_rewritten Number of erased sectors (may be NULL)
+ */
+int baikal_scp_flash_session_flush(
+	baikal_scp_flash_session_t *session,
+	unsigned int *sectors_rewritten
+);
+
+/**
+ * End the session. Data that was not flushed is discarded.
+ */
+void baikal_scp_flash_session_end(baikal_scp_flash_session_t *session);
+
+/* ---------------------------------------------------------------------------------- */
+
+/** Size of SHA-256 digest in bytes */
+#define BAIKAL_SCP_SHA256_SIZE 32
+
+/**
+ * SHA-256 context structure
+ */
+typedef struct baikal_scp_sha256_ctx {
+	unsigned int       state[8];
+	unsigned long long count;
+	unsigned char      buf[64];
+} baikal_scp_sha256_ctx_t;
+
+/**
+ * Calculate SHA-256 digest of the data incrementally
+ */
+void baikal_scp_sha256_init(baikal_scp_sha256_ctx_t *ctx);
+void baikal_scp_sha256_update(baikal_scp_sha256_ctx_t *ctx, const void *data, unsigned int size);
+void baikal_scp_sha256_final(baikal_scp_sha256_ctx_t *ctx,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]);
+
+/**
+ * Calculate SHA-256 digest of the data
+ */
+void baikal_scp_sha256(const void *data, unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]);
+
+/**
+ * Calculate SHA-256 digest of the flash area (default handle)
+ *
+ * @param[in]  offset Flash offset (no alignment required)
+ * @param[in]  size   Area size in bytes (no alignment required)
+ * @param[out] digest Calculated digest
+ */
+int baikal_scp_flash_sha256(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]
+);
+
+/**
+ * Calculate SHA-256 digest of the flash area on the handle. When the handle
+ * is connected to the flash service daemon, the digest is calculated by the
+ * daemon and the data is not transferred.
+ */
+int baikal_scp_handle_flash_sha256(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]
+);
+
+/* ---------------------------------------------------------------------------------- */
+
+/** Maximum length of the EFI variable name (UTF-8, including terminating zero) */
+#define BAIKAL_SCP_EFIVAR_NAME_MAX 128
+
+/**
+ * EFI GUID structure
+ */
+typedef struct baikal_scp_efi_guid {
+	unsigned int   data1;
+	unsigned short data2;
+	unsigned short data3;
+	unsigned char  data4[8];
+} baikal_scp_efi_guid_t;
+
+/**
+ * EFI variable information structure
+ */
+typedef struct baikal_scp_efivar_info {
+	char                  name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+	baikal_scp_efi_guid_t guid;
+	unsigned int          attributes;
+	unsigned int          data_size;
+	unsigned int          data_offset; /* Flash offset of the variable data */
+} baikal_scp_efivar_info_t;
+
+/**
+ * EFI variables list callback function
+ *
+ * @return 0 to continue listing or non-zero value to stop listing
+ *         (this value is returned from @ref baikal_scp_efivar_list)
+ */
+typedef int (*baikal_scp_efivar_list_cb_t)
+	(const baikal_scp_efivar_info_t *info, void *user);
+
+/**
+ * List valid variables from EFI variable store
+ *
+ * Only variable headers and names are read from flash. The built
+ * name/GUID index is cached in the library handle and reused until
+ * the store is changed.
+ *
+ * @param[in] store_offset Flash offset of the variable store (var partition)
+ * @param[in] store_size   Size of the variable store
+ * @param[in] cb           Pointer to the callback function called for each variable
+ * @param[in] user         User pointer passed to the callback function
+ */
+int baikal_scp_efivar_list(
+	unsigned int store_offset,
+	unsigned int store_size,
+	baikal_scp_efivar_list_cb_t cb,
+	void *user
+);
+
+/**
+ * Get single variable from EFI variable store
+ *
+ * @param[in]  store_offset Flash offset of the variable store (var partition)
+ * @param[in]  store_size   Size of the variable store
+ * @param[in]  name         Variable name (UTF-8)
+ * @param[in]  guid         Variable vendor GUID (NULL to match any GUID)
+ * @param[out] info         Pointer to the variable information structure
+ * @param[out] data         Pointer to the buffer for variable data
+ *                          (NULL to retrieve variable information only)
+ * @param[in]  data_size    Size of the data buffer
+ *
+ * @return 0 on success
+ * @return ENOENT if variable is not found
+ * @return ENOBUFS if data buffer is too small (info is filled)
+ */
+int baikal_scp_efivar_get(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	baikal_scp_efivar_info_t *info,
+	void *data,
+	unsigned int data_size
+);
+
+/**
+ * Set (add or update) single variable in EFI variable store
+ *
+ * The new variable record is appended to the end of the variable area and
+ * the old record (if any) is marked as deleted. Both steps only clear bits
+ * on flash, so normally no erase is required. The store sector is rewritten
+ * only if the area after the last variable is not blank.
+ *
+ * @param[in] store_offset Flash offset of the variable store (var partition)
+ * @param[in] store_size   Size of the variable store
+ * @param[in] name         Variable name (UTF-8)
+ * @param[in] guid         Variable vendor GUID
+ * @param[in] attributes   Variable attributes
+ * @param[in] data         Pointer to the variable data
+ * @param[in] data_size    Size of the variable data (0 to delete variable)
+ *
+ * @return 0 on success
+ * @return ENOSPC if there is no free space in the store
+ *         (use @ref baikal_scp_efivar_reclaim to free space)
+ */
+int baikal_scp_efivar_set(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	unsigned int attributes,
+	const void *data,
+	unsigned int data_size
+);
+
+/**
+ * Delete single variable from EFI variable store
+ *
+ * The variable record is only marked as deleted, the space
+ * is freed by @ref baikal_scp_efivar_reclaim.
+ */
+int baikal_scp_efivar_delete(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid
+);
+
+/**
+ * Reclaim space occupied by deleted variables in EFI variable store
+ *
+ * Valid variables are packed to the beginning of the variable area.
+ * Only sectors with changed contents are rewritten.
+ *
+ * The store is rewritten in place, not through the fault tolerant write
+ * spare block. A power loss during the reclaim destroys all variables.
+ *
+ * @param[in]  store_offset      Flash offset of the variable store (var partition)
+ * @param[in]  store_size        Size of the variable store
+ * @param[out] sectors_rewritten Number of rewritten sectors (may be NULL)
+ */
+int baikal_scp_efivar_reclaim(
+	unsigned int store_offset,
+	unsigned int store_size,
+	unsigned int *sectors_rewritten
+);
+
+/**
+ * List valid variables from EFI variable store (see baikal_scp_efivar_list())
+ */
+int baikal_scp_handle_efivar_list(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	baikal_scp_efivar_list_cb_t cb,
+	void *user
+);
+
+/**
+ * Get single variable from EFI variable store (see baikal_scp_efivar_get())
+ */
+int baikal_scp_handle_efivar_get(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	baikal_scp_efivar_info_t *info,
+	void *data,
+	unsigned int data_size
+);
+
+/**
+ * Set single variable in EFI variable store (see baikal_scp_efivar_set())
+ */
+int baikal_scp_handle_efivar_set(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	unsigned int attributes,
+	const void *data,
+	unsigned int data_size
+);
+
+/**
+ * Delete single variable from EFI variable store (see baikal_scp_efivar_delete())
+ */
+int baikal_scp_handle_efivar_delete(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid
+);
+
+/**
+ * Reclaim space in EFI variable store (see baikal_scp_efivar_reclaim())
+ */
+int baikal_scp_handle_efivar_reclaim(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	unsigned int *sectors_rewritten
+);
+
+/* ---------------------------------------------------------------------------------- */
+
+/** Maximum length of the FAT file name (UTF-8, including terminating zero) */
+#define BAIKAL_SCP_FAT_NAME_MAX 768
+
+/**
+ * FAT directory entry information structure
+ */
+typedef struct baikal_scp_fat_entry_info {
+	char         name[BAIKAL_SCP_FAT_NAME_MAX]; /* Long name (or short name if there is no long name) */
+	char         short_name[13];                /* Short 8.3 name */
+	unsigned int attributes;
+	unsigned int size;
+	unsigned int cluster;                       /* First cluster */
+	int          is_dir;
+} baikal_scp_fat_entry_info_t;
+
+/**
+ * FAT directory list callback function
+ *
+ * @return 0 to continue listing or non-zero value to stop listing
+ *         (this value is returned from @ref baikal_scp_fat_list)
+ */
+typedef int (*baikal_scp_fat_list_cb_t)
+	(const baikal_scp_fat_entry_info_t *info, void *user);
+
+/**
+ * List directory of the FAT file system (read-only)
+ *
+ * Boot sector, FAT and directory sectors are read from flash on demand
+ * through a small block cache, the whole area is never read.
+ *
+ * @param[in] area_offset Flash offset of the FAT file system (fat partition)
+ * @param[in] area_size   Size of the flash area
+ * @param[in] path        Directory path ('/' separated, NULL or "/" for root).
+ *                        If path is a file, only this file is listed.
+ * @param[in] cb          Pointer to the callback function called for each entry
+ * @param[in] user        User pointer passed to the callback function
+ *
+ * @return 0 on success
+ * @return ENOENT if path is not found
+ * @return EINVAL if there is no valid FAT file system in the area
+ */
+int baikal_scp_fat_list(
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_list_cb_t cb,
+	void *user
+);
+
+/**
+ * Read file from the FAT file system (read-only)
+ *
+ * Only the clusters of the file are read from flash.
+ *
+ * @param[in]  area_offset Flash offset of the FAT file system (fat partition)
+ * @param[in]  area_size   Size of the flash area
+ * @param[in]  path        File path ('/' separated, case-insensitive)
+ * @param[out] info        Pointer to the entry information structure
+ * @param[out] data        Pointer to the buffer for file data
+ *                         (NULL to retrieve file information only)
+ * @param[in]  data_size   Size of the data buffer
+ *
+ * @return 0 on success
+ * @return ENOENT if file is not found
+ * @return EISDIR if path is a directory
+ * @return ENOBUFS if data buffer is too small (info is filled)
+ */
+int baikal_scp_fat_read(
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_entry_info_t *info,
+	void *data,
+	unsigned int data_size
+);
+
+/**
+ * List directory of the FAT file system (see baikal_scp_fat_list())
+ */
+int baikal_scp_handle_fat_list(
+	baikal_scp_handle_t *handle,
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_list_cb_t cb,
+	void *user
+);
+
+/**
+ * Read file from the FAT file system (see baikal_scp_fat_read())
+ */
+int baikal_scp_handle_fat_read(
+	baikal_scp_handle_t *handle,
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_entry_info_t *info,
+	void *data,
+	unsigned int data_size
+);
+
 #endif /* __KERNEL__ */
 
 #endif /* BAIKAL_SCP_LIB_H */
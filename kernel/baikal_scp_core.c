@@ -9,36 +9,57 @@
 
 #include "baikal_scp_private.h"
 
+#define CREATE_TRACE_POINTS
+#include "baikal_scp_trace.h"
+
 static baikal_scp_dev_t *scpdev = NULL;
 
 static int baikal_scp_dev_fop_open(struct inode *inode, struct file *file)
 {
+	baikal_scp_file_t *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
 	mutex_lock(&scpdev->lock);
 
 	if (scpdev->open_counter) {
 		/* Only one instance of the user-space tool can work with SCP device */
 		mutex_unlock(&scpdev->lock);
+		kfree(ctx);
 		return -EBUSY;
 	}
 
 	++scpdev->open_counter;
 
 	mutex_unlock(&scpdev->lock);
+
+	file->private_data = ctx;
 	return 0;
 }
 
-static int baikal_scp_dev_fop_flush(struct file *file, fl_owner_t id)
+/*
+ * Called once the last reference to the file is dropped, so closing
+ * a duplicated descriptor does not release the device
+ */
+static int baikal_scp_dev_fop_release(struct inode *inode, struct file *file)
 {
 	mutex_lock(&scpdev->lock);
 	--scpdev->open_counter;
 	mutex_unlock(&scpdev->lock);
+
+	kfree(file->private_data);
 	return 0;
 }
 
 static const struct file_operations baikal_scp_dev_fops = {
 	.owner           = THIS_MODULE,
 	.open            = baikal_scp_dev_fop_open,
-	.flush           = baikal_scp_dev_fop_flush,
+	.release         = baikal_scp_dev_fop_release,
+	.llseek          = baikal_scp_dev_fop_llseek,
+	.read            = baikal_scp_dev_fop_read,
+	.write           = baikal_scp_dev_fop_write,
 	.unlocked_ioctl  = baikal_scp_dev_fop_ioctl,
 	.compat_ioctl    = baikal_scp_dev_fop_ioctl,
 };
@@ -86,7 +107,7 @@ static baikal_scp_dev_t *baikal_scp_dev_init(void)
 		return NULL;
 	}
 
-	device_create(dev->class, NULL, MKDEV(dev->major, 0),
+	dev->device = device_create(dev->class, NULL, MKDEV(dev->major, 0),
 		(void *)dev, BAIKAL_SCP_DEV_NAME
 	);
 
@@ -107,9 +128,24 @@ static void baikal_scp_dev_destroy(baikal_scp_dev_t *dev)
 
 static int __init baikal_scp_init_module(void)
 {
+	int ret;
+
+	ret = baikal_scp_worker_init();
+	if (ret)
+		return ret;
+
 	scpdev = baikal_scp_dev_init();
-	if (!scpdev)
+	if (!scpdev) {
+		baikal_scp_worker_exit();
 		return -1;
+	}
+
+	ret = baikal_scp_mtd_register(scpdev->device);
+	if (ret) {
+		baikal_scp_dev_destroy(scpdev);
+		baikal_scp_worker_exit();
+		return ret;
+	}
 
 	printk(BAIKAL_SCP_DRV_DESCRIPTION " version " BAIKAL_SCP_DRV_VERSION_STR " loaded\n");
 
@@ -118,7 +154,9 @@ static int __init baikal_scp_init_module(void)
 
 static void __exit baikal_scp_cleanup_module(void)
 {
+	baikal_scp_mtd_unregister();
 	baikal_scp_dev_destroy(scpdev);
+	baikal_scp_worker_exit();
 	printk(BAIKAL_SCP_DRV_DESCRIPTION " unloaded\n");
 }
 
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: (GPL-2.0+ OR MIT)
+/*
+ * Baikal-M (BE-M1000) SCP communication driver
+ *
+ * Copyright (C) 2021 Tano Systems LLC. All rights reserved.
+ *
+ * Authors: Anton Kikin <a.kikin@tano-systems.com>
+ */
+
+#include "baikal_scp_private.h"
+
+/*
+ * read()/write()/llseek() on the device file. The file offset is the flash
+ * offset, so the flash can be accessed with pread()/pwrite() and standard
+ * tools (dd, cmp, sha256sum). User data goes through a kernel buffer of
+ * BAIKAL_SCP_FILE_BUF_SIZE bytes, which is then streamed through the SMC
+ * buffer by the flash functions.
+ */
+#define BAIKAL_SCP_FILE_BUF_SIZE (64 * 1024)
+
+#define BAIKAL_SCP_FILE_ALIGN_DOWN(x) \
+	((x) & ~((unsigned)BAIKAL_SCP_FLASH_SIZE_ALIGNMENT - 1))
+
+#define BAIKAL_SCP_FILE_ALIGN_UP(x) \
+	BAIKAL_SCP_FILE_ALIGN_DOWN((x) + (unsigned)BAIKAL_SCP_FLASH_SIZE_ALIGNMENT - 1)
+
+/* Flash functions return -1 when an SMC call fails */
+static inline ssize_t baikal_scp_file_error(int ret)
+{
+	return (ret == -1) ? -EIO : ret;
+}
+
+loff_t baikal_scp_dev_fop_llseek(struct file *file, loff_t offset, int whence)
+{
+	int ret;
+	baikal_scp_flash_info_t flash_info;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	return fixed_size_llseek(file, offset, whence, flash_info.total_size);
+}
+
+/*
+ * Reads may start and end at any offset, the flash is read
+ * from/to the nearest aligned offsets
+ */
+ssize_t baikal_scp_dev_fop_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	int ret;
+	baikal_scp_flash_info_t flash_info;
+	unsigned char *data;
+	size_t copied = 0;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	if ((*ppos < 0) || (*ppos >= flash_info.total_size) || !count)
+		return 0;
+
+	count = min_t(size_t, count, flash_info.total_size - *ppos);
+
+	data = vmalloc(BAIKAL_SCP_FILE_BUF_SIZE);
+	if (!data)
+		return -ENOMEM;
+
+	while (copied < count) {
+		unsigned pos = *ppos;
+		unsigned start = BAIKAL_SCP_FILE_ALIGN_DOWN(pos);
+		unsigned end = BAIKAL_SCP_FILE_ALIGN_UP(pos + (unsigned)(count - copied));
+		unsigned done = 0;
+		unsigned part;
+
+		end = min(end, start + BAIKAL_SCP_FILE_BUF_SIZE);
+
+		ret = baikal_scp_flash_read_prio(start, end - start, data, &done,
+			((baikal_scp_file_t *)file->private_data)->interactive);
+
+		/* Data read before a failure is still passed to the caller */
+		part = (done > pos - start) ? done - (pos - start) : 0;
+		part = min_t(size_t, part, count - copied);
+
+		if (part && copy_to_user(buf + copied, data + (pos - start), part)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		copied += part;
+		*ppos += part;
+
+		if (ret)
+			break;
+	}
+
+	vfree(data);
+
+	return copied ? copied : baikal_scp_file_error(ret);
+}
+
+/*
+ * Writes program the flash without erasing it (same as the FLASH_WRITE
+ * ioctl), so offset and size must be aligned to the programming unit
+ */
+ssize_t baikal_scp_dev_fop_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	int ret;
+	baikal_scp_flash_info_t flash_info;
+	unsigned char *data;
+	size_t written = 0;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	if (!count)
+		return 0;
+
+	if ((*ppos < 0) || (*ppos >= flash_info.total_size))
+		return -ENOSPC;
+
+	count = min_t(size_t, count, flash_info.total_size - *ppos);
+
+	if ((*ppos % BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) ||
+	    (count % BAIKAL_SCP_FLASH_SIZE_ALIGNMENT))
+		return -EINVAL;
+
+	data = vmalloc(BAIKAL_SCP_FILE_BUF_SIZE);
+	if (!data)
+		return -ENOMEM;
+
+	while (written < count) {
+		unsigned done = 0;
+		unsigned part = min_t(size_t, count - written, BAIKAL_SCP_FILE_BUF_SIZE);
+
+		if (copy_from_user(data, buf + written, part)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = baikal_scp_flash_write(*ppos, part, data, &done);
+
+		written += done;
+		*ppos += done;
+
+		if (ret)
+			break;
+	}
+
+	vfree(data);
+
+	return written ? written : baikal_scp_file_error(ret);
+}
@@ -8,6 +8,7 @@
  */
 
 #include "baikal_scp_private.h"
+#include "baikal_scp_trace.h"
 
 /* This region is not accessible via SCP */
 #define SCP_SIZE (512 * 1024)
@@ -27,6 +28,12 @@
 static uint8_t test_flash[TEST_FLASH_SIZE] = { 0 };
 static uint8_t test_flash_buf[BAIKAL_SCP_FLASH_BUF_SIZE];
 static unsigned test_flash_buf_idx = 0;
+static int test_flash_erased = 0;
+
+/* Test hooks (see baikal_scp_flash_emu_*() functions) */
+static unsigned long test_flash_smc_calls = 0;
+static unsigned long test_flash_fail_func = 0;
+static unsigned test_flash_fail_skip = 0;
 
 struct baikal_arm_smccc_res {
 	unsigned long a0;
@@ -42,17 +49,38 @@ static void baikal_arm_smccc_smc(unsigned long a0, unsigned long a1,
 {
 	memset(res, 0, sizeof(struct baikal_arm_smccc_res));
 
+	test_flash_smc_calls++;
+
+	if (test_flash_fail_func && (test_flash_fail_func == a0)) {
+		if (!test_flash_fail_skip--) {
+			test_flash_fail_func = 0;
+			res->a0 = 1;
+			return;
+		}
+	}
+
+	/* Emulate NOR flash: erased state is all ones, programming only clears bits */
+	if (!test_flash_erased) {
+		memset(test_flash, 0xff, sizeof(test_flash));
+		test_flash_erased = 1;
+	}
+
 	switch(a0) {
-		case BAIKAL_SMC_FLASH_WRITE:
-			memcpy(test_flash + a1, test_flash_buf, a2);
+		case BAIKAL_SMC_FLASH_WRITE: {
+			unsigned long i;
+
+			for (i = 0; i < a2; i++)
+				test_flash[a1 + i] &= test_flash_buf[i];
+
 			break;
+		}
 
 		case BAIKAL_SMC_FLASH_READ:
 			memcpy(test_flash_buf, test_flash + a1, a2);
 			break;
 
 		case BAIKAL_SMC_FLASH_ERASE:
-			memset(test_flash + a1, 0, a2);
+			memset(test_flash + a1, 0xff, a2);
 			break;
 
 		case BAIKAL_SMC_FLASH_PUSH: {
@@ -97,6 +125,17 @@ static void baikal_arm_smccc_smc(unsigned long a0, unsigned long a1,
 	}
 }
 
+unsigned long baikal_scp_flash_emu_smc_calls(void)
+{
+	return test_flash_smc_calls;
+}
+
+void baikal_scp_flash_emu_inject_fault(unsigned long func, unsigned skip)
+{
+	test_flash_fail_func = func;
+	test_flash_fail_skip = skip;
+}
+
 #else
 
 #define baikal_arm_smccc_res arm_smccc_res
@@ -104,6 +143,42 @@ static void baikal_arm_smccc_smc(unsigned long a0, unsigned long a1,
 
 #endif
 
+/* Number of SMC calls made since the driver was loaded */
+static atomic64_t baikal_scp_flash_smc_count = ATOMIC64_INIT(0);
+
+static inline void baikal_scp_flash_smc(unsigned long a0, unsigned long a1,
+			unsigned long a2, unsigned long a3, unsigned long a4,
+			unsigned long a5, unsigned long a6, unsigned long a7,
+			struct baikal_arm_smccc_res *res)
+{
+	atomic64_inc(&baikal_scp_flash_smc_count);
+	baikal_arm_smccc_smc(a0, a1, a2, a3, a4, a5, a6, a7, res);
+}
+
+unsigned long long baikal_scp_flash_smc_calls(void)
+{
+	return atomic64_read(&baikal_scp_flash_smc_count);
+}
+
+/*
+ * Called between SMC buffer sized chunks of a long operation. Gives other
+ * tasks a chance to run on this CPU, waits for the SMC time budget of the
+ * throttled operations and stops the operation early if the calling
+ * process has been killed.
+ */
+static int baikal_scp_flash_yield(int throttle)
+{
+	if (fatal_signal_pending(current))
+		return -EINTR;
+
+	cond_resched();
+
+	if (throttle)
+		return baikal_scp_worker_throttle();
+
+	return 0;
+}
+
 static int baikal_scp_flash_validate_offset_size(unsigned offset, unsigned size)
 {
 	int ret;
@@ -129,6 +204,31 @@ static int baikal_scp_flash_validate_offset_size(unsigned offset, unsigned size)
 	return 0;
 }
 
+/*
+ * Copy and fill erase the destination area, so it must cover whole sectors
+ */
+static int baikal_scp_flash_validate_sectors(unsigned offset, unsigned size)
+{
+	int ret;
+	baikal_scp_flash_info_t flash_info;
+
+	ret = baikal_scp_flash_validate_offset_size(offset, size);
+	if (ret)
+		return ret;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	if ((offset % flash_info.sector_size) || (size % flash_info.sector_size)) {
+		pr_err("%s: Offset (0x%x) and size (0x%x) are not aligned to the sector size (0x%x)\n",
+			__FUNCTION__, offset, size, flash_info.sector_size);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 int baikal_scp_flash_info(baikal_scp_flash_info_t *flash)
 {
 	static baikal_scp_flash_info_t cached_flash_info;
@@ -138,7 +238,7 @@ int baikal_scp_flash_info(baikal_scp_flash_info_t *flash)
 		struct baikal_arm_smccc_res res;
 		unsigned int scp_sectors;
 
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_INFO, 0, 0, 0, 0, 0, 0, 0, &res);
+		baikal_scp_flash_smc(BAIKAL_SMC_FLASH_INFO, 0, 0, 0, 0, 0, 0, 0, &res);
 		if (res.a0) {
 			pr_err("%s: BAIKAL_SMC_FLASH_INFO failed (a0 = 0x%lx)\n", __FUNCTION__, res.a0);
 			return -1;
@@ -175,128 +275,497 @@ int baikal_scp_flash_info(baikal_scp_flash_info_t *flash)
 	return 0;
 }
 
-int baikal_scp_flash_write(unsigned offset, unsigned size, const void *data)
+/*
+ * The SMC buffer is shared firmware state, so an SMC sequence transferring
+ * one chunk must not interleave with another one. Concurrent requests
+ * (e.g. from several threads sharing the device file) are serialized
+ * per chunk, not per request, so none of them is starved.
+ */
+static DEFINE_MUTEX(baikal_scp_flash_smc_lock);
+
+/*
+ * Start timestamp for the baikal_scp_smc tracepoint. The clock
+ * is not read at all while the tracepoint is disabled.
+ */
+static inline u64 baikal_scp_trace_clock(void)
+{
+	return trace_baikal_scp_smc_enabled() ? ktime_get_ns() : 0;
+}
+
+/*
+ * SMC sequence writing a single chunk (up to BAIKAL_SCP_FLASH_BUF_SIZE bytes)
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_write_part(unsigned offset, unsigned part,
+	const unsigned long *ptr)
 {
-	int ret;
 	struct baikal_arm_smccc_res res;
+	unsigned i;
 
-	unsigned part;
+	/* Reset buffer position */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_POSITION, 0, 0, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_POSITION failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	/* Push to buffer */
+	for (i = 0; i < part; i += BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) {
+		baikal_scp_flash_smc(BAIKAL_SMC_FLASH_PUSH,
+			ptr[0], ptr[1], ptr[2], ptr[3], 0, 0, 0, &res);
+		if (res.a0) {
+			pr_err("%s: BAIKAL_SMC_FLASH_PUSH failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+				__FUNCTION__, offset, part, res.a0);
+			return res.a0;
+		}
+
+		ptr += 4;
+	}
+
+	/* Write data from buffer to flash */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_WRITE, offset, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_WRITE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	return 0;
+}
+
+/*
+ * SMC sequence reading a single chunk (up to BAIKAL_SCP_FLASH_BUF_SIZE bytes)
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_read_part(unsigned offset, unsigned part,
+	unsigned long *ptr)
+{
+	struct baikal_arm_smccc_res res;
 	unsigned i;
+
+	/* Reset buffer position */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_POSITION, 0, 0, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_POSITION failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	/* Read data from flash */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_READ, offset, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_READ failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	/* Pull from buffer */
+	for (i = 0; i < part; i += BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) {
+		baikal_scp_flash_smc(BAIKAL_SMC_FLASH_PULL, 0, 0, 0, 0, 0, 0, 0, &res);
+		ptr[0] = res.a0;
+		ptr[1] = res.a1;
+		ptr[2] = res.a2;
+		ptr[3] = res.a3;
+		ptr += 4;
+	}
+
+	return 0;
+}
+
+/*
+ * SMC sequence copying a single chunk (up to BAIKAL_SCP_FLASH_BUF_SIZE bytes).
+ * The source is read into the SMC buffer and the destination is written
+ * from it, so the data does not leave the firmware.
+ *
+ * This relies on FLASH_WRITE programming whatever the SMC buffer holds, i.e.
+ * on FLASH_READ leaving the data in the same buffer that FLASH_PUSH fills.
+ * The firmware interface does not guarantee it, so the tool verifies the
+ * copy by the SHA-256 digests of the source and the destination.
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_copy_part(unsigned src, unsigned dst, unsigned part)
+{
+	struct baikal_arm_smccc_res res;
+
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_READ, src, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_READ failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, src, part, res.a0);
+		return res.a0;
+	}
+
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_WRITE, dst, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_WRITE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, dst, part, res.a0);
+		return res.a0;
+	}
+
+	return 0;
+}
+
+/*
+ * SMC sequence filling a single chunk (up to BAIKAL_SCP_FLASH_BUF_SIZE bytes)
+ * with the pattern word
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_fill_part(unsigned offset, unsigned part,
+	unsigned long word)
+{
+	struct baikal_arm_smccc_res res;
+	unsigned i;
+
+	/* Reset buffer position */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_POSITION, 0, 0, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_POSITION failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	/* Push pattern to buffer */
+	for (i = 0; i < part; i += BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) {
+		baikal_scp_flash_smc(BAIKAL_SMC_FLASH_PUSH,
+			word, word, word, word, 0, 0, 0, &res);
+		if (res.a0) {
+			pr_err("%s: BAIKAL_SMC_FLASH_PUSH failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+				__FUNCTION__, offset, part, res.a0);
+			return res.a0;
+		}
+	}
+
+	/* Write data from buffer to flash */
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_WRITE, offset, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_WRITE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	return 0;
+}
+
+/*
+ * SMC sequence erasing a single chunk (up to BAIKAL_SCP_FLASH_BUF_SIZE bytes)
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_erase_part(unsigned offset, unsigned part)
+{
+	struct baikal_arm_smccc_res res;
+
+	baikal_scp_flash_smc(BAIKAL_SMC_FLASH_ERASE, offset, part, 0, 0, 0, 0, 0, &res);
+	if (res.a0) {
+		pr_err("%s: BAIKAL_SMC_FLASH_ERASE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
+			__FUNCTION__, offset, part, res.a0);
+		return res.a0;
+	}
+
+	return 0;
+}
+
+enum baikal_scp_flash_chunk_op {
+	BAIKAL_SCP_FLASH_CHUNK_WRITE,
+	BAIKAL_SCP_FLASH_CHUNK_READ,
+	BAIKAL_SCP_FLASH_CHUNK_ERASE,
+	BAIKAL_SCP_FLASH_CHUNK_COPY,
+	BAIKAL_SCP_FLASH_CHUNK_FILL,
+};
+
+/*
+ * Single chunk of a flash operation handed over to the worker thread
+ */
+struct baikal_scp_flash_chunk {
+	enum baikal_scp_flash_chunk_op op;
+	unsigned offset;
+	unsigned part;
+	unsigned src;        /* Copy source offset */
+	void *ptr;           /* Read or write data */
+	unsigned long word;  /* Fill pattern word */
+};
+
+static unsigned long baikal_scp_flash_chunk_seq(void *arg)
+{
+	struct baikal_scp_flash_chunk *chunk = arg;
+	unsigned long a0 = 1;
+
+	mutex_lock(&baikal_scp_flash_smc_lock);
+
+	switch (chunk->op) {
+		case BAIKAL_SCP_FLASH_CHUNK_WRITE:
+			a0 = baikal_scp_flash_write_part(chunk->offset, chunk->part, chunk->ptr);
+			break;
+
+		case BAIKAL_SCP_FLASH_CHUNK_READ:
+			a0 = baikal_scp_flash_read_part(chunk->offset, chunk->part, chunk->ptr);
+			break;
+
+		case BAIKAL_SCP_FLASH_CHUNK_ERASE:
+			a0 = baikal_scp_flash_erase_part(chunk->offset, chunk->part);
+			break;
+
+		case BAIKAL_SCP_FLASH_CHUNK_COPY:
+			a0 = baikal_scp_flash_copy_part(chunk->src, chunk->offset, chunk->part);
+			break;
+
+		case BAIKAL_SCP_FLASH_CHUNK_FILL:
+			a0 = baikal_scp_flash_fill_part(chunk->offset, chunk->part, chunk->word);
+			break;
+	}
+
+	mutex_unlock(&baikal_scp_flash_smc_lock);
+	return a0;
+}
+
+/*
+ * Execute the SMC sequence of a single chunk on the worker thread
+ *
+ * Returns a0 of the failed call or 0 on success
+ */
+static unsigned long baikal_scp_flash_chunk(unsigned long func,
+	struct baikal_scp_flash_chunk *chunk)
+{
+	unsigned long a0;
+	u64 start = baikal_scp_trace_clock();
+
+	a0 = baikal_scp_worker_run(baikal_scp_flash_chunk_seq, chunk);
+	trace_baikal_scp_smc(func, chunk->offset, chunk->part, a0, start);
+
+	return a0;
+}
+
+int baikal_scp_flash_write(unsigned offset, unsigned size, const void *data, unsigned *done)
+{
+	int ret;
+	unsigned part;
 	const unsigned long *ptr = data;
+	struct baikal_scp_flash_chunk chunk = { .op = BAIKAL_SCP_FLASH_CHUNK_WRITE };
+
+	if (done)
+		*done = 0;
 
 	ret = baikal_scp_flash_validate_offset_size(offset, size);
 	if (ret)
 		return ret;
 
 	while (size) {
-		part = min(size, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
+		ret = baikal_scp_flash_yield(1);
+		if (ret)
+			return ret;
 
-		/* Reset buffer position */
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_POSITION, 0, 0, 0, 0, 0, 0, 0, &res);
-		if (res.a0) {
-			pr_err("%s: BAIKAL_SMC_FLASH_POSITION failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-				__FUNCTION__, offset, size, res.a0);
-			return -1;
-		}
-
-		/* Push to buffer */
-		for (i = 0; i < part; i += BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) {
-			baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_PUSH,
-				ptr[0], ptr[1], ptr[2], ptr[3], 0, 0, 0, &res);
-			if (res.a0) {
-				pr_err("%s: BAIKAL_SMC_FLASH_PUSH failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-					__FUNCTION__, offset, size, res.a0);
-				return -1;
-			}
+		part = min(size, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
 
-			ptr += 4;
-		}
+		chunk.offset = offset;
+		chunk.part   = part;
+		chunk.ptr    = (void *)ptr;
 
-		/* Write data from buffer to flash */
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_WRITE, offset, part, 0, 0, 0, 0, 0, &res);
-		if (res.a0) {
-			pr_err("%s: BAIKAL_SMC_FLASH_WRITE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-				__FUNCTION__, offset, size, res.a0);
+		if (baikal_scp_flash_chunk(BAIKAL_SMC_FLASH_WRITE, &chunk))
 			return -1;
-		}
 
+		ptr += part / sizeof(*ptr);
 		offset += part;
 		size -= part;
+
+		if (done)
+			*done += part;
 	}
 
 	return 0;
 }
 
-int baikal_scp_flash_read(unsigned offset, unsigned size, void *data)
+int baikal_scp_flash_read_prio(unsigned offset, unsigned size, void *data,
+	unsigned *done, int interactive)
 {
 	int ret;
-
-	struct baikal_arm_smccc_res res;
 	unsigned part;
-	unsigned i;
 	unsigned long *ptr = data;
+	struct baikal_scp_flash_chunk chunk = { .op = BAIKAL_SCP_FLASH_CHUNK_READ };
+
+	if (done)
+		*done = 0;
 
 	ret = baikal_scp_flash_validate_offset_size(offset, size);
 	if (ret)
 		return ret;
 
 	while (size) {
+		ret = baikal_scp_flash_yield(!interactive);
+		if (ret)
+			return ret;
+
 		part = min(size, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
 
-		/* Reset buffer position */
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_POSITION, 0, 0, 0, 0, 0, 0, 0, &res);
-		if (res.a0) {
-			pr_err("%s: BAIKAL_SMC_FLASH_POSITION failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-				__FUNCTION__, offset, size, res.a0);
-			return -1;
-		}
+		chunk.offset = offset;
+		chunk.part   = part;
+		chunk.ptr    = ptr;
 
-		/* Read data from flash */
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_READ, offset, part, 0, 0, 0, 0, 0, &res);
-		if (res.a0) {
-			pr_err("%s: BAIKAL_SMC_FLASH_READ failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-				__FUNCTION__, offset, size, res.a0);
+		if (baikal_scp_flash_chunk(BAIKAL_SMC_FLASH_READ, &chunk))
 			return -1;
-		}
-
-		/* Pull from buffer */
-		for (i = 0; i < part; i += BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) {
-			baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_PULL, 0, 0, 0, 0, 0, 0, 0, &res);
-			ptr[0] = res.a0;
-			ptr[1] = res.a1;
-			ptr[2] = res.a2;
-			ptr[3] = res.a3;
-			ptr += 4;
-		}
 
+		ptr += part / sizeof(*ptr);
 		offset += part;
 		size -= part;
+
+		if (done)
+			*done += part;
 	}
 
 	return 0;
 }
 
-int baikal_scp_flash_erase(unsigned offset, unsigned size)
+int baikal_scp_flash_read(unsigned offset, unsigned size, void *data, unsigned *done)
+{
+	return baikal_scp_flash_read_prio(offset, size, data, done, 0);
+}
+
+int baikal_scp_flash_erase(unsigned offset, unsigned size, unsigned *done)
 {
 	int ret;
 	unsigned part;
-	struct baikal_arm_smccc_res res;
+	struct baikal_scp_flash_chunk chunk = { .op = BAIKAL_SCP_FLASH_CHUNK_ERASE };
+
+	if (done)
+		*done = 0;
 
 	ret = baikal_scp_flash_validate_offset_size(offset, size);
 	if (ret)
 		return ret;
 
 	while (size) {
+		ret = baikal_scp_flash_yield(1);
+		if (ret)
+			return ret;
+
 		part = min(size, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
-		baikal_arm_smccc_smc(BAIKAL_SMC_FLASH_ERASE, offset, part, 0, 0, 0, 0, 0, &res);
-		if (res.a0) {
-			pr_err("%s: BAIKAL_SMC_FLASH_ERASE failed at offset 0x%x and size 0x%x (a0 = 0x%lx)\n",
-				__FUNCTION__, offset, size, res.a0);
+
+		chunk.offset = offset;
+		chunk.part   = part;
+
+		if (baikal_scp_flash_chunk(BAIKAL_SMC_FLASH_ERASE, &chunk))
 			return -1;
-		}
 
 		offset += part;
 		size -= part;
+
+		if (done)
+			*done += part;
+	}
+
+	return 0;
+}
+
+int baikal_scp_flash_copy(unsigned src, unsigned dst, unsigned size, unsigned *done)
+{
+	int ret;
+	unsigned part, pos;
+	baikal_scp_flash_info_t flash_info;
+	struct baikal_scp_flash_chunk chunk = { .op = BAIKAL_SCP_FLASH_CHUNK_COPY };
+
+	if (done)
+		*done = 0;
+
+	ret = baikal_scp_flash_validate_offset_size(src, size);
+	if (ret)
+		return ret;
+
+	ret = baikal_scp_flash_validate_sectors(dst, size);
+	if (ret)
+		return ret;
+
+	/* Erasing the destination would destroy the source */
+	if ((src < dst + size) && (dst < src + size)) {
+		pr_err("%s: Source (0x%x) and destination (0x%x) areas of size 0x%x overlap\n",
+			__FUNCTION__, src, dst, size);
+		return -EINVAL;
+	}
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	while (size) {
+		ret = baikal_scp_flash_erase(dst, flash_info.sector_size, NULL);
+		if (ret)
+			return ret;
+
+		for (pos = 0; pos < flash_info.sector_size; pos += part) {
+			ret = baikal_scp_flash_yield(1);
+			if (ret)
+				return ret;
+
+			part = min(flash_info.sector_size - pos, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
+
+			chunk.src    = src + pos;
+			chunk.offset = dst + pos;
+			chunk.part   = part;
+
+			if (baikal_scp_flash_chunk(BAIKAL_SMC_FLASH_WRITE, &chunk))
+				return -1;
+		}
+
+		src += flash_info.sector_size;
+		dst += flash_info.sector_size;
+		size -= flash_info.sector_size;
+
+		/* Only whole sectors are reported, a resumed copy erases the sector again */
+		if (done)
+			*done += flash_info.sector_size;
+	}
+
+	return 0;
+}
+
+int baikal_scp_flash_fill(unsigned offset, unsigned size, unsigned char pattern, unsigned *done)
+{
+	int ret;
+	unsigned part, pos;
+	baikal_scp_flash_info_t flash_info;
+	struct baikal_scp_flash_chunk chunk = {
+		.op   = BAIKAL_SCP_FLASH_CHUNK_FILL,
+		.word = (~0UL / 0xff) * pattern,
+	};
+
+	if (done)
+		*done = 0;
+
+	ret = baikal_scp_flash_validate_sectors(offset, size);
+	if (ret)
+		return ret;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret)
+		return ret;
+
+	while (size) {
+		ret = baikal_scp_flash_erase(offset, flash_info.sector_size, NULL);
+		if (ret)
+			return ret;
+
+		/* Erased flash is all ones already */
+		for (pos = 0; (pattern != 0xff) && (pos < flash_info.sector_size); pos += part) {
+			ret = baikal_scp_flash_yield(1);
+			if (ret)
+				return ret;
+
+			part = min(flash_info.sector_size - pos, (unsigned)BAIKAL_SCP_FLASH_BUF_SIZE);
+
+			chunk.offset = offset + pos;
+			chunk.part   = part;
+
+			if (baikal_scp_flash_chunk(BAIKAL_SMC_FLASH_WRITE, &chunk))
+				return -1;
+		}
+
+		offset += flash_info.sector_size;
+		size -= flash_info.sector_size;
+
+		if (done)
+			*done += flash_info.sector_size;
 	}
 
 	return 0;
@@ -0,0 +1,427 @@
+// SPDX-License-Identifier: (GPL-2.0+ OR MIT)
+/*
+ * Baikal-M (BE-M1000) SCP communication driver
+ * KUnit tests and microbenchmarks for the flash functions
+ *
+ * Copyright (C) 2021 Tano Systems LLC. All rights reserved.
+ *
+ * Authors: Anton Kikin <a.kikin@tano-systems.com>
+ */
+
+#include <kunit/test.h>
+#include <linux/string.h>
+
+#include "baikal_scp_private.h"
+
+/*
+ * The tests run against the flash emulation only,
+ * they must never touch the real boot flash
+ */
+#ifdef BAIKAL_SMC_ENABLE_FLASH_EMULATION
+
+#define TEST_UNIT   ((unsigned)BAIKAL_SCP_FLASH_SIZE_ALIGNMENT)
+#define TEST_CHUNK  ((unsigned)BAIKAL_SCP_FLASH_BUF_SIZE)
+#define TEST_OFFSET (16 * 65536)
+
+/* SMC calls made by a write or read of size bytes */
+static unsigned long test_rw_smc_calls(unsigned size)
+{
+	unsigned chunks = DIV_ROUND_UP(size, TEST_CHUNK);
+
+	/* POSITION + WRITE/READ per chunk, PUSH/PULL per unit */
+	return 2 * chunks + size / TEST_UNIT;
+}
+
+static void test_fill(unsigned char *buf, unsigned size, unsigned seed)
+{
+	unsigned i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (unsigned char)(i * 31 + seed);
+}
+
+static int baikal_scp_flash_test_init(struct kunit *test)
+{
+	baikal_scp_flash_info_t info;
+
+	baikal_scp_flash_emu_inject_fault(0, 0);
+
+	/* Flash info is cached after the first call, no SMC calls later */
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_info(&info), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, info.sector_size, NULL), 0);
+
+	return 0;
+}
+
+static void baikal_scp_flash_test_info(struct kunit *test)
+{
+	baikal_scp_flash_info_t info;
+	unsigned long calls = baikal_scp_flash_emu_smc_calls();
+
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_info(&info), 0);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls(), calls);
+
+	KUNIT_EXPECT_EQ(test, info.sector_size, 65536u);
+	KUNIT_EXPECT_EQ(test, info.sector_count, 512u - (512u * 1024) / 65536);
+	KUNIT_EXPECT_EQ(test, info.total_size, info.sector_count * info.sector_size);
+}
+
+static void baikal_scp_flash_test_single_unit(struct kunit *test)
+{
+	unsigned char *src = kunit_kzalloc(test, TEST_UNIT, GFP_KERNEL);
+	unsigned char *dst = kunit_kzalloc(test, TEST_UNIT, GFP_KERNEL);
+	unsigned long calls;
+	unsigned done;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	test_fill(src, TEST_UNIT, 1);
+
+	calls = baikal_scp_flash_emu_smc_calls();
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, TEST_UNIT, src, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, TEST_UNIT);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls, test_rw_smc_calls(TEST_UNIT));
+
+	calls = baikal_scp_flash_emu_smc_calls();
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_UNIT, dst, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, TEST_UNIT);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls, test_rw_smc_calls(TEST_UNIT));
+
+	KUNIT_EXPECT_EQ(test, memcmp(src, dst, TEST_UNIT), 0);
+}
+
+/* Sizes around the SMC buffer size boundaries */
+static void baikal_scp_flash_test_multi_chunk(struct kunit *test)
+{
+	static const unsigned sizes[] = {
+		TEST_CHUNK - TEST_UNIT,
+		TEST_CHUNK,
+		TEST_CHUNK + TEST_UNIT,
+		3 * TEST_CHUNK + 2 * TEST_UNIT,
+	};
+
+	unsigned char *src = kunit_kzalloc(test, 4 * TEST_CHUNK, GFP_KERNEL);
+	unsigned char *dst = kunit_kzalloc(test, 4 * TEST_CHUNK, GFP_KERNEL);
+	unsigned long calls;
+	unsigned done;
+	unsigned i;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		/* Unit aligned, but not chunk aligned offset */
+		unsigned offset = TEST_OFFSET + TEST_UNIT;
+
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, 65536, NULL), 0);
+
+		test_fill(src, sizes[i], i);
+		memset(dst, 0, sizes[i] + TEST_UNIT);
+
+		calls = baikal_scp_flash_emu_smc_calls();
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(offset, sizes[i], src, &done), 0);
+		KUNIT_EXPECT_EQ(test, done, sizes[i]);
+		KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls, test_rw_smc_calls(sizes[i]));
+
+		calls = baikal_scp_flash_emu_smc_calls();
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(offset, sizes[i] + TEST_UNIT, dst, &done), 0);
+		KUNIT_EXPECT_EQ(test, done, sizes[i] + TEST_UNIT);
+		KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls,
+			test_rw_smc_calls(sizes[i] + TEST_UNIT));
+
+		KUNIT_EXPECT_EQ(test, memcmp(src, dst, sizes[i]), 0);
+
+		/* Unit following the written data stays erased */
+		KUNIT_EXPECT_PTR_EQ(test, memchr_inv(dst + sizes[i], 0xff, TEST_UNIT), NULL);
+	}
+}
+
+/* Programming only clears bits, erase sets them back */
+static void baikal_scp_flash_test_nor_semantics(struct kunit *test)
+{
+	unsigned char *buf = kunit_kzalloc(test, TEST_UNIT, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	memset(buf, 0x0f, TEST_UNIT);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, TEST_UNIT, buf, NULL), 0);
+
+	memset(buf, 0xf0, TEST_UNIT);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, TEST_UNIT, buf, NULL), 0);
+
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_UNIT, buf, NULL), 0);
+	KUNIT_EXPECT_PTR_EQ(test, memchr_inv(buf, 0x00, TEST_UNIT), NULL);
+
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, TEST_CHUNK, NULL), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_UNIT, buf, NULL), 0);
+	KUNIT_EXPECT_PTR_EQ(test, memchr_inv(buf, 0xff, TEST_UNIT), NULL);
+}
+
+/* Requests that are rejected before any SMC call */
+static void baikal_scp_flash_test_invalid(struct kunit *test)
+{
+	baikal_scp_flash_info_t info;
+	unsigned char *buf = kunit_kzalloc(test, 2 * TEST_UNIT, GFP_KERNEL);
+	unsigned long calls;
+	unsigned done = 1;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_info(&info), 0);
+
+	calls = baikal_scp_flash_emu_smc_calls();
+
+	/* Unaligned size */
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_UNIT - 1, buf, &done), -EINVAL);
+	KUNIT_EXPECT_EQ(test, done, 0u);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, TEST_UNIT + 1, buf, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, 1, NULL), -EINVAL);
+
+	/* Zero size */
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, 0, buf, NULL), -EINVAL);
+
+	/* Past the end of the flash */
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(info.total_size - TEST_UNIT,
+		2 * TEST_UNIT, buf, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_erase(info.total_size, TEST_UNIT, NULL), -EINVAL);
+
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls(), calls);
+
+	/* Last unit of the flash is accessible */
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(info.total_size - TEST_UNIT,
+		TEST_UNIT, buf, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, TEST_UNIT);
+}
+
+/* Failed SMC call stops the operation, completed chunks are reported */
+static void baikal_scp_flash_test_errors(struct kunit *test)
+{
+	unsigned char *buf = kunit_kzalloc(test, 4 * TEST_CHUNK, GFP_KERNEL);
+	unsigned long calls;
+	unsigned done;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	/* WRITE of the second chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_WRITE, 1);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, 4 * TEST_CHUNK, buf, &done), -1);
+	KUNIT_EXPECT_EQ(test, done, TEST_CHUNK);
+
+	/* PUSH in the middle of the first chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_PUSH, 3);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, 4 * TEST_CHUNK, buf, &done), -1);
+	KUNIT_EXPECT_EQ(test, done, 0u);
+
+	/* POSITION of the fourth chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_POSITION, 3);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, 4 * TEST_CHUNK, buf, &done), -1);
+	KUNIT_EXPECT_EQ(test, done, 3u * TEST_CHUNK);
+
+	/* READ of the third chunk, no PULL calls follow the failure */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_READ, 2);
+	calls = baikal_scp_flash_emu_smc_calls();
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, 4 * TEST_CHUNK, buf, &done), -1);
+	KUNIT_EXPECT_EQ(test, done, 2u * TEST_CHUNK);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls,
+		test_rw_smc_calls(2 * TEST_CHUNK) + 2);
+
+	/* ERASE of the second chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_ERASE, 1);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, 4 * TEST_CHUNK, &done), -1);
+	KUNIT_EXPECT_EQ(test, done, TEST_CHUNK);
+
+	/* The fault is injected once */
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, 4 * TEST_CHUNK, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, 4u * TEST_CHUNK);
+}
+
+/*
+ * Request of the library part size interrupted by a failed SMC call is
+ * resumed from offset + done, the result equals the uninterrupted request
+ */
+#define TEST_PART (64 * 1024)
+
+static void baikal_scp_flash_test_resume(struct kunit *test)
+{
+	unsigned char *src = kunit_kzalloc(test, TEST_PART, GFP_KERNEL);
+	unsigned char *dst = kunit_kzalloc(test, TEST_PART, GFP_KERNEL);
+	unsigned done, rest;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	test_fill(src, TEST_PART, 5);
+
+	/* WRITE of the sixth chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_WRITE, 5);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, TEST_PART, src, &done), -1);
+	KUNIT_ASSERT_EQ(test, done, 5u * TEST_CHUNK);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET + done, TEST_PART - done,
+		src + done, &rest), 0);
+	KUNIT_EXPECT_EQ(test, done + rest, (unsigned)TEST_PART);
+
+	/* READ of the eighth chunk, the data read before the failure is kept */
+	memset(dst, 0, TEST_PART);
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_READ, 7);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_PART, dst, &done), -1);
+	KUNIT_ASSERT_EQ(test, done, 7u * TEST_CHUNK);
+	KUNIT_EXPECT_EQ(test, memcmp(src, dst, done), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET + done, TEST_PART - done,
+		dst + done, &rest), 0);
+	KUNIT_EXPECT_EQ(test, done + rest, (unsigned)TEST_PART);
+	KUNIT_EXPECT_EQ(test, memcmp(src, dst, TEST_PART), 0);
+
+	/* ERASE of the tenth chunk */
+	baikal_scp_flash_emu_inject_fault(BAIKAL_SMC_FLASH_ERASE, 9);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, TEST_PART, &done), -1);
+	KUNIT_ASSERT_EQ(test, done, 9u * TEST_CHUNK);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET + done, TEST_PART - done,
+		&rest), 0);
+	KUNIT_EXPECT_EQ(test, done + rest, (unsigned)TEST_PART);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, TEST_PART, dst, NULL), 0);
+	KUNIT_EXPECT_PTR_EQ(test, memchr_inv(dst, 0xff, TEST_PART), NULL);
+}
+
+/* Copy and fill run in the driver, the destination is erased first */
+static void baikal_scp_flash_test_copy_fill(struct kunit *test)
+{
+	baikal_scp_flash_info_t info;
+	unsigned char *src, *dst;
+	unsigned long calls;
+	unsigned sector;
+	unsigned done;
+
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_info(&info), 0);
+	sector = info.sector_size;
+
+	src = kunit_kzalloc(test, sector, GFP_KERNEL);
+	dst = kunit_kzalloc(test, sector, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	/* Fill over programmed data */
+	memset(src, 0x0f, sector);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, sector, src, NULL), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_fill(TEST_OFFSET, sector, 0xa5, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, sector);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, sector, dst, NULL), 0);
+	KUNIT_EXPECT_PTR_EQ(test, memchr_inv(dst, 0xa5, sector), NULL);
+
+	/* Copy over programmed data */
+	test_fill(src, sector, 7);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, sector, NULL), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, sector, src, NULL), 0);
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_fill(TEST_OFFSET + sector, sector, 0x00, NULL), 0);
+
+	/* READ + WRITE per chunk, no PUSH/PULL */
+	calls = baikal_scp_flash_emu_smc_calls();
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_copy(TEST_OFFSET, TEST_OFFSET + sector,
+		sector, &done), 0);
+	KUNIT_EXPECT_EQ(test, done, sector);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls() - calls,
+		3ul * DIV_ROUND_UP(sector, TEST_CHUNK));
+
+	KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET + sector, sector, dst, NULL), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(src, dst, sector), 0);
+
+	/* Rejected before any SMC call */
+	calls = baikal_scp_flash_emu_smc_calls();
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_copy(TEST_OFFSET, TEST_OFFSET + TEST_CHUNK,
+		sector, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_copy(TEST_OFFSET + sector, TEST_OFFSET,
+		2 * sector, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_fill(TEST_OFFSET, TEST_CHUNK, 0, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_flash_emu_smc_calls(), calls);
+}
+
+static unsigned long test_worker_fn(void *arg)
+{
+	return *(unsigned long *)arg + 1;
+}
+
+/*
+ * Work handed over to the worker thread returns its result to the caller,
+ * no throttling without the duty cycle limit
+ */
+static void baikal_scp_flash_test_worker(struct kunit *test)
+{
+	unsigned long value = 41;
+
+	KUNIT_EXPECT_EQ(test, baikal_scp_worker_run(test_worker_fn, &value), 42UL);
+	KUNIT_EXPECT_EQ(test, baikal_scp_worker_throttle(), 0);
+}
+
+/*
+ * Microbenchmarks. SMC calls per KiB are deterministic and can be compared
+ * between driver changes directly, time per KiB is for the emulation only.
+ */
+#define BENCH_SIZE   (256 * 1024)
+#define BENCH_ROUNDS 8
+
+static void baikal_scp_flash_bench_report(struct kunit *test, const char *name,
+	unsigned long calls, u64 ns)
+{
+	unsigned long long kib = (unsigned long long)BENCH_SIZE * BENCH_ROUNDS / 1024;
+
+	kunit_info(test, "%s: %llu KiB, %lu SMC calls (%llu.%03llu per KiB), %llu ns per KiB\n",
+		name, kib, calls,
+		calls / kib, ((calls * 1000) / kib) % 1000,
+		ns / kib);
+}
+
+static void baikal_scp_flash_test_bench(struct kunit *test)
+{
+	unsigned char *buf = kunit_kzalloc(test, BENCH_SIZE, GFP_KERNEL);
+	unsigned long calls;
+	u64 start;
+	unsigned i;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	test_fill(buf, BENCH_SIZE, 0);
+
+	calls = baikal_scp_flash_emu_smc_calls();
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_erase(TEST_OFFSET, BENCH_SIZE, NULL), 0);
+	baikal_scp_flash_bench_report(test, "erase",
+		baikal_scp_flash_emu_smc_calls() - calls, ktime_get_ns() - start);
+
+	calls = baikal_scp_flash_emu_smc_calls();
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_write(TEST_OFFSET, BENCH_SIZE, buf, NULL), 0);
+	baikal_scp_flash_bench_report(test, "write",
+		baikal_scp_flash_emu_smc_calls() - calls, ktime_get_ns() - start);
+
+	calls = baikal_scp_flash_emu_smc_calls();
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		KUNIT_ASSERT_EQ(test, baikal_scp_flash_read(TEST_OFFSET, BENCH_SIZE, buf, NULL), 0);
+	baikal_scp_flash_bench_report(test, "read",
+		baikal_scp_flash_emu_smc_calls() - calls, ktime_get_ns() - start);
+}
+
+static struct kunit_case baikal_scp_flash_test_cases[] = {
+	KUNIT_CASE(baikal_scp_flash_test_info),
+	KUNIT_CASE(baikal_scp_flash_test_single_unit),
+	KUNIT_CASE(baikal_scp_flash_test_multi_chunk),
+	KUNIT_CASE(baikal_scp_flash_test_nor_semantics),
+	KUNIT_CASE(baikal_scp_flash_test_invalid),
+	KUNIT_CASE(baikal_scp_flash_test_errors),
+	KUNIT_CASE(baikal_scp_flash_test_resume),
+	KUNIT_CASE(baikal_scp_flash_test_copy_fill),
+	KUNIT_CASE(baikal_scp_flash_test_worker),
+	KUNIT_CASE(baikal_scp_flash_test_bench),
+	{}
+};
+
+static struct kunit_suite baikal_scp_flash_test_suite = {
+	.name       = "baikal_scp_flash",
+	.init       = baikal_scp_flash_test_init,
+	.test_cases = baikal_scp_flash_test_cases,
+};
+
+kunit_test_suite(baikal_scp_flash_test_suite);
+
+#endif /* BAIKAL_SMC_ENABLE_FLASH_EMULATION */
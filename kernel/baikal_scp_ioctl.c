@@ -8,8 +8,28 @@
  */
 
 #include "baikal_scp_private.h"
+#include "baikal_scp_trace.h"
 
-long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+/* Flash request parameters reported by the ioctl exit tracepoint */
+struct baikal_scp_ioctl_trace {
+	unsigned offset;
+	unsigned size;
+	unsigned done;
+};
+
+/*
+ * The legacy flash read, write and erase commands take the structures
+ * truncated before the "done" field. Never copy more than the older
+ * applications have allocated.
+ */
+static inline size_t baikal_scp_ioctl_arg_size(unsigned int cmd,
+	unsigned int cmd_done, size_t size, size_t legacy_size)
+{
+	return (cmd == cmd_done) ? size : legacy_size;
+}
+
+static long baikal_scp_dev_ioctl(baikal_scp_file_t *ctx, unsigned int cmd,
+	unsigned long arg, struct baikal_scp_ioctl_trace *trace)
 {
 	long ret = 0;
 
@@ -17,6 +37,8 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 		case BAIKAL_SCP_IOCTL_CMD_INFO: {
 			struct baikal_scp_ioctl_info info;
 
+			trace_baikal_scp_ioctl_enter(cmd, 0, 0);
+
 			info.drv_version = BAIKAL_SCP_VERSION(
 				BAIKAL_SCP_DRV_VERSION_MAJOR,
 				BAIKAL_SCP_DRV_VERSION_MINOR,
@@ -36,6 +58,8 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 			struct baikal_scp_ioctl_flash_info flash_info;
 			struct baikal_scp_flash_info scp_flash_info;
 
+			trace_baikal_scp_ioctl_enter(cmd, 0, 0);
+
 			ret = baikal_scp_flash_info(&scp_flash_info);
 			if (ret)
 				return ret;
@@ -53,16 +77,25 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 			break;
 		}
 
-		case BAIKAL_SCP_IOCTL_CMD_FLASH_READ: {
-			struct baikal_scp_ioctl_flash_read flash_read;
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_READ:
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_READ2: {
+			struct baikal_scp_ioctl_flash_read flash_read = { 0 };
+			size_t arg_size = baikal_scp_ioctl_arg_size(cmd,
+				BAIKAL_SCP_IOCTL_CMD_FLASH_READ2, sizeof(flash_read),
+				offsetof(struct baikal_scp_ioctl_flash_read, done));
 			void *data;
+			long op_ret;
 
-			ret = copy_from_user(&flash_read, (void *)arg, sizeof(flash_read));
+			ret = copy_from_user(&flash_read, (void *)arg, arg_size);
 			if (ret) {
 				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
 				return ret;
 			}
 
+			trace->offset = flash_read.offset;
+			trace->size   = flash_read.size;
+			trace_baikal_scp_ioctl_enter(cmd, flash_read.offset, flash_read.size);
+
 			if (!flash_read.size)
 				return -EINVAL;
 
@@ -70,34 +103,51 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 			if (!data)
 				return -ENOMEM;
 
-			ret = baikal_scp_flash_read(flash_read.offset, flash_read.size, data);
-			if (ret) {
-				vfree(data);
-				return ret;
+			op_ret = baikal_scp_flash_read_prio(flash_read.offset, flash_read.size,
+				data, &flash_read.done, ctx->interactive);
+			trace->done = flash_read.done;
+
+			/* Data read before a failure is still passed to the caller */
+			if (flash_read.done) {
+				ret = copy_to_user(flash_read.data, data, flash_read.done);
+				if (ret) {
+					pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
+					vfree(data);
+					return ret;
+				}
 			}
 
-			ret = copy_to_user(flash_read.data, data, flash_read.size);
+			vfree(data);
+
+			ret = copy_to_user((void *)arg, &flash_read, arg_size);
 			if (ret) {
 				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
-				vfree(data);
 				return ret;
 			}
 
-			vfree(data);
-
+			ret = op_ret;
 			break;
 		}
 
-		case BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE: {
-			struct baikal_scp_ioctl_flash_write flash_write;
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE:
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE2: {
+			struct baikal_scp_ioctl_flash_write flash_write = { 0 };
+			size_t arg_size = baikal_scp_ioctl_arg_size(cmd,
+				BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE2, sizeof(flash_write),
+				offsetof(struct baikal_scp_ioctl_flash_write, done));
 			void *data;
+			long op_ret;
 
-			ret = copy_from_user(&flash_write, (void *)arg, sizeof(flash_write));
+			ret = copy_from_user(&flash_write, (void *)arg, arg_size);
 			if (ret) {
 				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
 				return ret;
 			}
 
+			trace->offset = flash_write.offset;
+			trace->size   = flash_write.size;
+			trace_baikal_scp_ioctl_enter(cmd, flash_write.offset, flash_write.size);
+
 			if (!flash_write.size)
 				return -EINVAL;
 
@@ -112,30 +162,147 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 				return ret;
 			}
 
-			ret = baikal_scp_flash_write(flash_write.offset, flash_write.size, data);
+			op_ret = baikal_scp_flash_write(flash_write.offset, flash_write.size,
+				data, &flash_write.done);
+			trace->done = flash_write.done;
+
+			vfree(data);
+
+			ret = copy_to_user((void *)arg, &flash_write, arg_size);
 			if (ret) {
-				vfree(data);
+				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
 				return ret;
 			}
 
-			vfree(data);
+			ret = op_ret;
 			break;
 		}
 
-		case BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE: {
-			struct baikal_scp_ioctl_flash_erase flash_erase;
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE:
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE2: {
+			struct baikal_scp_ioctl_flash_erase flash_erase = { 0 };
+			size_t arg_size = baikal_scp_ioctl_arg_size(cmd,
+				BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE2, sizeof(flash_erase),
+				offsetof(struct baikal_scp_ioctl_flash_erase, done));
+			long op_ret;
 
-			ret = copy_from_user(&flash_erase, (void *)arg, sizeof(flash_erase));
+			ret = copy_from_user(&flash_erase, (void *)arg, arg_size);
 			if (ret) {
 				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
 				return ret;
 			}
 
-			ret = baikal_scp_flash_erase(flash_erase.offset, flash_erase.size);
+			trace->offset = flash_erase.offset;
+			trace->size   = flash_erase.size;
+			trace_baikal_scp_ioctl_enter(cmd, flash_erase.offset, flash_erase.size);
+
+			op_ret = baikal_scp_flash_erase(flash_erase.offset, flash_erase.size,
+				&flash_erase.done);
+			trace->done = flash_erase.done;
+
+			ret = copy_to_user((void *)arg, &flash_erase, arg_size);
+			if (ret) {
+				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			ret = op_ret;
+			break;
+		}
+
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_COPY: {
+			struct baikal_scp_ioctl_flash_copy flash_copy;
+			long op_ret;
+
+			ret = copy_from_user(&flash_copy, (void *)arg, sizeof(flash_copy));
+			if (ret) {
+				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			trace->offset = flash_copy.dst;
+			trace->size   = flash_copy.size;
+			trace_baikal_scp_ioctl_enter(cmd, flash_copy.dst, flash_copy.size);
+
+			op_ret = baikal_scp_flash_copy(flash_copy.src, flash_copy.dst,
+				flash_copy.size, &flash_copy.done);
+			trace->done = flash_copy.done;
+
+			ret = copy_to_user((void *)arg, &flash_copy, sizeof(flash_copy));
+			if (ret) {
+				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			ret = op_ret;
+			break;
+		}
+
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_FILL: {
+			struct baikal_scp_ioctl_flash_fill flash_fill;
+			long op_ret;
+
+			ret = copy_from_user(&flash_fill, (void *)arg, sizeof(flash_fill));
+			if (ret) {
+				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			trace->offset = flash_fill.offset;
+			trace->size   = flash_fill.size;
+			trace_baikal_scp_ioctl_enter(cmd, flash_fill.offset, flash_fill.size);
+
+			if (flash_fill.pattern > 0xff)
+				return -EINVAL;
+
+			op_ret = baikal_scp_flash_fill(flash_fill.offset, flash_fill.size,
+				flash_fill.pattern, &flash_fill.done);
+			trace->done = flash_fill.done;
+
+			ret = copy_to_user((void *)arg, &flash_fill, sizeof(flash_fill));
+			if (ret) {
+				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			ret = op_ret;
+			break;
+		}
+
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_STATS: {
+			struct baikal_scp_ioctl_flash_stats flash_stats;
+
+			trace_baikal_scp_ioctl_enter(cmd, 0, 0);
+
+			flash_stats.smc_calls = baikal_scp_flash_smc_calls();
+
+			ret = copy_to_user((void *)arg, &flash_stats, sizeof(flash_stats));
+			if (ret) {
+				pr_err("%s: copy_to_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			break;
+		}
+
+		case BAIKAL_SCP_IOCTL_CMD_FLASH_PRIORITY: {
+			struct baikal_scp_ioctl_flash_priority flash_priority;
+
+			ret = copy_from_user(&flash_priority, (void *)arg, sizeof(flash_priority));
+			if (ret) {
+				pr_err("%s: copy_from_user() failed (%ld)\n", __FUNCTION__, ret);
+				return ret;
+			}
+
+			trace_baikal_scp_ioctl_enter(cmd, 0, 0);
+
+			/* Read priority is requested per opened device file */
+			ctx->interactive = !!flash_priority.interactive;
 			break;
 		}
 
 		default: {
+			trace_baikal_scp_ioctl_enter(cmd, 0, 0);
 			pr_err("Unknown IOCTL command %u\n", cmd);
 			ret = -EINVAL;
 			break;
@@ -144,3 +311,14 @@ long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long
 
 	return ret;
 }
+
+long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	long ret;
+	struct baikal_scp_ioctl_trace trace = { 0 };
+
+	ret = baikal_scp_dev_ioctl(file->private_data, cmd, arg, &trace);
+	trace_baikal_scp_ioctl_exit(cmd, trace.offset, trace.size, trace.done, ret);
+
+	return ret;
+}
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: (GPL-2.0+ OR MIT)
+/*
+ * Baikal-M (BE-M1000) SCP communication driver
+ *
+ * Copyright (C) 2021 Tano Systems LLC. All rights reserved.
+ *
+ * Authors: Anton Kikin <a.kikin@tano-systems.com>
+ */
+
+#include "baikal_scp_private.h"
+
+static bool baikal_scp_mtd_enable = false;
+module_param_named(mtd, baikal_scp_mtd_enable, bool, 0444);
+MODULE_PARM_DESC(mtd, "Register the boot flash as an MTD device with partitions (default: false)");
+
+#if IS_ENABLED(CONFIG_MTD)
+
+#include <linux/mtd/mtd.h>
+#include <linux/mtd/partitions.h>
+
+/*
+ * Boot flash layout (offsets are in the SCP accessible flash space,
+ * same as the baikal-scp-flash partitions). Partitions that do not
+ * fit into the flash are not registered.
+ */
+static const struct mtd_partition baikal_scp_mtd_parts[] = {
+	{ .name = "bl1", .offset = 0x000000, .size = 0x040000 },
+	{ .name = "dtb", .offset = 0x040000, .size = 0x040000 },
+	{ .name = "var", .offset = 0x080000, .size = 0x0c0000 },
+	{ .name = "fip", .offset = 0x140000, .size = 0x640000 },
+	{ .name = "fat", .offset = 0x780000, .size = 0x800000 },
+};
+
+static struct mtd_info *baikal_scp_mtd = NULL;
+
+/*
+ * MTD requests may be unaligned, so the data goes through a buffer
+ * of one SMC buffer size, aligned to BAIKAL_SCP_FLASH_SIZE_ALIGNMENT
+ */
+static DEFINE_MUTEX(baikal_scp_mtd_lock);
+static unsigned long baikal_scp_mtd_buf[BAIKAL_SCP_FLASH_BUF_SIZE / sizeof(unsigned long)];
+
+#define BAIKAL_SCP_MTD_ALIGN_DOWN(x) \
+	((x) & ~((unsigned)BAIKAL_SCP_FLASH_SIZE_ALIGNMENT - 1))
+
+#define BAIKAL_SCP_MTD_ALIGN_UP(x) \
+	BAIKAL_SCP_MTD_ALIGN_DOWN((x) + (unsigned)BAIKAL_SCP_FLASH_SIZE_ALIGNMENT - 1)
+
+static int baikal_scp_mtd_read(struct mtd_info *mtd, loff_t from, size_t len,
+	size_t *retlen, u_char *buf)
+{
+	int ret = 0;
+	unsigned char *data = (unsigned char *)baikal_scp_mtd_buf;
+
+	mutex_lock(&baikal_scp_mtd_lock);
+
+	while (*retlen < len) {
+		unsigned pos = from + *retlen;
+		unsigned start = BAIKAL_SCP_MTD_ALIGN_DOWN(pos);
+		unsigned end = BAIKAL_SCP_MTD_ALIGN_UP(pos + (unsigned)(len - *retlen));
+		unsigned done = 0;
+		unsigned part;
+
+		end = min(end, start + BAIKAL_SCP_FLASH_BUF_SIZE);
+
+		ret = baikal_scp_flash_read(start, end - start, data, &done);
+
+		part = (done > pos - start) ? done - (pos - start) : 0;
+		part = min_t(size_t, part, len - *retlen);
+
+		memcpy(buf + *retlen, data + (pos - start), part);
+		*retlen += part;
+
+		if (ret)
+			break;
+	}
+
+	mutex_unlock(&baikal_scp_mtd_lock);
+
+	return ret ? -EIO : 0;
+}
+
+/*
+ * Unaligned head and tail are padded with 0xff,
+ * which leaves the flash contents unchanged
+ */
+static int baikal_scp_mtd_write(struct mtd_info *mtd, loff_t to, size_t len,
+	size_t *retlen, const u_char *buf)
+{
+	int ret = 0;
+	unsigned char *data = (unsigned char *)baikal_scp_mtd_buf;
+
+	mutex_lock(&baikal_scp_mtd_lock);
+
+	while (*retlen < len) {
+		unsigned pos = to + *retlen;
+		unsigned start = BAIKAL_SCP_MTD_ALIGN_DOWN(pos);
+		unsigned end = BAIKAL_SCP_MTD_ALIGN_UP(pos + (unsigned)(len - *retlen));
+		unsigned done = 0;
+		unsigned part;
+
+		end = min(end, start + BAIKAL_SCP_FLASH_BUF_SIZE);
+		part = min_t(size_t, end - pos, len - *retlen);
+
+		memset(data, 0xff, end - start);
+		memcpy(data + (pos - start), buf + *retlen, part);
+
+		ret = baikal_scp_flash_write(start, end - start, data, &done);
+		if (ret)
+			break;
+
+		*retlen += part;
+	}
+
+	mutex_unlock(&baikal_scp_mtd_lock);
+
+	return ret ? -EIO : 0;
+}
+
+static int baikal_scp_mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
+{
+	int ret;
+	unsigned done = 0;
+
+	ret = baikal_scp_flash_erase(instr->addr, instr->len, &done);
+	if (ret) {
+		instr->fail_addr = instr->addr + done;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 17, 0)
+		instr->state = MTD_ERASE_FAILED;
+#endif
+		return -EIO;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 17, 0)
+	instr->state = MTD_ERASE_DONE;
+	mtd_erase_callback(instr);
+#endif
+	return 0;
+}
+
+int baikal_scp_mtd_register(struct device *dev)
+{
+	int ret;
+	int nr_parts;
+	baikal_scp_flash_info_t flash_info;
+
+	if (!baikal_scp_mtd_enable)
+		return 0;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret) {
+		pr_err("Failed to get flash information for MTD device (%d)\n", ret);
+		return ret;
+	}
+
+	baikal_scp_mtd = kzalloc(sizeof(*baikal_scp_mtd), GFP_KERNEL);
+	if (!baikal_scp_mtd)
+		return -ENOMEM;
+
+	baikal_scp_mtd->name         = BAIKAL_SCP_DRV_NAME;
+	baikal_scp_mtd->type         = MTD_NORFLASH;
+	baikal_scp_mtd->flags        = MTD_CAP_NORFLASH;
+	baikal_scp_mtd->size         = flash_info.total_size;
+	baikal_scp_mtd->erasesize    = flash_info.sector_size;
+	baikal_scp_mtd->writesize    = 1;
+	baikal_scp_mtd->writebufsize = BAIKAL_SCP_FLASH_BUF_SIZE;
+	baikal_scp_mtd->owner        = THIS_MODULE;
+	baikal_scp_mtd->dev.parent   = dev;
+	baikal_scp_mtd->_read        = baikal_scp_mtd_read;
+	baikal_scp_mtd->_write       = baikal_scp_mtd_write;
+	baikal_scp_mtd->_erase       = baikal_scp_mtd_erase;
+
+	for (nr_parts = 0; nr_parts < ARRAY_SIZE(baikal_scp_mtd_parts); nr_parts++) {
+		const struct mtd_partition *p = &baikal_scp_mtd_parts[nr_parts];
+
+		if (p->offset + p->size > flash_info.total_size)
+			break;
+	}
+
+	ret = mtd_device_register(baikal_scp_mtd, baikal_scp_mtd_parts, nr_parts);
+	if (ret) {
+		pr_err("Failed to register MTD device (%d)\n", ret);
+		kfree(baikal_scp_mtd);
+		baikal_scp_mtd = NULL;
+		return ret;
+	}
+
+	pr_debug("Registered MTD device with %d partitions\n", nr_parts);
+	return 0;
+}
+
+void baikal_scp_mtd_unregister(void)
+{
+	if (!baikal_scp_mtd)
+		return;
+
+	mtd_device_unregister(baikal_scp_mtd);
+	kfree(baikal_scp_mtd);
+	baikal_scp_mtd = NULL;
+}
+
+#else /* !IS_ENABLED(CONFIG_MTD) */
+
+int baikal_scp_mtd_register(struct device *dev)
+{
+	if (baikal_scp_mtd_enable)
+		pr_warn("MTD support is not available in this kernel, \"mtd\" parameter ignored\n");
+
+	return 0;
+}
+
+void baikal_scp_mtd_unregister(void)
+{
+}
+
+#endif /* IS_ENABLED(CONFIG_MTD) */
@@ -7,6 +7,8 @@
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
@@ -43,12 +45,27 @@ typedef struct baikal_scp_dev {
 	struct class  *class;
 	int            major;
 	struct cdev    chrdev;
+	struct device *device;
 	unsigned int   open_counter;
 	struct mutex   lock;
 } baikal_scp_dev_t;
 
+/*
+ * State of an opened device file (file->private_data)
+ */
+typedef struct baikal_scp_file {
+	/* Reads are not throttled (BAIKAL_SCP_IOCTL_FLASH_PRIORITY) */
+	int interactive;
+} baikal_scp_file_t;
+
 long baikal_scp_dev_fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 
+loff_t baikal_scp_dev_fop_llseek(struct file *file, loff_t offset, int whence);
+ssize_t baikal_scp_dev_fop_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos);
+ssize_t baikal_scp_dev_fop_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos);
+
 typedef struct baikal_scp_flash_info {
 	unsigned sector_count;
 	unsigned sector_size;
@@ -56,8 +73,64 @@ typedef struct baikal_scp_flash_info {
 } baikal_scp_flash_info_t;
 
 int baikal_scp_flash_info(baikal_scp_flash_info_t *flash);
-int baikal_scp_flash_write(unsigned offset, unsigned size, const void *data);
-int baikal_scp_flash_read(unsigned offset, unsigned size, void *data);
-int baikal_scp_flash_erase(unsigned offset, unsigned size);
+/*
+ * Long operations are split into SMC buffer sized chunks. The number of bytes
+ * completed before a failure (or before the calling process was killed) is
+ * stored to *done, which may be NULL.
+ */
+int baikal_scp_flash_write(unsigned offset, unsigned size, const void *data, unsigned *done);
+int baikal_scp_flash_read(unsigned offset, unsigned size, void *data, unsigned *done);
+int baikal_scp_flash_erase(unsigned offset, unsigned size, unsigned *done);
+
+/*
+ * Copy the source area to the destination area or fill the area with the
+ * pattern byte without transferring the data to the kernel. The destination
+ * must cover whole sectors, each sector is erased before it is written,
+ * *done is set to the number of completed sectors in bytes.
+ */
+int baikal_scp_flash_copy(unsigned src, unsigned dst, unsigned size, unsigned *done);
+int baikal_scp_flash_fill(unsigned offset, unsigned size, unsigned char pattern, unsigned *done);
+
+/*
+ * Same as baikal_scp_flash_read(), interactive reads are not throttled
+ * by the duty cycle limit (BAIKAL_SCP_IOCTL_FLASH_PRIORITY)
+ */
+int baikal_scp_flash_read_prio(unsigned offset, unsigned size, void *data,
+	unsigned *done, int interactive);
+
+/*
+ * Number of SMC calls made by the flash functions since the driver
+ * was loaded (BAIKAL_SCP_IOCTL_FLASH_STATS)
+ */
+unsigned long long baikal_scp_flash_smc_calls(void);
+
+#ifdef BAIKAL_SMC_ENABLE_FLASH_EMULATION
+/*
+ * Flash emulation test hooks. baikal_scp_flash_emu_smc_calls() returns
+ * the number of SMC calls made so far. baikal_scp_flash_emu_inject_fault()
+ * makes the call of SMC function func that follows skip successful calls
+ * of that function fail (once). Zero func cancels the injected fault.
+ */
+unsigned long baikal_scp_flash_emu_smc_calls(void);
+void baikal_scp_flash_emu_inject_fault(unsigned long func, unsigned skip);
+#endif
+
+/*
+ * Flash worker thread executing the SMC sequences ("worker*" and "duty*"
+ * module parameters). baikal_scp_worker_run() executes fn(arg) on the
+ * worker thread (or in the caller context if the worker is disabled)
+ * and returns its result. baikal_scp_worker_throttle() sleeps while the
+ * SMC time budget of the current duty cycle period is spent.
+ */
+int baikal_scp_worker_init(void);
+void baikal_scp_worker_exit(void);
+unsigned long baikal_scp_worker_run(unsigned long (*fn)(void *arg), void *arg);
+int baikal_scp_worker_throttle(void);
+
+/*
+ * Optional MTD device on top of the flash functions ("mtd" module parameter)
+ */
+int baikal_scp_mtd_register(struct device *dev);
+void baikal_scp_mtd_unregister(void);
 
 #endif /* _BAIKAL_SCP_PRIVATE_H */
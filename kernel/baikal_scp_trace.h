@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR MIT) */
+/*
+ * Baikal-M (BE-M1000) SCP communication driver tracepoints
+ *
+ * Copyright (C) 2021 Tano Systems LLC. All rights reserved.
+ *
+ * Authors: Anton Kikin <a.kikin@tano-systems.com>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM baikal_scp
+
+#if !defined(_BAIKAL_SCP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BAIKAL_SCP_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+TRACE_EVENT(baikal_scp_ioctl_enter,
+
+	TP_PROTO(unsigned int cmd, unsigned int offset, unsigned int size),
+
+	TP_ARGS(cmd, offset, size),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+		__field(unsigned int, offset)
+		__field(unsigned int, size)
+	),
+
+	TP_fast_assign(
+		__entry->cmd    = cmd;
+		__entry->offset = offset;
+		__entry->size   = size;
+	),
+
+	TP_printk("cmd=%u offset=0x%x size=0x%x",
+		__entry->cmd, __entry->offset, __entry->size)
+);
+
+TRACE_EVENT(baikal_scp_ioctl_exit,
+
+	TP_PROTO(unsigned int cmd, unsigned int offset, unsigned int size,
+		unsigned int done, long ret),
+
+	TP_ARGS(cmd, offset, size, done, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+		__field(unsigned int, offset)
+		__field(unsigned int, size)
+		__field(unsigned int, done)
+		__field(long,         ret)
+	),
+
+	TP_fast_assign(
+		__entry->cmd    = cmd;
+		__entry->offset = offset;
+		__entry->size   = size;
+		__entry->done   = done;
+		__entry->ret    = ret;
+	),
+
+	TP_printk("cmd=%u offset=0x%x size=0x%x done=0x%x ret=%ld",
+		__entry->cmd, __entry->offset, __entry->size,
+		__entry->done, __entry->ret)
+);
+
+/*
+ * One SMC sequence transferring a single SMC buffer sized chunk
+ * (POSITION + PUSH/PULL + READ/WRITE, or ERASE). The start timestamp
+ * is taken only when the event is enabled (see baikal_scp_trace_clock()).
+ */
+TRACE_EVENT(baikal_scp_smc,
+
+	TP_PROTO(unsigned long func, unsigned int offset, unsigned int size,
+		unsigned long a0, u64 start),
+
+	TP_ARGS(func, offset, size, a0, start),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, func)
+		__field(unsigned int,  offset)
+		__field(unsigned int,  size)
+		__field(unsigned long, a0)
+		__field(u64,           duration)
+	),
+
+	TP_fast_assign(
+		__entry->func     = func;
+		__entry->offset   = offset;
+		__entry->size     = size;
+		__entry->a0       = a0;
+		__entry->duration = start ? ktime_get_ns() - start : 0;
+	),
+
+	TP_printk("func=0x%lx offset=0x%x size=0x%x a0=0x%lx duration=%llu ns",
+		__entry->func, __entry->offset, __entry->size,
+		__entry->a0, (unsigned long long)__entry->duration)
+);
+
+#endif /* _BAIKAL_SCP_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE baikal_scp_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: (GPL-2.0+ OR MIT)
+/*
+ * Baikal-M (BE-M1000) SCP communication driver
+ *
+ * Copyright (C) 2021 Tano Systems LLC. All rights reserved.
+ *
+ * Authors: Anton Kikin <a.kikin@tano-systems.com>
+ */
+
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/sched/types.h>
+
+#include "baikal_scp_private.h"
+
+/*
+ * Flash worker thread
+ *
+ * An SMC call stalls the CPU it is made on until the firmware returns.
+ * The SMC sequences are executed by a dedicated kernel thread, so the CPU
+ * affinity and the scheduling policy of the flash operations do not depend
+ * on the calling process. The caller waits for each chunk, the request
+ * loops, signal checks and progress accounting stay in the caller context.
+ *
+ * The optional duty cycle limit caps the SMC time per period. Callers of
+ * the throttled requests sleep before the next chunk once the budget of
+ * the current period is spent.
+ */
+
+static bool baikal_scp_worker_enable = true;
+module_param_named(worker, baikal_scp_worker_enable, bool, 0444);
+MODULE_PARM_DESC(worker, "Execute SMC calls on the dedicated flash worker thread (default: true)");
+
+static int baikal_scp_worker_cpu = -1;
+static int baikal_scp_worker_fifo = 0;
+static int baikal_scp_worker_nice = 0;
+
+static unsigned int baikal_scp_duty_smc_us = 0;
+module_param_named(duty_smc_us, baikal_scp_duty_smc_us, uint, 0644);
+MODULE_PARM_DESC(duty_smc_us, "Maximum SMC time per duty cycle period in microseconds, 0 for no limit (default: 0)");
+
+static unsigned int baikal_scp_duty_period_us = 100000;
+module_param_named(duty_period_us, baikal_scp_duty_period_us, uint, 0644);
+MODULE_PARM_DESC(duty_period_us, "Duty cycle period in microseconds (default: 100000)");
+
+static struct kthread_worker *baikal_scp_worker = NULL;
+
+/*
+ * Apply CPU affinity and scheduling policy to the worker thread
+ */
+static void baikal_scp_worker_apply(void)
+{
+	struct task_struct *task;
+	int cpu = baikal_scp_worker_cpu;
+
+	if (!baikal_scp_worker)
+		return;
+
+	task = baikal_scp_worker->task;
+
+	if ((cpu >= 0) && (cpu < nr_cpu_ids) && cpu_online(cpu))
+		set_cpus_allowed_ptr(task, cpumask_of(cpu));
+	else
+		set_cpus_allowed_ptr(task, cpu_possible_mask);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	if (baikal_scp_worker_fifo)
+		sched_set_fifo_low(task);
+	else
+		sched_set_normal(task, baikal_scp_worker_nice);
+#else
+	{
+		struct sched_param param = {
+			.sched_priority = baikal_scp_worker_fifo ? 1 : 0
+		};
+
+		sched_setscheduler_nocheck(task,
+			baikal_scp_worker_fifo ? SCHED_FIFO : SCHED_NORMAL, &param);
+
+		if (!baikal_scp_worker_fifo)
+			set_user_nice(task, baikal_scp_worker_nice);
+	}
+#endif
+}
+
+static int baikal_scp_worker_param_set_int(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_int(val, kp);
+
+	if (!ret)
+		baikal_scp_worker_apply();
+
+	return ret;
+}
+
+static const struct kernel_param_ops baikal_scp_worker_int_ops = {
+	.set = baikal_scp_worker_param_set_int,
+	.get = param_get_int,
+};
+
+static int baikal_scp_worker_param_set_policy(const char *val, const struct kernel_param *kp)
+{
+	if (sysfs_streq(val, "normal"))
+		baikal_scp_worker_fifo = 0;
+	else if (sysfs_streq(val, "fifo"))
+		baikal_scp_worker_fifo = 1;
+	else
+		return -EINVAL;
+
+	baikal_scp_worker_apply();
+	return 0;
+}
+
+static int baikal_scp_worker_param_get_policy(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%s\n", baikal_scp_worker_fifo ? "fifo" : "normal");
+}
+
+static const struct kernel_param_ops baikal_scp_worker_policy_ops = {
+	.set = baikal_scp_worker_param_set_policy,
+	.get = baikal_scp_worker_param_get_policy,
+};
+
+module_param_cb(worker_cpu, &baikal_scp_worker_int_ops, &baikal_scp_worker_cpu, 0644);
+MODULE_PARM_DESC(worker_cpu, "CPU the flash worker thread is bound to, -1 for any CPU (default: -1)");
+
+module_param_cb(worker_policy, &baikal_scp_worker_policy_ops, NULL, 0644);
+MODULE_PARM_DESC(worker_policy, "Scheduling policy of the flash worker thread: normal or fifo (default: normal)");
+
+module_param_cb(worker_nice, &baikal_scp_worker_int_ops, &baikal_scp_worker_nice, 0644);
+MODULE_PARM_DESC(worker_nice, "Nice value of the flash worker thread with the normal policy (default: 0)");
+
+/*
+ * Duty cycle accounting
+ */
+static DEFINE_SPINLOCK(baikal_scp_duty_lock);
+static u64 baikal_scp_duty_start = 0;
+static u64 baikal_scp_duty_used = 0;
+
+static void baikal_scp_duty_account(u64 duration)
+{
+	spin_lock(&baikal_scp_duty_lock);
+	baikal_scp_duty_used += duration;
+	spin_unlock(&baikal_scp_duty_lock);
+}
+
+int baikal_scp_worker_throttle(void)
+{
+	for (;;) {
+		u64 budget = (u64)READ_ONCE(baikal_scp_duty_smc_us) * NSEC_PER_USEC;
+		u64 period = (u64)READ_ONCE(baikal_scp_duty_period_us) * NSEC_PER_USEC;
+		u64 now, wait = 0;
+
+		if (!budget || (budget >= period))
+			return 0;
+
+		now = ktime_get_ns();
+
+		spin_lock(&baikal_scp_duty_lock);
+
+		if (now - baikal_scp_duty_start >= period) {
+			baikal_scp_duty_start = now;
+			baikal_scp_duty_used = 0;
+		}
+
+		if (baikal_scp_duty_used >= budget)
+			wait = baikal_scp_duty_start + period - now;
+
+		spin_unlock(&baikal_scp_duty_lock);
+
+		if (!wait)
+			return 0;
+
+		if (schedule_timeout_killable(max_t(unsigned long, nsecs_to_jiffies(wait), 1)) &&
+		    fatal_signal_pending(current))
+			return -EINTR;
+	}
+}
+
+struct baikal_scp_worker_work {
+	struct kthread_work work;
+	unsigned long (*fn)(void *arg);
+	void *arg;
+	unsigned long ret;
+};
+
+static unsigned long baikal_scp_worker_exec(unsigned long (*fn)(void *arg), void *arg)
+{
+	unsigned long ret;
+	u64 start = ktime_get_ns();
+
+	ret = fn(arg);
+	baikal_scp_duty_account(ktime_get_ns() - start);
+
+	return ret;
+}
+
+static void baikal_scp_worker_fn(struct kthread_work *work)
+{
+	struct baikal_scp_worker_work *w =
+		container_of(work, struct baikal_scp_worker_work, work);
+
+	w->ret = baikal_scp_worker_exec(w->fn, w->arg);
+}
+
+unsigned long baikal_scp_worker_run(unsigned long (*fn)(void *arg), void *arg)
+{
+	struct baikal_scp_worker_work w = {
+		.fn  = fn,
+		.arg = arg,
+	};
+
+	if (!baikal_scp_worker)
+		return baikal_scp_worker_exec(fn, arg);
+
+	kthread_init_work(&w.work, baikal_scp_worker_fn);
+	kthread_queue_work(baikal_scp_worker, &w.work);
+	kthread_flush_work(&w.work);
+
+	return w.ret;
+}
+
+int baikal_scp_worker_init(void)
+{
+	struct kthread_worker *worker;
+
+	if (!baikal_scp_worker_enable)
+		return 0;
+
+	worker = kthread_create_worker(0, BAIKAL_SCP_DRV_NAME);
+	if (IS_ERR(worker)) {
+		pr_err("Failed to create flash worker thread (%ld)\n", PTR_ERR(worker));
+		return PTR_ERR(worker);
+	}
+
+	baikal_scp_worker = worker;
+	baikal_scp_worker_apply();
+	return 0;
+}
+
+void baikal_scp_worker_exit(void)
+{
+	if (baikal_scp_worker) {
+		kthread_destroy_worker(baikal_scp_worker);
+		baikal_scp_worker = NULL;
+	}
+}
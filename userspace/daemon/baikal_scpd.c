@@ -0,0 +1,1061 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <baikal_scp_lib.h>
+#include <baikal_scp_lib_daemon.h>
+
+/*
+ * Flash service daemon
+ *
+ * The daemon holds the SCP device open, so the library handles of other
+ * processes connect to the daemon socket. Flash geometry and recently
+ * read flash blocks are cached. Requests received from the clients are
+ * queued and executed one at a time: short requests (read, checksum,
+ * information) first, then write and erase requests in arrival order.
+ * The clients split long operations into parts, so reads of one client
+ * are not blocked by a long write of another one.
+ *
+ * Client sockets are non-blocking. Requests and replies are transferred
+ * as the socket allows, so a client stalling in the middle of a request
+ * or not reading its reply does not stop serving the other clients.
+ * Subscribers not reading the events are disconnected.
+ */
+
+#define BAIKAL_SCPD_VERSION BAIKAL_SCP_VERSION(\
+	BAIKAL_SCP_TOOL_VERSION_MAJOR, \
+	BAIKAL_SCP_TOOL_VERSION_MINOR, \
+	BAIKAL_SCP_TOOL_VERSION_PATCH)
+
+#define SCPD_MAX_CLIENTS 16
+
+#define SCPD_CACHE_BLOCK_SIZE   4096
+#define SCPD_CACHE_DEFAULT_SIZE (1024 * 1024)
+
+typedef struct cache_block {
+	unsigned int   offset;
+	unsigned long  used;  /* LRU stamp, 0 for a free block */
+	unsigned char *data;
+} cache_block_t;
+
+typedef struct client {
+	int            fd;    /* -1 for a free slot */
+	pid_t          pid;
+	int            subscribed;
+	int            pending;
+	int            background; /* The pending request is a background request */
+	unsigned long  seq;   /* Arrival order of the pending request */
+	baikal_scpd_request_t request;
+	unsigned char *data;  /* Write request data or read reply data */
+	union {
+		baikal_scpd_flash_copy_t copy;
+		baikal_scpd_flash_fill_t fill;
+	} params;             /* Copy and fill request parameters */
+	size_t         rx_size;    /* Received bytes of the request being received */
+	int            sending;    /* The reply is being sent */
+	int            closing;    /* Dropped once the reply is sent */
+	size_t         tx_size;    /* Sent bytes of the reply (header included) */
+	baikal_scpd_reply_t reply;
+	void          *reply_data; /* Reply data, the data buffer or reply_buf */
+	union {
+		baikal_scpd_version_t     version;
+		baikal_scpd_flash_info_t  info;
+		baikal_scpd_flash_stats_t stats;
+		unsigned char             digest[BAIKAL_SCP_SHA256_SIZE];
+	} reply_buf;          /* Short reply data */
+} client_t;
+
+static baikal_scp_handle_t    *handle = NULL;
+static baikal_scp_flash_info_t flash_info;
+
+static client_t      clients[SCPD_MAX_CLIENTS];
+static unsigned long request_seq = 0;
+
+static cache_block_t *cache = NULL;
+static unsigned int   cache_count = 0;
+static unsigned long  cache_clock = 0;
+static unsigned long  cache_hits = 0;
+static unsigned long  cache_misses = 0;
+
+/* Reply data and read buffer */
+static unsigned char *io_buf = NULL;
+
+static const char  *socket_path = BAIKAL_SCPD_SOCKET;
+static unsigned int cache_size = SCPD_CACHE_DEFAULT_SIZE;
+static int          verbose = 0;
+static int          monitor = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static const char *cmd_name(unsigned int cmd)
+{
+	switch (cmd) {
+		case BAIKAL_SCPD_CMD_VERSION:      return "version";
+		case BAIKAL_SCPD_CMD_FLASH_INFO:   return "info";
+		case BAIKAL_SCPD_CMD_FLASH_READ:   return "read";
+		case BAIKAL_SCPD_CMD_FLASH_WRITE:  return "write";
+		case BAIKAL_SCPD_CMD_FLASH_ERASE:  return "erase";
+		case BAIKAL_SCPD_CMD_FLASH_SHA256: return "sha256";
+		case BAIKAL_SCPD_CMD_SUBSCRIBE:    return "subscribe";
+		case BAIKAL_SCPD_CMD_FLASH_STATS:  return "stats";
+		case BAIKAL_SCPD_CMD_FLASH_COPY:   return "copy";
+		case BAIKAL_SCPD_CMD_FLASH_FILL:   return "fill";
+		default:                           return "unknown";
+	}
+}
+
+static int io_full(int fd, void *buf, size_t size, int is_write)
+{
+	unsigned char *ptr = buf;
+
+	while (size) {
+		ssize_t n = is_write
+			? send(fd, ptr, size, MSG_NOSIGNAL)
+			: recv(fd, ptr, size, 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return errno;
+		}
+
+		if (!n)
+			return EPIPE;
+
+		ptr  += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Transfer the [*pos, size) part of the buffer on a non-blocking socket,
+ * returns 0 also when the socket would block (*pos < size)
+ */
+static int io_partial(int fd, void *buf, size_t size, size_t *pos, int is_write)
+{
+	unsigned char *ptr = buf;
+
+	while (*pos < size) {
+		ssize_t n = is_write
+			? send(fd, ptr + *pos, size - *pos, MSG_NOSIGNAL | MSG_DONTWAIT)
+			: recv(fd, ptr + *pos, size - *pos, MSG_DONTWAIT);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0;
+
+			return errno;
+		}
+
+		if (!n)
+			return EPIPE;
+
+		*pos += n;
+	}
+
+	return 0;
+}
+
+/* ---------------------------------------------------------------------------------- */
+
+static cache_block_t *cache_find(unsigned int offset)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache_count; i++) {
+		if (cache[i].used && (cache[i].offset == offset))
+			return &cache[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Get a free block or the least recently used one
+ */
+static cache_block_t *cache_alloc(unsigned int offset)
+{
+	unsigned int i;
+	cache_block_t *block = &cache[0];
+
+	for (i = 1; i < cache_count; i++) {
+		if (cache[i].used < block->used)
+			block = &cache[i];
+	}
+
+	block->offset = offset;
+	block->used = ++cache_clock;
+	return block;
+}
+
+static void cache_invalidate(unsigned int offset, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache_count; i++) {
+		if (cache[i].used &&
+		    (cache[i].offset < offset + size) &&
+		    (cache[i].offset + SCPD_CACHE_BLOCK_SIZE > offset))
+			cache[i].used = 0;
+	}
+}
+
+/*
+ * Read through the cache. Consecutive missing blocks are read from flash
+ * by a single request. Destination must not overlap io_buf.
+ */
+static int cache_read(unsigned int offset, unsigned int size, unsigned char *dst)
+{
+	int ret;
+	unsigned int pos = offset;
+	unsigned int end = offset + size;
+	unsigned char *buf = io_buf;
+
+	if (!cache_count)
+		return baikal_scp_handle_flash_read(handle, offset, size, dst, NULL, NULL);
+
+	while (pos < end) {
+		unsigned int block = pos - (pos % SCPD_CACHE_BLOCK_SIZE);
+		unsigned int run_end;
+		unsigned int blk;
+		unsigned int part;
+		cache_block_t *b = cache_find(block);
+
+		if (b) {
+			part = ((block + SCPD_CACHE_BLOCK_SIZE < end) ? block + SCPD_CACHE_BLOCK_SIZE : end) - pos;
+			memcpy(dst + (pos - offset), b->data + (pos - block), part);
+			b->used = ++cache_clock;
+			cache_hits++;
+			pos += part;
+			continue;
+		}
+
+		run_end = block + SCPD_CACHE_BLOCK_SIZE;
+		while ((run_end < end) && (run_end - block < BAIKAL_SCPD_MAX_DATA) &&
+		       !cache_find(run_end))
+			run_end += SCPD_CACHE_BLOCK_SIZE;
+
+		ret = baikal_scp_handle_flash_read(handle, block, run_end - block, buf, NULL, NULL);
+		if (ret)
+			return ret;
+
+		for (blk = block; blk < run_end; blk += SCPD_CACHE_BLOCK_SIZE) {
+			b = cache_alloc(blk);
+			memcpy(b->data, buf + (blk - block), SCPD_CACHE_BLOCK_SIZE);
+			cache_misses++;
+		}
+
+		part = ((run_end < end) ? run_end : end) - pos;
+		memcpy(dst + (pos - offset), buf + (pos - block), part);
+		pos += part;
+	}
+
+	return 0;
+}
+
+static int cache_init(void)
+{
+	unsigned int i;
+
+	/* Blocks must not cross the end of the flash */
+	if (flash_info.sector_size % SCPD_CACHE_BLOCK_SIZE)
+		return 0;
+
+	cache_count = cache_size / SCPD_CACHE_BLOCK_SIZE;
+	if (!cache_count)
+		return 0;
+
+	cache = calloc(cache_count, sizeof(cache_block_t));
+	if (!cache)
+		return ENOMEM;
+
+	for (i = 0; i < cache_count; i++) {
+		cache[i].data = malloc(SCPD_CACHE_BLOCK_SIZE);
+		if (!cache[i].data)
+			return ENOMEM;
+	}
+
+	return 0;
+}
+
+static void cache_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache_count; i++)
+		free(cache[i].data);
+
+	free(cache);
+	cache = NULL;
+	cache_count = 0;
+}
+
+/* ---------------------------------------------------------------------------------- */
+
+static void client_drop(client_t *c)
+{
+	if (verbose)
+		fprintf(stderr, "baikal-scpd: client %d disconnected\n", (int)c->pid);
+
+	close(c->fd);
+	free(c->data);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+}
+
+static void client_accept(int listen_fd)
+{
+	int fd;
+	unsigned int i;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd == -1)
+		return;
+
+	for (i = 0; i < SCPD_MAX_CLIENTS; i++) {
+		if (clients[i].fd == -1)
+			break;
+	}
+
+	if (i == SCPD_MAX_CLIENTS) {
+		fprintf(stderr, "baikal-scpd: too many clients, connection refused\n");
+		close(fd);
+		return;
+	}
+
+	clients[i].fd = fd;
+	clients[i].pid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ? 0 : cred.pid;
+
+	if (verbose)
+		fprintf(stderr, "baikal-scpd: client %d connected\n", (int)clients[i].pid);
+}
+
+/* Data following the request header */
+static void *request_payload(client_t *c, size_t *size)
+{
+	switch (c->request.cmd) {
+		case BAIKAL_SCPD_CMD_FLASH_WRITE:
+			*size = c->request.size;
+			return c->data;
+
+		case BAIKAL_SCPD_CMD_FLASH_COPY:
+			*size = sizeof(c->params.copy);
+			return &c->params.copy;
+
+		case BAIKAL_SCPD_CMD_FLASH_FILL:
+			*size = sizeof(c->params.fill);
+			return &c->params.fill;
+
+		default:
+			*size = 0;
+			return NULL;
+	}
+}
+
+/*
+ * Receive the available part of the request, the complete request
+ * is put into the queue
+ */
+static int client_receive(client_t *c)
+{
+	int ret;
+	baikal_scpd_request_t *req = &c->request;
+	void *payload;
+	size_t payload_size;
+	size_t pos;
+
+	if (c->rx_size < sizeof(*req)) {
+		ret = io_partial(c->fd, req, sizeof(*req), &c->rx_size, 0);
+		if (ret || (c->rx_size < sizeof(*req)))
+			return ret;
+
+		if (req->magic != BAIKAL_SCPD_MAGIC)
+			return EPROTO;
+
+		c->background = !!(req->cmd & BAIKAL_SCPD_CMD_BACKGROUND);
+		req->cmd &= ~BAIKAL_SCPD_CMD_BACKGROUND;
+
+		if (req->cmd == BAIKAL_SCPD_CMD_FLASH_WRITE) {
+			/* The data can not be skipped, so the connection is dropped */
+			if (req->size > BAIKAL_SCPD_MAX_DATA)
+				return EPROTO;
+
+			if (!c->data) {
+				c->data = malloc(BAIKAL_SCPD_MAX_DATA);
+				if (!c->data)
+					return ENOMEM;
+			}
+		}
+	}
+
+	payload = request_payload(c, &payload_size);
+	pos = c->rx_size - sizeof(*req);
+
+	ret = io_partial(c->fd, payload, payload_size, &pos, 0);
+	c->rx_size = sizeof(*req) + pos;
+	if (ret || (pos < payload_size))
+		return ret;
+
+	c->rx_size = 0;
+	c->pending = 1;
+	c->seq = ++request_seq;
+	return 0;
+}
+
+/*
+ * Send the available part of the reply
+ */
+static int client_send(client_t *c)
+{
+	int ret;
+	size_t pos;
+
+	if (c->tx_size < sizeof(c->reply)) {
+		ret = io_partial(c->fd, &c->reply, sizeof(c->reply), &c->tx_size, 1);
+		if (ret || (c->tx_size < sizeof(c->reply)))
+			return ret;
+	}
+
+	pos = c->tx_size - sizeof(c->reply);
+
+	ret = io_partial(c->fd, c->reply_data, c->reply.data_size, &pos, 1);
+	c->tx_size = sizeof(c->reply) + pos;
+	if (ret || (pos < c->reply.data_size))
+		return ret;
+
+	c->sending = 0;
+
+	/* A subscriber which missed an event is dropped after the reply */
+	return c->closing ? ECONNABORTED : 0;
+}
+
+static int request_valid(const baikal_scpd_request_t *req, unsigned int max_size)
+{
+	return req->size && (req->size <= max_size) &&
+		(req->offset + req->size >= req->offset) &&
+		(req->offset + req->size <= flash_info.total_size);
+}
+
+/*
+ * Short requests are served before the queued requests modifying the flash,
+ * background requests only when no other request is queued
+ */
+static int request_priority(const client_t *c)
+{
+	const baikal_scpd_request_t *req = &c->request;
+
+	if (c->background)
+		return -1;
+
+	return ((req->cmd == BAIKAL_SCPD_CMD_FLASH_WRITE) ||
+		(req->cmd == BAIKAL_SCPD_CMD_FLASH_ERASE) ||
+		(req->cmd == BAIKAL_SCPD_CMD_FLASH_COPY) ||
+		(req->cmd == BAIKAL_SCPD_CMD_FLASH_FILL)) ? 0 : 1;
+}
+
+static client_t *queue_next(unsigned int *queued)
+{
+	unsigned int i;
+	client_t *next = NULL;
+
+	*queued = 0;
+
+	for (i = 0; i < SCPD_MAX_CLIENTS; i++) {
+		client_t *c = &clients[i];
+
+		if ((c->fd == -1) || !c->pending)
+			continue;
+
+		(*queued)++;
+
+		if (!next ||
+		    (request_priority(c) > request_priority(next)) ||
+		    ((request_priority(c) == request_priority(next)) &&
+		     (c->seq < next->seq)))
+			next = c;
+	}
+
+	return next;
+}
+
+static void clients_event(const client_t *c, int result, unsigned int queued)
+{
+	unsigned int i;
+	baikal_scpd_reply_t reply = {
+		.magic     = BAIKAL_SCPD_MAGIC,
+		.type      = BAIKAL_SCPD_EVENT,
+		.data_size = sizeof(baikal_scpd_event_t)
+	};
+	baikal_scpd_event_t event = {
+		.cmd    = c->request.cmd,
+		.offset = c->request.offset,
+		.size   = c->request.size,
+		.result = result,
+		.pid    = c->pid,
+		.queued = queued
+	};
+
+	struct iovec iov[2] = {
+		{ .iov_base = &reply, .iov_len = sizeof(reply) },
+		{ .iov_base = &event, .iov_len = sizeof(event) }
+	};
+	struct msghdr msg = {
+		.msg_iov    = iov,
+		.msg_iovlen = 2
+	};
+
+	/*
+	 * The event is sent whole or not at all, a subscriber which has not
+	 * read the previous events (its socket buffer is full) is dropped.
+	 * A subscriber in the middle of a reply can not get the event without
+	 * breaking the reply, it is dropped when the reply has been sent.
+	 */
+	for (i = 0; i < SCPD_MAX_CLIENTS; i++) {
+		client_t *s = &clients[i];
+		ssize_t n;
+
+		if ((s->fd == -1) || !s->subscribed || s->closing)
+			continue;
+
+		if (!s->sending) {
+			do {
+				n = sendmsg(s->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+			} while ((n < 0) && (errno == EINTR));
+
+			if (n == (ssize_t)(sizeof(reply) + sizeof(event)))
+				continue;
+		}
+
+		if (verbose) {
+			fprintf(stderr, "baikal-scpd: client %d does not read events\n",
+				(int)s->pid);
+		}
+
+		if (s->sending)
+			s->closing = 1;
+		else
+			client_drop(s);
+	}
+}
+
+static void client_execute(client_t *c, unsigned int queued)
+{
+	int ret;
+	const baikal_scpd_request_t *req = &c->request;
+	baikal_scp_version_info_t version_info;
+	baikal_scpd_reply_t *reply = &c->reply;
+	void *reply_data = &c->reply_buf;
+	int is_flash_op = 0;
+
+	c->pending = 0;
+
+	memset(reply, 0, sizeof(*reply));
+	reply->magic = BAIKAL_SCPD_MAGIC;
+	reply->type  = BAIKAL_SCPD_REPLY;
+
+	switch (req->cmd) {
+		case BAIKAL_SCPD_CMD_VERSION:
+			ret = baikal_scp_handle_version(handle, &version_info);
+			c->reply_buf.version.drv_version = version_info.drv_version;
+			c->reply_buf.version.daemon_version = BAIKAL_SCPD_VERSION;
+			reply->data_size = sizeof(c->reply_buf.version);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_INFO:
+			ret = 0;
+			c->reply_buf.info.sector_count = flash_info.sector_count;
+			c->reply_buf.info.sector_size = flash_info.sector_size;
+			c->reply_buf.info.total_size = flash_info.total_size;
+			reply->data_size = sizeof(c->reply_buf.info);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_READ:
+			is_flash_op = 1;
+			if (!request_valid(req, BAIKAL_SCPD_MAX_DATA)) {
+				ret = EINVAL;
+				break;
+			}
+
+			reply_data = c->data ? c->data : malloc(BAIKAL_SCPD_MAX_DATA);
+			if (!reply_data) {
+				ret = ENOMEM;
+				break;
+			}
+
+			c->data = reply_data;
+			ret = cache_read(req->offset, req->size, reply_data);
+			reply->data_size = req->size;
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_WRITE:
+			is_flash_op = 1;
+			if (!request_valid(req, BAIKAL_SCPD_MAX_DATA)) {
+				ret = EINVAL;
+				break;
+			}
+
+			cache_invalidate(req->offset, req->size);
+			ret = baikal_scp_handle_flash_write(handle,
+				req->offset, req->size, c->data, NULL, NULL);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_ERASE:
+			is_flash_op = 1;
+			if (!request_valid(req, flash_info.total_size)) {
+				ret = EINVAL;
+				break;
+			}
+
+			cache_invalidate(req->offset, req->size);
+			ret = baikal_scp_handle_flash_erase(handle,
+				req->offset, req->size, NULL, NULL);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_SHA256:
+			is_flash_op = 1;
+			if (!request_valid(req, flash_info.total_size)) {
+				ret = EINVAL;
+				break;
+			}
+
+			ret = baikal_scp_handle_flash_sha256(handle,
+				req->offset, req->size, c->reply_buf.digest);
+			reply->data_size = sizeof(c->reply_buf.digest);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_COPY:
+			is_flash_op = 1;
+			if (!request_valid(req, flash_info.total_size) ||
+			    (c->params.copy.src > flash_info.total_size - req->size)) {
+				ret = EINVAL;
+				break;
+			}
+
+			cache_invalidate(req->offset, req->size);
+			ret = baikal_scp_handle_flash_copy(handle,
+				c->params.copy.src, req->offset, req->size, NULL, NULL);
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_FILL:
+			is_flash_op = 1;
+			if (!request_valid(req, flash_info.total_size) ||
+			    (c->params.fill.pattern > 0xff)) {
+				ret = EINVAL;
+				break;
+			}
+
+			cache_invalidate(req->offset, req->size);
+			ret = baikal_scp_handle_flash_fill(handle,
+				req->offset, req->size, c->params.fill.pattern, NULL, NULL);
+			break;
+
+		case BAIKAL_SCPD_CMD_SUBSCRIBE:
+			c->subscribed = 1;
+			ret = 0;
+			break;
+
+		case BAIKAL_SCPD_CMD_FLASH_STATS: {
+			unsigned long long smc_calls;
+
+			ret = baikal_scp_handle_flash_smc_calls(handle, &smc_calls);
+			c->reply_buf.stats.smc_calls = smc_calls;
+			reply->data_size = sizeof(c->reply_buf.stats);
+			break;
+		}
+
+		default:
+			ret = EINVAL;
+			break;
+	}
+
+	/* Failed driver requests return -1 with errno set */
+	if (ret == -1)
+		ret = errno ? errno : EIO;
+
+	if (ret)
+		reply->data_size = 0;
+
+	reply->result = ret;
+
+	if (verbose) {
+		fprintf(stderr, "baikal-scpd: client %d: %s 0x%x+0x%x: %d\n",
+			(int)c->pid, cmd_name(req->cmd), req->offset, req->size, ret);
+	}
+
+	if (is_flash_op) {
+		clients_event(c, ret, queued - 1);
+
+		/* The client itself may be a subscriber not reading the events */
+		if (c->fd == -1)
+			return;
+	}
+
+	c->reply_data = reply_data;
+	c->tx_size = 0;
+	c->sending = 1;
+
+	if (client_send(c))
+		client_drop(c);
+}
+
+/* ---------------------------------------------------------------------------------- */
+
+static int is_daemon_running(void)
+{
+	int fd;
+	int ret;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return 0;
+
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	ret = !connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+	close(fd);
+
+	return ret;
+}
+
+static int socket_listen(void)
+{
+	int fd;
+	char *dir;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path is too long\n");
+		return -1;
+	}
+
+	dir = strdup(socket_path);
+	if (dir) {
+		mkdir(dirname(dir), 0700);
+		free(dir);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		fprintf(stderr, "ERROR: Cannot create socket (%d)\n", errno);
+		return -1;
+	}
+
+	/* Remove stale socket left after an unclean shutdown */
+	unlink(socket_path);
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(socket_path, 0600) ||
+	    listen(fd, SCPD_MAX_CLIENTS)) {
+		fprintf(stderr, "ERROR: Cannot listen on \"%s\" (%d)\n", socket_path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void signal_handler(int sig)
+{
+	running = 0;
+}
+
+static int serve(void)
+{
+	int ret;
+	int listen_fd;
+	unsigned int i;
+	struct sigaction sa = { .sa_handler = signal_handler };
+
+	if (is_daemon_running()) {
+		fprintf(stderr, "ERROR: Daemon is already running on \"%s\"\n", socket_path);
+		return EBUSY;
+	}
+
+	ret = baikal_scp_open(&handle);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to open SCP device (%d)\n", ret);
+		return ret;
+	}
+
+	ret = baikal_scp_handle_flash_info(handle, &flash_info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to get flash information (%d)\n", ret);
+		goto exit;
+	}
+
+	io_buf = malloc(BAIKAL_SCPD_MAX_DATA);
+	ret = io_buf ? cache_init() : ENOMEM;
+	if (ret) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		goto exit;
+	}
+
+	listen_fd = socket_listen();
+	if (listen_fd == -1) {
+		ret = EIO;
+		goto exit;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < SCPD_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	if (verbose) {
+		fprintf(stderr, "baikal-scpd: listening on %s, cache %u blocks\n",
+			socket_path, cache_count);
+	}
+
+	while (running) {
+		struct pollfd pfd[SCPD_MAX_CLIENTS + 1];
+		client_t *pclient[SCPD_MAX_CLIENTS + 1];
+		unsigned int nfds = 0;
+		unsigned int queued;
+		client_t *next;
+
+		pfd[nfds].fd = listen_fd;
+		pfd[nfds].events = POLLIN;
+		pclient[nfds++] = NULL;
+
+		/* Clients with a queued request wait for the reply */
+		for (i = 0; i < SCPD_MAX_CLIENTS; i++) {
+			if ((clients[i].fd == -1) || clients[i].pending)
+				continue;
+
+			pfd[nfds].fd = clients[i].fd;
+			pfd[nfds].events = clients[i].sending ? POLLOUT : POLLIN;
+			pclient[nfds++] = &clients[i];
+		}
+
+		queue_next(&queued);
+
+		if (poll(pfd, nfds, queued ? 0 : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "ERROR: poll() failed (%d)\n", errno);
+			ret = errno;
+			break;
+		}
+
+		for (i = 1; i < nfds; i++) {
+			client_t *c = pclient[i];
+
+			if (!(pfd[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)))
+				continue;
+
+			if (c->sending ? client_send(c) : client_receive(c))
+				client_drop(c);
+		}
+
+		if (pfd[0].revents & POLLIN)
+			client_accept(listen_fd);
+
+		next = queue_next(&queued);
+		if (next)
+			client_execute(next, queued);
+	}
+
+	for (i = 0; i < SCPD_MAX_CLIENTS; i++) {
+		if (clients[i].fd != -1)
+			client_drop(&clients[i]);
+	}
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	if (verbose) {
+		fprintf(stderr, "baikal-scpd: cache hits %lu, misses %lu\n",
+			cache_hits, cache_misses);
+	}
+
+exit:
+	cache_free();
+	free(io_buf);
+	baikal_scp_close(handle);
+	return ret;
+}
+
+/*
+ * Print progress events of the running daemon
+ */
+static int monitor_events(void)
+{
+	int ret;
+	int fd;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	baikal_scpd_request_t request = {
+		.magic = BAIKAL_SCPD_MAGIC,
+		.cmd   = BAIKAL_SCPD_CMD_SUBSCRIBE
+	};
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return errno;
+
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot connect to \"%s\" (%d)\n", socket_path, ret);
+		close(fd);
+		return ret;
+	}
+
+	ret = io_full(fd, &request, sizeof(request), 1);
+
+	while (!ret) {
+		baikal_scpd_reply_t reply;
+		baikal_scpd_event_t event;
+
+		ret = io_full(fd, &reply, sizeof(reply), 0);
+		if (ret)
+			break;
+
+		if (reply.magic != BAIKAL_SCPD_MAGIC) {
+			ret = EPROTO;
+			break;
+		}
+
+		if (reply.type != BAIKAL_SCPD_EVENT)
+			continue;
+
+		if (reply.data_size != sizeof(event)) {
+			ret = EPROTO;
+			break;
+		}
+
+		ret = io_full(fd, &event, sizeof(event), 0);
+		if (ret)
+			break;
+
+		fprintf(stdout, "%d: %-6s 0x%08x + 0x%08x: %s (queued %u)\n",
+			(int)event.pid, cmd_name(event.cmd), event.offset, event.size,
+			event.result ? strerror(event.result) : "OK", event.queued);
+		fflush(stdout);
+	}
+
+	close(fd);
+
+	if (ret == EPIPE) {
+		fprintf(stderr, "Daemon has stopped\n");
+		return 0;
+	}
+
+	return ret;
+}
+
+/* ---------------------------------------------------------------------------------- */
+
+static const char *opts_str = "hs:c:mv";
+
+static const struct option opts[] = {
+	{ .name = "help",    .val = 'h' },
+	{ .name = "socket",  .val = 's', .has_arg = 1 },
+	{ .name = "cache",   .val = 'c', .has_arg = 1 },
+	{ .name = "monitor", .val = 'm' },
+	{ .name = "verbose", .val = 'v' },
+	{ 0 }
+};
+
+static void display_usage(void)
+{
+	fprintf(stdout,
+		"\n"
+		"Baikal-M SCP Flash Service Daemon version %u.%u.%u\n"
+		"Copyright (c) 2021-2022, Tano Systems LLC, All Rights Reserved\n"
+		"\n"
+		"Usage: baikal-scpd [options]\n"
+		"\n"
+		"Options:\n"
+		"  -h, --help\n"
+		"        Show this help text.\n"
+		"\n"
+		"  -s, --socket <path>\n"
+		"        Listen on the Unix socket <path> (default: %s).\n"
+		"        The library connects to the default socket only.\n"
+		"\n"
+		"  -c, --cache <size>\n"
+		"        Size of the flash read cache in bytes (default: %u).\n"
+		"        Zero disables the cache.\n"
+		"\n"
+		"  -m, --monitor\n"
+		"        Connect to the running daemon and print the flash requests\n"
+		"        it executes.\n"
+		"\n"
+		"  -v, --verbose\n"
+		"        Log client connections and requests to stderr.\n"
+		"\n",
+		BAIKAL_SCP_TOOL_VERSION_MAJOR,
+		BAIKAL_SCP_TOOL_VERSION_MINOR,
+		BAIKAL_SCP_TOOL_VERSION_PATCH,
+		BAIKAL_SCPD_SOCKET,
+		SCPD_CACHE_DEFAULT_SIZE
+	);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, opts_str, opts, NULL)) != -1) {
+		switch (opt) {
+			case 's': /* --socket */
+				socket_path = optarg;
+				break;
+
+			case 'c': /* --cache */
+				cache_size = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'm': /* --monitor */
+				monitor = 1;
+				break;
+
+			case 'v': /* --verbose */
+				verbose = 1;
+				break;
+
+			case 'h': /* --help */
+				display_usage();
+				return 0;
+
+			default:
+				display_usage();
+				return EINVAL;
+		}
+	}
+
+	return monitor ? monitor_events() : serve();
+}
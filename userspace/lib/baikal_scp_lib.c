@@ -6,56 +6,220 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <pthread.h>
+
 #include "baikal_scp_lib_private.h"
+#include "baikal_scp_lib_daemon.h"
 
-baikal_scp_lib_t *baikal_scp_lib = NULL;
+/* Default handle used by the baikal_scp_init() based API */
+baikal_scp_handle_t *baikal_scp_lib = NULL;
 
-int baikal_scp_init(void)
+/*
+ * The driver allows the device to be opened only once, so the device file
+ * is opened by the first handle of the process and every handle works
+ * with its own duplicate of that descriptor. If the device is held by
+ * the flash service daemon, each handle connects to the daemon instead.
+ */
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+static int device_fhnd = -1;
+static unsigned int device_refs = 0;
+
+/* Busy device open retries, BAIKAL_SCP_OPEN_RETRY_DELAY us apart */
+#define BAIKAL_SCP_OPEN_RETRIES     20
+#define BAIKAL_SCP_OPEN_RETRY_DELAY 50000
+
+/*
+ * Open the device (or connect to the daemon) for the handle
+ */
+static int handle_attach(baikal_scp_handle_t *h)
 {
 	char devpath[PATH_MAX];
+	baikal_scp_version_info_t version_info;
+	unsigned int retries = 0;
 
-	if (baikal_scp_lib)
-		return ECANCELED;
+retry:
+	pthread_mutex_lock(&device_lock);
 
-	baikal_scp_lib = calloc(sizeof(baikal_scp_lib_t), 1);
-	if (!baikal_scp_lib)
-		return ENOMEM;
+	if (!device_refs) {
+		snprintf(devpath, sizeof(devpath) - 1, "/dev/%s", BAIKAL_SCP_DEV_NAME);
+
+		device_fhnd = open(devpath, O_RDWR | O_CLOEXEC);
+		if (device_fhnd == -1) {
+			int busy = (errno == EBUSY);
+
+			pthread_mutex_unlock(&device_lock);
+
+			if (busy && !_baikal_scp_client_connect(h))
+				return 0;
+
+			/* Another process may only hold the device for a moment */
+			if (busy && (retries++ < BAIKAL_SCP_OPEN_RETRIES)) {
+				usleep(BAIKAL_SCP_OPEN_RETRY_DELAY);
+				goto retry;
+			}
 
-	snprintf(devpath, sizeof(devpath) - 1, "/dev/%s", BAIKAL_SCP_DEV_NAME);
+			return busy ? EBUSY : ENODEV;
+		}
+	}
+
+	h->fhnd_scp = fcntl(device_fhnd, F_DUPFD_CLOEXEC, 0);
+	if (h->fhnd_scp == -1) {
+		int ret = errno;
+
+		if (!device_refs) {
+			close(device_fhnd);
+			device_fhnd = -1;
+		}
+
+		pthread_mutex_unlock(&device_lock);
+		return ret;
+	}
 
-	baikal_scp_lib->fhnd_scp = open(devpath, O_RDWR);
-	if (baikal_scp_lib->fhnd_scp == -1) {
-		free(baikal_scp_lib);
-		baikal_scp_lib = NULL;
-		return ENODEV;
+	device_refs++;
+	pthread_mutex_unlock(&device_lock);
+
+	if (!baikal_scp_handle_version(h, &version_info)) {
+		h->has_file_rw = version_info.drv_version >= BAIKAL_SCP_DRV_VERSION_FILE_RW;
+		h->has_flash_copy = version_info.drv_version >= BAIKAL_SCP_DRV_VERSION_FLASH_COPY;
+		h->has_flash_done = version_info.drv_version >= BAIKAL_SCP_DRV_VERSION_FLASH_DONE;
 	}
 
 	return 0;
 }
 
-void baikal_scp_deinit(void)
+/*
+ * Close the device file (or the daemon connection) of the handle
+ */
+static void handle_detach(baikal_scp_handle_t *h)
 {
-	if (!baikal_scp_lib)
+	if (h->fhnd_scp == -1)
 		return;
 
-	close(baikal_scp_lib->fhnd_scp);
+	close(h->fhnd_scp);
+	h->fhnd_scp = -1;
 
-	free(baikal_scp_lib);
-	baikal_scp_lib = NULL;
+	if (h->is_client) {
+		h->is_client = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&device_lock);
+
+	if (!--device_refs) {
+		close(device_fhnd);
+		device_fhnd = -1;
+	}
+
+	pthread_mutex_unlock(&device_lock);
 }
 
-int baikal_scp_version(baikal_scp_version_info_t *version_info)
+int baikal_scp_open(baikal_scp_handle_t **handle)
+{
+	int ret;
+	baikal_scp_handle_t *h;
+
+	if (!handle)
+		return EINVAL;
+
+	h = calloc(sizeof(baikal_scp_handle_t), 1);
+	if (!h)
+		return ENOMEM;
+
+	ret = handle_attach(h);
+	if (ret) {
+		free(h);
+		return ret;
+	}
+
+	*handle = h;
+	return 0;
+}
+
+void baikal_scp_close(baikal_scp_handle_t *handle)
+{
+	if (!handle)
+		return;
+
+	handle_detach(handle);
+
+	free(handle->efivar_index);
+	free(handle->buf);
+	free(handle);
+}
+
+int baikal_scp_handle_suspend(baikal_scp_handle_t *handle)
+{
+	if (!handle)
+		return EINVAL;
+
+	handle_detach(handle);
+	return 0;
+}
+
+int baikal_scp_handle_resume(baikal_scp_handle_t *handle)
+{
+	if (!handle)
+		return EINVAL;
+
+	if (handle->fhnd_scp != -1)
+		return 0;
+
+	return handle_attach(handle);
+}
+
+int baikal_scp_handle_set_background(
+	baikal_scp_handle_t *handle,
+	int background
+)
+{
+	if (!handle)
+		return EINVAL;
+
+	handle->background = !!background;
+	return 0;
+}
+
+void *_baikal_scp_handle_buffer(baikal_scp_handle_t *handle, size_t size)
+{
+	void *buf;
+
+	if (size <= handle->buf_size)
+		return handle->buf;
+
+	buf = realloc(handle->buf, size);
+	if (!buf)
+		return NULL;
+
+	handle->buf = buf;
+	handle->buf_size = size;
+	return buf;
+}
+
+int baikal_scp_handle_version(
+	baikal_scp_handle_t *handle,
+	baikal_scp_version_info_t *version_info
+)
 {
 	int ret;
 	struct baikal_scp_ioctl_info ioctl_info;
 
-	if (!version_info)
+	if (!handle || !version_info)
 		return EINVAL;
 
-	if (!baikal_scp_lib)
-		return ECANCELED;
+	if (handle->is_client) {
+		baikal_scpd_version_t version;
+
+		ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_VERSION,
+			0, 0, NULL, 0, &version, sizeof(version));
+		if (ret)
+			return ret;
+
+		version_info->drv_version = version.drv_version;
+		version_info->lib_version = BAIKAL_SCP_LIB_VERSION;
+		return 0;
+	}
 
-	ret = ioctl(baikal_scp_lib->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_INFO, &ioctl_info);
+	ret = ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_INFO, &ioctl_info);
 	if (ret)
 		return ret;
 
@@ -64,3 +228,55 @@ int baikal_scp_version(baikal_scp_version_info_t *version_info)
 
 	return 0;
 }
+
+int baikal_scp_init(void)
+{
+	if (baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_open(&baikal_scp_lib);
+}
+
+void baikal_scp_deinit(void)
+{
+	if (!baikal_scp_lib)
+		return;
+
+	baikal_scp_close(baikal_scp_lib);
+	baikal_scp_lib = NULL;
+}
+
+int baikal_scp_suspend(void)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_suspend(baikal_scp_lib);
+}
+
+int baikal_scp_resume(void)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_resume(baikal_scp_lib);
+}
+
+int baikal_scp_set_background(int background)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_set_background(baikal_scp_lib, background);
+}
+
+int baikal_scp_version(baikal_scp_version_info_t *version_info)
+{
+	if (!version_info)
+		return EINVAL;
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_version(baikal_scp_lib, version_info);
+}
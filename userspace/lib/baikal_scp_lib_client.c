@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "baikal_scp_lib_private.h"
+#include "baikal_scp_lib_daemon.h"
+
+/*
+ * Flash service daemon client. Handles opened while the daemon holds
+ * the device send their requests to the daemon socket.
+ */
+
+int _baikal_scp_io_full(int fd, void *buf, size_t size, int is_write)
+{
+	unsigned char *ptr = buf;
+
+	while (size) {
+		ssize_t n = is_write
+			? send(fd, ptr, size, MSG_NOSIGNAL)
+			: recv(fd, ptr, size, 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return errno;
+		}
+
+		if (!n)
+			return EPIPE;
+
+		ptr  += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+int _baikal_scp_client_connect(baikal_scp_handle_t *handle)
+{
+	int fd;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return errno;
+
+	strncpy(addr.sun_path, BAIKAL_SCPD_SOCKET, sizeof(addr.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int ret = errno;
+		close(fd);
+		return ret;
+	}
+
+	handle->fhnd_scp = fd;
+	handle->is_client = 1;
+	return 0;
+}
+
+/*
+ * Send request followed by src_size bytes of the request data and receive
+ * the reply header and up to dst_size bytes of the reply data. Returns
+ * errno-style error code of the transfer or of the request itself.
+ *
+ * The reply data that does not fit into dst is read and discarded, so the
+ * next request starts at the reply header. A reply with an invalid header
+ * leaves the stream out of sync, the connection is shut down then and all
+ * the following requests on the handle fail.
+ */
+int _baikal_scp_client_request(
+	baikal_scp_handle_t *handle,
+	unsigned int cmd,
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	unsigned int src_size,
+	void *dst,
+	unsigned int dst_size
+)
+{
+	int ret;
+	baikal_scpd_request_t request = {
+		.magic  = BAIKAL_SCPD_MAGIC,
+		.cmd    = cmd | (handle->background ? BAIKAL_SCPD_CMD_BACKGROUND : 0),
+		.offset = offset,
+		.size   = size
+	};
+	baikal_scpd_reply_t reply;
+	unsigned int excess;
+
+	ret = _baikal_scp_io_full(handle->fhnd_scp, &request, sizeof(request), 1);
+	if (ret)
+		return ret;
+
+	if (src_size) {
+		ret = _baikal_scp_io_full(handle->fhnd_scp, (void *)src, src_size, 1);
+		if (ret)
+			return ret;
+	}
+
+	ret = _baikal_scp_io_full(handle->fhnd_scp, &reply, sizeof(reply), 0);
+	if (ret)
+		return ret;
+
+	if ((reply.magic != BAIKAL_SCPD_MAGIC) ||
+	    (reply.type != BAIKAL_SCPD_REPLY)) {
+		shutdown(handle->fhnd_scp, SHUT_RDWR);
+		return EPROTO;
+	}
+
+	excess = (reply.data_size > dst_size) ? (reply.data_size - dst_size) : 0;
+
+	if (reply.data_size - excess) {
+		ret = _baikal_scp_io_full(handle->fhnd_scp, dst, reply.data_size - excess, 0);
+		if (ret)
+			return ret;
+	}
+
+	while (excess) {
+		unsigned char discard[256];
+		unsigned int part = (excess < sizeof(discard)) ? excess : sizeof(discard);
+
+		ret = _baikal_scp_io_full(handle->fhnd_scp, discard, part, 0);
+		if (ret)
+			return ret;
+
+		excess -= part;
+	}
+
+	return (reply.data_size > dst_size) ? EPROTO : reply.result;
+}
+
+/*
+ * Flash request part. Returns the same as the flash ioctls: 0 or -1
+ * with errno set, and the number of transferred bytes in *done.
+ */
+int _baikal_scp_client_op(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int offset,
+	unsigned int size,
+	void *data,
+	unsigned int *done
+)
+{
+	int ret;
+
+	switch (op) {
+		case BAIKAL_SCP_FLASH_READ:
+			ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_READ,
+				offset, size, NULL, 0, data, size);
+			break;
+
+		case BAIKAL_SCP_FLASH_WRITE:
+			ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_WRITE,
+				offset, size, data, size, NULL, 0);
+			break;
+
+		case BAIKAL_SCP_FLASH_ERASE:
+			ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_ERASE,
+				offset, size, NULL, 0, NULL, 0);
+			break;
+
+		default:
+			ret = EINVAL;
+			break;
+	}
+
+	*done = ret ? 0 : size;
+
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+
+	return 0;
+}
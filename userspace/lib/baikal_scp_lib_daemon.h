@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BAIKAL_SCP_LIB_DAEMON_H
+#define BAIKAL_SCP_LIB_DAEMON_H
+
+#include <stdint.h>
+
+/*
+ * Flash service daemon (baikal-scpd) protocol
+ *
+ * The daemon holds the SCP device open, so the library handles opened
+ * while it is running connect to the daemon socket instead. Each request
+ * is a header followed by the data to be written (FLASH_WRITE) or by the
+ * request parameters (FLASH_COPY and FLASH_FILL).
+ * Each reply is a header followed by the reply data: version information,
+ * flash information, read data, checksum or driver statistics. Connections subscribed to
+ * the progress events receive an event after each executed flash request.
+ */
+
+/** Daemon socket path */
+#define BAIKAL_SCPD_SOCKET "/run/baikal-scp/scpd.sock"
+
+#define BAIKAL_SCPD_MAGIC 0x44504353 /* "SCPD" */
+
+/** Maximum request data size */
+#define BAIKAL_SCPD_MAX_DATA (1024 * 1024)
+
+typedef enum {
+	BAIKAL_SCPD_CMD_VERSION = 0,
+	BAIKAL_SCPD_CMD_FLASH_INFO,
+	BAIKAL_SCPD_CMD_FLASH_READ,
+	BAIKAL_SCPD_CMD_FLASH_WRITE,
+	BAIKAL_SCPD_CMD_FLASH_ERASE,
+	BAIKAL_SCPD_CMD_FLASH_SHA256,
+	BAIKAL_SCPD_CMD_SUBSCRIBE,
+	BAIKAL_SCPD_CMD_FLASH_STATS,
+	BAIKAL_SCPD_CMD_FLASH_COPY,
+	BAIKAL_SCPD_CMD_FLASH_FILL,
+} baikal_scpd_cmd_t;
+
+/** Command flag: serve the request only when no other request is queued */
+#define BAIKAL_SCPD_CMD_BACKGROUND 0x80000000
+
+typedef enum {
+	BAIKAL_SCPD_REPLY = 0,
+	BAIKAL_SCPD_EVENT,
+} baikal_scpd_reply_type_t;
+
+typedef struct baikal_scpd_request {
+	uint32_t magic;
+	uint32_t cmd;
+	uint32_t offset;
+	uint32_t size;
+} baikal_scpd_request_t;
+
+typedef struct baikal_scpd_reply {
+	uint32_t magic;
+	uint32_t type;
+	int32_t  result;    /* errno-style error code */
+	uint32_t data_size; /* Size of the data following the header */
+} baikal_scpd_reply_t;
+
+typedef struct baikal_scpd_version {
+	uint32_t drv_version;
+	uint32_t daemon_version;
+} baikal_scpd_version_t;
+
+typedef struct baikal_scpd_flash_info {
+	uint32_t sector_count;
+	uint32_t sector_size;
+	uint32_t total_size;
+} baikal_scpd_flash_info_t;
+
+/** FLASH_COPY parameters, the request offset is the destination */
+typedef struct baikal_scpd_flash_copy {
+	uint32_t src;
+} baikal_scpd_flash_copy_t;
+
+/** FLASH_FILL parameters */
+typedef struct baikal_scpd_flash_fill {
+	uint32_t pattern;
+} baikal_scpd_flash_fill_t;
+
+typedef struct baikal_scpd_flash_stats {
+	uint64_t smc_calls;
+} baikal_scpd_flash_stats_t;
+
+/** Progress event, sent after each executed flash request */
+typedef struct baikal_scpd_event {
+	uint32_t cmd;
+	uint32_t offset;
+	uint32_t size;
+	int32_t  result;
+	int32_t  pid;       /* Requesting client process */
+	uint32_t queued;    /* Requests waiting in the queue */
+} baikal_scpd_event_t;
+
+#endif /* BAIKAL_SCP_LIB_DAEMON_H */
@@ -0,0 +1,1264 @@
+/*
+ * Copyright (C) 2021 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "baikal_scp_lib_private.h"
+
+/*
+ * UEFI variable store parser (EDK2 flash variable store format).
+ *
+ * The store is expected to start with a firmware volume header followed by
+ * the variable store header. Variable headers are walked one by one reading
+ * only the header and name bytes, the variable data is read only for the
+ * requested variable. The resulting name/GUID index is kept in memory and
+ * in BAIKAL_SCP_LIB_RUNTIME_DIR, so consecutive lookups during the same boot
+ * only need to check that the store has not changed since the index was built.
+ */
+
+#define EFIVAR_BLOCK_SIZE 256
+
+#define EFI_FVH_SIGNATURE 0x4856465f /* "_FVH" */
+
+#define VARIABLE_STORE_FORMATTED 0x5a
+#define VARIABLE_STORE_HEALTHY   0xfe
+
+#define VARIABLE_DATA 0x55aa
+
+#define VAR_IN_DELETED_TRANSITION 0xfe
+#define VAR_DELETED               0xfd
+#define VAR_HEADER_VALID_ONLY     0x7f
+#define VAR_ADDED                 0x3f
+
+#define HEADER_ALIGN(x) (((x) + 3) & ~3u)
+
+#define EFIVAR_INDEX_MAGIC   0x49565342 /* "BSVI" */
+#define EFIVAR_INDEX_VERSION 1
+
+typedef struct __attribute__((packed)) {
+	uint8_t  zero_vector[16];
+	uint8_t  fs_guid[16];
+	uint64_t fv_length;
+	uint32_t signature;
+	uint32_t attributes;
+	uint16_t header_length;
+	uint16_t checksum;
+	uint16_t ext_header_offset;
+	uint8_t  reserved;
+	uint8_t  revision;
+} efi_fv_header_t;
+
+typedef struct __attribute__((packed)) {
+	baikal_scp_efi_guid_t signature;
+	uint32_t size;
+	uint8_t  format;
+	uint8_t  state;
+	uint16_t reserved;
+	uint32_t reserved1;
+} efi_variable_store_header_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t start_id;
+	uint8_t  state;
+	uint8_t  reserved;
+	uint32_t attributes;
+	uint32_t name_size;
+	uint32_t data_size;
+	baikal_scp_efi_guid_t vendor_guid;
+} efi_variable_header_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t start_id;
+	uint8_t  state;
+	uint8_t  reserved;
+	uint32_t attributes;
+	uint64_t monotonic_count;
+	uint8_t  timestamp[16];
+	uint32_t pubkey_index;
+	uint32_t name_size;
+	uint32_t data_size;
+	baikal_scp_efi_guid_t vendor_guid;
+} efi_auth_variable_header_t;
+
+static const baikal_scp_efi_guid_t efi_variable_guid = {
+	0xddcf3616, 0x3275, 0x4164, { 0x98, 0xb6, 0xfe, 0x85, 0x70, 0x7f, 0xfe, 0x7d }
+};
+
+static const baikal_scp_efi_guid_t efi_auth_variable_guid = {
+	0xaaf32c78, 0x947b, 0x439a, { 0xa1, 0x80, 0x2e, 0x14, 0x4e, 0xc3, 0x77, 0x92 }
+};
+
+typedef struct efivar_index_entry {
+	unsigned int hdr_offset;
+	unsigned int name_size;
+	unsigned int data_size;
+	unsigned int attributes;
+	baikal_scp_efi_guid_t guid;
+	char name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+} efivar_index_entry_t;
+
+typedef struct efivar_index {
+	unsigned int store_offset;
+	unsigned int store_size;
+	unsigned int vars_last;
+	unsigned int checksum;
+	unsigned int count;
+	efivar_index_entry_t entries[];
+} efivar_index_t;
+
+typedef struct efivar_store {
+	baikal_scp_handle_t *handle; /* Library handle used for flash access */
+
+	unsigned int offset;     /* Flash offset of the store (partition) */
+	unsigned int size;       /* Size of the store (partition) */
+	unsigned int vars_start; /* Flash offset of the first variable header */
+	unsigned int vars_end;   /* Flash offset of the end of the variable area */
+	unsigned int vars_last;  /* Flash offset after the last variable */
+	unsigned int hdr_size;   /* Size of variable header */
+	int          auth;       /* Authenticated variables format */
+	unsigned int checksum;
+
+	/* Store contents read to memory (used by reclaim) */
+	const unsigned char *image;
+	unsigned int         image_offset;
+
+	/* Read cache (single block) */
+	unsigned int  block_offset;
+	int           block_valid;
+	unsigned char block[EFIVAR_BLOCK_SIZE];
+} efivar_store_t;
+
+static unsigned int fnv1a(unsigned int hash, const void *data, unsigned int size)
+{
+	const unsigned char *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static int efivar_read(efivar_store_t *store, unsigned int offset, void *dst, unsigned int size)
+{
+	int ret;
+	unsigned char *ptr = dst;
+
+	if (store->image) {
+		memcpy(dst, store->image + (offset - store->image_offset), size);
+		return 0;
+	}
+
+	while (size) {
+		unsigned int block_offset = offset - (offset % EFIVAR_BLOCK_SIZE);
+		unsigned int part = block_offset + EFIVAR_BLOCK_SIZE - offset;
+
+		if (part > size)
+			part = size;
+
+		if (!store->block_valid || (store->block_offset != block_offset)) {
+			ret = baikal_scp_handle_flash_read(store->handle, block_offset,
+				EFIVAR_BLOCK_SIZE, store->block, NULL, NULL);
+			if (ret) {
+				store->block_valid = 0;
+				return ret;
+			}
+
+			store->block_offset = block_offset;
+			store->block_valid = 1;
+		}
+
+		memcpy(ptr, &store->block[offset - block_offset], part);
+
+		ptr    += part;
+		offset += part;
+		size   -= part;
+	}
+
+	return 0;
+}
+
+/*
+ * Read variable header at the specified offset and convert it to
+ * the non-authenticated header layout
+ */
+static int efivar_read_header(efivar_store_t *store, unsigned int offset,
+	efi_variable_header_t *hdr)
+{
+	int ret;
+
+	if ((offset + store->hdr_size) > store->vars_end)
+		return ENOENT;
+
+	if (store->auth) {
+		efi_auth_variable_header_t auth_hdr;
+
+		ret = efivar_read(store, offset, &auth_hdr, sizeof(auth_hdr));
+		if (ret)
+			return ret;
+
+		hdr->start_id    = auth_hdr.start_id;
+		hdr->state       = auth_hdr.state;
+		hdr->attributes  = auth_hdr.attributes;
+		hdr->name_size   = auth_hdr.name_size;
+		hdr->data_size   = auth_hdr.data_size;
+		hdr->vendor_guid = auth_hdr.vendor_guid;
+	}
+	else {
+		ret = efivar_read(store, offset, hdr, sizeof(*hdr));
+		if (ret)
+			return ret;
+	}
+
+	if (hdr->start_id != VARIABLE_DATA)
+		return ENOENT;
+
+	if ((hdr->name_size > (store->vars_end - offset - store->hdr_size)) ||
+	    (hdr->data_size > (store->vars_end - offset - store->hdr_size - hdr->name_size)))
+		return ENOENT;
+
+	return 0;
+}
+
+/*
+ * Convert UCS-2 name to UTF-8
+ */
+static int efivar_read_name(efivar_store_t *store, unsigned int offset,
+	unsigned int name_size, char *name)
+{
+	int ret;
+	unsigned int i;
+	unsigned int n = 0;
+	uint16_t ucs2[BAIKAL_SCP_EFIVAR_NAME_MAX];
+
+	if (name_size > sizeof(ucs2))
+		return ENAMETOOLONG;
+
+	ret = efivar_read(store, offset, ucs2, name_size);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < name_size / 2 && ucs2[i]; i++) {
+		uint16_t c = ucs2[i];
+
+		if (c < 0x80) {
+			if (n + 1 >= BAIKAL_SCP_EFIVAR_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)c;
+		}
+		else if (c < 0x800) {
+			if (n + 2 >= BAIKAL_SCP_EFIVAR_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)(0xc0 | (c >> 6));
+			name[n++] = (char)(0x80 | (c & 0x3f));
+		}
+		else {
+			if (n + 3 >= BAIKAL_SCP_EFIVAR_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)(0xe0 | (c >> 12));
+			name[n++] = (char)(0x80 | ((c >> 6) & 0x3f));
+			name[n++] = (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	name[n] = '\0';
+	return 0;
+}
+
+static int efivar_is_valid_state(uint8_t state)
+{
+	return (state == VAR_ADDED) ||
+		(state == (VAR_ADDED & VAR_IN_DELETED_TRANSITION));
+}
+
+/*
+ * Parse firmware volume and variable store headers
+ */
+static int efivar_store_open(efivar_store_t *store, baikal_scp_handle_t *handle,
+	unsigned int offset, unsigned int size)
+{
+	int ret;
+	efi_fv_header_t fvh;
+	efi_variable_store_header_t vsh;
+	unsigned int vsh_offset = offset;
+
+	memset(store, 0, sizeof(*store));
+	store->handle = handle;
+	store->offset = offset;
+	store->size   = size;
+
+	if (size < sizeof(fvh) + sizeof(vsh))
+		return EINVAL;
+
+	ret = efivar_read(store, offset, &fvh, sizeof(fvh));
+	if (ret)
+		return ret;
+
+	/* Variable store may be placed without firmware volume header */
+	if (fvh.signature == EFI_FVH_SIGNATURE) {
+		if ((fvh.header_length < sizeof(fvh)) ||
+		    (fvh.header_length > size - sizeof(vsh)))
+			return EILSEQ;
+
+		vsh_offset += fvh.header_length;
+	}
+
+	ret = efivar_read(store, vsh_offset, &vsh, sizeof(vsh));
+	if (ret)
+		return ret;
+
+	if (!memcmp(&vsh.signature, &efi_auth_variable_guid, sizeof(vsh.signature))) {
+		store->auth = 1;
+		store->hdr_size = sizeof(efi_auth_variable_header_t);
+	}
+	else if (!memcmp(&vsh.signature, &efi_variable_guid, sizeof(vsh.signature))) {
+		store->auth = 0;
+		store->hdr_size = sizeof(efi_variable_header_t);
+	}
+	else
+		return EILSEQ;
+
+	if ((vsh.format != VARIABLE_STORE_FORMATTED) ||
+	    (vsh.state != VARIABLE_STORE_HEALTHY))
+		return EILSEQ;
+
+	if ((vsh.size < sizeof(vsh)) || (vsh.size > (offset + size - vsh_offset)))
+		return EILSEQ;
+
+	store->vars_start = HEADER_ALIGN(vsh_offset + sizeof(vsh));
+	store->vars_end   = vsh_offset + vsh.size;
+	store->vars_last  = store->vars_start;
+
+	store->checksum = fnv1a(0x811c9dc5, &fvh, sizeof(fvh));
+	store->checksum = fnv1a(store->checksum, &vsh, sizeof(vsh));
+	return 0;
+}
+
+/*
+ * Store checksum covers the store headers, the end of the variable
+ * area and the contents right after the last variable. Any variable
+ * added, updated or reclaimed changes at least one of them. Variable
+ * deletion only changes the state of the existing header, this is
+ * caught by checking the header before returning variable data.
+ */
+static int efivar_store_checksum(efivar_store_t *store, unsigned int vars_last,
+	unsigned int *checksum)
+{
+	int ret;
+	unsigned char tail[BAIKAL_SCP_FLASH_SIZE_ALIGNMENT];
+	unsigned int hash = store->checksum;
+
+	memset(tail, 0xff, sizeof(tail));
+
+	if (vars_last < store->vars_end) {
+		unsigned int n = store->vars_end - vars_last;
+
+		ret = efivar_read(store, vars_last, tail,
+			n < sizeof(tail) ? n : sizeof(tail));
+		if (ret)
+			return ret;
+	}
+
+	hash = fnv1a(hash, &vars_last, sizeof(vars_last));
+	hash = fnv1a(hash, tail, sizeof(tail));
+
+	*checksum = hash;
+	return 0;
+}
+
+static void efivar_index_path(char *path, size_t size, unsigned int store_offset)
+{
+	snprintf(path, size, "%s/efivar-%08x.idx",
+		BAIKAL_SCP_LIB_RUNTIME_DIR, store_offset);
+}
+
+static int efivar_boot_id(char *boot_id, size_t size)
+{
+	FILE *f;
+	int ret = 0;
+
+	memset(boot_id, 0, size);
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!f)
+		return errno;
+
+	if (!fgets(boot_id, size, f))
+		ret = EIO;
+
+	fclose(f);
+	return ret;
+}
+
+static void efivar_index_save(const efivar_index_t *index)
+{
+	int fd;
+	FILE *f;
+	char path[PATH_MAX];
+	char boot_id[40];
+	unsigned int hdr[3] = { EFIVAR_INDEX_MAGIC, EFIVAR_INDEX_VERSION, 0 };
+
+	if (efivar_boot_id(boot_id, sizeof(boot_id)))
+		return;
+
+	mkdir(BAIKAL_SCP_LIB_RUNTIME_DIR, 0700);
+	efivar_index_path(path, sizeof(path), index->store_offset);
+
+	/* The index lists the variable names, keep it private like the directory */
+	fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd < 0)
+		return;
+
+	f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		unlink(path);
+		return;
+	}
+
+	hdr[2] = sizeof(*index) + index->count * sizeof(index->entries[0]);
+
+	if ((fwrite(hdr, sizeof(hdr), 1, f) != 1) ||
+	    (fwrite(boot_id, sizeof(boot_id), 1, f) != 1) ||
+	    (fwrite(index, hdr[2], 1, f) != 1)) {
+		fclose(f);
+		unlink(path);
+		return;
+	}
+
+	fclose(f);
+}
+
+static efivar_index_t *efivar_index_load(unsigned int store_offset, unsigned int store_size)
+{
+	FILE *f;
+	char path[PATH_MAX];
+	char boot_id[40];
+	char saved_boot_id[40];
+	unsigned int hdr[3];
+	efivar_index_t *index = NULL;
+
+	if (efivar_boot_id(boot_id, sizeof(boot_id)))
+		return NULL;
+
+	efivar_index_path(path, sizeof(path), store_offset);
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if ((fread(hdr, sizeof(hdr), 1, f) != 1) ||
+	    (hdr[0] != EFIVAR_INDEX_MAGIC) ||
+	    (hdr[1] != EFIVAR_INDEX_VERSION) ||
+	    (hdr[2] < sizeof(*index)) ||
+	    (fread(saved_boot_id, sizeof(saved_boot_id), 1, f) != 1) ||
+	    memcmp(boot_id, saved_boot_id, sizeof(boot_id)))
+		goto exit;
+
+	index = malloc(hdr[2]);
+	if (!index)
+		goto exit;
+
+	if ((fread(index, hdr[2], 1, f) != 1) ||
+	    (index->store_offset != store_offset) ||
+	    (index->store_size != store_size) ||
+	    (hdr[2] != sizeof(*index) + index->count * sizeof(index->entries[0]))) {
+		free(index);
+		index = NULL;
+	}
+
+exit:
+	fclose(f);
+	return index;
+}
+
+/*
+ * Walk all variable headers and build name/GUID index of the valid variables
+ */
+static int efivar_index_build(efivar_store_t *store, efivar_index_t **result)
+{
+	int ret;
+	unsigned int offset = store->vars_start;
+	unsigned int capacity = 32;
+	efivar_index_t *index;
+	efi_variable_header_t hdr;
+
+	index = calloc(1, sizeof(*index) + capacity * sizeof(index->entries[0]));
+	if (!index)
+		return ENOMEM;
+
+	index->store_offset = store->offset;
+	index->store_size   = store->size;
+
+	while (!(ret = efivar_read_header(store, offset, &hdr))) {
+		efivar_index_entry_t *entry;
+		unsigned int i;
+
+		if (efivar_is_valid_state(hdr.state)) {
+			if (index->count == capacity) {
+				efivar_index_t *tmp;
+
+				capacity *= 2;
+				tmp = realloc(index, sizeof(*index) + capacity * sizeof(index->entries[0]));
+				if (!tmp) {
+					free(index);
+					return ENOMEM;
+				}
+
+				index = tmp;
+			}
+
+			entry = &index->entries[index->count];
+			memset(entry, 0, sizeof(*entry));
+
+			entry->hdr_offset = offset - store->offset;
+			entry->name_size  = hdr.name_size;
+			entry->data_size  = hdr.data_size;
+			entry->attributes = hdr.attributes;
+			entry->guid       = hdr.vendor_guid;
+
+			ret = efivar_read_name(store, offset + store->hdr_size,
+				hdr.name_size, entry->name);
+			if (ret) {
+				free(index);
+				return ret;
+			}
+
+			/*
+			 * Variable in deleted transition state is superseded
+			 * by the newer added copy of the same variable
+			 */
+			for (i = 0; i < index->count; i++) {
+				if (!strcmp(index->entries[i].name, entry->name) &&
+				    !memcmp(&index->entries[i].guid, &entry->guid, sizeof(entry->guid)))
+					break;
+			}
+
+			if (i < index->count) {
+				if (hdr.state == VAR_ADDED)
+					index->entries[i] = *entry;
+			}
+			else
+				index->count++;
+		}
+
+		offset = HEADER_ALIGN(offset + store->hdr_size + hdr.name_size + hdr.data_size);
+	}
+
+	if (ret != ENOENT) {
+		free(index);
+		return ret;
+	}
+
+	store->vars_last  = offset;
+	index->vars_last = offset;
+
+	ret = efivar_store_checksum(store, offset, &index->checksum);
+	if (ret) {
+		free(index);
+		return ret;
+	}
+
+	*result = index;
+	return 0;
+}
+
+/*
+ * Get index for the store, rebuild it if the store has been changed
+ * since the index was built (or if rebuild is requested)
+ */
+static int efivar_index_get(efivar_store_t *store, int rebuild, efivar_index_t **result)
+{
+	int ret;
+	unsigned int checksum;
+	baikal_scp_handle_t *handle = store->handle;
+	efivar_index_t *index = handle->efivar_index;
+
+	if (index && ((index->store_offset != store->offset) ||
+	              (index->store_size != store->size))) {
+		free(handle->efivar_index);
+		handle->efivar_index = index = NULL;
+	}
+
+	if (!index && !rebuild)
+		handle->efivar_index = index = efivar_index_load(store->offset, store->size);
+
+	if (index && !rebuild) {
+		if ((index->vars_last >= store->vars_start) &&
+		    (index->vars_last <= store->vars_end)) {
+			ret = efivar_store_checksum(store, index->vars_last, &checksum);
+			if (ret)
+				return ret;
+
+			if (checksum == index->checksum) {
+				store->vars_last = index->vars_last;
+				*result = index;
+				return 0;
+			}
+		}
+	}
+
+	free(handle->efivar_index);
+	handle->efivar_index = NULL;
+
+	ret = efivar_index_build(store, &index);
+	if (ret)
+		return ret;
+
+	efivar_index_save(index);
+
+	handle->efivar_index = index;
+	*result = index;
+	return 0;
+}
+
+static void efivar_entry_to_info(const efivar_store_t *store,
+	const efivar_index_entry_t *entry, baikal_scp_efivar_info_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	memcpy(info->name, entry->name, sizeof(info->name));
+
+	info->guid        = entry->guid;
+	info->attributes  = entry->attributes;
+	info->data_size   = entry->data_size;
+	info->data_offset = store->offset + entry->hdr_offset +
+		store->hdr_size + entry->name_size;
+}
+
+/*
+ * Check that the indexed variable header is still valid
+ * and still describes the indexed variable
+ */
+static int efivar_entry_check(efivar_store_t *store, const efivar_index_entry_t *entry)
+{
+	int ret;
+	unsigned int offset = store->offset + entry->hdr_offset;
+	efi_variable_header_t hdr;
+	char name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+
+	ret = efivar_read_header(store, offset, &hdr);
+	if (ret)
+		return ret;
+
+	if (!efivar_is_valid_state(hdr.state) ||
+	    (hdr.name_size != entry->name_size) ||
+	    (hdr.data_size != entry->data_size) ||
+	    memcmp(&hdr.vendor_guid, &entry->guid, sizeof(entry->guid)))
+		return ESTALE;
+
+	ret = efivar_read_name(store, offset + store->hdr_size, hdr.name_size, name);
+	if (ret)
+		return ret;
+
+	if (strcmp(name, entry->name))
+		return ESTALE;
+
+	return 0;
+}
+
+static const efivar_index_entry_t *efivar_index_find(const efivar_index_t *index,
+	const char *name, const baikal_scp_efi_guid_t *guid)
+{
+	unsigned int i;
+
+	for (i = 0; i < index->count; i++) {
+		if (strcmp(index->entries[i].name, name))
+			continue;
+
+		if (guid && memcmp(&index->entries[i].guid, guid, sizeof(*guid)))
+			continue;
+
+		return &index->entries[i];
+	}
+
+	return NULL;
+}
+
+int baikal_scp_handle_efivar_list(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	baikal_scp_efivar_list_cb_t cb,
+	void *user
+)
+{
+	int ret;
+	unsigned int i;
+	efivar_store_t store;
+	efivar_index_t *index;
+	baikal_scp_efivar_info_t info;
+
+	if (!cb)
+		return EINVAL;
+
+	if (!handle)
+		return EINVAL;
+
+	ret = efivar_store_open(&store, handle, store_offset, store_size);
+	if (ret)
+		return ret;
+
+	ret = efivar_index_get(&store, 0, &index);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < index->count; i++) {
+		efivar_entry_to_info(&store, &index->entries[i], &info);
+
+		ret = cb(&info, user);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Find valid variable using the index. The index is rebuilt once if the
+ * indexed variable header does not match the flash contents anymore.
+ */
+static int efivar_lookup(efivar_store_t *store, const char *name,
+	const baikal_scp_efi_guid_t *guid, efivar_index_t **index,
+	efivar_index_entry_t **entry)
+{
+	int ret;
+	int rebuild;
+	efivar_index_entry_t *found;
+
+	for (rebuild = 0; rebuild < 2; rebuild++) {
+		ret = efivar_index_get(store, rebuild, index);
+		if (ret)
+			return ret;
+
+		found = (efivar_index_entry_t *)efivar_index_find(*index, name, guid);
+		if (!found)
+			return ENOENT;
+
+		ret = efivar_entry_check(store, found);
+		if (!ret) {
+			*entry = found;
+			return 0;
+		}
+
+		if (ret != ESTALE && ret != ENOENT)
+			return ret;
+
+		/* Variable has been deleted or moved since index was built */
+	}
+
+	return ENOENT;
+}
+
+int baikal_scp_handle_efivar_get(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	baikal_scp_efivar_info_t *info,
+	void *data,
+	unsigned int data_size
+)
+{
+	int ret;
+	efivar_store_t store;
+	efivar_index_t *index;
+	efivar_index_entry_t *entry;
+
+	if (!name || !info)
+		return EINVAL;
+
+	if (!handle)
+		return EINVAL;
+
+	ret = efivar_store_open(&store, handle, store_offset, store_size);
+	if (ret)
+		return ret;
+
+	ret = efivar_lookup(&store, name, guid, &index, &entry);
+	if (ret)
+		return ret;
+
+	efivar_entry_to_info(&store, entry, info);
+
+	if (!data)
+		return 0;
+
+	if (data_size < info->data_size)
+		return ENOBUFS;
+
+	return efivar_read(&store, info->data_offset, data, info->data_size);
+}
+
+/*
+ * Convert UTF-8 name to UCS-2 (including terminating zero)
+ */
+static int efivar_name_to_ucs2(const char *name, uint16_t *ucs2, unsigned int *name_size)
+{
+	const unsigned char *p = (const unsigned char *)name;
+	unsigned int n = 0;
+
+	while (*p) {
+		uint16_t c;
+
+		if (n + 1 >= BAIKAL_SCP_EFIVAR_NAME_MAX)
+			return ENAMETOOLONG;
+
+		if (p[0] < 0x80) {
+			c = p[0];
+			p += 1;
+		}
+		else if (((p[0] & 0xe0) == 0xc0) && ((p[1] & 0xc0) == 0x80)) {
+			c = ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+			p += 2;
+		}
+		else if (((p[0] & 0xf0) == 0xe0) && ((p[1] & 0xc0) == 0x80) &&
+		         ((p[2] & 0xc0) == 0x80)) {
+			c = ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+			p += 3;
+		}
+		else
+			return EILSEQ;
+
+		ucs2[n++] = c;
+	}
+
+	ucs2[n++] = 0;
+	*name_size = n * sizeof(ucs2[0]);
+	return 0;
+}
+
+/*
+ * Change state of the variable. State transitions are
+ * designed to only clear bits, so no erase is required.
+ */
+static int efivar_set_state(efivar_store_t *store, unsigned int hdr_offset, uint8_t state)
+{
+	int ret;
+	uint8_t cur;
+	const unsigned int state_offset = hdr_offset + offsetof(efi_variable_header_t, state);
+
+	ret = efivar_read(store, state_offset, &cur, 1);
+	if (ret)
+		return ret;
+
+	state &= cur;
+	if (state == cur)
+		return 0;
+
+	store->block_valid = 0;
+	return _baikal_scp_flash_program(store->handle, state_offset, 1, &state, NULL);
+}
+
+static void efivar_index_invalidate(efivar_store_t *store)
+{
+	char path[PATH_MAX];
+
+	free(store->handle->efivar_index);
+	store->handle->efivar_index = NULL;
+
+	efivar_index_path(path, sizeof(path), store->offset);
+	unlink(path);
+}
+
+static int efivar_index_update(efivar_store_t *store, efivar_index_t *index)
+{
+	int ret;
+
+	ret = efivar_store_checksum(store, index->vars_last, &index->checksum);
+	if (ret) {
+		efivar_index_invalidate(store);
+		return ret;
+	}
+
+	efivar_index_save(index);
+	return 0;
+}
+
+static void efivar_index_remove(efivar_index_t *index, efivar_index_entry_t *entry)
+{
+	unsigned int i = entry - index->entries;
+
+	memmove(entry, entry + 1, (index->count - i - 1) * sizeof(*entry));
+	index->count--;
+}
+
+int baikal_scp_handle_efivar_set(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	unsigned int attributes,
+	const void *data,
+	unsigned int data_size
+)
+{
+	int ret;
+	efivar_store_t store;
+	efivar_index_t *index;
+	efivar_index_entry_t *entry = NULL;
+	uint16_t ucs2[BAIKAL_SCP_EFIVAR_NAME_MAX];
+	unsigned int name_size;
+	unsigned int record_size;
+	unsigned int hdr_offset;
+	unsigned char *record = NULL;
+
+	if (!handle || !name || !guid || (data_size && !data))
+		return EINVAL;
+
+	if (!data_size)
+		return baikal_scp_handle_efivar_delete(handle, store_offset, store_size, name, guid);
+
+	ret = efivar_name_to_ucs2(name, ucs2, &name_size);
+	if (ret)
+		return ret;
+
+	ret = efivar_store_open(&store, handle, store_offset, store_size);
+	if (ret)
+		return ret;
+
+	ret = efivar_lookup(&store, name, guid, &index, &entry);
+	if (ret == ENOENT) {
+		/* Variable does not exist, make sure index is up to date */
+		ret = efivar_index_get(&store, 0, &index);
+		entry = NULL;
+	}
+
+	if (ret)
+		return ret;
+
+	record_size = store.hdr_size + name_size + data_size;
+
+	if ((index->vars_last > store.vars_end) ||
+	    (record_size > store.vars_end - index->vars_last))
+		return ENOSPC;
+
+	record = calloc(1, record_size);
+	if (!record)
+		return ENOMEM;
+
+	if (entry) {
+		/* Keep authentication fields of the existing variable */
+		ret = efivar_read(&store, store.offset + entry->hdr_offset, record, store.hdr_size);
+		if (ret)
+			goto exit;
+
+		/* Nothing to do if the variable is not changed */
+		if ((entry->attributes == attributes) && (entry->data_size == data_size)) {
+			ret = efivar_read(&store, store.offset + entry->hdr_offset +
+				store.hdr_size + entry->name_size, record + store.hdr_size, data_size);
+			if (ret)
+				goto exit;
+
+			if (!memcmp(record + store.hdr_size, data, data_size))
+				goto exit;
+		}
+	}
+
+	if (store.auth) {
+		efi_auth_variable_header_t *hdr = (efi_auth_variable_header_t *)record;
+
+		hdr->start_id    = VARIABLE_DATA;
+		hdr->state       = VAR_HEADER_VALID_ONLY;
+		hdr->reserved    = 0;
+		hdr->attributes  = attributes;
+		hdr->name_size   = name_size;
+		hdr->data_size   = data_size;
+		hdr->vendor_guid = *guid;
+	}
+	else {
+		efi_variable_header_t *hdr = (efi_variable_header_t *)record;
+
+		hdr->start_id    = VARIABLE_DATA;
+		hdr->state       = VAR_HEADER_VALID_ONLY;
+		hdr->reserved    = 0;
+		hdr->attributes  = attributes;
+		hdr->name_size   = name_size;
+		hdr->data_size   = data_size;
+		hdr->vendor_guid = *guid;
+	}
+
+	memcpy(record + store.hdr_size, ucs2, name_size);
+	memcpy(record + store.hdr_size + name_size, data, data_size);
+
+	/*
+	 * Same sequence as used by the UEFI variable driver, so the store
+	 * stays consistent if the update is interrupted at any step:
+	 *   1. mark old variable as "in deleted transition";
+	 *   2. append new variable with "header valid only" state;
+	 *   3. mark new variable as "added";
+	 *   4. mark old variable as "deleted".
+	 */
+	if (entry) {
+		ret = efivar_set_state(&store, store.offset + entry->hdr_offset,
+			VAR_IN_DELETED_TRANSITION);
+		if (ret)
+			goto fail;
+	}
+
+	hdr_offset = index->vars_last;
+
+	store.block_valid = 0;
+	ret = _baikal_scp_flash_program(store.handle, hdr_offset, record_size, record, NULL);
+	if (ret)
+		goto fail;
+
+	ret = efivar_set_state(&store, hdr_offset, VAR_ADDED);
+	if (ret)
+		goto fail;
+
+	if (entry) {
+		ret = efivar_set_state(&store, store.offset + entry->hdr_offset, VAR_DELETED);
+		if (ret)
+			goto fail;
+
+		efivar_index_remove(index, entry);
+	}
+
+	/* Append new variable to the index (there is a room for removed entry) */
+	if (!entry) {
+		efivar_index_t *tmp = realloc(index,
+			sizeof(*index) + (index->count + 1) * sizeof(index->entries[0]));
+		if (!tmp) {
+			efivar_index_invalidate(&store);
+			goto exit;
+		}
+
+		store.handle->efivar_index = index = tmp;
+	}
+
+	entry = &index->entries[index->count++];
+	memset(entry, 0, sizeof(*entry));
+
+	entry->hdr_offset = hdr_offset - store.offset;
+	entry->name_size  = name_size;
+	entry->data_size  = data_size;
+	entry->attributes = attributes;
+	entry->guid       = *guid;
+	strncpy(entry->name, name, sizeof(entry->name) - 1);
+
+	index->vars_last = HEADER_ALIGN(hdr_offset + record_size);
+	store.block_valid = 0;
+
+	ret = efivar_index_update(&store, index);
+	goto exit;
+
+fail:
+	efivar_index_invalidate(&store);
+
+exit:
+	free(record);
+	return ret;
+}
+
+int baikal_scp_handle_efivar_delete(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid
+)
+{
+	int ret;
+	efivar_store_t store;
+	efivar_index_t *index;
+	efivar_index_entry_t *entry;
+
+	if (!name || !guid)
+		return EINVAL;
+
+	if (!handle)
+		return EINVAL;
+
+	ret = efivar_store_open(&store, handle, store_offset, store_size);
+	if (ret)
+		return ret;
+
+	ret = efivar_lookup(&store, name, guid, &index, &entry);
+	if (ret)
+		return ret;
+
+	ret = efivar_set_state(&store, store.offset + entry->hdr_offset, VAR_DELETED);
+	if (ret) {
+		efivar_index_invalidate(&store);
+		return ret;
+	}
+
+	efivar_index_remove(index, entry);
+	return efivar_index_update(&store, index);
+}
+
+int baikal_scp_handle_efivar_reclaim(
+	baikal_scp_handle_t *handle,
+	unsigned int store_offset,
+	unsigned int store_size,
+	unsigned int *sectors_rewritten
+)
+{
+	int ret;
+	efivar_store_t store;
+	efivar_store_t image;
+	efivar_index_t *index = NULL;
+	unsigned char *old = NULL;
+	unsigned char *new = NULL;
+	unsigned int read_offset;
+	unsigned int read_size;
+	unsigned int pos;
+	unsigned int i;
+	const unsigned int unit = BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
+
+	if (sectors_rewritten)
+		*sectors_rewritten = 0;
+
+	if (!handle)
+		return EINVAL;
+
+	ret = efivar_store_open(&store, handle, store_offset, store_size);
+	if (ret)
+		return ret;
+
+	/* Read whole variable area */
+	read_offset = store.vars_start - (store.vars_start % unit);
+	read_size   = store.vars_end - read_offset;
+	read_size   = read_size + ((read_size % unit) ? (unit - read_size % unit) : 0);
+
+	old = malloc(read_size);
+	new = malloc(read_size);
+	if (!old || !new) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	ret = baikal_scp_handle_flash_read(handle, read_offset, read_size, old, NULL, NULL);
+	if (ret)
+		goto exit;
+
+	image = store;
+	image.image = old;
+	image.image_offset = read_offset;
+
+	ret = efivar_index_build(&image, &index);
+	if (ret)
+		goto exit;
+
+	/* Pack valid variables to the beginning of the variable area */
+	memcpy(new, old, read_size);
+	memset(new + (store.vars_start - read_offset), 0xff,
+		store.vars_end - store.vars_start);
+
+	pos = store.vars_start;
+
+	for (i = 0; i < index->count; i++) {
+		const efivar_index_entry_t *entry = &index->entries[i];
+		unsigned int src = store.offset + entry->hdr_offset;
+		unsigned int len = store.hdr_size + entry->name_size + entry->data_size;
+
+		memcpy(new + (pos - read_offset), old + (src - read_offset), len);
+		new[pos - read_offset + offsetof(efi_variable_header_t, state)] = VAR_ADDED;
+
+		pos = HEADER_ALIGN(pos + len);
+	}
+
+	/* Not power loss safe: the store sectors are erased and programmed in place */
+	if (memcmp(old, new, read_size)) {
+		ret = _baikal_scp_flash_program(handle, read_offset, read_size, new, sectors_rewritten);
+		if (ret)
+			goto exit;
+	}
+
+exit:
+	efivar_index_invalidate(&store);
+	free(index);
+	free(new);
+	free(old);
+	return ret;
+}
+
+int baikal_scp_efivar_list(
+	unsigned int store_offset,
+	unsigned int store_size,
+	baikal_scp_efivar_list_cb_t cb,
+	void *user
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_efivar_list(baikal_scp_lib, store_offset, store_size, cb, user);
+}
+
+int baikal_scp_efivar_get(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	baikal_scp_efivar_info_t *info,
+	void *data,
+	unsigned int data_size
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_efivar_get(baikal_scp_lib, store_offset, store_size,
+		name, guid, info, data, data_size);
+}
+
+int baikal_scp_efivar_set(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid,
+	unsigned int attributes,
+	const void *data,
+	unsigned int data_size
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_efivar_set(baikal_scp_lib, store_offset, store_size,
+		name, guid, attributes, data, data_size);
+}
+
+int baikal_scp_efivar_delete(
+	unsigned int store_offset,
+	unsigned int store_size,
+	const char *name,
+	const baikal_scp_efi_guid_t *guid
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_efivar_delete(baikal_scp_lib, store_offset, store_size,
+		name, guid);
+}
+
+int baikal_scp_efivar_reclaim(
+	unsigned int store_offset,
+	unsigned int store_size,
+	unsigned int *sectors_rewritten
+)
+{
+	if (sectors_rewritten)
+		*sectors_rewritten = 0;
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_efivar_reclaim(baikal_scp_lib, store_offset, store_size,
+		sectors_rewritten);
+}
@@ -0,0 +1,799 @@
+/*
+ * Copyright (C) 2021 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "baikal_scp_lib_private.h"
+
+/*
+ * Read-only FAT12/16/32 file system reader.
+ *
+ * Boot sector, FAT and directory sectors are read on demand through
+ * a small LRU block cache, so walking a path costs only a few reads.
+ * File data is read directly from flash by runs of contiguous clusters.
+ */
+
+#ifndef DIV_ROUND_UP
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#endif
+
+#define FAT_CACHE_BLOCK_SIZE 512
+#define FAT_CACHE_BLOCKS     16
+
+#define FAT_DIRENT_SIZE 32
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+#define FAT_ATTR_LFN       0x0f
+
+#define FAT_LFN_LAST       0x40
+#define FAT_LFN_CHARS      13
+
+#define FAT_DIRENT_FREE    0xe5
+#define FAT_DIRENT_END     0x00
+
+/* Directory callback result stopping the iteration (not an errno value) */
+#define FAT_DIR_STOP       (-1)
+
+/* Lower case flags in the reserved (NTRes) field */
+#define FAT_NTRES_LOWER_BASE 0x08
+#define FAT_NTRES_LOWER_EXT  0x10
+
+typedef struct __attribute__((packed)) {
+	uint8_t  jump[3];
+	uint8_t  oem_name[8];
+	uint16_t bytes_per_sector;
+	uint8_t  sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint8_t  num_fats;
+	uint16_t root_entries;
+	uint16_t total_sectors_16;
+	uint8_t  media;
+	uint16_t fat_size_16;
+	uint16_t sectors_per_track;
+	uint16_t num_heads;
+	uint32_t hidden_sectors;
+	uint32_t total_sectors_32;
+	/* FAT32 only */
+	uint32_t fat_size_32;
+	uint16_t ext_flags;
+	uint16_t fs_version;
+	uint32_t root_cluster;
+} fat_boot_sector_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t  name[11];
+	uint8_t  attr;
+	uint8_t  ntres;
+	uint8_t  create_time_tenth;
+	uint16_t create_time;
+	uint16_t create_date;
+	uint16_t access_date;
+	uint16_t cluster_hi;
+	uint16_t write_time;
+	uint16_t write_date;
+	uint16_t cluster_lo;
+	uint32_t size;
+} fat_dirent_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t  order;
+	uint16_t name1[5];
+	uint8_t  attr;
+	uint8_t  type;
+	uint8_t  checksum;
+	uint16_t name2[6];
+	uint16_t cluster_lo;
+	uint16_t name3[2];
+} fat_lfn_dirent_t;
+
+typedef struct fat_cache_block {
+	unsigned int  offset; /* Offset relative to the volume start */
+	unsigned int  lru;
+	int           valid;
+	unsigned char data[FAT_CACHE_BLOCK_SIZE];
+} fat_cache_block_t;
+
+typedef struct fat_volume {
+	baikal_scp_handle_t *handle; /* Library handle used for flash access */
+
+	unsigned int offset; /* Flash offset of the volume */
+	unsigned int size;   /* Size of the flash area */
+
+	unsigned int type;   /* 12, 16 or 32 */
+	unsigned int cluster_size;
+	unsigned int clusters;
+	unsigned int fat_offset;
+	unsigned int root_offset;  /* FAT12/16 fixed root directory */
+	unsigned int root_size;
+	unsigned int root_cluster; /* FAT32 root directory */
+	unsigned int data_offset;
+
+	unsigned int      lru;
+	fat_cache_block_t cache[FAT_CACHE_BLOCKS];
+} fat_volume_t;
+
+/* Directory iteration callback */
+typedef int (*fat_dir_cb_t)(fat_volume_t *vol,
+	const baikal_scp_fat_entry_info_t *info, void *user);
+
+static int fat_read(fat_volume_t *vol, unsigned int offset, void *dst, unsigned int size)
+{
+	int ret;
+	unsigned char *ptr = dst;
+
+	if ((offset > vol->size) || (size > vol->size - offset))
+		return EIO;
+
+	while (size) {
+		unsigned int block_offset = offset - (offset % FAT_CACHE_BLOCK_SIZE);
+		unsigned int part = block_offset + FAT_CACHE_BLOCK_SIZE - offset;
+		fat_cache_block_t *block = NULL;
+		int i;
+
+		if (part > size)
+			part = size;
+
+		for (i = 0; i < FAT_CACHE_BLOCKS; i++) {
+			if (vol->cache[i].valid && (vol->cache[i].offset == block_offset)) {
+				block = &vol->cache[i];
+				break;
+			}
+		}
+
+		if (!block) {
+			/* Replace the least recently used block */
+			block = &vol->cache[0];
+			for (i = 1; i < FAT_CACHE_BLOCKS; i++) {
+				if (!vol->cache[i].valid ||
+				    (block->valid && (vol->cache[i].lru < block->lru)))
+					block = &vol->cache[i];
+			}
+
+			ret = baikal_scp_handle_flash_read(vol->handle, vol->offset + block_offset,
+				FAT_CACHE_BLOCK_SIZE, block->data, NULL, NULL);
+			if (ret) {
+				block->valid = 0;
+				return ret;
+			}
+
+			block->offset = block_offset;
+			block->valid = 1;
+		}
+
+		block->lru = ++vol->lru;
+
+		memcpy(ptr, &block->data[offset - block_offset], part);
+
+		ptr    += part;
+		offset += part;
+		size   -= part;
+	}
+
+	return 0;
+}
+
+static int fat_mount(fat_volume_t *vol, baikal_scp_handle_t *handle,
+	unsigned int offset, unsigned int size)
+{
+	int ret;
+	fat_boot_sector_t bs;
+	unsigned int total_sectors;
+	unsigned int fat_size;
+	unsigned int root_sectors;
+	unsigned int data_sectors;
+
+	memset(vol, 0, sizeof(*vol));
+	vol->handle = handle;
+	vol->offset = offset;
+	vol->size   = size;
+
+	ret = fat_read(vol, 0, &bs, sizeof(bs));
+	if (ret)
+		return ret;
+
+	if ((bs.bytes_per_sector < 512) || (bs.bytes_per_sector > 4096) ||
+	    (bs.bytes_per_sector & (bs.bytes_per_sector - 1)) ||
+	    !bs.sectors_per_cluster ||
+	    (bs.sectors_per_cluster & (bs.sectors_per_cluster - 1)) ||
+	    !bs.reserved_sectors || !bs.num_fats)
+		return EINVAL;
+
+	total_sectors = bs.total_sectors_16 ? bs.total_sectors_16 : bs.total_sectors_32;
+	fat_size = bs.fat_size_16 ? bs.fat_size_16 : bs.fat_size_32;
+	root_sectors = DIV_ROUND_UP(bs.root_entries * FAT_DIRENT_SIZE, bs.bytes_per_sector);
+
+	if (!fat_size || (total_sectors <= bs.reserved_sectors +
+	    bs.num_fats * fat_size + root_sectors))
+		return EINVAL;
+
+	/* The volume must not extend beyond the flash area */
+	if ((uint64_t)total_sectors * bs.bytes_per_sector > size)
+		return EINVAL;
+
+	data_sectors = total_sectors - bs.reserved_sectors -
+		bs.num_fats * fat_size - root_sectors;
+
+	vol->cluster_size = bs.bytes_per_sector * bs.sectors_per_cluster;
+	vol->clusters     = data_sectors / bs.sectors_per_cluster;
+	vol->fat_offset   = bs.reserved_sectors * bs.bytes_per_sector;
+	vol->root_offset  = vol->fat_offset + bs.num_fats * fat_size * bs.bytes_per_sector;
+	vol->root_size    = root_sectors * bs.bytes_per_sector;
+	vol->data_offset  = vol->root_offset + vol->root_size;
+
+	/*
+	 * Small FAT32 volumes (like the 8 MiB rescue area) have less clusters
+	 * than required by the specification, so FAT32 is detected by the BPB
+	 * layout as Linux does, FAT12 and FAT16 are told apart by the count
+	 * of clusters
+	 */
+	if (!bs.fat_size_16) {
+		vol->type = 32;
+		vol->root_cluster = bs.root_cluster;
+	}
+	else if (vol->clusters < 4085)
+		vol->type = 12;
+	else
+		vol->type = 16;
+
+	return 0;
+}
+
+static int fat_next_cluster(fat_volume_t *vol, unsigned int cluster, unsigned int *next)
+{
+	int ret;
+	unsigned int value;
+	unsigned int eoc;
+	unsigned char buf[4] = { 0 };
+
+	if ((cluster < 2) || (cluster >= vol->clusters + 2))
+		return EIO;
+
+	if (vol->type == 12) {
+		ret = fat_read(vol, vol->fat_offset + cluster + cluster / 2, buf, 2);
+		value = buf[0] | (buf[1] << 8);
+		value = (cluster & 1) ? (value >> 4) : (value & 0xfff);
+		eoc = 0xff8;
+	}
+	else if (vol->type == 16) {
+		ret = fat_read(vol, vol->fat_offset + cluster * 2, buf, 2);
+		value = buf[0] | (buf[1] << 8);
+		eoc = 0xfff8;
+	}
+	else {
+		ret = fat_read(vol, vol->fat_offset + cluster * 4, buf, 4);
+		value = (buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+			((unsigned int)buf[3] << 24)) & 0x0fffffff;
+		eoc = 0x0ffffff8;
+	}
+
+	if (ret)
+		return ret;
+
+	if (value >= eoc) {
+		*next = 0;
+		return 0;
+	}
+
+	if ((value < 2) || (value >= vol->clusters + 2))
+		return EIO;
+
+	*next = value;
+	return 0;
+}
+
+static unsigned int fat_cluster_offset(const fat_volume_t *vol, unsigned int cluster)
+{
+	return vol->data_offset + (cluster - 2) * vol->cluster_size;
+}
+
+static unsigned char fat_lfn_checksum(const uint8_t *name)
+{
+	unsigned char sum = 0;
+	int i;
+
+	for (i = 0; i < 11; i++)
+		sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+
+	return sum;
+}
+
+static void fat_short_name(const fat_dirent_t *de, char *name)
+{
+	int i;
+	int n = 0;
+	int len;
+
+	for (len = 8; (len > 0) && (de->name[len - 1] == ' '); len--);
+
+	for (i = 0; i < len; i++) {
+		char c = (char)((!i && (de->name[0] == 0x05)) ? 0xe5 : de->name[i]);
+
+		if (de->ntres & FAT_NTRES_LOWER_BASE)
+			c = (char)tolower((unsigned char)c);
+
+		name[n++] = c;
+	}
+
+	for (len = 3; (len > 0) && (de->name[8 + len - 1] == ' '); len--);
+
+	if (len) {
+		name[n++] = '.';
+
+		for (i = 0; i < len; i++) {
+			char c = (char)de->name[8 + i];
+
+			if (de->ntres & FAT_NTRES_LOWER_EXT)
+				c = (char)tolower((unsigned char)c);
+
+			name[n++] = c;
+		}
+	}
+
+	name[n] = '\0';
+}
+
+/*
+ * Convert UCS-2 long file name to UTF-8
+ */
+static int fat_lfn_to_utf8(const uint16_t *lfn, unsigned int count, char *name)
+{
+	unsigned int i;
+	unsigned int n = 0;
+
+	for (i = 0; (i < count) && lfn[i] && (lfn[i] != 0xffff); i++) {
+		uint16_t c = lfn[i];
+
+		if (c < 0x80) {
+			if (n + 1 >= BAIKAL_SCP_FAT_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)c;
+		}
+		else if (c < 0x800) {
+			if (n + 2 >= BAIKAL_SCP_FAT_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)(0xc0 | (c >> 6));
+			name[n++] = (char)(0x80 | (c & 0x3f));
+		}
+		else {
+			if (n + 3 >= BAIKAL_SCP_FAT_NAME_MAX)
+				return ENAMETOOLONG;
+
+			name[n++] = (char)(0xe0 | (c >> 12));
+			name[n++] = (char)(0x80 | ((c >> 6) & 0x3f));
+			name[n++] = (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	name[n] = '\0';
+	return 0;
+}
+
+/*
+ * Iterate over directory entries. Directory with cluster 0 is the root
+ * directory. Callback returns non-zero value (errno-style error code or
+ * FAT_DIR_STOP) to stop iteration. A cluster chain longer than the count
+ * of clusters on the volume has a loop, EIO is returned for it.
+ */
+static int fat_dir_iterate(fat_volume_t *vol, unsigned int cluster,
+	fat_dir_cb_t cb, void *user)
+{
+	int ret;
+	unsigned int pos = 0;
+	unsigned int end;
+	unsigned int chain = 1;
+	unsigned int lfn_order = 0;
+	unsigned char lfn_checksum = 0;
+	uint16_t lfn[20 * FAT_LFN_CHARS];
+	baikal_scp_fat_entry_info_t info;
+
+	if (!cluster && (vol->type == 32))
+		cluster = vol->root_cluster;
+
+	if (cluster) {
+		pos = fat_cluster_offset(vol, cluster);
+		end = pos + vol->cluster_size;
+	}
+	else {
+		pos = vol->root_offset;
+		end = pos + vol->root_size;
+	}
+
+	for (;;) {
+		fat_dirent_t de;
+
+		if (pos >= end) {
+			if (!cluster)
+				return 0;
+
+			ret = fat_next_cluster(vol, cluster, &cluster);
+			if (ret)
+				return ret;
+
+			if (!cluster)
+				return 0;
+
+			if (++chain > vol->clusters)
+				return EIO;
+
+			pos = fat_cluster_offset(vol, cluster);
+			end = pos + vol->cluster_size;
+		}
+
+		ret = fat_read(vol, pos, &de, sizeof(de));
+		if (ret)
+			return ret;
+
+		pos += sizeof(de);
+
+		if (de.name[0] == FAT_DIRENT_END)
+			return 0;
+
+		if (de.name[0] == FAT_DIRENT_FREE) {
+			lfn_order = 0;
+			continue;
+		}
+
+		if ((de.attr & 0x3f) == FAT_ATTR_LFN) {
+			const fat_lfn_dirent_t *lde = (const fat_lfn_dirent_t *)&de;
+			unsigned int order = lde->order & 0x1f;
+			uint16_t *chars;
+
+			if (!order || (order > 20)) {
+				lfn_order = 0;
+				continue;
+			}
+
+			if (lde->order & FAT_LFN_LAST) {
+				memset(lfn, 0, sizeof(lfn));
+				lfn_checksum = lde->checksum;
+			}
+			else if ((order != lfn_order - 1) || (lde->checksum != lfn_checksum)) {
+				lfn_order = 0;
+				continue;
+			}
+
+			lfn_order = order;
+
+			chars = &lfn[(order - 1) * FAT_LFN_CHARS];
+			memcpy(&chars[0], lde->name1, sizeof(lde->name1));
+			memcpy(&chars[5], lde->name2, sizeof(lde->name2));
+			memcpy(&chars[11], lde->name3, sizeof(lde->name3));
+			continue;
+		}
+
+		if (de.attr & FAT_ATTR_VOLUME_ID) {
+			lfn_order = 0;
+			continue;
+		}
+
+		memset(&info, 0, sizeof(info));
+
+		if ((lfn_order != 1) || (fat_lfn_checksum(de.name) != lfn_checksum) ||
+		    fat_lfn_to_utf8(lfn, sizeof(lfn) / sizeof(lfn[0]), info.name))
+			fat_short_name(&de, info.name);
+
+		fat_short_name(&de, info.short_name);
+		lfn_order = 0;
+
+		if (!strcmp(info.short_name, ".") || !strcmp(info.short_name, ".."))
+			continue;
+
+		info.attributes = de.attr;
+		info.size       = de.size;
+		info.cluster    = de.cluster_lo;
+		info.is_dir     = !!(de.attr & FAT_ATTR_DIRECTORY);
+
+		if (vol->type == 32)
+			info.cluster |= (unsigned int)de.cluster_hi << 16;
+
+		ret = cb(vol, &info, user);
+		if (ret)
+			return ret;
+	}
+}
+
+typedef struct fat_find_ctx {
+	const char                  *name;
+	unsigned int                 name_len;
+	baikal_scp_fat_entry_info_t *info;
+	int                          found;
+} fat_find_ctx_t;
+
+static int fat_find_cb(fat_volume_t *vol,
+	const baikal_scp_fat_entry_info_t *info, void *user)
+{
+	fat_find_ctx_t *ctx = user;
+
+	if ((strlen(info->name) == ctx->name_len &&
+	     !strncasecmp(info->name, ctx->name, ctx->name_len)) ||
+	    (strlen(info->short_name) == ctx->name_len &&
+	     !strncasecmp(info->short_name, ctx->name, ctx->name_len))) {
+		*ctx->info = *info;
+		ctx->found = 1;
+		return FAT_DIR_STOP;
+	}
+
+	return 0;
+}
+
+/*
+ * Find directory entry by path (components are separated by '/').
+ * Empty path or "/" is the root directory.
+ */
+static int fat_lookup(fat_volume_t *vol, const char *path,
+	baikal_scp_fat_entry_info_t *info)
+{
+	int ret;
+	const char *p = path;
+
+	memset(info, 0, sizeof(*info));
+	info->is_dir = 1;
+	info->attributes = FAT_ATTR_DIRECTORY;
+
+	for (;;) {
+		fat_find_ctx_t ctx;
+		const char *sep;
+
+		while (*p == '/')
+			p++;
+
+		if (!*p)
+			return 0;
+
+		if (!info->is_dir)
+			return ENOTDIR;
+
+		sep = strchr(p, '/');
+
+		ctx.name     = p;
+		ctx.name_len = sep ? (unsigned int)(sep - p) : strlen(p);
+		ctx.info     = info;
+		ctx.found    = 0;
+
+		ret = fat_dir_iterate(vol, info->cluster, fat_find_cb, &ctx);
+		if (ret && (ret != FAT_DIR_STOP))
+			return ret;
+
+		if (!ctx.found)
+			return ENOENT;
+
+		p += ctx.name_len;
+	}
+}
+
+typedef struct fat_list_ctx {
+	baikal_scp_fat_list_cb_t cb;
+	void                    *user;
+	int                      ret;
+} fat_list_ctx_t;
+
+static int fat_list_cb(fat_volume_t *vol,
+	const baikal_scp_fat_entry_info_t *info, void *user)
+{
+	fat_list_ctx_t *ctx = user;
+
+	ctx->ret = ctx->cb(info, ctx->user);
+	return ctx->ret ? FAT_DIR_STOP : 0;
+}
+
+int baikal_scp_handle_fat_list(
+	baikal_scp_handle_t *handle,
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_list_cb_t cb,
+	void *user)
+{
+	int ret;
+	fat_volume_t *vol;
+	baikal_scp_fat_entry_info_t dir;
+	fat_list_ctx_t ctx = { .cb = cb, .user = user, .ret = 0 };
+
+	if (!handle || !cb)
+		return EINVAL;
+
+	vol = malloc(sizeof(*vol));
+	if (!vol)
+		return ENOMEM;
+
+	ret = fat_mount(vol, handle, area_offset, area_size);
+	if (ret)
+		goto exit;
+
+	ret = fat_lookup(vol, path ? path : "", &dir);
+	if (ret)
+		goto exit;
+
+	if (!dir.is_dir) {
+		/* List single file */
+		ret = cb(&dir, user);
+		goto exit;
+	}
+
+	ret = fat_dir_iterate(vol, dir.cluster, fat_list_cb, &ctx);
+	if (ret == FAT_DIR_STOP)
+		ret = ctx.ret;
+
+exit:
+	free(vol);
+	return ret;
+}
+
+/*
+ * Read cluster run directly from flash bypassing the cache
+ */
+static int fat_read_direct(fat_volume_t *vol, unsigned int offset,
+	unsigned char *dst, unsigned int size)
+{
+	int ret;
+	unsigned int alignment = baikal_scp_flash_alignment();
+	unsigned int head = size & ~(alignment - 1);
+
+	if ((offset > vol->size) || (size > vol->size - offset))
+		return EIO;
+
+	if (head) {
+		ret = baikal_scp_handle_flash_read(vol->handle, vol->offset + offset, head, dst, NULL, NULL);
+		if (ret)
+			return ret;
+	}
+
+	if (size > head) {
+		unsigned char tail[FAT_CACHE_BLOCK_SIZE];
+
+		if (alignment > sizeof(tail))
+			return EINVAL;
+
+		ret = baikal_scp_handle_flash_read(vol->handle, vol->offset + offset + head,
+			alignment, tail, NULL, NULL);
+		if (ret)
+			return ret;
+
+		memcpy(dst + head, tail, size - head);
+	}
+
+	return 0;
+}
+
+int baikal_scp_handle_fat_read(
+	baikal_scp_handle_t *handle,
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_entry_info_t *info,
+	void *data,
+	unsigned int data_size)
+{
+	int ret;
+	fat_volume_t *vol;
+	unsigned int cluster;
+	unsigned int chain = 1;
+	unsigned int remain;
+	unsigned char *ptr = data;
+
+	if (!handle || !path || !info)
+		return EINVAL;
+
+	vol = malloc(sizeof(*vol));
+	if (!vol)
+		return ENOMEM;
+
+	ret = fat_mount(vol, handle, area_offset, area_size);
+	if (ret)
+		goto exit;
+
+	ret = fat_lookup(vol, path, info);
+	if (ret)
+		goto exit;
+
+	if (info->is_dir) {
+		ret = EISDIR;
+		goto exit;
+	}
+
+	if (!data)
+		goto exit;
+
+	if (data_size < info->size) {
+		ret = ENOBUFS;
+		goto exit;
+	}
+
+	cluster = info->cluster;
+	remain  = info->size;
+
+	while (remain) {
+		unsigned int start = cluster;
+		unsigned int count = 1;
+		unsigned int part;
+
+		if (!cluster) {
+			ret = EIO;
+			goto exit;
+		}
+
+		/* Collect run of contiguous clusters */
+		for (;;) {
+			unsigned int next;
+
+			if (count * vol->cluster_size >= remain)
+				break;
+
+			ret = fat_next_cluster(vol, cluster, &next);
+			if (ret)
+				goto exit;
+
+			/* A chain longer than the count of clusters has a loop */
+			if (next && (++chain > vol->clusters)) {
+				ret = EIO;
+				goto exit;
+			}
+
+			cluster = next;
+
+			if (cluster != start + count)
+				break;
+
+			count++;
+		}
+
+		part = count * vol->cluster_size;
+		if (part > remain)
+			part = remain;
+
+		ret = fat_read_direct(vol, fat_cluster_offset(vol, start), ptr, part);
+		if (ret)
+			goto exit;
+
+		ptr    += part;
+		remain -= part;
+	}
+
+exit:
+	free(vol);
+	return ret;
+}
+
+int baikal_scp_fat_list(
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_list_cb_t cb,
+	void *user)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_fat_list(baikal_scp_lib, area_offset, area_size, path, cb, user);
+}
+
+int baikal_scp_fat_read(
+	unsigned int area_offset,
+	unsigned int area_size,
+	const char *path,
+	baikal_scp_fat_entry_info_t *info,
+	void *data,
+	unsigned int data_size)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_fat_read(baikal_scp_lib, area_offset, area_size, path,
+		info, data, data_size);
+}
@@ -6,28 +6,201 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
+#include <time.h>
+
 #include "baikal_scp_lib_private.h"
+#include "baikal_scp_lib_daemon.h"
 
-#define FLASH_PART_SIZE 1024
+/*
+ * Request size for the flash ioctls. The driver streams it through the SMC
+ * buffer itself and reports the completed part on a failure, so only the
+ * failed remainder of a request is repeated.
+ */
+#define FLASH_PART_SIZE (64 * 1024)
 
-int baikal_scp_flash_info(baikal_scp_flash_info_t *info)
+/*
+ * Request size for pread()/pwrite() on the device file. The driver streams
+ * it through the SMC buffer itself, the size only limits the progress
+ * callback granularity.
+ */
+#define FLASH_FILE_PART_SIZE (1024 * 1024)
+
+/*
+ * Request size for the flash service daemon. Large operations are split,
+ * so the daemon can serve requests of other clients in between.
+ */
+#define FLASH_CLIENT_PART_SIZE (64 * 1024)
+
+/* Maximum request size set by baikal_scp_flash_set_part_size() */
+#define FLASH_PART_MAX_SIZE (1024 * 1024)
+
+/* How many times a partially completed request is resumed before giving up */
+#define FLASH_PART_RETRIES 3
+
+static unsigned long long flash_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Account a single request started at the specified time. Bytes are
+ * accounted by the caller, as a failed request may still be resumed.
+ */
+static baikal_scp_stats_entry_t *flash_stats_request(
+	baikal_scp_handle_t *handle,
+	baikal_scp_stats_op_t op,
+	unsigned long long start,
+	int ret
+)
+{
+	baikal_scp_stats_entry_t *entry = &handle->counters.op[op];
+	unsigned long long ns = flash_stats_now() - start;
+	unsigned long long limit = 10000;
+	unsigned int bucket = 0;
+
+	while ((bucket < BAIKAL_SCP_STATS_HIST_BUCKETS - 1) && (ns >= limit)) {
+		limit *= 10;
+		bucket++;
+	}
+
+	entry->requests++;
+	entry->total_ns += ns;
+	entry->hist[bucket]++;
+
+	if (ns > entry->max_ns)
+		entry->max_ns = ns;
+
+	if (ret)
+		entry->errors++;
+
+	return entry;
+}
+
+int baikal_scp_handle_flash_info(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_info_t *info
+)
 {
 	int ret;
 	struct baikal_scp_ioctl_flash_info ioctl_info;
 
-	if (!info)
+	if (!handle || !info)
 		return EINVAL;
 
-	if (!baikal_scp_lib)
-		return ECANCELED;
+	if (!handle->has_flash_info && handle->is_client) {
+		baikal_scpd_flash_info_t daemon_info;
 
-	ret = ioctl(baikal_scp_lib->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_INFO, &ioctl_info);
-	if (ret)
-		return ret;
+		ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_INFO,
+			0, 0, NULL, 0, &daemon_info, sizeof(daemon_info));
+		if (ret)
+			return ret;
+
+		handle->flash_info.sector_count = daemon_info.sector_count;
+		handle->flash_info.sector_size = daemon_info.sector_size;
+		handle->flash_info.total_size = daemon_info.total_size;
+		handle->has_flash_info = 1;
+	}
+
+	if (!handle->has_flash_info) {
+		ret = ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_INFO, &ioctl_info);
+		if (ret)
+			return ret;
+
+		handle->flash_info.sector_count = ioctl_info.sector_count;
+		handle->flash_info.sector_size = ioctl_info.sector_size;
+		handle->flash_info.total_size = ioctl_info.total_size;
+		handle->has_flash_info = 1;
+	}
+
+	*info = handle->flash_info;
+	return 0;
+}
+
+int baikal_scp_handle_flash_counters(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_counters_t *counters
+)
+{
+	const baikal_scp_stats_entry_t *op;
+	unsigned int i;
+
+	if (!handle || !counters)
+		return EINVAL;
+
+	*counters = handle->counters;
+	op = counters->op;
+
+	/* Copy and fill requests both erase and write the sector */
+	counters->ioctls = 0;
+	counters->retries = 0;
+	counters->bytes_read = op[BAIKAL_SCP_STATS_READ].bytes;
+	counters->bytes_written = op[BAIKAL_SCP_STATS_WRITE].bytes +
+		op[BAIKAL_SCP_STATS_COPY].bytes + op[BAIKAL_SCP_STATS_FILL].bytes;
+	counters->bytes_erased = op[BAIKAL_SCP_STATS_ERASE].bytes +
+		op[BAIKAL_SCP_STATS_COPY].bytes + op[BAIKAL_SCP_STATS_FILL].bytes;
+
+	for (i = 0; i < BAIKAL_SCP_STATS_OPS; i++) {
+		counters->ioctls += op[i].requests;
+		counters->retries += op[i].retries;
+	}
+
+	return 0;
+}
+
+int baikal_scp_handle_flash_smc_calls(
+	baikal_scp_handle_t *handle,
+	unsigned long long *calls
+)
+{
+	int ret;
+	struct baikal_scp_ioctl_flash_stats ioctl_stats;
+
+	if (!handle || !calls)
+		return EINVAL;
+
+	if (handle->is_client) {
+		baikal_scpd_flash_stats_t stats;
+
+		ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_STATS,
+			0, 0, NULL, 0, &stats, sizeof(stats));
+		if (ret)
+			return ret;
+
+		*calls = stats.smc_calls;
+		return 0;
+	}
+
+	/* Older drivers do not implement the request */
+	if (ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_STATS, &ioctl_stats))
+		return EOPNOTSUPP;
+
+	*calls = ioctl_stats.smc_calls;
+	return 0;
+}
 
-	info->sector_count = ioctl_info.sector_count;
-	info->sector_size = ioctl_info.sector_size;
-	info->total_size = ioctl_info.total_size;
+int baikal_scp_handle_flash_set_interactive(
+	baikal_scp_handle_t *handle,
+	int interactive
+)
+{
+	struct baikal_scp_ioctl_flash_priority ioctl_priority;
+
+	if (!handle)
+		return EINVAL;
+
+	/* The daemon device file is shared by all clients */
+	if (handle->is_client)
+		return EOPNOTSUPP;
+
+	ioctl_priority.interactive = !!interactive;
+
+	/* Older drivers do not implement the request */
+	if (ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_PRIORITY, &ioctl_priority))
+		return EOPNOTSUPP;
 
 	return 0;
 }
@@ -37,12 +210,48 @@ static int is_flash_alignment_valid(unsigned int value)
 	return (value % BAIKAL_SCP_FLASH_SIZE_ALIGNMENT) == 0;
 }
 
+/*
+ * Read or write a part with pread()/pwrite() on the device file. Returns
+ * the same as the flash ioctls: 0 or -1 with errno set, and the number
+ * of transferred bytes in *done.
+ */
+static int flash_file_op(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int offset,
+	unsigned int size,
+	void *data,
+	unsigned int *done
+)
+{
+	ssize_t n;
+
+	if (op == BAIKAL_SCP_FLASH_READ)
+		n = pread(handle->fhnd_scp, data, size, offset);
+	else
+		n = pwrite(handle->fhnd_scp, data, size, offset);
+
+	*done = (n > 0) ? n : 0;
+
+	if (n < 0)
+		return -1;
+
+	if (n < size) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
 static int _baikal_scp_flash_op(
+	baikal_scp_handle_t *handle,
 	baikal_scp_flash_operation_t op,
 	unsigned int offset,
 	unsigned int size,
 	void *data,
-	baikal_scp_flash_progress_cb_t cb
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
 )
 {
 	int ret;
@@ -63,11 +272,13 @@ static int _baikal_scp_flash_op(
 	unsigned int op_offset = offset;
 	void        *op_ptr = data;
 	unsigned int op_part;
+	unsigned int op_done;
+	unsigned int op_retries = 0;
+	unsigned int part_size = FLASH_PART_SIZE;
+	unsigned long long op_start;
+	baikal_scp_stats_entry_t *stats;
 
-	if (!baikal_scp_lib)
-		return ECANCELED;
-
-	if (!size)
+	if (!handle || !size)
 		return EINVAL;
 
 	if (!is_flash_alignment_valid(offset))
@@ -76,47 +287,98 @@ static int _baikal_scp_flash_op(
 	if (!is_flash_alignment_valid(size))
 		return EINVAL;
 
+	if (handle->is_client)
+		part_size = FLASH_CLIENT_PART_SIZE;
+	else if (handle->part_size[op])
+		part_size = handle->part_size[op];
+	else if (handle->has_file_rw && (op != BAIKAL_SCP_FLASH_ERASE))
+		part_size = FLASH_FILE_PART_SIZE;
+
 	if (cb)
-		cb(&progress);
+		cb(&progress, user);
 
 	while (op_size) {
-		op_part = (op_size < FLASH_PART_SIZE)
-			? op_size : FLASH_PART_SIZE;
+		op_part = (op_size < part_size)
+			? op_size : part_size;
+
+		op_start = flash_stats_now();
 
-		switch(op) {
+		if (handle->is_client)
+			ret = _baikal_scp_client_op(handle, op, op_offset, op_part, op_ptr, &op_done);
+		else switch(op) {
 			case BAIKAL_SCP_FLASH_READ:
+				if (handle->has_file_rw) {
+					ret = flash_file_op(handle, op, op_offset, op_part, op_ptr, &op_done);
+					break;
+				}
+
 				ioctl_data.read.size   = op_part;
 				ioctl_data.read.offset = op_offset;
 				ioctl_data.read.data   = op_ptr;
+				ioctl_data.read.done   = 0;
 
-				ret = ioctl(baikal_scp_lib->fhnd_scp,
-					BAIKAL_SCP_IOCTL_CMD_FLASH_READ, &ioctl_data);
+				ret = ioctl(handle->fhnd_scp, handle->has_flash_done
+					? BAIKAL_SCP_IOCTL_CMD_FLASH_READ2
+					: BAIKAL_SCP_IOCTL_CMD_FLASH_READ, &ioctl_data);
+				op_done = ioctl_data.read.done;
 				break;
 
 			case BAIKAL_SCP_FLASH_WRITE:
+				if (handle->has_file_rw) {
+					ret = flash_file_op(handle, op, op_offset, op_part, op_ptr, &op_done);
+					break;
+				}
+
 				ioctl_data.write.size   = op_part;
 				ioctl_data.write.offset = op_offset;
 				ioctl_data.write.data   = op_ptr;
+				ioctl_data.write.done   = 0;
 
-				ret = ioctl(baikal_scp_lib->fhnd_scp,
-					BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE, &ioctl_data);
+				ret = ioctl(handle->fhnd_scp, handle->has_flash_done
+					? BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE2
+					: BAIKAL_SCP_IOCTL_CMD_FLASH_WRITE, &ioctl_data);
+				op_done = ioctl_data.write.done;
 				break;
 
 			case BAIKAL_SCP_FLASH_ERASE:
 				ioctl_data.erase.size   = op_part;
 				ioctl_data.erase.offset = op_offset;
+				ioctl_data.erase.done   = 0;
 
-				ret = ioctl(baikal_scp_lib->fhnd_scp,
-					BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE, &ioctl_data);
+				ret = ioctl(handle->fhnd_scp, handle->has_flash_done
+					? BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE2
+					: BAIKAL_SCP_IOCTL_CMD_FLASH_ERASE, &ioctl_data);
+				op_done = ioctl_data.erase.done;
 				break;
 
 			default:
 				ret = EINVAL;
+				op_done = 0;
 				break;
 		}
 
-		if (ret)
-			return ret;
+		stats = flash_stats_request(handle,
+			(op == BAIKAL_SCP_FLASH_READ)  ? BAIKAL_SCP_STATS_READ :
+			(op == BAIKAL_SCP_FLASH_WRITE) ? BAIKAL_SCP_STATS_WRITE :
+			BAIKAL_SCP_STATS_ERASE, op_start, ret);
+
+		if (ret) {
+			/*
+			 * The driver reports how many bytes were completed before
+			 * the failure, so continue right from that point instead
+			 * of repeating (or losing) the whole request.
+			 */
+			if ((errno == EINTR) || !op_done || (op_done >= op_part) ||
+			    (++op_retries > FLASH_PART_RETRIES))
+				return ret;
+
+			op_part = op_done;
+			stats->retries++;
+		}
+		else
+			op_retries = 0;
+
+		stats->bytes += op_part;
 
 		op_offset += op_part;
 		op_size   -= op_part;
@@ -127,39 +389,591 @@ static int _baikal_scp_flash_op(
 		if (cb) {
 			progress.bytes += op_part;
 			progress.percent = (progress.bytes * 100) / size;
-			cb(&progress);
+			cb(&progress, user);
 		}
 	}
 
 	return 0;
 }
 
-int baikal_scp_flash_read(
+/*
+ * Unaligned requests
+ *
+ * Request [offset, offset + size) is split into the partial units at
+ * the edges (head and tail) and the aligned body in between. The body is
+ * transferred directly, the edges go through a single unit buffer:
+ * - read:  the whole unit is read and the requested bytes are copied;
+ * - write: the unit is padded with 0xff, which leaves the flash contents
+ *          of the neighbouring bytes unchanged (programming only clears bits);
+ * - erase: the neighbouring bytes are preserved, so the edge is
+ *          reprogrammed with 0xff (the sector is rewritten only if needed).
+ */
+
+typedef struct {
+	baikal_scp_flash_progress_ex_cb_t cb;
+	void        *user;
+	unsigned int offset;
+	unsigned int size;
+	unsigned int bytes;  /* Bytes of the edges transferred before the body */
+} unaligned_progress_t;
+
+static void unaligned_progress_cb(const baikal_scp_flash_progress_info_t *progress_info, void *user)
+{
+	unaligned_progress_t *up = user;
+	baikal_scp_flash_progress_info_t progress = *progress_info;
+
+	progress.offset  = up->offset;
+	progress.size    = up->size;
+	progress.bytes   = up->bytes + progress_info->bytes;
+	progress.percent = (progress.bytes * 100) / up->size;
+
+	up->cb(&progress, up->user);
+}
+
+static void unaligned_progress(unaligned_progress_t *up, baikal_scp_flash_operation_t op)
+{
+	baikal_scp_flash_progress_info_t progress = {
+		.operation = op,
+		.size      = up->size,
+		.offset    = up->offset,
+		.bytes     = up->bytes,
+		.percent   = (up->bytes * 100) / up->size
+	};
+
+	if (up->cb)
+		up->cb(&progress, up->user);
+}
+
+/*
+ * Transfer edge [offset, offset + size) lying within a single unit
+ */
+static int flash_op_edge(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int offset,
+	unsigned int size,
+	void *data
+)
+{
+	int ret;
+	unsigned char unit[BAIKAL_SCP_FLASH_SIZE_ALIGNMENT];
+	unsigned int unit_offset = offset - (offset % sizeof(unit));
+
+	switch (op) {
+		case BAIKAL_SCP_FLASH_READ:
+			ret = _baikal_scp_flash_op(handle, op, unit_offset, sizeof(unit), unit, NULL, NULL);
+			if (!ret)
+				memcpy(data, unit + (offset - unit_offset), size);
+
+			return ret;
+
+		case BAIKAL_SCP_FLASH_WRITE:
+			memset(unit, 0xff, sizeof(unit));
+			memcpy(unit + (offset - unit_offset), data, size);
+			return _baikal_scp_flash_op(handle, op, unit_offset, sizeof(unit), unit, NULL, NULL);
+
+		case BAIKAL_SCP_FLASH_ERASE:
+			memset(unit, 0xff, size);
+			return _baikal_scp_flash_program(handle, offset, size, unit, NULL);
+
+		default:
+			return EINVAL;
+	}
+}
+
+static int _baikal_scp_flash_op_unaligned(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int offset,
+	unsigned int size,
+	void *data,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+)
+{
+	int ret;
+	const unsigned int unit = BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
+	unsigned int end = offset + size;
+	unsigned int body_start;
+	unsigned int body_end;
+	unsigned int head;
+	unsigned int tail;
+
+	unaligned_progress_t up = {
+		.cb     = cb,
+		.user   = user,
+		.offset = offset,
+		.size   = size
+	};
+
+	if (!handle || !size || (end < offset))
+		return EINVAL;
+
+	if (is_flash_alignment_valid(offset) && is_flash_alignment_valid(size))
+		return _baikal_scp_flash_op(handle, op, offset, size, data, cb, user);
+
+	body_start = offset + ((offset % unit) ? (unit - offset % unit) : 0);
+	body_end   = end - (end % unit);
+
+	if (body_start > body_end) {
+		/* Request lies within a single unit */
+		head = size;
+		tail = 0;
+		body_start = body_end = end;
+	}
+	else {
+		head = body_start - offset;
+		tail = end - body_end;
+	}
+
+	unaligned_progress(&up, op);
+
+	if (head) {
+		ret = flash_op_edge(handle, op, offset, head, data);
+		if (ret)
+			return ret;
+
+		up.bytes += head;
+	}
+
+	if (body_end > body_start) {
+		ret = _baikal_scp_flash_op(handle, op, body_start, body_end - body_start,
+			data ? (unsigned char *)data + head : NULL,
+			cb ? unaligned_progress_cb : NULL, &up);
+		if (ret)
+			return ret;
+
+		up.bytes += body_end - body_start;
+	}
+
+	if (tail) {
+		ret = flash_op_edge(handle, op, body_end, tail,
+			data ? (unsigned char *)data + (body_end - offset) : NULL);
+		if (ret)
+			return ret;
+
+		up.bytes += tail;
+	}
+
+	unaligned_progress(&up, op);
+	return 0;
+}
+
+int baikal_scp_handle_flash_set_part_size(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int size
+)
+{
+	if (!handle || (op > BAIKAL_SCP_FLASH_WRITE))
+		return EINVAL;
+
+	if (size && (!is_flash_alignment_valid(size) || (size > FLASH_PART_MAX_SIZE)))
+		return EINVAL;
+
+	handle->part_size[op] = size;
+	return 0;
+}
+
+int baikal_scp_handle_flash_read(
+	baikal_scp_handle_t *handle,
 	unsigned int offset,
 	unsigned int size,
 	void *dst,
-	baikal_scp_flash_progress_cb_t cb
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
 )
 {
 	if (!size || !dst)
 		return EINVAL;
 
-	return _baikal_scp_flash_op(
-		BAIKAL_SCP_FLASH_READ, offset, size, dst, cb);
+	return _baikal_scp_flash_op_unaligned(handle,
+		BAIKAL_SCP_FLASH_READ, offset, size, dst, cb, user);
 }
 
-int baikal_scp_flash_write(
+int baikal_scp_handle_flash_write(
+	baikal_scp_handle_t *handle,
 	unsigned int offset,
 	unsigned int size,
 	const void *src,
-	baikal_scp_flash_progress_cb_t cb
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
 )
 {
 	if (!size || !src)
 		return EINVAL;
 
-	return _baikal_scp_flash_op(
-		BAIKAL_SCP_FLASH_WRITE, offset, size, (void *)src, cb);
+	return _baikal_scp_flash_op_unaligned(handle,
+		BAIKAL_SCP_FLASH_WRITE, offset, size, (void *)src, cb, user);
+}
+
+int baikal_scp_handle_flash_erase(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+)
+{
+	return _baikal_scp_flash_op_unaligned(handle,
+		BAIKAL_SCP_FLASH_ERASE, offset, size, NULL, cb, user);
+}
+
+/*
+ * Copy and fill
+ *
+ * The destination is processed sector by sector. The driver (or the daemon)
+ * erases and writes each sector itself, so the data is not transferred to
+ * the process. With older drivers the sector goes through the handle buffer.
+ *
+ * The driver copy relies on the firmware programming the data left in its
+ * buffer by the preceding read, which the firmware interface does not
+ * guarantee. Each copied sector is therefore compared with the source by
+ * the SHA-256 digests. On a mismatch the sector and all the following
+ * sectors of the handle are copied through the handle buffer.
+ */
+
+/* Pattern value selecting the copy */
+#define FLASH_COPY_PATTERN (-1)
+
+static int flash_copy_sector_buffered(
+	baikal_scp_handle_t *handle,
+	int pattern,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int sector_size
+)
+{
+	int ret;
+	void *buf;
+
+	buf = _baikal_scp_handle_buffer(handle, sector_size);
+	if (!buf)
+		return ENOMEM;
+
+	if (pattern == FLASH_COPY_PATTERN) {
+		ret = baikal_scp_handle_flash_read(handle, src, sector_size, buf, NULL, NULL);
+		if (ret)
+			return ret;
+	}
+	else
+		memset(buf, pattern, sector_size);
+
+	ret = baikal_scp_handle_flash_erase(handle, dst, sector_size, NULL, NULL);
+	if (ret || (pattern == 0xff))
+		return ret;
+
+	return baikal_scp_handle_flash_write(handle, dst, sector_size, buf, NULL, NULL);
+}
+
+static int flash_copy_verify(
+	baikal_scp_handle_t *handle,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int sector_size,
+	int *match
+)
+{
+	int ret;
+	unsigned char src_digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned char dst_digest[BAIKAL_SCP_SHA256_SIZE];
+
+	ret = baikal_scp_handle_flash_sha256(handle, src, sector_size, src_digest);
+	if (!ret)
+		ret = baikal_scp_handle_flash_sha256(handle, dst, sector_size, dst_digest);
+
+	if (!ret)
+		*match = !memcmp(src_digest, dst_digest, sizeof(src_digest));
+
+	return ret;
+}
+
+static int flash_copy_sector(
+	baikal_scp_handle_t *handle,
+	int pattern,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int sector_size
+)
+{
+	int ret;
+	int match = 1;
+	unsigned long long start = flash_stats_now();
+	baikal_scp_stats_entry_t *stats;
+
+	union {
+		struct baikal_scp_ioctl_flash_copy copy;
+		struct baikal_scp_ioctl_flash_fill fill;
+	} ioctl_data;
+
+	if ((pattern == FLASH_COPY_PATTERN) && handle->copy_unverified)
+		return flash_copy_sector_buffered(handle, pattern, src, dst, sector_size);
+
+	if (handle->is_client) {
+		baikal_scpd_flash_copy_t copy = { .src = src };
+		baikal_scpd_flash_fill_t fill = { .pattern = pattern };
+
+		if (pattern == FLASH_COPY_PATTERN)
+			ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_COPY,
+				dst, sector_size, &copy, sizeof(copy), NULL, 0);
+		else
+			ret = _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_FILL,
+				dst, sector_size, &fill, sizeof(fill), NULL, 0);
+	}
+	else if (handle->has_flash_copy) {
+		if (pattern == FLASH_COPY_PATTERN) {
+			ioctl_data.copy.src  = src;
+			ioctl_data.copy.dst  = dst;
+			ioctl_data.copy.size = sector_size;
+			ioctl_data.copy.done = 0;
+
+			ret = ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_COPY, &ioctl_data);
+		}
+		else {
+			ioctl_data.fill.offset  = dst;
+			ioctl_data.fill.size    = sector_size;
+			ioctl_data.fill.pattern = pattern;
+			ioctl_data.fill.done    = 0;
+
+			ret = ioctl(handle->fhnd_scp, BAIKAL_SCP_IOCTL_CMD_FLASH_FILL, &ioctl_data);
+		}
+	}
+	else
+		return flash_copy_sector_buffered(handle, pattern, src, dst, sector_size);
+
+	/* The fallback above is accounted as the read, erase and write requests */
+	stats = flash_stats_request(handle, (pattern == FLASH_COPY_PATTERN)
+		? BAIKAL_SCP_STATS_COPY : BAIKAL_SCP_STATS_FILL, start, ret);
+
+	if (!ret)
+		stats->bytes += sector_size;
+
+	if (!ret && (pattern == FLASH_COPY_PATTERN))
+		ret = flash_copy_verify(handle, src, dst, sector_size, &match);
+
+	if (!ret && !match) {
+		handle->copy_unverified = 1;
+		return flash_copy_sector_buffered(handle, pattern, src, dst, sector_size);
+	}
+
+	return ret;
+}
+
+static int flash_copy_fill(
+	baikal_scp_handle_t *handle,
+	int pattern,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+)
+{
+	int ret;
+	unsigned int pos;
+	baikal_scp_flash_info_t info;
+
+	baikal_scp_flash_progress_info_t progress = {
+		.operation = BAIKAL_SCP_FLASH_WRITE,
+		.size      = size,
+		.offset    = dst
+	};
+
+	if (!handle || !size)
+		return EINVAL;
+
+	ret = baikal_scp_handle_flash_info(handle, &info);
+	if (ret)
+		return ret;
+
+	if ((dst % info.sector_size) || (size % info.sector_size) ||
+	    (dst > info.total_size) || (size > info.total_size - dst))
+		return EINVAL;
+
+	if (pattern == FLASH_COPY_PATTERN) {
+		if (!is_flash_alignment_valid(src) ||
+		    (src > info.total_size) || (size > info.total_size - src))
+			return EINVAL;
+
+		/* Erasing the destination would destroy the source */
+		if ((src < dst + size) && (dst < src + size))
+			return EINVAL;
+	}
+
+	if (cb)
+		cb(&progress, user);
+
+	for (pos = 0; pos < size; pos += info.sector_size) {
+		ret = flash_copy_sector(handle, pattern, src + pos, dst + pos, info.sector_size);
+		if (ret)
+			return ret;
+
+		if (cb) {
+			progress.bytes += info.sector_size;
+			progress.percent = (progress.bytes * 100) / size;
+			cb(&progress, user);
+		}
+	}
+
+	return 0;
+}
+
+int baikal_scp_handle_flash_copy(
+	baikal_scp_handle_t *handle,
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+)
+{
+	return flash_copy_fill(handle, FLASH_COPY_PATTERN, src, dst, size, cb, user);
+}
+
+int baikal_scp_handle_flash_fill(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress_ex_cb_t cb,
+	void *user
+)
+{
+	return flash_copy_fill(handle, pattern, 0, offset, size, cb, user);
+}
+
+/*
+ * The daemon calculates the digest itself,
+ * so the data is not transferred to the client
+ */
+int baikal_scp_handle_flash_sha256(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]
+)
+{
+	int ret;
+	void *buf;
+	baikal_scp_sha256_ctx_t ctx;
+
+	if (!handle || !size || !digest)
+		return EINVAL;
+
+	if (handle->is_client)
+		return _baikal_scp_client_request(handle, BAIKAL_SCPD_CMD_FLASH_SHA256,
+			offset, size, NULL, 0, digest, BAIKAL_SCP_SHA256_SIZE);
+
+	buf = _baikal_scp_handle_buffer(handle, FLASH_CLIENT_PART_SIZE);
+	if (!buf)
+		return ENOMEM;
+
+	baikal_scp_sha256_init(&ctx);
+
+	while (size) {
+		unsigned int part = (size < FLASH_CLIENT_PART_SIZE) ? size : FLASH_CLIENT_PART_SIZE;
+
+		ret = baikal_scp_handle_flash_read(handle, offset, part, buf, NULL, NULL);
+		if (ret)
+			return ret;
+
+		baikal_scp_sha256_update(&ctx, buf, part);
+		offset += part;
+		size   -= part;
+	}
+
+	baikal_scp_sha256_final(&ctx, digest);
+	return 0;
+}
+
+/*
+ * Default handle API wrappers
+ */
+
+typedef struct {
+	baikal_scp_flash_progress_cb_t cb;
+} progress_adapter_t;
+
+static void progress_adapter_cb(const baikal_scp_flash_progress_info_t *progress_info, void *user)
+{
+	((progress_adapter_t *)user)->cb(progress_info);
+}
+
+int baikal_scp_flash_info(baikal_scp_flash_info_t *info)
+{
+	if (!info)
+		return EINVAL;
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_info(baikal_scp_lib, info);
+}
+
+int baikal_scp_flash_counters(baikal_scp_flash_counters_t *counters)
+{
+	if (!counters)
+		return EINVAL;
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_counters(baikal_scp_lib, counters);
+}
+
+int baikal_scp_flash_smc_calls(unsigned long long *calls)
+{
+	if (!calls)
+		return EINVAL;
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_smc_calls(baikal_scp_lib, calls);
+}
+
+int baikal_scp_flash_sha256(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE]
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_sha256(baikal_scp_lib, offset, size, digest);
+}
+
+int baikal_scp_flash_read(
+	unsigned int offset,
+	unsigned int size,
+	void *dst,
+	baikal_scp_flash_progress_cb_t cb
+)
+{
+	progress_adapter_t adapter = { .cb = cb };
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_read(baikal_scp_lib, offset, size, dst,
+		cb ? progress_adapter_cb : NULL, &adapter);
+}
+
+int baikal_scp_flash_write(
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	baikal_scp_flash_progress_cb_t cb
+)
+{
+	progress_adapter_t adapter = { .cb = cb };
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_write(baikal_scp_lib, offset, size, src,
+		cb ? progress_adapter_cb : NULL, &adapter);
 }
 
 int baikal_scp_flash_erase(
@@ -168,11 +982,191 @@ int baikal_scp_flash_erase(
 	baikal_scp_flash_progress_cb_t cb
 )
 {
-	return _baikal_scp_flash_op(
-		BAIKAL_SCP_FLASH_ERASE, offset, size, NULL, cb);
+	progress_adapter_t adapter = { .cb = cb };
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_erase(baikal_scp_lib, offset, size,
+		cb ? progress_adapter_cb : NULL, &adapter);
+}
+
+int _baikal_scp_flash_program_units(baikal_scp_handle_t *handle,
+	unsigned int offset, unsigned int size,
+	const unsigned char *cur, const unsigned char *new)
+{
+	int ret;
+	unsigned int i;
+	unsigned int run = 0;
+	const unsigned int unit = BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
+
+	for (i = 0; i <= size; i += unit) {
+		if ((i < size) && memcmp(cur + i, new + i, unit)) {
+			run += unit;
+			continue;
+		}
+
+		if (run) {
+			ret = baikal_scp_handle_flash_write(handle,
+				offset + i - run, run, new + i - run, NULL, NULL);
+			if (ret)
+				return ret;
+
+			run = 0;
+		}
+	}
+
+	return 0;
+}
+
+int _baikal_scp_flash_program(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	const void *data,
+	unsigned int *sectors_rewritten
+)
+{
+	int ret;
+	baikal_scp_flash_info_t info;
+	unsigned char *cur = NULL;
+	unsigned char *new = NULL;
+	unsigned int start;
+	unsigned int end;
+	unsigned int sector;
+	unsigned int i;
+	const unsigned int unit = BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
+
+	if (sectors_rewritten)
+		*sectors_rewritten = 0;
+
+	if (!size || !data)
+		return EINVAL;
+
+	ret = baikal_scp_handle_flash_info(handle, &info);
+	if (ret)
+		return ret;
+
+	if ((offset + size < offset) || (offset + size > info.total_size))
+		return EINVAL;
+
+	cur = _baikal_scp_handle_buffer(handle, 2 * info.sector_size);
+	if (!cur)
+		return ENOMEM;
+
+	new = cur + info.sector_size;
+
+	start = offset - (offset % unit);
+	end   = offset + size;
+	end   = end + ((end % unit) ? (unit - end % unit) : 0);
+
+	for (sector = start - (start % info.sector_size); sector < end; sector += info.sector_size) {
+		unsigned int a0 = (start > sector) ? start : sector;
+		unsigned int a1 = (end < sector + info.sector_size) ? end : sector + info.sector_size;
+		unsigned int d0 = (offset > a0) ? offset : a0;
+		unsigned int d1 = (offset + size < a1) ? offset + size : a1;
+		int need_erase = 0;
+
+		ret = baikal_scp_handle_flash_read(handle, a0, a1 - a0, cur, NULL, NULL);
+		if (ret)
+			return ret;
+
+		memcpy(new, cur, a1 - a0);
+		memcpy(new + (d0 - a0), (const unsigned char *)data + (d0 - offset), d1 - d0);
+
+		if (!memcmp(cur, new, a1 - a0))
+			continue;
+
+		for (i = 0; i < a1 - a0; i++) {
+			if ((cur[i] & new[i]) != new[i]) {
+				need_erase = 1;
+				break;
+			}
+		}
+
+		if (!need_erase) {
+			/* Only 1 -> 0 bit transitions, no erase required */
+			ret = _baikal_scp_flash_program_units(handle, a0, a1 - a0, cur, new);
+			if (ret)
+				return ret;
+
+			continue;
+		}
+
+		/* Rewrite whole sector */
+		ret = baikal_scp_handle_flash_read(handle, sector, info.sector_size, cur, NULL, NULL);
+		if (ret)
+			return ret;
+
+		memcpy(new, cur, info.sector_size);
+		memcpy(new + (d0 - sector), (const unsigned char *)data + (d0 - offset), d1 - d0);
+
+		ret = baikal_scp_handle_flash_erase(handle, sector, info.sector_size, NULL, NULL);
+		if (ret)
+			return ret;
+
+		memset(cur, 0xff, info.sector_size);
+
+		ret = _baikal_scp_flash_program_units(handle, sector, info.sector_size, cur, new);
+		if (ret)
+			return ret;
+
+		if (sectors_rewritten)
+			(*sectors_rewritten)++;
+	}
+
+	return 0;
 }
 
 unsigned int baikal_scp_flash_alignment(void)
 {
 	return BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
 }
+
+int baikal_scp_flash_copy(
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress_cb_t cb
+)
+{
+	progress_adapter_t adapter = { .cb = cb };
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_copy(baikal_scp_lib, src, dst, size,
+		cb ? progress_adapter_cb : NULL, &adapter);
+}
+
+int baikal_scp_flash_fill(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress_cb_t cb
+)
+{
+	progress_adapter_t adapter = { .cb = cb };
+
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_fill(baikal_scp_lib, offset, size, pattern,
+		cb ? progress_adapter_cb : NULL, &adapter);
+}
+
+int baikal_scp_flash_set_interactive(int interactive)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_set_interactive(baikal_scp_lib, interactive);
+}
+
+int baikal_scp_flash_set_part_size(baikal_scp_flash_operation_t op, unsigned int size)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_set_part_size(baikal_scp_lib, op, size);
+}
@@ -27,12 +27,132 @@
 	BAIKAL_SCP_LIB_VERSION_MINOR, \
 	BAIKAL_SCP_LIB_VERSION_PATCH)
 
-typedef struct {
-	/** SCP device file handle */
+/** First driver version implementing read()/write() on the device file */
+#define BAIKAL_SCP_DRV_VERSION_FILE_RW BAIKAL_SCP_VERSION(1, 2, 0)
+
+/** First driver version implementing the flash copy and fill ioctls */
+#define BAIKAL_SCP_DRV_VERSION_FLASH_COPY BAIKAL_SCP_VERSION(1, 4, 0)
+
+/** First driver version reporting partial completion (READ2, WRITE2, ERASE2) */
+#define BAIKAL_SCP_DRV_VERSION_FLASH_DONE BAIKAL_SCP_VERSION(1, 6, 0)
+
+/** Directory for the per-boot runtime caches */
+#define BAIKAL_SCP_LIB_RUNTIME_DIR "/run/baikal-scp"
+
+struct baikal_scp_handle {
+	/** SCP device file handle (daemon socket for the client handles) */
 	int fhnd_scp;
 
-} baikal_scp_lib_t;
+	/** Requests are sent to the flash service daemon */
+	int is_client;
+
+	/** Flash can be read and written with pread()/pwrite() on the device file */
+	int has_file_rw;
+
+	/** Flash can be copied and filled by the driver */
+	int has_flash_copy;
+
+	/** Driver copy produced a wrong sector, copies go through the buffer */
+	int copy_unverified;
+
+	/** Flash requests report the bytes completed before a failure */
+	int has_flash_done;
+
+	/** Request size per operation type (0 for the default size) */
+	unsigned int part_size[BAIKAL_SCP_FLASH_WRITE + 1];
+
+	/** Requests yield to the requests of the other processes */
+	int background;
+
+	/** Cached flash geometry (the flash does not change while the handle is open) */
+	int has_flash_info;
+	baikal_scp_flash_info_t flash_info;
+
+	/** Transfer buffer reused between the operations */
+	void  *buf;
+	size_t buf_size;
+
+	/** EFI variable store index built by the last lookup */
+	struct efivar_index *efivar_index;
+
+	/** Flash operation counters, only the per request type ones are kept */
+	baikal_scp_flash_counters_t counters;
+};
+
+/** Default handle used by the baikal_scp_init() based API */
+extern baikal_scp_handle_t *baikal_scp_lib;
 
-extern baikal_scp_lib_t *baikal_scp_lib;
+/**
+ * Get handle transfer buffer of at least the specified size.
+ * The buffer is owned by the handle and is valid until the next call.
+ */
+void *_baikal_scp_handle_buffer(baikal_scp_handle_t *handle, size_t size);
+
+/**
+ * Program changed units of the flash area. Buffer cur holds current flash
+ * contents of the area and buffer new holds the contents to be programmed.
+ * Unchanged units are skipped, adjacent changed units are programmed
+ * by a single write. Offset and size must be aligned.
+ */
+int _baikal_scp_flash_program_units(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	const unsigned char *cur,
+	const unsigned char *new
+);
+
+/**
+ * Program data at arbitrary (unaligned) flash offset with the minimum
+ * number of flash cycles. When the new data only clears bits of the
+ * current flash contents, the changed units are programmed without erase.
+ * Otherwise each sector that needs bits to be set is read, erased and
+ * written back with the new data merged in.
+ *
+ * @param[out] sectors_rewritten Number of erased sectors (may be NULL)
+ */
+int _baikal_scp_flash_program(
+	baikal_scp_handle_t *handle,
+	unsigned int offset,
+	unsigned int size,
+	const void *data,
+	unsigned int *sectors_rewritten
+);
+
+/**
+ * Send or receive exactly size bytes on the socket
+ */
+int _baikal_scp_io_full(int fd, void *buf, size_t size, int is_write);
+
+/**
+ * Connect the handle to the flash service daemon
+ */
+int _baikal_scp_client_connect(baikal_scp_handle_t *handle);
+
+/**
+ * Send request to the flash service daemon and receive the reply
+ */
+int _baikal_scp_client_request(
+	baikal_scp_handle_t *handle,
+	unsigned int cmd,
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	unsigned int src_size,
+	void *dst,
+	unsigned int dst_size
+);
+
+/**
+ * Flash request part through the flash service daemon
+ */
+int _baikal_scp_client_op(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_operation_t op,
+	unsigned int offset,
+	unsigned int size,
+	void *data,
+	unsigned int *done
+);
 
 #endif /* BAIKAL_SCP_LIB_PRIVATE_H */
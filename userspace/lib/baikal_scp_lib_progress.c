@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "baikal_scp_lib_private.h"
+
+/*
+ * Progress reporting v2
+ *
+ * The flash functions report the progress of each request after every
+ * transferred part. The requests of a phase are accumulated here, and
+ * the caller callback is rate limited, so a slow callback (e.g. terminal
+ * or network output) does not slow down the transfer.
+ */
+
+static double progress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void progress_emit(baikal_scp_flash_progress2_t *progress, double now)
+{
+	baikal_scp_flash_progress2_info_t *info = &progress->info;
+
+	info->timestamp = now;
+	info->elapsed   = now - progress->begin;
+	info->percent   = info->size ? (unsigned int)((info->bytes * 100) / info->size) : 100;
+
+	if (now > progress->last)
+		info->rate = (double)(info->bytes - progress->last_bytes) / (now - progress->last);
+
+	info->avg_rate = (info->elapsed > 0) ? (double)info->bytes / info->elapsed : 0;
+	info->eta = ((info->avg_rate > 0) && (info->size >= info->bytes))
+		? (double)(info->size - info->bytes) / info->avg_rate : -1;
+
+	progress->last = now;
+	progress->last_bytes = info->bytes;
+
+	if (progress->cb)
+		progress->cb(info, progress->user);
+}
+
+void baikal_scp_flash_progress2_begin(
+	baikal_scp_flash_progress2_t *progress,
+	baikal_scp_flash_phase_t phase,
+	unsigned long long size
+)
+{
+	double now = progress_now();
+
+	if (!progress)
+		return;
+
+	memset(&progress->info, 0, sizeof(progress->info));
+	progress->info.phase = phase;
+	progress->info.size  = size;
+
+	progress->begin          = now;
+	progress->last           = now;
+	progress->last_bytes     = 0;
+	progress->request_base   = 0;
+	progress->request_offset = 0;
+	progress->request_size   = 0;
+	progress->request_bytes  = 0;
+
+	progress_emit(progress, now);
+}
+
+void baikal_scp_flash_progress2_end(baikal_scp_flash_progress2_t *progress)
+{
+	if (!progress)
+		return;
+
+	progress->info.final = 1;
+	progress_emit(progress, progress_now());
+}
+
+void baikal_scp_flash_progress2_cb(
+	const baikal_scp_flash_progress_info_t *progress_info,
+	void *user
+)
+{
+	baikal_scp_flash_progress2_t *progress = user;
+	double now;
+
+	if (!progress)
+		return;
+
+	/* The bytes only grow within a request */
+	if ((progress_info->offset != progress->request_offset) ||
+	    (progress_info->size != progress->request_size) ||
+	    (progress_info->bytes < progress->request_bytes)) {
+		progress->request_base   = progress->info.bytes;
+		progress->request_offset = progress_info->offset;
+		progress->request_size   = progress_info->size;
+	}
+
+	progress->request_bytes  = progress_info->bytes;
+	progress->info.operation = progress_info->operation;
+	progress->info.offset    = progress_info->offset + progress_info->bytes;
+	progress->info.bytes     = progress->request_base + progress_info->bytes;
+
+	/* Request start, nothing new to report */
+	if (progress->info.bytes == progress->last_bytes)
+		return;
+
+	now = progress_now();
+	if (progress->max_rate && ((now - progress->last) * progress->max_rate < 1.0))
+		return;
+
+	progress_emit(progress, now);
+}
+
+/*
+ * Default handle API wrappers
+ */
+
+int baikal_scp_flash_read2(
+	unsigned int offset,
+	unsigned int size,
+	void *dst,
+	baikal_scp_flash_progress2_t *progress
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_read(baikal_scp_lib, offset, size, dst,
+		progress ? baikal_scp_flash_progress2_cb : NULL, progress);
+}
+
+int baikal_scp_flash_write2(
+	unsigned int offset,
+	unsigned int size,
+	const void *src,
+	baikal_scp_flash_progress2_t *progress
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_write(baikal_scp_lib, offset, size, src,
+		progress ? baikal_scp_flash_progress2_cb : NULL, progress);
+}
+
+int baikal_scp_flash_erase2(
+	unsigned int offset,
+	unsigned int size,
+	baikal_scp_flash_progress2_t *progress
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_erase(baikal_scp_lib, offset, size,
+		progress ? baikal_scp_flash_progress2_cb : NULL, progress);
+}
+
+int baikal_scp_flash_copy2(
+	unsigned int src,
+	unsigned int dst,
+	unsigned int size,
+	baikal_scp_flash_progress2_t *progress
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_copy(baikal_scp_lib, src, dst, size,
+		progress ? baikal_scp_flash_progress2_cb : NULL, progress);
+}
+
+int baikal_scp_flash_fill2(
+	unsigned int offset,
+	unsigned int size,
+	unsigned char pattern,
+	baikal_scp_flash_progress2_t *progress
+)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_fill(baikal_scp_lib, offset, size, pattern,
+		progress ? baikal_scp_flash_progress2_cb : NULL, progress);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+
+#include "baikal_scp_lib_private.h"
+
+/*
+ * Buffered flash update session. Writes are accumulated in per-sector
+ * shadow buffers, each with a byte mask of the written bytes, so
+ * overlapping and adjacent writes are merged before anything is
+ * programmed. Each touched sector is then programmed once on flush.
+ */
+
+typedef struct session_sector {
+	unsigned int   offset;  /* Flash offset of the sector */
+	unsigned int   lo;      /* Written span within the sector */
+	unsigned int   hi;
+	unsigned char *data;    /* Written data */
+	unsigned char *mask;    /* Non-zero for written bytes */
+} session_sector_t;
+
+struct baikal_scp_flash_session {
+	baikal_scp_handle_t    *handle;
+	baikal_scp_flash_info_t info;
+
+	session_sector_t *sectors;
+	unsigned int      sector_count;
+	unsigned int      sector_alloc;
+};
+
+int baikal_scp_handle_flash_session_begin(
+	baikal_scp_handle_t *handle,
+	baikal_scp_flash_session_t **session
+)
+{
+	int ret;
+	baikal_scp_flash_session_t *s;
+
+	if (!handle || !session)
+		return EINVAL;
+
+	s = calloc(sizeof(baikal_scp_flash_session_t), 1);
+	if (!s)
+		return ENOMEM;
+
+	ret = baikal_scp_handle_flash_info(handle, &s->info);
+	if (ret) {
+		free(s);
+		return ret;
+	}
+
+	s->handle = handle;
+	*session = s;
+	return 0;
+}
+
+int baikal_scp_flash_session_begin(baikal_scp_flash_session_t **session)
+{
+	if (!baikal_scp_lib)
+		return ECANCELED;
+
+	return baikal_scp_handle_flash_session_begin(baikal_scp_lib, session);
+}
+
+static void session_clear(baikal_scp_flash_session_t *session)
+{
+	unsigned int i;
+
+	for (i = 0; i < session->sector_count; i++) {
+		free(session->sectors[i].data);
+		free(session->sectors[i].mask);
+	}
+
+	session->sector_count = 0;
+}
+
+void baikal_scp_flash_session_end(baikal_scp_flash_session_t *session)
+{
+	if (!session)
+		return;
+
+	session_clear(session);
+	free(session->sectors);
+	free(session);
+}
+
+static session_sector_t *session_sector(baikal_scp_flash_session_t *session, unsigned int offset)
+{
+	unsigned int i;
+	session_sector_t *sector;
+
+	for (i = 0; i < session->sector_count; i++) {
+		if (session->sectors[i].offset == offset)
+			return &session->sectors[i];
+	}
+
+	if (session->sector_count == session->sector_alloc) {
+		unsigned int alloc = session->sector_alloc ? session->sector_alloc * 2 : 8;
+
+		sector = realloc(session->sectors, alloc * sizeof(session_sector_t));
+		if (!sector)
+			return NULL;
+
+		session->sectors = sector;
+		session->sector_alloc = alloc;
+	}
+
+	sector = &session->sectors[session->sector_count];
+	sector->offset = offset;
+	sector->lo     = session->info.sector_size;
+	sector->hi     = 0;
+	sector->data   = malloc(session->info.sector_size);
+	sector->mask   = calloc(session->info.sector_size, 1);
+
+	if (!sector->data || !sector->mask) {
+		free(sector->data);
+		free(sector->mask);
+		return NULL;
+	}
+
+	session->sector_count++;
+	return sector;
+}
+
+int baikal_scp_flash_session_write(
+	baikal_scp_flash_session_t *session,
+	unsigned int offset,
+	unsigned int size,
+	const void *data
+)
+{
+	const unsigned int sector_size = session ? session->info.sector_size : 0;
+	const unsigned char *src = data;
+
+	if (!session || !size || !data)
+		return EINVAL;
+
+	if ((offset + size < offset) || (offset + size > session->info.total_size))
+		return EINVAL;
+
+	while (size) {
+		unsigned int pos = offset % sector_size;
+		unsigned int part = (size < sector_size - pos) ? size : sector_size - pos;
+		session_sector_t *sector;
+
+		sector = session_sector(session, offset - pos);
+		if (!sector)
+			return ENOMEM;
+
+		memcpy(sector->data + pos, src, part);
+		memset(sector->mask + pos, 1, part);
+
+		if (pos < sector->lo)
+			sector->lo = pos;
+
+		if (pos + part > sector->hi)
+			sector->hi = pos + part;
+
+		offset += part;
+		size   -= part;
+		src    += part;
+	}
+
+	return 0;
+}
+
+static void session_merge(const session_sector_t *sector,
+	unsigned char *new, unsigned int lo, unsigned int hi)
+{
+	unsigned int i;
+
+	for (i = lo; i < hi; i++) {
+		if (sector->mask[i])
+			new[i] = sector->data[i];
+	}
+}
+
+/*
+ * Program one sector. Only the written span is read first. When the new
+ * data only clears bits, the changed units are programmed without erase,
+ * otherwise the rest of the sector is read and the sector is rewritten.
+ */
+static int session_flush_sector(baikal_scp_flash_session_t *session,
+	const session_sector_t *sector, unsigned char *cur, unsigned char *new,
+	unsigned int *sectors_rewritten)
+{
+	int ret;
+	unsigned int i;
+	const unsigned int unit = BAIKAL_SCP_FLASH_SIZE_ALIGNMENT;
+	const unsigned int sector_size = session->info.sector_size;
+	unsigned int lo = sector->lo - (sector->lo % unit);
+	unsigned int hi = sector->hi + ((sector->hi % unit) ? (unit - sector->hi % unit) : 0);
+	int need_erase = 0;
+
+	ret = baikal_scp_handle_flash_read(session->handle,
+		sector->offset + lo, hi - lo, cur + lo, NULL, NULL);
+	if (ret)
+		return ret;
+
+	memcpy(new + lo, cur + lo, hi - lo);
+	session_merge(sector, new, lo, hi);
+
+	if (!memcmp(cur + lo, new + lo, hi - lo))
+		return 0;
+
+	for (i = lo; i < hi; i++) {
+		if ((cur[i] & new[i]) != new[i]) {
+			need_erase = 1;
+			break;
+		}
+	}
+
+	if (!need_erase) {
+		/* Only 1 -> 0 bit transitions, no erase required */
+		return _baikal_scp_flash_program_units(session->handle,
+			sector->offset + lo, hi - lo, cur + lo, new + lo);
+	}
+
+	if (lo) {
+		ret = baikal_scp_handle_flash_read(session->handle,
+			sector->offset, lo, new, NULL, NULL);
+		if (ret)
+			return ret;
+	}
+
+	if (hi < sector_size) {
+		ret = baikal_scp_handle_flash_read(session->handle,
+			sector->offset + hi, sector_size - hi, new + hi, NULL, NULL);
+		if (ret)
+			return ret;
+	}
+
+	ret = baikal_scp_handle_flash_erase(session->handle,
+		sector->offset, sector_size, NULL, NULL);
+	if (ret)
+		return ret;
+
+	memset(cur, 0xff, sector_size);
+
+	ret = _baikal_scp_flash_program_units(session->handle,
+		sector->offset, sector_size, cur, new);
+	if (ret)
+		return ret;
+
+	if (sectors_rewritten)
+		(*sectors_rewritten)++;
+
+	return 0;
+}
+
+static int session_sector_cmp(const void *a, const void *b)
+{
+	const session_sector_t *sa = a;
+	const session_sector_t *sb = b;
+
+	return (sa->offset > sb->offset) - (sa->offset < sb->offset);
+}
+
+int baikal_scp_flash_session_flush(
+	baikal_scp_flash_session_t *session,
+	unsigned int *sectors_rewritten
+)
+{
+	int ret;
+	unsigned int i;
+	unsigned char *cur;
+	unsigned char *new;
+
+	if (sectors_rewritten)
+		*sectors_rewritten = 0;
+
+	if (!session)
+		return EINVAL;
+
+	cur = _baikal_scp_handle_buffer(session->handle, 2 * session->info.sector_size);
+	if (!cur)
+		return ENOMEM;
+
+	new = cur + session->info.sector_size;
+
+	/* Program sectors in flash order */
+	qsort(session->sectors, session->sector_count,
+		sizeof(session_sector_t), session_sector_cmp);
+
+	for (i = 0; i < session->sector_count; i++) {
+		ret = session_flush_sector(session, &session->sectors[i],
+			cur, new, sectors_rewritten);
+		if (ret)
+			return ret;
+	}
+
+	session_clear(session);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2021 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+
+#include "baikal_scp_lib_private.h"
+
+/*
+ * SHA-256 (FIPS 180-4) implementation used for comparing flash contents
+ * with images without keeping both in memory
+ */
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const unsigned int sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_transform(baikal_scp_sha256_ctx_t *ctx, const unsigned char *block)
+{
+	unsigned int w[64];
+	unsigned int a, b, c, d, e, f, g, h;
+	unsigned int t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = ((unsigned int)block[i * 4 + 0] << 24) |
+		       ((unsigned int)block[i * 4 + 1] << 16) |
+		       ((unsigned int)block[i * 4 + 2] << 8) |
+		       ((unsigned int)block[i * 4 + 3]);
+	}
+
+	for (i = 16; i < 64; i++) {
+		unsigned int s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		unsigned int s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+	f = ctx->state[5];
+	g = ctx->state[6];
+	h = ctx->state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+			((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+void baikal_scp_sha256_init(baikal_scp_sha256_ctx_t *ctx)
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->count = 0;
+}
+
+void baikal_scp_sha256_update(baikal_scp_sha256_ctx_t *ctx, const void *data, unsigned int size)
+{
+	const unsigned char *ptr = data;
+	unsigned int used = (unsigned int)(ctx->count % sizeof(ctx->buf));
+
+	ctx->count += size;
+
+	if (used) {
+		unsigned int part = sizeof(ctx->buf) - used;
+
+		if (part > size)
+			part = size;
+
+		memcpy(ctx->buf + used, ptr, part);
+		ptr  += part;
+		size -= part;
+
+		if (used + part < sizeof(ctx->buf))
+			return;
+
+		sha256_transform(ctx, ctx->buf);
+	}
+
+	while (size >= sizeof(ctx->buf)) {
+		sha256_transform(ctx, ptr);
+		ptr  += sizeof(ctx->buf);
+		size -= sizeof(ctx->buf);
+	}
+
+	if (size)
+		memcpy(ctx->buf, ptr, size);
+}
+
+void baikal_scp_sha256_final(baikal_scp_sha256_ctx_t *ctx,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE])
+{
+	unsigned long long bits = ctx->count * 8;
+	unsigned int used = (unsigned int)(ctx->count % sizeof(ctx->buf));
+	int i;
+
+	ctx->buf[used++] = 0x80;
+
+	if (used > sizeof(ctx->buf) - 8) {
+		memset(ctx->buf + used, 0, sizeof(ctx->buf) - used);
+		sha256_transform(ctx, ctx->buf);
+		used = 0;
+	}
+
+	memset(ctx->buf + used, 0, sizeof(ctx->buf) - 8 - used);
+
+	for (i = 0; i < 8; i++)
+		ctx->buf[sizeof(ctx->buf) - 1 - i] = (unsigned char)(bits >> (i * 8));
+
+	sha256_transform(ctx, ctx->buf);
+
+	for (i = 0; i < 8; i++) {
+		digest[i * 4 + 0] = (unsigned char)(ctx->state[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[i * 4 + 3] = (unsigned char)(ctx->state[i]);
+	}
+}
+
+void baikal_scp_sha256(const void *data, unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE])
+{
+	baikal_scp_sha256_ctx_t ctx;
+
+	baikal_scp_sha256_init(&ctx);
+	baikal_scp_sha256_update(&ctx, data, size);
+	baikal_scp_sha256_final(&ctx, digest);
+}
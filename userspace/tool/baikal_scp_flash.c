@@ -8,10 +8,6 @@
 
 #include "baikal_scp_tool.h"
 
-#ifdef USE_LIBCURL
-#include <curl/curl.h>
-#endif
-
 #define MODE_NONE          0
 
 #define MODE_SHOW_VERSION  1
@@ -19,17 +15,83 @@
 #define MODE_FLASH_READ    10
 #define MODE_FLASH_WRITE   11
 #define MODE_FLASH_ERASE   12
+#define MODE_FLASH_COPY    13
+#define MODE_FLASH_FILL    14
+#define MODE_FLASH_PATCH   15
+#define MODE_PATCH_CREATE  16
+
+#define MODE_EFIVAR_LIST   20
+#define MODE_EFIVAR_GET    21
+#define MODE_EFIVAR_SET    22
+#define MODE_EFIVAR_DELETE 23
+#define MODE_EFIVAR_RECLAIM 24
+
+#define MODE_FIP_LIST      30
+#define MODE_FIP_UPDATE    31
+
+#define MODE_FAT_LIST      40
+#define MODE_FAT_GET       41
+
+#define MODE_BENCHMARK     50
+#define MODE_SCRUB         51
+
+/* Values for the long-only command line options */
+#define OPT_EFIVAR_LIST    0x100
+#define OPT_EFIVAR_GET     0x101
+#define OPT_EFIVAR_SET     0x102
+#define OPT_EFIVAR_DELETE  0x103
+#define OPT_EFIVAR_RECLAIM 0x104
+#define OPT_EFIVAR_ATTR    0x105
+#define OPT_FIP_LIST       0x106
+#define OPT_FIP_UPDATE     0x107
+#define OPT_FAT_LIST       0x108
+#define OPT_FAT_GET        0x109
+#define OPT_REPORT         0x10a
+#define OPT_RESUME         0x10b
+#define OPT_JOURNAL        0x10c
+#define OPT_PLAN           0x10d
+#define OPT_PROFILE        0x10e
+#define OPT_BENCHMARK      0x10f
+#define OPT_COPY           0x110
+#define OPT_FILL           0x111
+#define OPT_SCRUB          0x112
+#define OPT_SCRUB_RATE     0x113
+#define OPT_SCRUB_TIME     0x114
+#define OPT_SCRUB_ACCEPT   0x115
+#define OPT_MANIFEST       0x116
+#define OPT_CACHE          0x117
+#define OPT_CACHE_SIZE     0x118
+#define OPT_CACHE_TTL      0x119
+#define OPT_PATCH          0x11a
+#define OPT_PATCH_CREATE   0x11b
 
 static unsigned int mode = MODE_NONE;
 
 static char        *filepath  = NULL;
+static char        *output    = NULL;
+static char        *input     = NULL;
+static char        *efivar    = NULL;
+static int          efivar_attr = -1;
+static char        *fat_path  = NULL;
 static unsigned int filesize  = 0;
 static unsigned int size      = 0;
 static unsigned int offset    = 0;
 static unsigned int skip      = 0;
+static unsigned int copy_dst  = 0;
+static unsigned int fill_pattern = 0;
 static int          no_verify = 0;
 static int          quiet     = 0;
 static int          yes       = 0;
+static int          resume    = 0;
+static char        *journal_path = JOURNAL_DEFAULT_PATH;
+static char        *profile_path = NULL;
+static char        *manifest_path = SCRUB_DEFAULT_PATH;
+static unsigned int scrub_rate = SCRUB_DEFAULT_RATE;
+static unsigned int scrub_time = 0;
+static int          scrub_accept = 0;
+static char        *cache_path = NULL;
+static unsigned int cache_size = DOWNLOAD_CACHE_DEFAULT_SIZE;
+static unsigned int cache_ttl  = 0;
 
 typedef struct flash_partition {
 	char        *name;
@@ -44,6 +106,7 @@ static flash_partition_t flash_parts[] = {
 	{ .name = "dtb", .smc_offset = 0x040000, .size = 0x040000, .desc = "Flattened Device Tree Blob (DTB)" },
 	{ .name = "var", .smc_offset = 0x080000, .size = 0x0c0000, .desc = "EFI variables" },
 	{ .name = "fip", .smc_offset = 0x140000, .size = 0x640000, .desc = "Firmware Image Package (FIP)" },
+	{ .name = "fat", .smc_offset = 0x780000, .size = 0x800000, .desc = "FAT32 rescue files (optional)" },
 };
 
 static const flash_partition_t *part = NULL;
@@ -62,7 +125,7 @@ static const flash_partition_t *find_part(char *name)
 /**
  * @brief Short command line options list
  */
-static const char *opts_str = "hw:r:ep:s:o:k:yqnv";
+static const char *opts_str = "hw:r:ep:s:o:k:yqnvO:I:";
 
 /**
  * @brief Long command line options list
@@ -80,6 +143,36 @@ static const struct option opts[] = {
 	{ .name = "quiet",             .val = 'q' },
 	{ .name = "no-verify",         .val = 'n' },
 	{ .name = "version",           .val = 'v' },
+	{ .name = "output",            .val = 'O', .has_arg = 1 },
+	{ .name = "efivar-list",       .val = OPT_EFIVAR_LIST },
+	{ .name = "input",             .val = 'I', .has_arg = 1 },
+	{ .name = "efivar-get",        .val = OPT_EFIVAR_GET, .has_arg = 1 },
+	{ .name = "efivar-set",        .val = OPT_EFIVAR_SET, .has_arg = 1 },
+	{ .name = "efivar-delete",     .val = OPT_EFIVAR_DELETE, .has_arg = 1 },
+	{ .name = "efivar-reclaim",    .val = OPT_EFIVAR_RECLAIM },
+	{ .name = "efivar-attr",       .val = OPT_EFIVAR_ATTR, .has_arg = 1 },
+	{ .name = "fip-list",          .val = OPT_FIP_LIST },
+	{ .name = "fip-update",        .val = OPT_FIP_UPDATE, .has_arg = 1 },
+	{ .name = "fat-list",          .val = OPT_FAT_LIST, .has_arg = 2 },
+	{ .name = "fat-get",           .val = OPT_FAT_GET, .has_arg = 1 },
+	{ .name = "report",            .val = OPT_REPORT, .has_arg = 1 },
+	{ .name = "resume",            .val = OPT_RESUME },
+	{ .name = "journal",           .val = OPT_JOURNAL, .has_arg = 1 },
+	{ .name = "plan",              .val = OPT_PLAN, .has_arg = 2 },
+	{ .name = "profile",           .val = OPT_PROFILE, .has_arg = 1 },
+	{ .name = "benchmark",         .val = OPT_BENCHMARK, .has_arg = 0 },
+	{ .name = "copy",              .val = OPT_COPY, .has_arg = 1 },
+	{ .name = "fill",              .val = OPT_FILL, .has_arg = 1 },
+	{ .name = "scrub",             .val = OPT_SCRUB },
+	{ .name = "scrub-rate",        .val = OPT_SCRUB_RATE, .has_arg = 1 },
+	{ .name = "scrub-time",        .val = OPT_SCRUB_TIME, .has_arg = 1 },
+	{ .name = "scrub-accept",      .val = OPT_SCRUB_ACCEPT },
+	{ .name = "manifest",          .val = OPT_MANIFEST, .has_arg = 1 },
+	{ .name = "cache",             .val = OPT_CACHE, .has_arg = 2 },
+	{ .name = "cache-size",        .val = OPT_CACHE_SIZE, .has_arg = 1 },
+	{ .name = "cache-ttl",         .val = OPT_CACHE_TTL, .has_arg = 1 },
+	{ .name = "patch",             .val = OPT_PATCH, .has_arg = 1 },
+	{ .name = "patch-create",      .val = OPT_PATCH_CREATE, .has_arg = 1 },
 	{ 0 }
 };
 
@@ -89,7 +182,6 @@ static const struct option opts[] = {
 static void display_usage(void)
 {
 	int i;
-	unsigned alignment = baikal_scp_flash_alignment();
 
 	if (quiet) {
 		return;
@@ -130,6 +222,39 @@ static void display_usage(void)
 		"        by built-in named partition (option -p, --part) or manually specify\n"
 		"        flash offset (option -o, --offset) and erase size (option -s, --size).\n"
 		"\n"
+		"  --copy <offset>\n"
+		"        Copy SPI Boot Flash area selected by built-in named partition\n"
+		"        (option -p, --part) or by options -o (--offset) and -s (--size)\n"
+		"        to the flash offset <offset>. The data is copied by the driver\n"
+		"        without transferring it to the utility. The destination offset\n"
+		"        and the size must be aligned to the flash sector size, the\n"
+		"        destination sectors are erased. The areas must not overlap.\n"
+		"        The SHA-256 digest of the destination is compared with the digest\n"
+		"        of the source afterwards unless option -n (--no-verify) is set.\n"
+		"\n"
+		"  --fill <byte>\n"
+		"        Fill SPI Boot Flash area selected by built-in named partition\n"
+		"        (option -p, --part) or by options -o (--offset) and -s (--size)\n"
+		"        with the byte value. The area is erased and written by the driver,\n"
+		"        its offset and size must be aligned to the flash sector size.\n"
+		"        The result is verified by its SHA-256 digest unless option -n\n"
+		"        (--no-verify) is set.\n"
+		"\n"
+		"  --patch <filepath>\n"
+		"        Apply binary delta patch created by the --patch-create option\n"
+		"        to the SPI Boot Flash area starting at the offset of built-in\n"
+		"        named partition (option -p, --part) or at offset -o (--offset).\n"
+		"        Only the flash blocks referenced by the patch are read and only\n"
+		"        the changed sectors are erased and written. The patch is\n"
+		"        rejected if the flash contents differ from the patch source.\n"
+		"        WARNING: The sectors are rewritten in place, an interrupted patch\n"
+		"        cannot be resumed or applied again. Requires option -y (--yes).\n"
+		"\n"
+		"  --patch-create <filepath>\n"
+		"        Create binary delta patch (option -O, --output) transforming\n"
+		"        the image from the file specified by option -I (--input) into\n"
+		"        the image from the file <filepath>. The device is not accessed.\n"
+		"\n"
 		"  -p, --part <partition>\n"
 		"        Select SPI Boot Flash offset and size by built-in named partition\n"
 		"        for read (option -r, --read), write (option -w, --write) or/and erase\n"
@@ -157,15 +282,18 @@ static void display_usage(void)
 	fprintf(stdout,
 		"        -----------+----------+----------+-----------------------------------\n"
 		"\n"
+		"        For the 'dtb' partition only the device tree blob is transferred\n"
+		"        (its size is taken from the FDT header). The rest of the partition\n"
+		"        is erased after writing if it is not blank.\n"
+		"\n"
 		"  -s, --size <size>\n"
 		"        Specify size for read (option -r, --read), write (option -w, --write)\n"
-		"        or erase (option -e, --erase) operations. The specified size is\n"
-		"        automatically up-aligned to the %u-byte boundary.\n"
+		"        or erase (option -e, --erase) operations. No alignment is required.\n"
 		"\n"
 		"  -o, --offset <offset>\n"
 		"        Specify SPI Boot Flash offset for read (option -r, --read), write\n"
-		"        (option -w, --write) or erase (option -e, --erase) operations. The\n"
-		"        specified size is automatically up-aligned to the %u-byte boundary.\n"
+		"        (option -w, --write) or erase (option -e, --erase) operations.\n"
+		"        No alignment is required.\n"
 		"\n"
 		"  -k, --skip <skip>\n"
 		"        The number of bytes to skip at the beginning of the input file\n"
@@ -173,7 +301,8 @@ static void display_usage(void)
 		"\n"
 		"  -n, --no-verify\n"
 		"        Do not read and verify the written data with the original data\n"
-		"        during the write (option -w, --write) operation.\n"
+		"        during the write (option -w, --write) operation, and do not\n"
+		"        verify the result of the --copy and --fill operations.\n"
 		"\n"
 		"  -y, --yes\n"
 		"        Automatically confirm destructive operations (write, erase) without\n"
@@ -186,9 +315,160 @@ static void display_usage(void)
 		"\n"
 		"  -v, --version\n"
 		"        Display information about utility, library and driver versions.\n"
+		"\n"
+		"  --efivar-list\n"
+		"        List EFI variables stored in the EFI variable store. The store\n"
+		"        location is the built-in 'var' partition unless it is specified by\n"
+		"        options -p (--part) or -o (--offset) and -s (--size).\n"
+		"\n"
+		"  --efivar-get <name>[:<guid>]\n"
+		"        Read a single EFI variable from the EFI variable store. Variable data\n"
+		"        is displayed as a hex dump or written to the file specified by\n"
+		"        the -O (--output) option. Only the variable headers and the data of\n"
+		"        the requested variable are read from flash.\n"
+		"\n"
+		"  --efivar-set <name>:<guid>\n"
+		"        Add or update a single EFI variable with the data from the file\n"
+		"        specified by the -I (--input) option. The new variable is appended\n"
+		"        to the store and the old one is marked as deleted, normally without\n"
+		"        erasing any flash sectors.\n"
+		"\n"
+		"  --efivar-attr <attributes>\n"
+		"        Attributes for the --efivar-set option. By default, the attributes\n"
+		"        of the existing variable are kept, and 0x%x (NV+BS+RT) is used for\n"
+		"        a new variable.\n"
+		"\n"
+		"  --efivar-delete <name>:<guid>\n"
+		"        Mark a single EFI variable as deleted.\n"
+		"\n"
+		"  --efivar-reclaim\n"
+		"        Reclaim space occupied by deleted and updated EFI variables. Only\n"
+		"        sectors with changed contents are rewritten.\n"
+		"        WARNING: The store is rewritten in place, a power loss during\n"
+		"        the reclaim destroys all EFI variables. Requires option -y (--yes).\n"
+		"\n"
+		"  --fip-list\n"
+		"        List images in the Firmware Image Package (FIP). The FIP location\n"
+		"        is the built-in 'fip' partition unless it is specified by options\n"
+		"        -p (--part) or -o (--offset) and -s (--size).\n"
+		"\n"
+		"  --fip-update <filepath>\n"
+		"        Write FIP image from the file, rewriting only the flash sectors\n"
+		"        that cover the ToC and the images that differ from the ones\n"
+		"        currently stored on flash.\n"
+		"\n"
+		"  --fat-list[=<path>]\n"
+		"        List directory of the FAT file system. The file system location\n"
+		"        is the built-in 'fat' partition unless it is specified by options\n"
+		"        -p (--part) or -o (--offset) and -s (--size). Only the sectors\n"
+		"        needed to walk the path are read from flash.\n"
+		"\n"
+		"  --fat-get <path>\n"
+		"        Extract a single file from the FAT file system to the file\n"
+		"        specified by the -O (--output) option or to the file with the\n"
+		"        same name in the current directory. Only the clusters of the\n"
+		"        file are read from flash.\n"
+		"\n"
+		"  --benchmark\n"
+		"        Measure request latency and throughput of the flash operations\n"
+		"        with several request sizes and save the best throughput and\n"
+		"        request size of each operation to the profile (option --profile)\n"
+		"        used by the --plan option and the flash operations. If the scratch\n"
+		"        area is specified by options -p (--part) or -o (--offset) and\n"
+		"        -s (--size), its whole sectors (up to 1 MiB) are erased and\n"
+		"        written, the contents of the area are lost. Otherwise the flash\n"
+		"        is only read. SMC calls per KiB are reported if the driver\n"
+		"        provides the SMC counter.\n"
+		"\n"
+		"  --scrub\n"
+		"        Check the flash for corruption in the background. Each sector\n"
+		"        of the flash (or of the area specified by options -p (--part) or\n"
+		"        -o (--offset) and -s (--size)) is read at a limited rate and its\n"
+		"        SHA-256 digest is compared with the baseline stored in the scrub\n"
+		"        manifest. Changed and unreadable sectors are reported and the exit\n"
+		"        status is non-zero. The run ends after a complete pass or on\n"
+		"        SIGINT/SIGTERM, the next run continues from the same sector.\n"
+		"        Foreground flash operations are not blocked by the scrub.\n"
+		"\n"
+		"  --scrub-rate <KiB/s>\n"
+		"        Maximum scrub read rate (default: %u KiB/s).\n"
+		"\n"
+		"  --scrub-time <seconds>\n"
+		"        Stop the scrub after the time, the next run continues.\n"
+		"\n"
+		"  --scrub-accept\n"
+		"        Accept the current contents of the changed sectors as the new\n"
+		"        baseline instead of reporting them.\n"
+		"\n"
+		"  --manifest <filepath>\n"
+		"        Scrub manifest file (default: %s). Flash areas\n"
+		"        modified by the other operations are dropped from the baseline.\n"
+		"\n"
+#ifdef USE_LIBCURL
+		"  --cache[=<dirpath>]\n"
+		"        Keep the images downloaded by the -w (--write) option in the local\n"
+		"        cache directory (default: %s). A cached image\n"
+		"        is validated with a conditional request (ETag, Last-Modified) and\n"
+		"        is not downloaded again if it is not modified.\n"
+		"\n"
+		"  --cache-size <MiB>\n"
+		"        Cache size limit, the least recently used images are removed\n"
+		"        (default: %u MiB).\n"
+		"\n"
+		"  --cache-ttl <seconds>\n"
+		"        Use the cached image without contacting the server for the time\n"
+		"        after its last validation (default: 0, always validate).\n"
+		"\n"
+#endif
+		"  --report json[:<filepath>]\n"
+		"        Output JSON report with per-phase (erase, write, verify, ...) wall\n"
+		"        time, bytes, throughput, ioctl and retry counts and SHA-256 digest\n"
+		"        of the data to the file or to the standard error output (stderr).\n"
+		"        The report is also produced when the operation fails.\n"
+		"\n"
+		"  --resume\n"
+		"        Resume an interrupted write (option -w, --write) of the same image\n"
+		"        to the same flash area. The sectors recorded as written in the write\n"
+		"        journal are checked against the image by comparing SHA-256 digests\n"
+		"        of the whole sectors, and only the remaining sectors are erased,\n"
+		"        written and verified.\n"
+		"\n"
+		"  --journal <filepath>\n"
+		"        Write journal file used to resume an interrupted write\n"
+		"        (default: %s). The journal is removed after a successful write.\n"
+		"\n"
+		"  --plan[=json[:<filepath>]]\n"
+		"        Do not modify the flash, only output the plan of the write\n"
+		"        (option -w, --write) or erase (option -e, --erase) operation:\n"
+		"        sectors skipped as identical, sectors written without erase,\n"
+		"        erased and written sectors, the list of flash operations and\n"
+		"        the predicted wall time. The plan is output as text or JSON\n"
+		"        to the standard output or to the file.\n"
+		"\n"
+		"  --profile <filepath>\n"
+		"        Throughput profile for the --plan option and the output file\n"
+		"        of the --benchmark option\n"
+		"        (default: %s). Each line of the profile\n"
+		"        is \"<read|write|erase> <MiB/s> [<request size>]\". Built-in\n"
+		"        estimates are used if the default profile does not exist. Flash\n"
+		"        operations are split into requests of the profile request size.\n"
+		"\n"
+		"  -O, --output <filepath>\n"
+		"        Output file for the --efivar-get, --fat-get and --patch-create options.\n"
+		"\n"
+		"  -I, --input <filepath>\n"
+		"        Input file for the --efivar-set option and the source image\n"
+		"        for the --patch-create option.\n"
 		"\n",
-		alignment,
-		alignment
+		EFI_VARIABLE_DEFAULT_ATTRIBUTES,
+		SCRUB_DEFAULT_RATE,
+		SCRUB_DEFAULT_PATH,
+#ifdef USE_LIBCURL
+		DOWNLOAD_CACHE_DEFAULT_PATH,
+		DOWNLOAD_CACHE_DEFAULT_SIZE,
+#endif
+		JOURNAL_DEFAULT_PATH,
+		PLAN_PROFILE_DEFAULT_PATH
 	);
 }
 
@@ -204,6 +484,7 @@ static void display_usage(void)
 static int parse_cli_args(int argc, char *argv[])
 {
 	int opt;
+	int ret;
 
 	while((opt = getopt_long(argc, argv, opts_str, opts, NULL)) != EOF) {
 		switch(opt) {
@@ -286,6 +567,210 @@ static int parse_cli_args(int argc, char *argv[])
 				break;
 			}
 
+			case 'O': { /* --output */
+				output = optarg;
+				break;
+			}
+
+			case 'I': { /* --input */
+				input = optarg;
+				break;
+			}
+
+			case OPT_EFIVAR_SET: { /* --efivar-set */
+				if (mode == MODE_NONE) {
+					mode = MODE_EFIVAR_SET;
+					efivar = optarg;
+				}
+				break;
+			}
+
+			case OPT_EFIVAR_DELETE: { /* --efivar-delete */
+				if (mode == MODE_NONE) {
+					mode = MODE_EFIVAR_DELETE;
+					efivar = optarg;
+				}
+				break;
+			}
+
+			case OPT_EFIVAR_RECLAIM: { /* --efivar-reclaim */
+				if (mode == MODE_NONE) {
+					mode = MODE_EFIVAR_RECLAIM;
+				}
+				break;
+			}
+
+			case OPT_EFIVAR_ATTR: { /* --efivar-attr */
+				efivar_attr = (int)strtoul(optarg, NULL, 0);
+				break;
+			}
+
+			case OPT_EFIVAR_LIST: { /* --efivar-list */
+				if (mode == MODE_NONE) {
+					mode = MODE_EFIVAR_LIST;
+				}
+				break;
+			}
+
+			case OPT_EFIVAR_GET: { /* --efivar-get */
+				if (mode == MODE_NONE) {
+					mode = MODE_EFIVAR_GET;
+					efivar = optarg;
+				}
+				break;
+			}
+
+			case OPT_FIP_LIST: { /* --fip-list */
+				if (mode == MODE_NONE) {
+					mode = MODE_FIP_LIST;
+				}
+				break;
+			}
+
+			case OPT_FIP_UPDATE: { /* --fip-update */
+				if (mode == MODE_NONE) {
+					mode = MODE_FIP_UPDATE;
+					filepath = optarg;
+				}
+				break;
+			}
+
+			case OPT_FAT_LIST: { /* --fat-list */
+				if (mode == MODE_NONE) {
+					mode = MODE_FAT_LIST;
+					fat_path = optarg ? optarg : "/";
+				}
+				break;
+			}
+
+			case OPT_FAT_GET: { /* --fat-get */
+				if (mode == MODE_NONE) {
+					mode = MODE_FAT_GET;
+					fat_path = optarg;
+				}
+				break;
+			}
+
+			case OPT_REPORT: { /* --report */
+				if (report_init(optarg)) {
+					fprintf(stderr, "ERROR: Invalid report specification '%s'\n", optarg);
+					return EINVAL;
+				}
+				break;
+			}
+
+			case OPT_RESUME: { /* --resume */
+				resume = 1;
+				break;
+			}
+
+			case OPT_JOURNAL: { /* --journal */
+				journal_path = optarg;
+				break;
+			}
+
+			case OPT_PLAN: { /* --plan */
+				if (plan_init(optarg)) {
+					fprintf(stderr, "ERROR: Invalid plan specification '%s'\n", optarg);
+					return EINVAL;
+				}
+				break;
+			}
+
+			case OPT_PROFILE: { /* --profile */
+				profile_path = optarg;
+				break;
+			}
+
+			case OPT_BENCHMARK: { /* --benchmark */
+				if (mode == MODE_NONE) {
+					mode = MODE_BENCHMARK;
+				}
+				break;
+			}
+
+			case OPT_COPY: { /* --copy */
+				if (mode == MODE_NONE) {
+					mode = MODE_FLASH_COPY;
+					copy_dst = strtoul(optarg, NULL, 0);
+				}
+				break;
+			}
+
+			case OPT_FILL: { /* --fill */
+				if (mode == MODE_NONE) {
+					mode = MODE_FLASH_FILL;
+					fill_pattern = strtoul(optarg, NULL, 0);
+					if (fill_pattern > 0xff) {
+						fprintf(stderr, "ERROR: Invalid fill byte value '%s'\n", optarg);
+						return EINVAL;
+					}
+				}
+				break;
+			}
+
+			case OPT_SCRUB: { /* --scrub */
+				if (mode == MODE_NONE) {
+					mode = MODE_SCRUB;
+				}
+				break;
+			}
+
+			case OPT_SCRUB_RATE: { /* --scrub-rate */
+				scrub_rate = strtoul(optarg, NULL, 0);
+				if (!scrub_rate) {
+					fprintf(stderr, "ERROR: Invalid scrub rate '%s'\n", optarg);
+					return EINVAL;
+				}
+				break;
+			}
+
+			case OPT_SCRUB_TIME: { /* --scrub-time */
+				scrub_time = strtoul(optarg, NULL, 0);
+				break;
+			}
+
+			case OPT_SCRUB_ACCEPT: { /* --scrub-accept */
+				scrub_accept = 1;
+				break;
+			}
+
+			case OPT_MANIFEST: { /* --manifest */
+				manifest_path = optarg;
+				break;
+			}
+
+			case OPT_PATCH: { /* --patch */
+				if (mode == MODE_NONE) {
+					mode = MODE_FLASH_PATCH;
+					filepath = optarg;
+				}
+				break;
+			}
+
+			case OPT_PATCH_CREATE: { /* --patch-create */
+				if (mode == MODE_NONE) {
+					mode = MODE_PATCH_CREATE;
+					filepath = optarg;
+				}
+				break;
+			}
+
+			case OPT_CACHE: { /* --cache */
+				cache_path = optarg ? optarg : DOWNLOAD_CACHE_DEFAULT_PATH;
+				break;
+			}
+
+			case OPT_CACHE_SIZE: { /* --cache-size */
+				cache_size = strtoul(optarg, NULL, 0);
+				break;
+			}
+
+			case OPT_CACHE_TTL: { /* --cache-ttl */
+				cache_ttl = strtoul(optarg, NULL, 0);
+				break;
+			}
+
 			case 'v': { /* --version */
 				if (mode == MODE_NONE) {
 					mode = MODE_SHOW_VERSION;
@@ -299,63 +784,212 @@ static int parse_cli_args(int argc, char *argv[])
 	}
 
 	if (mode == MODE_NONE) {
-		fprintf(stderr, "ERROR: You must specify '--read', '--write' or '--erase' option\n");
+		fprintf(stderr, "ERROR: You must specify an operation option ('--read', '--write', '--erase', ...)\n");
+		return EINVAL;
+	}
+
+	/* Not power loss safe, so not confirmed by a mere keystroke */
+	if ((mode == MODE_EFIVAR_RECLAIM) && !yes) {
+		fprintf(stderr, "ERROR: Option '--efivar-reclaim' requires '--yes', a power loss during "
+			"the reclaim destroys all EFI variables\n");
+		return EINVAL;
+	}
+
+	/* The sectors are rewritten in place, an interrupted patch cannot be resumed */
+	if ((mode == MODE_FLASH_PATCH) && !yes) {
+		fprintf(stderr, "ERROR: Option '--patch' requires '--yes', an interrupted patch "
+			"leaves the flash area partially rewritten and cannot be resumed\n");
 		return EINVAL;
 	}
 
+	if (plan_enabled()) {
+		if ((mode != MODE_FLASH_WRITE) && (mode != MODE_FLASH_ERASE)) {
+			fprintf(stderr, "ERROR: Option '--plan' can only be used with '--write' or '--erase'\n");
+			return EINVAL;
+		}
+
+		/* Keep the plan output clean */
+		if (plan_uses_stdout())
+			quiet = 1;
+	}
+
+	/*
+	 * The profile is the output of the benchmark, for the other modes
+	 * it provides the estimates of --plan and the request sizes
+	 */
+	if (mode != MODE_BENCHMARK) {
+		ret = profile_path
+			? plan_profile_load(profile_path, 1)
+			: plan_profile_load(PLAN_PROFILE_DEFAULT_PATH, 0);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
+/* Maximum rate of the progress output, updates per second */
+#define PROGRESS_MAX_RATE 10
+
 static void baikal_scp_flash_progress_cb(
-	const baikal_scp_flash_progress_info_t *progress_info)
+	const baikal_scp_flash_progress2_info_t *progress_info, void *user)
 {
-	const char *strop = "UNKNOWN";
-	static unsigned int percent = 100;
+	static const char *phases[] = {
+		[BAIKAL_SCP_FLASH_PHASE_READ]    = "Reading",
+		[BAIKAL_SCP_FLASH_PHASE_ERASE]   = "Erasing",
+		[BAIKAL_SCP_FLASH_PHASE_WRITE]   = "Writing",
+		[BAIKAL_SCP_FLASH_PHASE_VERIFY]  = "Verifying",
+		[BAIKAL_SCP_FLASH_PHASE_COMPARE] = "Comparing",
+	};
 
-	if (progress_info->percent == percent)
+	/* Sectors written so far are recorded in the journal */
+	if (user) {
+		unsigned int run_offset = *(unsigned int *)user;
+
+		if (progress_info->offset > run_offset) {
+			journal_mark(run_offset, progress_info->offset - run_offset,
+				JOURNAL_SECTOR_WRITTEN, 1);
+			journal_flush(0);
+		}
+	}
+
+	/* Nothing to show before the first request of the phase */
+	if (quiet || !progress_info->size || (!progress_info->bytes && !progress_info->final))
 		return;
 
-	if (!quiet) {
-		if (progress_info->operation == BAIKAL_SCP_FLASH_READ)
-			strop = "Reading";
-		else if (progress_info->operation == BAIKAL_SCP_FLASH_WRITE)
-			strop = "Writing";
-		else if (progress_info->operation == BAIKAL_SCP_FLASH_ERASE)
-			strop = "Erasing";
+	printf("\r%s: [+0x%x] 0x%08llx / 0x%08llx [%3u%%] %8.1f KiB/s",
+		phases[progress_info->phase],
+		progress_info->offset,
+		progress_info->bytes,
+		progress_info->size,
+		progress_info->percent,
+		progress_info->rate / 1024.0);
+
+	if (progress_info->final)
+		printf(" %7.1f s   ", progress_info->elapsed);
+	else if (progress_info->eta >= 0)
+		printf(" ETA %3.0f s", progress_info->eta);
+	else
+		printf(" ETA   - s");
+
+	fflush(stdout);
+}
 
-		printf("\r%s: [+0x%x] 0x%08x / 0x%08x [%3u%%]",
-			strop,
-			progress_info->offset,
-			progress_info->bytes,
-			progress_info->size,
-			progress_info->percent);
+static baikal_scp_flash_progress2_t progress = {
+	.cb       = baikal_scp_flash_progress_cb,
+	.max_rate = PROGRESS_MAX_RATE,
+};
 
-		fflush(stdout);
+/*
+ * Operation name for the report
+ */
+static const char *mode_name(void)
+{
+	switch(mode) {
+		case MODE_SHOW_VERSION:   return "version";
+		case MODE_FLASH_READ:     return "read";
+		case MODE_FLASH_WRITE:    return "write";
+		case MODE_FLASH_ERASE:    return "erase";
+		case MODE_FLASH_COPY:     return "copy";
+		case MODE_FLASH_FILL:     return "fill";
+		case MODE_FLASH_PATCH:    return "patch";
+		case MODE_PATCH_CREATE:   return "patch-create";
+		case MODE_EFIVAR_LIST:    return "efivar-list";
+		case MODE_EFIVAR_GET:     return "efivar-get";
+		case MODE_EFIVAR_SET:     return "efivar-set";
+		case MODE_EFIVAR_DELETE:  return "efivar-delete";
+		case MODE_EFIVAR_RECLAIM: return "efivar-reclaim";
+		case MODE_FIP_LIST:       return "fip-list";
+		case MODE_FIP_UPDATE:     return "fip-update";
+		case MODE_FAT_LIST:       return "fat-list";
+		case MODE_FAT_GET:        return "fat-get";
+		case MODE_BENCHMARK:      return "benchmark";
+		case MODE_SCRUB:          return "scrub";
+		default:                  return "none";
 	}
+}
 
-	percent = progress_info->percent;
+/*
+ * Operation modifies the flash area specified by offset and size
+ * (by copy_dst and size for the copy)
+ */
+static int mode_modifies_flash(void)
+{
+	switch(mode) {
+		case MODE_FLASH_WRITE:
+		case MODE_FLASH_ERASE:
+		case MODE_FLASH_COPY:
+		case MODE_FLASH_FILL:
+		case MODE_FLASH_PATCH:
+		case MODE_EFIVAR_SET:
+		case MODE_EFIVAR_DELETE:
+		case MODE_EFIVAR_RECLAIM:
+		case MODE_FIP_UPDATE:
+		case MODE_BENCHMARK:
+			return 1;
+
+		default:
+			return 0;
+	}
 }
 
-static void align_sizes(void)
+/*
+ * Use built-in partition offset and size if the
+ * flash area is not specified in the command line
+ */
+static void default_part(char *name)
 {
-	unsigned alignment = baikal_scp_flash_alignment();
+	if (!size) {
+		part   = find_part(name);
+		offset = part->smc_offset;
+		size   = part->size;
+	}
+}
 
-	offset = ALIGN(offset, alignment);
-	size   = ALIGN(size, alignment);
+/*
+ * Check that the flash area is the built-in 'dtb' partition
+ */
+static int is_dtb_part(void)
+{
+	return part && !strcmp(part->name, "dtb") && (offset == part->smc_offset);
+}
+
+/*
+ * Ask for confirmation of the destructive operation unless option -y is set.
+ * The operation message is not displayed in the quiet mode, so the prompt
+ * names the operation then.
+ */
+static int confirm(const char *what)
+{
+	char s[2];
+
+	if (yes)
+		return 1;
+
+	if (quiet)
+		fprintf(stdout, "%s. Continue? [y/N] ", what);
+	else
+		fprintf(stdout, "Continue? [y/N] ");
+
+	fflush(stdout);
+	return fgets(s, 2, stdin) && ((s[0] == 'y') || (s[0] == 'Y'));
 }
 
 static int flash_read(int fhandle)
 {
 	int ret;
 	void *buffer;
-
-	align_sizes();
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
 
 	buffer = calloc(size, 1);
 	if (!buffer)
 		return ENOMEM;
 
-	ret = baikal_scp_flash_read(offset, size, buffer, baikal_scp_flash_progress_cb);
+	report_phase_begin("read");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_READ, size);
+	ret = baikal_scp_flash_read2(offset, size, buffer, &progress);
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
 
 	if (!quiet) {
 		printf("\n");
@@ -366,6 +1000,9 @@ static int flash_read(int fhandle)
 		goto exit;
 	}
 
+	baikal_scp_sha256(buffer, size, digest);
+	report_digest(digest);
+
 	if (write(fhandle, buffer, size) != size) {
 		ret = errno;
 		fprintf(stderr, "ERROR: Failed to write flash data to file (%d)\n", ret);
@@ -381,14 +1018,132 @@ exit:
 	return ret;
 }
 
+/*
+ * Size of the part of the flash sector at pos lying before end
+ */
+static unsigned int sector_part(unsigned int pos, unsigned int end)
+{
+	unsigned int part = end - pos;
+	baikal_scp_flash_info_t flash_info;
+
+	if (!baikal_scp_flash_info(&flash_info) &&
+	    (flash_info.sector_size - pos % flash_info.sector_size < part))
+		part = flash_info.sector_size - pos % flash_info.sector_size;
+
+	return part;
+}
+
+/*
+ * Compare the image with the current flash contents sector by sector.
+ * Identical sectors are skipped, sectors that only need bits to be
+ * cleared (e.g. blank sectors) are written without erase.
+ */
+static int flash_compare(const unsigned char *buffer, unsigned char *buffer_read)
+{
+	int ret;
+	unsigned int run_offset, run_size;
+	unsigned int pos, sector, part, i;
+
+	for (pos = offset;
+	     journal_run(pos, JOURNAL_SECTOR_WRITTEN, &run_offset, &run_size);
+	     pos = run_offset + run_size) {
+		ret = baikal_scp_flash_read2(run_offset, run_size,
+			buffer_read + (run_offset - offset), &progress);
+		if (ret)
+			return ret;
+
+		if (plan_enabled()) {
+			ret = plan_add("compare", run_offset, run_size);
+			if (ret)
+				return ret;
+		}
+
+		for (sector = run_offset; sector < run_offset + run_size; sector += part) {
+			const unsigned char *new = buffer + (sector - offset);
+			const unsigned char *cur = buffer_read + (sector - offset);
+
+			part = sector_part(sector, run_offset + run_size);
+
+			if (!memcmp(cur, new, part)) {
+				journal_mark(sector, part, JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_VERIFIED, 1);
+				continue;
+			}
+
+			for (i = 0; (i < part) && ((cur[i] & new[i]) == new[i]); i++);
+
+			journal_mark(sector, part, JOURNAL_SECTOR_NO_ERASE, i == part);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the read back data sector by sector, so that only
+ * the mismatched sectors are written again on resume
+ */
+static int flash_verify(const unsigned char *buffer, const unsigned char *buffer_read,
+	unsigned int run_offset, unsigned int run_size)
+{
+	int ret = 0;
+	unsigned int pos, part;
+
+	for (pos = run_offset; pos < run_offset + run_size; pos += part) {
+		part = sector_part(pos, run_offset + run_size);
+
+		if (memcmp(buffer + (pos - run_offset), buffer_read + (pos - run_offset), part)) {
+			journal_mark(pos, part, JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_NO_ERASE, 0);
+			ret = EIO;
+		}
+		else {
+			journal_mark(pos, part, JOURNAL_SECTOR_VERIFIED, 1);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Add the operations left after the comparison to the plan
+ */
+static int flash_write_plan(void)
+{
+	int ret = 0;
+	unsigned int run_offset, run_size;
+	unsigned int pos;
+	unsigned int total = journal_count(0);
+	unsigned int to_write = journal_count(JOURNAL_SECTOR_WRITTEN);
+	unsigned int to_erase = journal_count(JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_NO_ERASE);
+
+	plan_sectors(total, total - to_write, to_write - to_erase, to_erase);
+
+	for (pos = offset; !ret &&
+	     journal_run(pos, JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_NO_ERASE, &run_offset, &run_size);
+	     pos = run_offset + run_size)
+		ret = plan_add("erase", run_offset, run_size);
+
+	for (pos = offset; !ret &&
+	     journal_run(pos, JOURNAL_SECTOR_WRITTEN, &run_offset, &run_size);
+	     pos = run_offset + run_size)
+		ret = plan_add("write", run_offset, run_size);
+
+	for (pos = offset; !ret && !no_verify &&
+	     journal_run(pos, JOURNAL_SECTOR_VERIFIED, &run_offset, &run_size);
+	     pos = run_offset + run_size)
+		ret = plan_add("verify", run_offset, run_size);
+
+	return ret ? ret : plan_emit();
+}
+
 static int flash_write(int fhandle)
 {
 	int ret;
-	void *buffer;
-	void *buffer_read;
+	unsigned char *buffer;
+	unsigned char *buffer_read;
 	unsigned int file_read_size = size;
-
-	align_sizes();
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned int run_offset, run_size;
+	unsigned int pos;
 
 	buffer = calloc(size, 1);
 	if (!buffer) {
@@ -410,33 +1165,119 @@ static int flash_write(int fhandle)
 		goto exit;
 	}
 
-	/* 1. Erase */
-	ret = baikal_scp_flash_erase(offset, size, baikal_scp_flash_progress_cb);
+	baikal_scp_sha256(buffer, size, digest);
+	report_digest(digest);
+
+	ret = journal_open(journal_path, offset, size, buffer, digest,
+		resume, plan_enabled(), quiet);
+	if (ret)
+		goto exit;
+
+	/*
+	 * Each phase processes only the sectors not yet marked
+	 * in the journal (identical or already written on resume)
+	 */
+
+	/* 1. Compare */
+	report_phase_begin("compare");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_COMPARE,
+		journal_bytes(JOURNAL_SECTOR_WRITTEN));
+	ret = flash_compare(buffer, buffer_read);
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
 
 	if (!quiet) {
 		printf("\n");
 	}
 
 	if (ret) {
-		fprintf(stderr, "ERROR: Failed to erase flash data (%d)\n", ret);
+		fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+		goto exit_journal;
+	}
+
+	report_sectors(journal_count(0), journal_count(0) - journal_count(JOURNAL_SECTOR_WRITTEN));
+
+	if (plan_enabled()) {
+		ret = flash_write_plan();
+		journal_close(0);
 		goto exit;
 	}
 
-	/* 2. Write */
-	ret = baikal_scp_flash_write(offset, size, buffer, baikal_scp_flash_progress_cb);
+	/* 2. Erase */
+	report_phase_begin("erase");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_ERASE,
+		journal_bytes(JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_NO_ERASE));
+	for (pos = offset; !ret &&
+	     journal_run(pos, JOURNAL_SECTOR_WRITTEN | JOURNAL_SECTOR_NO_ERASE, &run_offset, &run_size);
+	     pos = run_offset + run_size)
+		ret = baikal_scp_flash_erase2(run_offset, run_size, &progress);
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
+
+	if (!quiet) {
+		printf("\n");
+	}
+
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to erase flash data (%d)\n", ret);
+		goto exit_journal;
+	}
+
+	/* 3. Write */
+	report_phase_begin("write");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_WRITE,
+		journal_bytes(JOURNAL_SECTOR_WRITTEN));
+	progress.user = &run_offset;
+	for (pos = offset; !ret &&
+	     journal_run(pos, JOURNAL_SECTOR_WRITTEN, &run_offset, &run_size);
+	     pos = run_offset + run_size) {
+		ret = baikal_scp_flash_write2(run_offset, run_size,
+			buffer + (run_offset - offset), &progress);
+		if (!ret)
+			journal_mark(run_offset, run_size, JOURNAL_SECTOR_WRITTEN, 1);
+	}
+	progress.user = NULL;
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
 
 	if (!quiet) {
 		printf("\n");
 	}
 
+	journal_flush(1);
+
 	if (ret) {
 		fprintf(stderr, "ERROR: Failed to write data to flash (%d)\n", ret);
-		goto exit;
+		goto exit_journal;
 	}
 
 	if (!no_verify) {
-		/* 3. Read */
-		ret = baikal_scp_flash_read(offset, size, buffer_read, baikal_scp_flash_progress_cb);
+		/* 4. Read and verify */
+		report_phase_begin("verify");
+		baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_VERIFY,
+			journal_bytes(JOURNAL_SECTOR_VERIFIED));
+		for (pos = offset; !ret &&
+		     journal_run(pos, JOURNAL_SECTOR_VERIFIED, &run_offset, &run_size);
+		     pos = run_offset + run_size) {
+			ret = baikal_scp_flash_read2(run_offset, run_size,
+				buffer_read + (run_offset - offset), &progress);
+			if (ret)
+				break;
+
+			ret = flash_verify(buffer + (run_offset - offset),
+				buffer_read + (run_offset - offset), run_offset, run_size);
+			if (ret) {
+				baikal_scp_flash_progress2_end(&progress);
+				report_phase_end();
+				if (!quiet) {
+					printf("\n");
+				}
+				fprintf(stderr, "ERROR: Verification failed\n");
+				goto exit_journal;
+			}
+		}
+		baikal_scp_flash_progress2_end(&progress);
+		report_phase_end();
 
 		if (!quiet) {
 			printf("\n");
@@ -444,13 +1285,7 @@ static int flash_write(int fhandle)
 
 		if (ret) {
 			fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
-			goto exit;
-		}
-
-		/* 4. Verify */
-		if (memcmp(buffer, buffer_read, size)) {
-			fprintf(stderr, "ERROR: Verification failed\n");
-			goto exit;
+			goto exit_journal;
 		}
 	}
 
@@ -458,6 +1293,12 @@ static int flash_write(int fhandle)
 		printf("OK: Success\n");
 	}
 
+exit_journal:
+	if (journal_close(!ret) && !quiet) {
+		printf("Write progress is saved to \"%s\", run the same command\n"
+			"with the --resume option to continue\n", journal_path);
+	}
+
 exit:
 	free(buffer_read);
 	free(buffer);
@@ -468,9 +1309,11 @@ static int flash_erase(int fhandle)
 {
 	int ret;
 
-	align_sizes();
-
-	ret = baikal_scp_flash_erase(offset, size, baikal_scp_flash_progress_cb);
+	report_phase_begin("erase");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_ERASE, size);
+	ret = baikal_scp_flash_erase2(offset, size, &progress);
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
 	printf("\n");
 	if (ret) {
 		fprintf(stderr, "\nERROR: Failed to erase flash data (%d)\n", ret);
@@ -482,6 +1325,96 @@ static int flash_erase(int fhandle)
 	return ret;
 }
 
+/*
+ * The driver copies and fills the flash inside the firmware, so the data is
+ * not seen by the utility. Verify the result by comparing the SHA-256 digest
+ * of the destination with the digest of the source area (copy) or of the
+ * pattern (fill), only the digests are transferred.
+ */
+static int flash_copy_fill_verify(void)
+{
+	int ret;
+	unsigned int dst = (mode == MODE_FLASH_COPY) ? copy_dst : offset;
+	unsigned char expected[BAIKAL_SCP_SHA256_SIZE];
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+
+	report_phase_begin("verify");
+
+	if (mode == MODE_FLASH_COPY) {
+		ret = baikal_scp_flash_sha256(offset, size, expected);
+	} else {
+		unsigned char pattern[4096];
+		baikal_scp_sha256_ctx_t ctx;
+		unsigned int pos;
+
+		memset(pattern, fill_pattern, sizeof(pattern));
+		baikal_scp_sha256_init(&ctx);
+		for (pos = 0; pos < size; pos += sizeof(pattern)) {
+			baikal_scp_sha256_update(&ctx, pattern,
+				(size - pos < sizeof(pattern)) ? (size - pos) : sizeof(pattern));
+		}
+		baikal_scp_sha256_final(&ctx, expected);
+		ret = 0;
+	}
+
+	if (!ret)
+		ret = baikal_scp_flash_sha256(dst, size, digest);
+
+	report_phase_end();
+
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+		return ret;
+	}
+
+	if (memcmp(digest, expected, sizeof(digest))) {
+		fprintf(stderr, "ERROR: Verification failed (SHA-256 of the area at 0x%x "
+			"does not match the %s)\n", dst,
+			(mode == MODE_FLASH_COPY) ? "source" : "pattern");
+		return EIO;
+	}
+
+	return 0;
+}
+
+static int flash_copy_fill(void)
+{
+	int ret;
+
+	report_phase_begin("write");
+	baikal_scp_flash_progress2_begin(&progress, BAIKAL_SCP_FLASH_PHASE_WRITE, size);
+
+	if (mode == MODE_FLASH_COPY)
+		ret = baikal_scp_flash_copy2(offset, copy_dst, size, &progress);
+	else
+		ret = baikal_scp_flash_fill2(offset, size, fill_pattern, &progress);
+
+	baikal_scp_flash_progress2_end(&progress);
+	report_phase_end();
+
+	if (!quiet) {
+		printf("\n");
+	}
+
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to %s flash data (%d)\n",
+			(mode == MODE_FLASH_COPY) ? "copy" : "fill", ret);
+		return ret;
+	}
+
+	if (!no_verify) {
+		ret = flash_copy_fill_verify();
+		if (ret)
+			return ret;
+	}
+
+	if (!quiet) {
+		printf("OK: Success\n");
+	}
+
+	return 0;
+}
+
 int display_version(void)
 {
 	int ret;
@@ -511,66 +1444,57 @@ int display_version(void)
 	return ret;
 }
 
-#ifdef USE_LIBCURL
-
-static size_t curl_retrieved_size = 0;
-
-static size_t curl_write_cb(void *contents, size_t size, size_t nmemb, void *userp)
-{
-	size_t realsize = size * nmemb;
-	size_t nmemb_written;
-	FILE *fp = (FILE *)userp;
-
-	if (!fp)
-		return 0;
-
-	nmemb_written = fwrite(contents, size, nmemb, fp);
-	if (nmemb_written != nmemb)
-		return 0;
-
-	curl_retrieved_size += realsize;
-	return realsize;
-}
-
-#endif
-
 int main(int argc, char *argv[])
 {
 	int fh = -1;
 	int ret;
 	baikal_scp_flash_info_t flash_info;
 
-#ifdef USE_LIBCURL
-	FILE *ftmp = NULL;
-
-	static const char *supported_protos[] = {
-		"http://",
-		"https://",
-		"scp://",
-		"ftp://",
-		NULL
-	};
-#endif
-
 	ret = parse_cli_args(argc, argv);
 	if (ret) {
 		display_usage();
 		return ret;
 	}
 
+	/* The patch is created from the image files, without the device */
+	if (mode == MODE_PATCH_CREATE) {
+		ret = patch_create(input, filepath, output, quiet);
+		report_operation(mode_name(), 0, 0);
+		report_emit(ret);
+		return ret;
+	}
+
 	ret = baikal_scp_init();
 	if (ret) {
 		fprintf(stderr, "ERROR: Failed to initialize Baikal SCP library (%d)\n", ret);
+		report_operation(mode_name(), offset, size);
+		report_emit(ret);
 		return ret;
 	}
 
 	ret = baikal_scp_flash_info(&flash_info);
 	if (ret) {
 		fprintf(stderr, "ERROR: Failed to retrieve flash information (%d)\n", ret);
+		report_operation(mode_name(), offset, size);
+		report_emit(ret);
 		baikal_scp_deinit();
 		return ret;
 	}
 
+	/*
+	 * The modes only reading the flash are run on behalf of a waiting user,
+	 * so their reads are not throttled by the driver duty cycle limit
+	 * (not supported by the older drivers and the daemon, not an error)
+	 */
+	if ((mode == MODE_FLASH_READ) ||
+	    (mode == MODE_EFIVAR_LIST) || (mode == MODE_EFIVAR_GET) ||
+	    (mode == MODE_FIP_LIST) ||
+	    (mode == MODE_FAT_LIST) || (mode == MODE_FAT_GET))
+		baikal_scp_flash_set_interactive(1);
+
+	/* Request sizes measured by --benchmark */
+	plan_profile_apply();
+
 	switch(mode) {
 		case MODE_SHOW_VERSION:
 			ret = display_version();
@@ -580,6 +1504,18 @@ int main(int argc, char *argv[])
 			if (!size)
 				size = flash_info.total_size - offset;
 
+			/* Read only the device tree blob, not the whole partition */
+			if (is_dtb_part()) {
+				unsigned int fdt_size;
+
+				if (!fdt_flash_size(offset, size, &fdt_size)) {
+					size = fdt_size;
+
+					if (!quiet)
+						fprintf(stdout, "Reading FDT blob of %u bytes\n", fdt_size);
+				}
+			}
+
 			if ((fh = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
 				ret = errno;
 				fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", filepath, ret);
@@ -591,54 +1527,15 @@ int main(int argc, char *argv[])
 
 		case MODE_FLASH_WRITE: {
 			struct stat st;
+			int dtb_write = 0;
+			unsigned int dtb_old_size = 0;
 
 #ifdef USE_LIBCURL
-			int use_curl = 0;
-			int i;
-
-			for (i = 0; supported_protos[i]; i++) {
-				if (!strncmp(filepath, supported_protos[i], strlen(supported_protos[i]))) {
-					use_curl = 1;
-					break;
-				}
-			}
-
-			if (use_curl) {
-				CURL *curl_handle;
-				CURLcode res;
-
-				ftmp = tmpfile();
-				if (!ftmp) {
-					ret = -1;
-					fprintf(stderr, "ERROR: Failed to open temporary file\n");
+			if (download_is_url(filepath)) {
+				ret = download_open(filepath, cache_path, cache_size, cache_ttl,
+					quiet, &fh, &filesize);
+				if (ret)
 					break;
-				}
-
-				if (!quiet) {
-					fprintf(stdout, "Downloading %s...\n", filepath);
-				}
-
-				curl_global_init(CURL_GLOBAL_ALL);
-				curl_handle = curl_easy_init();
-
-				curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, 0L);
-				curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, quiet ? 1L : 0L);
-				curl_easy_setopt(curl_handle, CURLOPT_URL, filepath);
-				curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curl_write_cb);
-				curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)ftmp);
-				curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-
-				res = curl_easy_perform(curl_handle);
-				if(res != CURLE_OK) {
-					ret = -1;
-					fprintf(stderr, "ERROR: Downloading failed: %s\n",
-					curl_easy_strerror(res));
-					break;
-				}
-
-				filesize = curl_retrieved_size;
-				fh = fileno(ftmp);
-				rewind(ftmp);
 
 				if (!quiet) {
 					fprintf(stdout, "Received %u bytes\n", filesize);
@@ -678,6 +1575,24 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			/*
+			 * For the device tree blob only the sectors covered by the new
+			 * blob are written, stale data after the blob is erased later
+			 */
+			if (is_dtb_part()) {
+				unsigned char header[FDT_HEADER_SIZE];
+				unsigned int fdt_size;
+
+				if ((pread(fh, header, sizeof(header), skip) == sizeof(header)) &&
+				    !fdt_header_size(header, size, &fdt_size)) {
+					size = fdt_size;
+					dtb_write = 1;
+
+					if (fdt_flash_size(offset, part->size, &dtb_old_size))
+						dtb_old_size = 0;
+				}
+			}
+
 			if (skip)
 				lseek(fh, skip, SEEK_SET);
 
@@ -686,16 +1601,19 @@ int main(int argc, char *argv[])
 					size, offset);
 			}
 
-			if (!yes) {
-				char s[2];
-				fprintf(stdout, "Continue? [y/N] ");
-				fflush(stdout);
-				if (!fgets(s, 2, stdin) || (s[0] != 'y' && s[0] != 'Y')) {
-					goto exit;
-				}
-			}
+			if (!plan_enabled() && !confirm("Writing SPI Boot Flash"))
+				goto exit;
 
+			plan_operation(mode_name(), offset, size);
 			ret = flash_write(fh);
+
+			if (!ret && dtb_write && !plan_enabled()) {
+				report_phase_begin("clean");
+				ret = fdt_clean_tail(offset, part->size, size, dtb_old_size, quiet);
+				report_phase_end();
+				if (ret)
+					fprintf(stderr, "ERROR: Failed to erase stale data after the blob (%d)\n", ret);
+			}
 			break;
 		}
 
@@ -708,35 +1626,155 @@ int main(int argc, char *argv[])
 					size, offset);
 			}
 
-			if (!yes) {
-				char s[2];
-				fprintf(stdout, "Continue? [y/N] ");
-				fflush(stdout);
-				if (!fgets(s, 2, stdin) || (s[0] != 'y' && s[0] != 'Y')) {
-					goto exit;
-				}
+			if (plan_enabled()) {
+				plan_operation(mode_name(), offset, size);
+				ret = plan_add("erase", offset, size);
+				if (!ret)
+					ret = plan_emit();
+				break;
 			}
 
+			if (!confirm("Erasing SPI Boot Flash"))
+				goto exit;
+
 			ret = flash_erase(fh);
 			break;
 
+		case MODE_FLASH_COPY:
+		case MODE_FLASH_FILL:
+			if (!size) {
+				fprintf(stderr, "ERROR: The flash area must be specified by options "
+					"-p (--part) or -o (--offset) and -s (--size)\n");
+				ret = EINVAL;
+				break;
+			}
+
+			if (!quiet) {
+				if (mode == MODE_FLASH_COPY)
+					fprintf(stdout, "Copying 0x%x bytes of SPI Boot Flash from offset 0x%0x "
+						"to offset 0x%0x\n", size, offset, copy_dst);
+				else
+					fprintf(stdout, "Filling 0x%x bytes of SPI Boot Flash at offset 0x%0x "
+						"with 0x%02x\n", size, offset, fill_pattern);
+			}
+
+			if (!confirm((mode == MODE_FLASH_COPY)
+					? "Copying SPI Boot Flash" : "Filling SPI Boot Flash"))
+				goto exit;
+
+			ret = flash_copy_fill();
+			break;
+
+		case MODE_FLASH_PATCH:
+			if (!quiet) {
+				fprintf(stdout, "Patching SPI Boot Flash at offset 0x%0x from file \"%s\"\n",
+					offset, filepath);
+			}
+
+			ret = patch_apply(offset, size, filepath, no_verify, quiet, &size);
+			break;
+
+		case MODE_EFIVAR_LIST:
+			default_part("var");
+			ret = efivar_list(offset, size);
+			break;
+
+		case MODE_EFIVAR_GET:
+			default_part("var");
+			ret = efivar_get(offset, size, efivar, output, quiet);
+			break;
+
+		case MODE_EFIVAR_SET:
+		case MODE_EFIVAR_DELETE:
+		case MODE_EFIVAR_RECLAIM:
+			default_part("var");
+
+			if (!quiet) {
+				if (mode == MODE_EFIVAR_RECLAIM)
+					fprintf(stdout, "Reclaiming EFI variable store at offset 0x%0x\n", offset);
+				else
+					fprintf(stdout, "%s EFI variable %s in store at offset 0x%0x\n",
+						(mode == MODE_EFIVAR_SET) ? "Setting" : "Deleting", efivar, offset);
+			}
+
+			if (!confirm("Modifying EFI variable store"))
+				goto exit;
+
+			if (mode == MODE_EFIVAR_SET)
+				ret = efivar_set(offset, size, efivar, input, efivar_attr, quiet);
+			else if (mode == MODE_EFIVAR_DELETE)
+				ret = efivar_delete(offset, size, efivar, quiet);
+			else
+				ret = efivar_reclaim(offset, size, quiet);
+			break;
+
+		case MODE_FIP_LIST:
+			default_part("fip");
+			ret = fip_list(offset, size);
+			break;
+
+		case MODE_FIP_UPDATE:
+			default_part("fip");
+
+			if (!quiet)
+				fprintf(stdout, "Updating FIP at offset 0x%0x from file \"%s\"\n", offset, filepath);
+
+			if (!confirm("Updating FIP"))
+				goto exit;
+
+			ret = fip_update(offset, size, filepath, no_verify, quiet);
+			break;
+
+		case MODE_FAT_LIST:
+			default_part("fat");
+			ret = fat_list(offset, size, fat_path);
+			break;
+
+		case MODE_FAT_GET:
+			default_part("fat");
+			ret = fat_get(offset, size, fat_path, output, quiet);
+			break;
+
+		case MODE_BENCHMARK:
+			/* The flash area specified in the command line is the scratch area */
+			if (size) {
+				if (!quiet) {
+					fprintf(stdout, "Benchmark uses 0x%x bytes of SPI Boot Flash at offset 0x%0x "
+						"as the scratch area, its contents will be lost\n", size, offset);
+				}
+
+				if (!confirm("Overwriting benchmark scratch area"))
+					goto exit;
+			}
+
+			ret = bench_run(offset, size, size != 0,
+				profile_path ? profile_path : PLAN_PROFILE_DEFAULT_PATH, quiet);
+			break;
+
+		case MODE_SCRUB:
+			ret = scrub_run(manifest_path, offset, size,
+				scrub_rate, scrub_time, scrub_accept, quiet);
+			break;
+
 		default:
 			ret = EINVAL;
 			break;
 	}
 
-exit:
-#ifdef USE_LIBCURL
-	if (ftmp) {
-		if (fh == fileno(ftmp))
-			fh = -1;
-		fclose(ftmp);
+	/* The intended changes must not be reported by the scrub */
+	if (mode_modifies_flash() && !plan_enabled()) {
+		scrub_forget(manifest_path,
+			(mode == MODE_FLASH_COPY) ? copy_dst : offset,
+			is_dtb_part() ? part->size : size);
 	}
-#endif
 
+exit:
 	if (fh != -1)
 		close(fh);
 
+	report_operation(mode_name(), offset, size);
+	report_emit(ret);
+
 	baikal_scp_deinit();
 	return ret;
 }
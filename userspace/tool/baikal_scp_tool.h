@@ -32,4 +32,120 @@
 #define ALIGN(x, a) (((x) + (a - 1)) & ~(a - 1))
 #endif
 
+#ifndef DIV_ROUND_UP
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#endif
+
+/* "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" + '\0' */
+#define EFI_GUID_STR_SIZE 37
+
+/* EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS */
+#define EFI_VARIABLE_DEFAULT_ATTRIBUTES 0x7
+
+/* baikal_scp_tool_efivar.c */
+int efi_guid_parse(const char *str, baikal_scp_efi_guid_t *guid);
+void efi_guid_format(const baikal_scp_efi_guid_t *guid, char *str);
+int efivar_spec_parse(const char *spec, char *name,
+	baikal_scp_efi_guid_t *guid, int *has_guid);
+int efivar_list(unsigned int store_offset, unsigned int store_size);
+int efivar_get(unsigned int store_offset, unsigned int store_size,
+	const char *spec, const char *output, int quiet);
+int efivar_set(unsigned int store_offset, unsigned int store_size,
+	const char *spec, const char *input, int attributes, int quiet);
+int efivar_delete(unsigned int store_offset, unsigned int store_size,
+	const char *spec, int quiet);
+int efivar_reclaim(unsigned int store_offset, unsigned int store_size, int quiet);
+
+/* baikal_scp_tool_fat.c */
+int fat_list(unsigned int area_offset, unsigned int area_size, const char *path);
+int fat_get(unsigned int area_offset, unsigned int area_size,
+	const char *path, const char *output, int quiet);
+
+/* baikal_scp_tool_journal.c */
+#define JOURNAL_DEFAULT_PATH "/var/lib/baikal-scp/flash-write.journal"
+
+#define JOURNAL_SECTOR_WRITTEN  0x01 /* Erased and written */
+#define JOURNAL_SECTOR_VERIFIED 0x02
+#define JOURNAL_SECTOR_NO_ERASE 0x04 /* Can be written without erase */
+
+int journal_open(const char *path, unsigned int offset, unsigned int size,
+	const void *data, const unsigned char *digest, int resume, int dry_run, int quiet);
+int journal_flush(int force);
+int journal_run(unsigned int from, unsigned char flag,
+	unsigned int *run_offset, unsigned int *run_size);
+unsigned int journal_count(unsigned char flag);
+unsigned int journal_bytes(unsigned char flag);
+void journal_mark(unsigned int offset, unsigned int size, unsigned char flag, int set);
+int journal_close(int remove);
+
+/* baikal_scp_tool_plan.c */
+#define PLAN_PROFILE_DEFAULT_PATH "/var/lib/baikal-scp/profile"
+
+int plan_init(const char *spec);
+int plan_enabled(void);
+int plan_uses_stdout(void);
+int plan_profile_load(const char *path, int required);
+double plan_profile_rate(const char *name);
+unsigned int plan_profile_chunk(const char *name);
+void plan_profile_apply(void);
+void plan_operation(const char *operation, unsigned int offset, unsigned int size);
+void plan_sectors(unsigned int total, unsigned int identical,
+	unsigned int no_erase, unsigned int erase);
+int plan_add(const char *name, unsigned int offset, unsigned int size);
+int plan_emit(void);
+
+/* baikal_scp_tool_bench.c */
+int bench_run(unsigned int offset, unsigned int size, int scratch,
+	const char *profile_path, int quiet);
+
+/* baikal_scp_tool_scrub.c */
+#define SCRUB_DEFAULT_PATH "/var/lib/baikal-scp/scrub.manifest"
+
+/* Default scrub rate, KiB/s */
+#define SCRUB_DEFAULT_RATE 64
+
+int scrub_run(const char *path, unsigned int offset, unsigned int size,
+	unsigned int rate, unsigned int max_time, int accept, int quiet);
+void scrub_forget(const char *path, unsigned int offset, unsigned int size);
+
+/* baikal_scp_tool_download.c */
+#define DOWNLOAD_CACHE_DEFAULT_PATH "/var/cache/baikal-scp"
+
+/* Default download cache size limit, MiB */
+#define DOWNLOAD_CACHE_DEFAULT_SIZE 256
+
+#ifdef USE_LIBCURL
+int download_is_url(const char *path);
+int download_open(const char *url, const char *cache_dir, unsigned int cache_size,
+	unsigned int cache_ttl, int quiet, int *fh, unsigned int *size);
+#endif
+
+/* baikal_scp_tool_patch.c */
+int patch_apply(unsigned int offset, unsigned int max_size, const char *path,
+	int no_verify, int quiet, unsigned int *target_size);
+int patch_create(const char *source_path, const char *target_path,
+	const char *output, int quiet);
+
+/* baikal_scp_tool_report.c */
+int report_init(const char *spec);
+void report_operation(const char *operation, unsigned int offset, unsigned int size);
+void report_phase_begin(const char *name);
+void report_phase_end(void);
+void report_sectors(unsigned int total, unsigned int skipped);
+void report_digest(const unsigned char *digest);
+int report_emit(int result);
+
+/* baikal_scp_tool_fdt.c */
+#define FDT_HEADER_SIZE 40
+
+int fdt_header_size(const void *header, unsigned int max_size, unsigned int *fdt_size);
+int fdt_flash_size(unsigned int offset, unsigned int max_size, unsigned int *fdt_size);
+int fdt_clean_tail(unsigned int offset, unsigned int size,
+	unsigned int used_size, unsigned int old_size, int quiet);
+
+/* baikal_scp_tool_fip.c */
+int fip_list(unsigned int part_offset, unsigned int part_size);
+int fip_update(unsigned int part_offset, unsigned int part_size,
+	const char *path, int no_verify, int quiet);
+
 #endif /* BAIKAL_SCP_TOOL_H */
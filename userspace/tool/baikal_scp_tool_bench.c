@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+#include <libgen.h>
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Calibration benchmark (--benchmark option)
+ *
+ * Reads the flash, and on a scratch area also erases and writes it, with
+ * requests of several sizes through the library calls and measures the
+ * request latency and throughput. The best throughput of each operation
+ * and its request size are saved to the throughput profile. The --plan
+ * option estimates the time by the throughput, the flash operations are
+ * split into the requests of the saved size.
+ */
+
+/* Maximum size of the flash area used for each measurement */
+#define BENCH_MAX_SIZE (1024 * 1024)
+
+static const unsigned int bench_chunks[] = {
+	1024, 4096, 16384, 65536, 262144, 1048576
+};
+
+/* Erase requests cover whole sectors */
+static const unsigned int bench_erase_sectors[] = { 1, 4, 16 };
+
+#define BENCH_RESULTS_MAX \
+	(2 * (sizeof(bench_chunks) / sizeof(bench_chunks[0])) + \
+	 sizeof(bench_erase_sectors) / sizeof(bench_erase_sectors[0]))
+
+typedef struct bench_result {
+	const char        *name;
+	unsigned int       chunk;
+	unsigned int       calls;
+	unsigned int       bytes;
+	double             time;        /* Seconds */
+	double             max_latency; /* Seconds */
+	int                has_smc;
+	unsigned long long smc_calls;
+} bench_result_t;
+
+static bench_result_t bench_results[BENCH_RESULTS_MAX];
+static unsigned int bench_count = 0;
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double bench_rate(const bench_result_t *r)
+{
+	return r->time ? ((double)r->bytes / (1024.0 * 1024.0)) / r->time : 0;
+}
+
+/*
+ * Transfer the flash area with requests of the chunk size
+ */
+static int bench_measure(const char *name, baikal_scp_flash_operation_t op,
+	unsigned int offset, unsigned int size, unsigned int chunk, unsigned char *data)
+{
+	int ret = 0;
+	unsigned int pos, part;
+	unsigned long long smc_calls;
+	bench_result_t *r = &bench_results[bench_count];
+
+	memset(r, 0, sizeof(*r));
+	r->name  = name;
+	r->chunk = chunk;
+	r->has_smc = !baikal_scp_flash_smc_calls(&r->smc_calls);
+
+	for (pos = 0; pos < size; pos += part) {
+		double start, latency;
+
+		part = (size - pos < chunk) ? size - pos : chunk;
+		start = bench_now();
+
+		if (op == BAIKAL_SCP_FLASH_READ)
+			ret = baikal_scp_flash_read(offset + pos, part, data + pos, NULL);
+		else if (op == BAIKAL_SCP_FLASH_WRITE)
+			ret = baikal_scp_flash_write(offset + pos, part, data + pos, NULL);
+		else
+			ret = baikal_scp_flash_erase(offset + pos, part, NULL);
+
+		latency = bench_now() - start;
+
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to %s flash at offset 0x%x (%d)\n",
+				name, offset + pos, ret);
+			return ret;
+		}
+
+		r->calls++;
+		r->bytes += part;
+		r->time  += latency;
+
+		if (latency > r->max_latency)
+			r->max_latency = latency;
+	}
+
+	if (r->has_smc && !baikal_scp_flash_smc_calls(&smc_calls))
+		r->smc_calls = smc_calls - r->smc_calls;
+	else
+		r->has_smc = 0;
+
+	bench_count++;
+	return 0;
+}
+
+static void bench_print(const bench_result_t *r)
+{
+	printf("  %-7s 0x%08x %6u %10.3f %10.3f %10.3f",
+		r->name, r->chunk, r->calls,
+		r->time * 1000.0 / r->calls, r->max_latency * 1000.0, bench_rate(r));
+
+	if (r->has_smc)
+		printf(" %10.2f\n", (double)r->smc_calls * 1024.0 / r->bytes);
+	else
+		printf(" %10s\n", "-");
+}
+
+/*
+ * Best throughput of the operation and its request size, 0 if it is not measured
+ */
+static double bench_best(const char *name, unsigned int *chunk)
+{
+	unsigned int i;
+	double best = 0;
+
+	*chunk = 0;
+
+	for (i = 0; i < bench_count; i++) {
+		if (!strcmp(bench_results[i].name, name) && (bench_rate(&bench_results[i]) > best)) {
+			best = bench_rate(&bench_results[i]);
+			*chunk = bench_results[i].chunk;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Save the profile. The operations not measured keep the rates and
+ * request sizes of the existing profile (or the built-in estimates).
+ */
+static int bench_save(const char *path)
+{
+	FILE *f;
+	unsigned int i;
+	char *dir;
+	static const char *names[] = { "read", "write", "erase" };
+
+	plan_profile_load(path, 0);
+
+	/* The default profile directory may not exist yet */
+	dir = strdup(path);
+	if (dir) {
+		mkdir(dirname(dir), 0755);
+		free(dir);
+	}
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", path, errno);
+		return errno;
+	}
+
+	fprintf(f, "# Baikal-M SCP SPI Boot Flash throughput profile (MiB/s)\n");
+	fprintf(f, "# Measured with baikal-scp-flash --benchmark\n");
+	fprintf(f, "#\n");
+	fprintf(f, "# <operation> <MiB/s> <best request size>\n");
+	fprintf(f, "#\n");
+	fprintf(f, "# <operation> <request size> <MiB/s> <average latency, ms> <SMC calls per KiB>\n");
+
+	for (i = 0; i < bench_count; i++) {
+		const bench_result_t *r = &bench_results[i];
+
+		fprintf(f, "# %s %u %.3f %.3f", r->name, r->chunk,
+			bench_rate(r), r->time * 1000.0 / r->calls);
+
+		if (r->has_smc)
+			fprintf(f, " %.2f\n", (double)r->smc_calls * 1024.0 / r->bytes);
+		else
+			fprintf(f, " -\n");
+	}
+
+	fprintf(f, "\n");
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		unsigned int chunk;
+		double rate = bench_best(names[i], &chunk);
+
+		if (rate) {
+			fprintf(f, "%s %.3f %u\n", names[i], rate, chunk);
+			continue;
+		}
+
+		fprintf(f, "# %s is not measured\n%s %.3f", names[i], names[i],
+			plan_profile_rate(names[i]));
+
+		chunk = plan_profile_chunk(names[i]);
+		if (chunk)
+			fprintf(f, " %u\n", chunk);
+		else
+			fprintf(f, "\n");
+	}
+
+	if (fclose(f)) {
+		fprintf(stderr, "ERROR: Failed to write \"%s\" (%d)\n", path, errno);
+		return errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Run the benchmark. With scratch set the flash area is erased and written,
+ * its contents are lost. Otherwise the flash is only read.
+ */
+int bench_run(unsigned int offset, unsigned int size, int scratch,
+	const char *profile_path, int quiet)
+{
+	int ret = 0;
+	unsigned int i, sector_size;
+	unsigned char *pattern = NULL;
+	unsigned char *data = NULL;
+	baikal_scp_flash_info_t flash_info;
+	uint32_t seed = 0x2545f491;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to get flash information (%d)\n", ret);
+		return ret;
+	}
+
+	sector_size = flash_info.sector_size;
+
+	if ((offset >= flash_info.total_size) || (size > flash_info.total_size - offset)) {
+		fprintf(stderr, "ERROR: Invalid size or offset value or its combination\n");
+		return EINVAL;
+	}
+
+	if (scratch) {
+		/* Only whole sectors of the scratch area are used */
+		unsigned int start = ALIGN(offset, sector_size);
+		unsigned int end = (offset + size) / sector_size * sector_size;
+
+		if (end > start + BENCH_MAX_SIZE)
+			end = start + (BENCH_MAX_SIZE / sector_size) * sector_size;
+
+		if (end <= start) {
+			fprintf(stderr, "ERROR: The scratch area must contain at least one whole sector\n");
+			return EINVAL;
+		}
+
+		offset = start;
+		size = end - start;
+	}
+	else {
+		size = flash_info.total_size - offset;
+		if (size > BENCH_MAX_SIZE)
+			size = BENCH_MAX_SIZE;
+	}
+
+	pattern = malloc(size);
+	data = malloc(size);
+	if (!pattern || !data) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	/* Random data, so programming clears a part of the bits */
+	for (i = 0; i < size; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		pattern[i] = seed;
+	}
+
+	bench_count = 0;
+
+	if (!quiet) {
+		printf("Benchmarking %s 0x%x bytes of SPI Boot Flash at offset 0x%x\n",
+			scratch ? "read, erase and write of" : "read of", size, offset);
+	}
+
+	if (scratch) {
+		report_phase_begin("erase");
+
+		for (i = 0; !ret && (i < sizeof(bench_erase_sectors) / sizeof(bench_erase_sectors[0])); i++) {
+			if (bench_erase_sectors[i] * sector_size <= size)
+				ret = bench_measure("erase", BAIKAL_SCP_FLASH_ERASE, offset, size,
+					bench_erase_sectors[i] * sector_size, NULL);
+		}
+
+		report_phase_end();
+
+		report_phase_begin("write");
+
+		for (i = 0; !ret && (i < sizeof(bench_chunks) / sizeof(bench_chunks[0])); i++) {
+			if ((bench_chunks[i] > size) && i)
+				break;
+
+			ret = baikal_scp_flash_erase(offset, size, NULL);
+			if (ret) {
+				fprintf(stderr, "ERROR: Failed to erase flash (%d)\n", ret);
+				break;
+			}
+
+			ret = bench_measure("write", BAIKAL_SCP_FLASH_WRITE, offset, size,
+				bench_chunks[i], pattern);
+		}
+
+		report_phase_end();
+	}
+
+	if (!ret) {
+		report_phase_begin("read");
+
+		for (i = 0; !ret && (i < sizeof(bench_chunks) / sizeof(bench_chunks[0])); i++) {
+			if ((bench_chunks[i] > size) && i)
+				break;
+
+			ret = bench_measure("read", BAIKAL_SCP_FLASH_READ, offset, size,
+				bench_chunks[i], data);
+		}
+
+		report_phase_end();
+	}
+
+	if (ret)
+		goto exit;
+
+	if (scratch && memcmp(data, pattern, size)) {
+		fprintf(stderr, "ERROR: Data read from the scratch area differs from the written data\n");
+		ret = EIO;
+		goto exit;
+	}
+
+	if (!quiet) {
+		printf("\n  %-7s %-10s %6s %10s %10s %10s %10s\n",
+			"Op", "Request", "Calls", "Avg, ms", "Max, ms", "MiB/s", "SMC/KiB");
+
+		for (i = 0; i < bench_count; i++)
+			bench_print(&bench_results[i]);
+
+		printf("\n");
+	}
+
+	ret = bench_save(profile_path);
+	if (!ret && !quiet)
+		printf("Profile saved to \"%s\"\n", profile_path);
+
+exit:
+	free(pattern);
+	free(data);
+	return ret;
+}
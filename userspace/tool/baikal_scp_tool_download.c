@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+#ifdef USE_LIBCURL
+
+#include <time.h>
+#include <dirent.h>
+#include <strings.h>
+#include <curl/curl.h>
+
+/*
+ * Download of the images from the remote servers with an optional
+ * local cache (--cache option)
+ *
+ * The cache directory holds the downloaded images named by the SHA-256
+ * digest of their contents (objects/) and an index entry for each URL
+ * (urls/, named by the digest of the URL) with the object digest and the
+ * ETag and Last-Modified values of the response. A cached URL is
+ * requested with If-None-Match/If-Modified-Since, so an unchanged image
+ * is answered by 304 Not Modified without transferring it. Within the
+ * --cache-ttl time after the last validation the server is not contacted
+ * at all. Objects are checked against their digest before use, the same
+ * image downloaded from different URLs is stored once. The least recently
+ * used objects are removed when the cache exceeds its size limit.
+ */
+
+#define DOWNLOAD_DIGEST_HEX_SIZE (BAIKAL_SCP_SHA256_SIZE * 2 + 1)
+#define DOWNLOAD_FIELD_SIZE      256
+#define DOWNLOAD_LINE_SIZE       4096
+
+static const char *download_protos[] = {
+	"http://",
+	"https://",
+	"scp://",
+	"ftp://",
+	NULL
+};
+
+typedef struct download_entry {
+	char      object[DOWNLOAD_DIGEST_HEX_SIZE];
+	char      etag[DOWNLOAD_FIELD_SIZE];
+	char      last_modified[DOWNLOAD_FIELD_SIZE];
+	long long validated; /* Time of the last download or validation */
+} download_entry_t;
+
+typedef struct download {
+	int                     fd;
+	unsigned long long      size;
+	baikal_scp_sha256_ctx_t sha256;
+	download_entry_t        entry; /* Validators of the response */
+} download_t;
+
+typedef struct download_object {
+	char               name[DOWNLOAD_DIGEST_HEX_SIZE];
+	unsigned long long size;
+	time_t             mtime;
+} download_object_t;
+
+int download_is_url(const char *path)
+{
+	int i;
+
+	for (i = 0; download_protos[i]; i++) {
+		if (!strncmp(path, download_protos[i], strlen(download_protos[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void download_hex(const unsigned char digest[BAIKAL_SCP_SHA256_SIZE],
+	char hex[DOWNLOAD_DIGEST_HEX_SIZE])
+{
+	int i;
+
+	for (i = 0; i < BAIKAL_SCP_SHA256_SIZE; i++)
+		sprintf(hex + i * 2, "%02x", digest[i]);
+}
+
+static size_t download_write_cb(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	download_t *d = (download_t *)userp;
+	size_t realsize = size * nmemb;
+	size_t written = 0;
+	ssize_t n;
+
+	while (written < realsize) {
+		n = write(d->fd, (char *)contents + written, realsize - written);
+		if (n <= 0)
+			return 0;
+
+		written += n;
+	}
+
+	baikal_scp_sha256_update(&d->sha256, contents, realsize);
+	d->size += realsize;
+	return realsize;
+}
+
+/* Copy value of the response header into the field, without the trailing CR/LF */
+static void download_header_value(const char *value, size_t len, char *field)
+{
+	while (len && ((*value == ' ') || (*value == '\t'))) {
+		value++;
+		len--;
+	}
+
+	while (len && ((value[len - 1] == '\r') || (value[len - 1] == '\n') ||
+	               (value[len - 1] == ' ')))
+		len--;
+
+	if (len >= DOWNLOAD_FIELD_SIZE)
+		len = 0; /* Not usable as a validator */
+
+	memcpy(field, value, len);
+	field[len] = '\0';
+}
+
+static size_t download_header_cb(char *buffer, size_t size, size_t nitems, void *userp)
+{
+	download_t *d = (download_t *)userp;
+	size_t len = size * nitems;
+
+	/* Each response (e.g. of a redirect) starts with the status line */
+	if ((len >= 5) && !strncmp(buffer, "HTTP/", 5)) {
+		d->entry.etag[0] = '\0';
+		d->entry.last_modified[0] = '\0';
+	}
+	else if ((len > 5) && !strncasecmp(buffer, "ETag:", 5))
+		download_header_value(buffer + 5, len - 5, d->entry.etag);
+	else if ((len > 14) && !strncasecmp(buffer, "Last-Modified:", 14))
+		download_header_value(buffer + 14, len - 14, d->entry.last_modified);
+
+	return len;
+}
+
+/*
+ * Download the URL into the file. If the entry is specified, the request
+ * is conditional and *not_modified is set if the server answers 304.
+ */
+static int download_fetch(const char *url, const download_entry_t *entry,
+	download_t *d, int *not_modified, int quiet)
+{
+	int ret = 0;
+	CURL *curl_handle;
+	CURLcode res;
+	long code = 0;
+	struct curl_slist *headers = NULL;
+	char header[DOWNLOAD_FIELD_SIZE + 32];
+
+	*not_modified = 0;
+
+	d->size = 0;
+	memset(&d->entry, 0, sizeof(d->entry));
+	baikal_scp_sha256_init(&d->sha256);
+
+	if (entry && entry->etag[0]) {
+		snprintf(header, sizeof(header), "If-None-Match: %s", entry->etag);
+		headers = curl_slist_append(headers, header);
+	}
+
+	if (entry && entry->last_modified[0]) {
+		snprintf(header, sizeof(header), "If-Modified-Since: %s", entry->last_modified);
+		headers = curl_slist_append(headers, header);
+	}
+
+	if (!quiet) {
+		fprintf(stdout, "Downloading %s...\n", url);
+	}
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	curl_handle = curl_easy_init();
+	if (!curl_handle) {
+		curl_slist_free_all(headers);
+		fprintf(stderr, "ERROR: Failed to initialize libcurl\n");
+		return ENOMEM;
+	}
+
+	curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, 0L);
+	curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, quiet ? 1L : 0L);
+	curl_easy_setopt(curl_handle, CURLOPT_URL, url);
+	curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, download_write_cb);
+	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)d);
+	curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, download_header_cb);
+	curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)d);
+	curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+
+	res = curl_easy_perform(curl_handle);
+	if (res != CURLE_OK) {
+		ret = EIO;
+		fprintf(stderr, "ERROR: Downloading failed: %s\n",
+			curl_easy_strerror(res));
+	}
+	else {
+		curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+		if (entry && (code == 304) && !strncmp(url, "http", 4))
+			*not_modified = 1;
+	}
+
+	curl_easy_cleanup(curl_handle);
+	curl_slist_free_all(headers);
+
+	return ret;
+}
+
+static int download_entry_load(const char *path, const char *url, download_entry_t *entry)
+{
+	FILE *f;
+	char line[DOWNLOAD_LINE_SIZE];
+	int url_match = 0;
+	size_t len;
+
+	memset(entry, 0, sizeof(*entry));
+
+	f = fopen(path, "r");
+	if (!f)
+		return ENOENT;
+
+	while (fgets(line, sizeof(line), f)) {
+		len = strlen(line);
+		if (len && (line[len - 1] == '\n'))
+			line[--len] = '\0';
+
+		if (!strncmp(line, "url ", 4))
+			url_match = !strcmp(line + 4, url);
+		else if (!strncmp(line, "object ", 7) && (len - 7 == DOWNLOAD_DIGEST_HEX_SIZE - 1))
+			strcpy(entry->object, line + 7);
+		else if (!strncmp(line, "etag ", 5))
+			download_header_value(line + 5, len - 5, entry->etag);
+		else if (!strncmp(line, "last-modified ", 14))
+			download_header_value(line + 14, len - 14, entry->last_modified);
+		else if (!strncmp(line, "validated ", 10))
+			entry->validated = strtoll(line + 10, NULL, 10);
+	}
+
+	fclose(f);
+
+	return (url_match && entry->object[0]) ? 0 : ENOENT;
+}
+
+static int download_entry_save(const char *path, const char *url, const download_entry_t *entry)
+{
+	FILE *f;
+	char tmp_path[PATH_MAX + 8];
+	int ret = 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	f = fopen(tmp_path, "w");
+	if (!f)
+		return errno;
+
+	fprintf(f, "url %s\n", url);
+	fprintf(f, "object %s\n", entry->object);
+	fprintf(f, "etag %s\n", entry->etag);
+	fprintf(f, "last-modified %s\n", entry->last_modified);
+	fprintf(f, "validated %lld\n", entry->validated);
+
+	if (fclose(f))
+		ret = errno;
+
+	if (!ret && rename(tmp_path, path))
+		ret = errno;
+
+	if (ret)
+		unlink(tmp_path);
+
+	return ret;
+}
+
+/*
+ * Open the cached object and check its contents against the digest.
+ * The object becomes the most recently used one.
+ */
+static int download_object_open(const char *dir, const char *name)
+{
+	int fd;
+	char path[PATH_MAX];
+	char hex[DOWNLOAD_DIGEST_HEX_SIZE];
+	unsigned char buf[64 * 1024];
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+	baikal_scp_sha256_ctx_t sha256;
+	ssize_t n;
+
+	snprintf(path, sizeof(path), "%s/objects/%s", dir, name);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	baikal_scp_sha256_init(&sha256);
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		baikal_scp_sha256_update(&sha256, buf, n);
+
+	baikal_scp_sha256_final(&sha256, digest);
+	download_hex(digest, hex);
+
+	if (n || strcmp(hex, name)) {
+		fprintf(stderr, "WARNING: Cached image %s is corrupted, removing\n", name);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	futimens(fd, NULL);
+
+	return fd;
+}
+
+static int download_object_cmp(const void *a, const void *b)
+{
+	const download_object_t *oa = a;
+	const download_object_t *ob = b;
+
+	return (oa->mtime > ob->mtime) - (oa->mtime < ob->mtime);
+}
+
+/* Remove the least recently used objects above the size limit, except the one in use */
+static void download_cache_evict(const char *dir, unsigned long long limit,
+	const char *keep, int quiet)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	download_object_t *objects = NULL, *tmp;
+	unsigned int count = 0, alloc = 0, i;
+	unsigned long long total = 0;
+
+	snprintf(path, sizeof(path), "%s/objects", dir);
+
+	d = opendir(path);
+	if (!d)
+		return;
+
+	while ((de = readdir(d))) {
+		if (strlen(de->d_name) != DOWNLOAD_DIGEST_HEX_SIZE - 1)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/objects/%s", dir, de->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(objects, alloc * sizeof(*objects));
+			if (!tmp)
+				break;
+
+			objects = tmp;
+		}
+
+		strcpy(objects[count].name, de->d_name);
+		objects[count].size  = st.st_size;
+		objects[count].mtime = st.st_mtime;
+		total += st.st_size;
+		count++;
+	}
+
+	closedir(d);
+
+	qsort(objects, count, sizeof(*objects), download_object_cmp);
+
+	for (i = 0; (i < count) && (total > limit); i++) {
+		if (!strcmp(objects[i].name, keep))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/objects/%s", dir, objects[i].name);
+		if (unlink(path))
+			continue;
+
+		total -= objects[i].size;
+
+		if (!quiet)
+			fprintf(stdout, "Removed cached image %s (%llu bytes)\n",
+				objects[i].name, objects[i].size);
+	}
+
+	free(objects);
+}
+
+static int download_cache_mkdir(const char *dir)
+{
+	char path[PATH_MAX];
+
+	if (mkdir(dir, 0755) && (errno != EEXIST))
+		return errno;
+
+	snprintf(path, sizeof(path), "%s/objects", dir);
+	if (mkdir(path, 0755) && (errno != EEXIST))
+		return errno;
+
+	snprintf(path, sizeof(path), "%s/urls", dir);
+	if (mkdir(path, 0755) && (errno != EEXIST))
+		return errno;
+
+	return 0;
+}
+
+/* Download without the cache into an unnamed temporary file */
+static int download_uncached(const char *url, int quiet, int *fh, unsigned int *size)
+{
+	int ret;
+	int not_modified;
+	FILE *ftmp;
+	download_t d;
+
+	ftmp = tmpfile();
+	if (!ftmp) {
+		fprintf(stderr, "ERROR: Failed to open temporary file\n");
+		return errno;
+	}
+
+	d.fd = dup(fileno(ftmp));
+	fclose(ftmp);
+
+	if (d.fd == -1)
+		return errno;
+
+	ret = download_fetch(url, NULL, &d, &not_modified, quiet);
+	if (ret) {
+		close(d.fd);
+		return ret;
+	}
+
+	lseek(d.fd, 0, SEEK_SET);
+
+	*fh = d.fd;
+	*size = d.size;
+
+	return 0;
+}
+
+/*
+ * Download the image from the URL (through the cache in the cache_dir if
+ * it is not NULL) and return the descriptor of the file with the image
+ */
+int download_open(const char *url, const char *cache_dir, unsigned int cache_size,
+	unsigned int cache_ttl, int quiet, int *fh, unsigned int *size)
+{
+	int ret;
+	int fd = -1;
+	int has_entry;
+	int not_modified = 0;
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+	char url_hex[DOWNLOAD_DIGEST_HEX_SIZE];
+	char entry_path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	char object_path[PATH_MAX];
+	download_entry_t entry;
+	download_t d;
+	struct stat st;
+
+	if (!cache_dir)
+		return download_uncached(url, quiet, fh, size);
+
+	ret = download_cache_mkdir(cache_dir);
+	if (ret) {
+		fprintf(stderr, "WARNING: Cannot use cache directory \"%s\" (%d), "
+			"downloading without cache\n", cache_dir, ret);
+		return download_uncached(url, quiet, fh, size);
+	}
+
+	baikal_scp_sha256(url, strlen(url), digest);
+	download_hex(digest, url_hex);
+	snprintf(entry_path, sizeof(entry_path), "%s/urls/%s", cache_dir, url_hex);
+
+	has_entry = !download_entry_load(entry_path, url, &entry);
+	if (has_entry) {
+		fd = download_object_open(cache_dir, entry.object);
+		if (fd == -1)
+			has_entry = 0;
+	}
+
+	if (has_entry && cache_ttl && (time(NULL) - entry.validated < cache_ttl)) {
+		if (!quiet)
+			fprintf(stdout, "Using cached image %s\n", entry.object);
+
+		goto done;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/download.XXXXXX", cache_dir);
+
+	d.fd = mkstemp(tmp_path);
+	if (d.fd == -1) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot create file in the cache directory \"%s\" (%d)\n",
+			cache_dir, ret);
+		goto error;
+	}
+
+	ret = download_fetch(url, has_entry ? &entry : NULL, &d, &not_modified, quiet);
+	if (ret) {
+		close(d.fd);
+		unlink(tmp_path);
+		goto error;
+	}
+
+	if (not_modified) {
+		close(d.fd);
+		unlink(tmp_path);
+
+		if (!quiet)
+			fprintf(stdout, "Image is not modified, using cached image %s\n", entry.object);
+
+		/* 304 may repeat the validators or omit them */
+		if (d.entry.etag[0])
+			strcpy(entry.etag, d.entry.etag);
+
+		if (d.entry.last_modified[0])
+			strcpy(entry.last_modified, d.entry.last_modified);
+	}
+	else {
+		if (fd != -1)
+			close(fd);
+
+		baikal_scp_sha256_final(&d.sha256, digest);
+
+		entry = d.entry;
+		download_hex(digest, entry.object);
+
+		/* The same image cached for another URL is replaced by the identical file */
+		snprintf(object_path, sizeof(object_path), "%s/objects/%s", cache_dir, entry.object);
+		if (rename(tmp_path, object_path)) {
+			ret = errno;
+			fprintf(stderr, "ERROR: Cannot store \"%s\" (%d)\n", object_path, ret);
+			close(d.fd);
+			unlink(tmp_path);
+			return ret;
+		}
+
+		close(d.fd);
+
+		fd = download_object_open(cache_dir, entry.object);
+		if (fd == -1) {
+			ret = EIO;
+			goto error;
+		}
+	}
+
+	entry.validated = time(NULL);
+
+	ret = download_entry_save(entry_path, url, &entry);
+	if (ret)
+		fprintf(stderr, "WARNING: Cannot update cache index \"%s\" (%d)\n", entry_path, ret);
+
+	download_cache_evict(cache_dir, (unsigned long long)cache_size * 1024 * 1024,
+		entry.object, quiet);
+
+done:
+	if (fstat(fd, &st)) {
+		ret = errno;
+		goto error;
+	}
+
+	*fh = fd;
+	*size = st.st_size;
+
+	return 0;
+
+error:
+	if (fd != -1)
+		close(fd);
+
+	return ret;
+}
+
+#endif /* USE_LIBCURL */
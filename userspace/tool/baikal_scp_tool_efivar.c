@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+int efi_guid_parse(const char *str, baikal_scp_efi_guid_t *guid)
+{
+	unsigned int d[11];
+	int n = 0;
+	int i;
+
+	if ((sscanf(str, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x%n",
+			&d[0], &d[1], &d[2], &d[3], &d[4], &d[5],
+			&d[6], &d[7], &d[8], &d[9], &d[10], &n) != 11) ||
+	    (n != 36) || str[n])
+		return EINVAL;
+
+	guid->data1 = d[0];
+	guid->data2 = (unsigned short)d[1];
+	guid->data3 = (unsigned short)d[2];
+
+	for (i = 0; i < 8; i++)
+		guid->data4[i] = (unsigned char)d[3 + i];
+
+	return 0;
+}
+
+void efi_guid_format(const baikal_scp_efi_guid_t *guid, char *str)
+{
+	sprintf(str, "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+		guid->data1, guid->data2, guid->data3,
+		guid->data4[0], guid->data4[1], guid->data4[2], guid->data4[3],
+		guid->data4[4], guid->data4[5], guid->data4[6], guid->data4[7]);
+}
+
+/*
+ * Parse variable specification in form "<name>[:<guid>]"
+ */
+int efivar_spec_parse(const char *spec, char *name,
+	baikal_scp_efi_guid_t *guid, int *has_guid)
+{
+	const char *sep = strrchr(spec, ':');
+	size_t name_len = sep ? (size_t)(sep - spec) : strlen(spec);
+
+	if (!name_len || name_len >= BAIKAL_SCP_EFIVAR_NAME_MAX)
+		return EINVAL;
+
+	memcpy(name, spec, name_len);
+	name[name_len] = '\0';
+
+	*has_guid = 0;
+
+	if (sep) {
+		if (efi_guid_parse(sep + 1, guid))
+			return EINVAL;
+
+		*has_guid = 1;
+	}
+
+	return 0;
+}
+
+static int efivar_list_cb(const baikal_scp_efivar_info_t *info, void *user)
+{
+	char guid[EFI_GUID_STR_SIZE];
+
+	efi_guid_format(&info->guid, guid);
+
+	fprintf(stdout, "%-36s  %s  0x%08x  %6u\n",
+		info->name, guid, info->attributes, info->data_size);
+
+	return 0;
+}
+
+int efivar_list(unsigned int store_offset, unsigned int store_size)
+{
+	int ret;
+
+	fprintf(stdout, "%-36s  %-36s  %-10s  %6s\n",
+		"Name", "GUID", "Attributes", "Size");
+
+	ret = baikal_scp_efivar_list(store_offset, store_size, efivar_list_cb, NULL);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to list EFI variables (%d)\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void hexdump(const unsigned char *data, unsigned int size)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < size; i += 16) {
+		fprintf(stdout, "%08x: ", i);
+
+		for (j = i; j < i + 16; j++) {
+			if (j < size)
+				fprintf(stdout, "%02x ", data[j]);
+			else
+				fprintf(stdout, "   ");
+		}
+
+		fprintf(stdout, " ");
+
+		for (j = i; (j < i + 16) && (j < size); j++)
+			fputc(((data[j] >= 0x20) && (data[j] < 0x7f)) ? data[j] : '.', stdout);
+
+		fprintf(stdout, "\n");
+	}
+}
+
+int efivar_get(unsigned int store_offset, unsigned int store_size,
+	const char *spec, const char *output, int quiet)
+{
+	int ret;
+	int has_guid;
+	char name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+	char guid_str[EFI_GUID_STR_SIZE];
+	baikal_scp_efi_guid_t guid;
+	baikal_scp_efivar_info_t info;
+	void *data = NULL;
+
+	if (efivar_spec_parse(spec, name, &guid, &has_guid)) {
+		fprintf(stderr, "ERROR: Invalid EFI variable specification '%s'\n", spec);
+		return EINVAL;
+	}
+
+	ret = baikal_scp_efivar_get(store_offset, store_size,
+		name, has_guid ? &guid : NULL, &info, NULL, 0);
+	if (ret) {
+		if (ret == ENOENT)
+			fprintf(stderr, "ERROR: EFI variable '%s' not found\n", spec);
+		else
+			fprintf(stderr, "ERROR: Failed to get EFI variable (%d)\n", ret);
+
+		return ret;
+	}
+
+	data = malloc(info.data_size ? info.data_size : 1);
+	if (!data) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return ENOMEM;
+	}
+
+	ret = baikal_scp_efivar_get(store_offset, store_size,
+		name, &info.guid, &info, data, info.data_size);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to get EFI variable (%d)\n", ret);
+		goto exit;
+	}
+
+	if (output) {
+		int fh = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fh == -1) {
+			ret = errno;
+			fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", output, ret);
+			goto exit;
+		}
+
+		if (write(fh, data, info.data_size) != info.data_size) {
+			ret = errno;
+			fprintf(stderr, "ERROR: Failed to write variable data to file (%d)\n", ret);
+		}
+
+		close(fh);
+		goto exit;
+	}
+
+	if (!quiet) {
+		efi_guid_format(&info.guid, guid_str);
+		fprintf(stdout, "Name:       %s\n", info.name);
+		fprintf(stdout, "GUID:       %s\n", guid_str);
+		fprintf(stdout, "Attributes: 0x%08x\n", info.attributes);
+		fprintf(stdout, "Size:       %u\n", info.data_size);
+	}
+
+	hexdump(data, info.data_size);
+
+exit:
+	free(data);
+	return ret;
+}
+
+int efivar_set(unsigned int store_offset, unsigned int store_size,
+	const char *spec, const char *input, int attributes, int quiet)
+{
+	int ret;
+	int fh;
+	int has_guid;
+	struct stat st;
+	char name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+	baikal_scp_efi_guid_t guid;
+	baikal_scp_efivar_info_t info;
+	void *data = NULL;
+
+	if (efivar_spec_parse(spec, name, &guid, &has_guid) || !has_guid) {
+		fprintf(stderr, "ERROR: Invalid EFI variable specification '%s'"
+			" (<name>:<guid> expected)\n", spec);
+		return EINVAL;
+	}
+
+	if (!input) {
+		fprintf(stderr, "ERROR: Input file for variable data is not specified\n");
+		return EINVAL;
+	}
+
+	if ((fh = open(input, O_RDONLY)) == -1) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for reading (%d)\n", input, ret);
+		return ret;
+	}
+
+	if (fstat(fh, &st) || !st.st_size) {
+		fprintf(stderr, "ERROR: Input file \"%s\" is empty\n", input);
+		close(fh);
+		return EINVAL;
+	}
+
+	data = malloc(st.st_size);
+	if (!data) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		close(fh);
+		return ENOMEM;
+	}
+
+	if (read(fh, data, st.st_size) != st.st_size) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Failed to read data from file (%d)\n", ret);
+		goto exit;
+	}
+
+	/* Keep attributes of the existing variable by default */
+	if (attributes < 0) {
+		ret = baikal_scp_efivar_get(store_offset, store_size,
+			name, &guid, &info, NULL, 0);
+
+		if (!ret)
+			attributes = info.attributes;
+		else if (ret == ENOENT)
+			attributes = EFI_VARIABLE_DEFAULT_ATTRIBUTES;
+		else {
+			fprintf(stderr, "ERROR: Failed to get EFI variable (%d)\n", ret);
+			goto exit;
+		}
+	}
+
+	ret = baikal_scp_efivar_set(store_offset, store_size,
+		name, &guid, attributes, data, st.st_size);
+	if (ret) {
+		if (ret == ENOSPC)
+			fprintf(stderr, "ERROR: No free space in EFI variable store"
+				" (use --efivar-reclaim)\n");
+		else
+			fprintf(stderr, "ERROR: Failed to set EFI variable (%d)\n", ret);
+
+		goto exit;
+	}
+
+	if (!quiet)
+		printf("OK: Success\n");
+
+exit:
+	close(fh);
+	free(data);
+	return ret;
+}
+
+int efivar_delete(unsigned int store_offset, unsigned int store_size,
+	const char *spec, int quiet)
+{
+	int ret;
+	int has_guid;
+	char name[BAIKAL_SCP_EFIVAR_NAME_MAX];
+	baikal_scp_efi_guid_t guid;
+
+	if (efivar_spec_parse(spec, name, &guid, &has_guid) || !has_guid) {
+		fprintf(stderr, "ERROR: Invalid EFI variable specification '%s'"
+			" (<name>:<guid> expected)\n", spec);
+		return EINVAL;
+	}
+
+	ret = baikal_scp_efivar_delete(store_offset, store_size, name, &guid);
+	if (ret) {
+		if (ret == ENOENT)
+			fprintf(stderr, "ERROR: EFI variable '%s' not found\n", spec);
+		else
+			fprintf(stderr, "ERROR: Failed to delete EFI variable (%d)\n", ret);
+
+		return ret;
+	}
+
+	if (!quiet)
+		printf("OK: Success\n");
+
+	return 0;
+}
+
+int efivar_reclaim(unsigned int store_offset, unsigned int store_size, int quiet)
+{
+	int ret;
+	unsigned int sectors;
+
+	ret = baikal_scp_efivar_reclaim(store_offset, store_size, &sectors);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to reclaim EFI variable store (%d)\n", ret);
+		return ret;
+	}
+
+	if (!quiet)
+		printf("OK: Success (%u sectors rewritten)\n", sectors);
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+static int fat_list_cb(const baikal_scp_fat_entry_info_t *info, void *user)
+{
+	fprintf(stdout, "%c%c%c%c  %10u  %s%s\n",
+		info->is_dir ? 'd' : '-',
+		(info->attributes & 0x01) ? 'r' : '-',
+		(info->attributes & 0x02) ? 'h' : '-',
+		(info->attributes & 0x04) ? 's' : '-',
+		info->size, info->name, info->is_dir ? "/" : "");
+
+	return 0;
+}
+
+int fat_list(unsigned int area_offset, unsigned int area_size, const char *path)
+{
+	int ret;
+
+	ret = baikal_scp_fat_list(area_offset, area_size, path, fat_list_cb, NULL);
+	if (ret) {
+		if (ret == ENOENT)
+			fprintf(stderr, "ERROR: Path '%s' not found\n", path);
+		else if (ret == EINVAL)
+			fprintf(stderr, "ERROR: No valid FAT file system found at offset 0x%x\n", area_offset);
+		else
+			fprintf(stderr, "ERROR: Failed to list FAT directory (%d)\n", ret);
+
+		return ret;
+	}
+
+	return 0;
+}
+
+int fat_get(unsigned int area_offset, unsigned int area_size,
+	const char *path, const char *output, int quiet)
+{
+	int ret;
+	int fh;
+	baikal_scp_fat_entry_info_t info;
+	void *data = NULL;
+
+	ret = baikal_scp_fat_read(area_offset, area_size, path, &info, NULL, 0);
+	if (ret) {
+		if (ret == ENOENT)
+			fprintf(stderr, "ERROR: File '%s' not found\n", path);
+		else if (ret == EISDIR)
+			fprintf(stderr, "ERROR: '%s' is a directory\n", path);
+		else if (ret == EINVAL)
+			fprintf(stderr, "ERROR: No valid FAT file system found at offset 0x%x\n", area_offset);
+		else
+			fprintf(stderr, "ERROR: Failed to read FAT file (%d)\n", ret);
+
+		return ret;
+	}
+
+	/* Save to the file with the same name in the current directory by default */
+	if (!output) {
+		output = strrchr(path, '/');
+		output = output ? output + 1 : path;
+	}
+
+	data = malloc(info.size ? info.size : 1);
+	if (!data) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return ENOMEM;
+	}
+
+	ret = baikal_scp_fat_read(area_offset, area_size, path, &info, data, info.size);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to read FAT file (%d)\n", ret);
+		goto exit;
+	}
+
+	fh = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fh == -1) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", output, ret);
+		goto exit;
+	}
+
+	if (write(fh, data, info.size) != info.size) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Failed to write file data (%d)\n", ret);
+	}
+
+	close(fh);
+
+	if (!ret && !quiet)
+		printf("OK: Success (%u bytes written to \"%s\")\n", info.size, output);
+
+exit:
+	free(data);
+	return ret;
+}
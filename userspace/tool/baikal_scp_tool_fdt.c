@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Flattened Device Tree (FDT) header. All fields are big-endian.
+ * Only the magic and the total size of the blob are used here.
+ */
+#define FDT_MAGIC 0xd00dfeed
+
+static uint32_t fdt32_to_cpu(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+int fdt_header_size(const void *header, unsigned int max_size, unsigned int *fdt_size)
+{
+	const unsigned char *p = header;
+	uint32_t totalsize;
+
+	if (fdt32_to_cpu(p) != FDT_MAGIC)
+		return EINVAL;
+
+	totalsize = fdt32_to_cpu(p + 4);
+	if ((totalsize < FDT_HEADER_SIZE) || (totalsize > max_size))
+		return EINVAL;
+
+	*fdt_size = totalsize;
+	return 0;
+}
+
+int fdt_flash_size(unsigned int offset, unsigned int max_size, unsigned int *fdt_size)
+{
+	int ret;
+	unsigned char *header;
+	unsigned int header_size = ALIGN(FDT_HEADER_SIZE, baikal_scp_flash_alignment());
+
+	header = malloc(header_size);
+	if (!header)
+		return ENOMEM;
+
+	ret = baikal_scp_flash_read(offset, header_size, header, NULL);
+	if (!ret)
+		ret = fdt_header_size(header, max_size, fdt_size);
+
+	free(header);
+	return ret;
+}
+
+static int is_blank(const unsigned char *data, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Erase stale data in the partition after the first used_size bytes.
+ * Sectors covered by the previous blob (old_size bytes) are erased
+ * without checking. Other sectors are expected to be blank, so only
+ * their first unit is checked. If the previous blob size is unknown
+ * (old_size is 0), all sectors are checked completely.
+ */
+int fdt_clean_tail(unsigned int offset, unsigned int size,
+	unsigned int used_size, unsigned int old_size, int quiet)
+{
+	int ret = 0;
+	unsigned int pos;
+	unsigned int erased = 0;
+	unsigned char *buf;
+	baikal_scp_flash_info_t info;
+	unsigned int alignment = baikal_scp_flash_alignment();
+
+	ret = baikal_scp_flash_info(&info);
+	if (ret)
+		return ret;
+
+	buf = malloc(info.sector_size);
+	if (!buf)
+		return ENOMEM;
+
+	for (pos = ALIGN(used_size, info.sector_size); pos < size; pos += info.sector_size) {
+		if (!old_size || (pos >= old_size)) {
+			unsigned int check_size = old_size ? alignment : info.sector_size;
+
+			if (check_size > size - pos)
+				check_size = size - pos;
+
+			ret = baikal_scp_flash_read(offset + pos, check_size, buf, NULL);
+			if (ret)
+				break;
+
+			if (is_blank(buf, check_size))
+				continue;
+		}
+
+		ret = baikal_scp_flash_erase(offset + pos, info.sector_size, NULL);
+		if (ret)
+			break;
+
+		erased++;
+	}
+
+	if (!ret && !quiet && erased)
+		printf("Erased %u stale sector(s) after the blob\n", erased);
+
+	free(buf);
+	return ret;
+}
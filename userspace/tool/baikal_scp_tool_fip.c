@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Firmware Image Package (FIP) support. FIP starts with the table of
+ * contents (ToC): ToC header followed by ToC entries that describe
+ * offsets and sizes of the images. ToC is terminated by an entry
+ * with null UUID.
+ */
+
+#define FIP_TOC_HEADER_NAME 0xaa640001
+
+#define FIP_MAX_ENTRIES 64
+
+/* Chunk size for hashing flash contents */
+#define FIP_HASH_CHUNK_SIZE 0x10000
+
+typedef struct __attribute__((packed)) fip_toc_header {
+	uint32_t name;
+	uint32_t serial_number;
+	uint64_t flags;
+} fip_toc_header_t;
+
+typedef struct __attribute__((packed)) fip_toc_entry {
+	uint8_t  uuid[16];
+	uint64_t offset_address;
+	uint64_t size;
+	uint64_t flags;
+} fip_toc_entry_t;
+
+typedef struct fip_toc {
+	fip_toc_header_t header;
+	unsigned int     count;
+	unsigned int     toc_size;
+	fip_toc_entry_t  entries[FIP_MAX_ENTRIES];
+} fip_toc_t;
+
+typedef struct fip_image_name {
+	uint8_t     uuid[16];
+	const char *name;
+} fip_image_name_t;
+
+/* Well-known image UUIDs (from TF-A firmware_image_package.h) */
+static const fip_image_name_t fip_image_names[] = {
+	{ { 0x5f, 0xf9, 0xec, 0x0b, 0x4d, 0x22, 0x3e, 0x4d,
+	    0xa5, 0x44, 0xc3, 0x9d, 0x81, 0xc7, 0x3f, 0x0a }, "tb-fw (BL2)" },
+	{ { 0x97, 0x66, 0xfd, 0x3d, 0x89, 0xbe, 0xe8, 0x49,
+	    0xae, 0x5d, 0x78, 0xa1, 0x40, 0x60, 0x82, 0x13 }, "scp-fw (SCP_BL2)" },
+	{ { 0x47, 0xd4, 0x08, 0x6d, 0x4c, 0xfe, 0x98, 0x46,
+	    0x9b, 0x95, 0x29, 0x50, 0xcb, 0xbd, 0x5a, 0x00 }, "soc-fw (BL31)" },
+	{ { 0x05, 0xd0, 0xe1, 0x89, 0x53, 0xdc, 0x13, 0x47,
+	    0x8d, 0x2b, 0x50, 0x0a, 0x4b, 0x7a, 0x3e, 0x38 }, "tos-fw (BL32)" },
+	{ { 0xd6, 0xd0, 0xee, 0xa7, 0xfc, 0xea, 0xd5, 0x4b,
+	    0x97, 0x82, 0x99, 0x34, 0xf2, 0x34, 0xb6, 0xe4 }, "nt-fw (BL33)" },
+	{ { 0x82, 0x7e, 0xe8, 0x90, 0xf8, 0x60, 0xe4, 0x11,
+	    0xa1, 0xb4, 0x77, 0x7a, 0x21, 0xb4, 0xf9, 0x4c }, "trusted-key-cert" },
+	{ { 0xd6, 0xe2, 0x69, 0xea, 0x5d, 0x63, 0xe4, 0x11,
+	    0x8d, 0x8c, 0x9f, 0xba, 0xbe, 0x99, 0x56, 0xa5 }, "tb-fw-cert" },
+};
+
+static const char *fip_image_name(const uint8_t *uuid)
+{
+	int i;
+
+	for (i = 0; i < sizeof(fip_image_names) / sizeof(fip_image_names[0]); i++) {
+		if (!memcmp(uuid, fip_image_names[i].uuid, 16))
+			return fip_image_names[i].name;
+	}
+
+	return "";
+}
+
+static void fip_uuid_format(const uint8_t *uuid, char *str)
+{
+	sprintf(str, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+		uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+		uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+}
+
+static int fip_uuid_is_null(const uint8_t *uuid)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (uuid[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Parse FIP ToC from buffer with the beginning of the FIP image
+ */
+static int fip_parse_toc(const unsigned char *buf, unsigned int buf_size,
+	unsigned int fip_size, fip_toc_t *toc)
+{
+	unsigned int pos = sizeof(fip_toc_header_t);
+
+	memset(toc, 0, sizeof(*toc));
+
+	if (buf_size < sizeof(fip_toc_header_t))
+		return EINVAL;
+
+	memcpy(&toc->header, buf, sizeof(toc->header));
+	if (toc->header.name != FIP_TOC_HEADER_NAME)
+		return EINVAL;
+
+	for (;;) {
+		fip_toc_entry_t *entry;
+
+		if (pos + sizeof(fip_toc_entry_t) > buf_size)
+			return EINVAL;
+
+		if (toc->count == FIP_MAX_ENTRIES)
+			return E2BIG;
+
+		entry = &toc->entries[toc->count];
+		memcpy(entry, buf + pos, sizeof(*entry));
+		pos += sizeof(*entry);
+
+		if (fip_uuid_is_null(entry->uuid))
+			break;
+
+		if ((entry->offset_address > fip_size) ||
+		    (entry->size > fip_size - entry->offset_address))
+			return EINVAL;
+
+		toc->count++;
+	}
+
+	toc->toc_size = pos;
+	return 0;
+}
+
+/*
+ * Read FIP ToC from flash. Only the ToC area is read.
+ */
+static int fip_read_toc(unsigned int part_offset, unsigned int part_size, fip_toc_t *toc)
+{
+	int ret;
+	unsigned char *buf;
+	unsigned int alignment = baikal_scp_flash_alignment();
+	unsigned int size = ALIGN(sizeof(fip_toc_header_t) +
+		(FIP_MAX_ENTRIES + 1) * sizeof(fip_toc_entry_t), alignment);
+
+	if (size > part_size)
+		size = part_size;
+
+	buf = malloc(size);
+	if (!buf)
+		return ENOMEM;
+
+	ret = baikal_scp_flash_read(part_offset, size, buf, NULL);
+	if (!ret)
+		ret = fip_parse_toc(buf, size, part_size, toc);
+
+	free(buf);
+	return ret;
+}
+
+int fip_list(unsigned int part_offset, unsigned int part_size)
+{
+	int ret;
+	unsigned int i;
+	fip_toc_t toc;
+	char uuid[EFI_GUID_STR_SIZE];
+
+	ret = fip_read_toc(part_offset, part_size, &toc);
+	if (ret) {
+		fprintf(stderr, "ERROR: No valid FIP found at offset 0x%x (%d)\n", part_offset, ret);
+		return ret;
+	}
+
+	fprintf(stdout, "FIP at offset 0x%x, serial number 0x%08x, flags 0x%016llx\n",
+		part_offset, toc.header.serial_number, (unsigned long long)toc.header.flags);
+
+	fprintf(stdout, "%-36s  %-18s  %-10s  %-10s  %s\n",
+		"UUID", "Image", "Offset", "Size", "Flags");
+
+	for (i = 0; i < toc.count; i++) {
+		fip_uuid_format(toc.entries[i].uuid, uuid);
+
+		fprintf(stdout, "%-36s  %-18s  0x%08llx  0x%08llx  0x%016llx\n",
+			uuid, fip_image_name(toc.entries[i].uuid),
+			(unsigned long long)toc.entries[i].offset_address,
+			(unsigned long long)toc.entries[i].size,
+			(unsigned long long)toc.entries[i].flags);
+	}
+
+	return 0;
+}
+
+/*
+ * Calculate SHA-256 of the flash area
+ */
+static int fip_hash_flash(unsigned int offset, unsigned int size,
+	unsigned char *digest, unsigned char *buf)
+{
+	int ret;
+	unsigned int alignment = baikal_scp_flash_alignment();
+	unsigned int head = offset % alignment;
+	unsigned int pos = offset - head;
+	unsigned int end = offset + size;
+	baikal_scp_sha256_ctx_t ctx;
+
+	baikal_scp_sha256_init(&ctx);
+
+	while (pos < end) {
+		unsigned int part = ALIGN(end - pos, alignment);
+
+		if (part > FIP_HASH_CHUNK_SIZE)
+			part = FIP_HASH_CHUNK_SIZE;
+
+		ret = baikal_scp_flash_read(pos, part, buf, NULL);
+		if (ret)
+			return ret;
+
+		if (pos + part > end)
+			part = end - pos;
+
+		baikal_scp_sha256_update(&ctx, buf + head, part - head);
+
+		pos += part;
+		head = 0;
+	}
+
+	baikal_scp_sha256_final(&ctx, digest);
+	return 0;
+}
+
+static const fip_toc_entry_t *fip_find_entry(const fip_toc_t *toc, const uint8_t *uuid)
+{
+	unsigned int i;
+
+	for (i = 0; i < toc->count; i++) {
+		if (!memcmp(toc->entries[i].uuid, uuid, 16))
+			return &toc->entries[i];
+	}
+
+	return NULL;
+}
+
+static void fip_mark_dirty(unsigned char *dirty, unsigned int start,
+	unsigned int end, unsigned int sector_size)
+{
+	unsigned int s;
+
+	for (s = start / sector_size; s < DIV_ROUND_UP(end, sector_size); s++)
+		dirty[s] = 1;
+}
+
+int fip_update(unsigned int part_offset, unsigned int part_size,
+	const char *path, int no_verify, int quiet)
+{
+	int ret;
+	int fh;
+	struct stat st;
+	unsigned char *image = NULL;
+	unsigned char *buf = NULL;
+	unsigned char *dirty = NULL;
+	unsigned char old_digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned char new_digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned int fip_size;
+	unsigned int i;
+	unsigned int s;
+	unsigned int toc_end;
+	unsigned int entries_changed = 0;
+	unsigned int sectors_total;
+	unsigned int sectors_dirty = 0;
+	unsigned int sectors_done = 0;
+	int old_valid;
+	fip_toc_t new_toc;
+	fip_toc_t old_toc;
+	baikal_scp_flash_info_t info;
+	unsigned int alignment = baikal_scp_flash_alignment();
+
+	ret = baikal_scp_flash_info(&info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to retrieve flash information (%d)\n", ret);
+		return ret;
+	}
+
+	if ((part_offset % info.sector_size) || (part_offset + part_size > info.total_size)) {
+		fprintf(stderr, "ERROR: FIP area must start at the flash sector boundary\n");
+		return EINVAL;
+	}
+
+	if ((fh = open(path, O_RDONLY)) == -1) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for reading (%d)\n", path, ret);
+		return ret;
+	}
+
+	if (fstat(fh, &st) || (st.st_size > part_size) || !st.st_size) {
+		fprintf(stderr, "ERROR: Invalid FIP image size\n");
+		close(fh);
+		return EINVAL;
+	}
+
+	fip_size = (unsigned int)st.st_size;
+	sectors_total = DIV_ROUND_UP(fip_size, info.sector_size);
+
+	image = malloc(sectors_total * info.sector_size);
+	buf = malloc(info.sector_size > FIP_HASH_CHUNK_SIZE ? info.sector_size : FIP_HASH_CHUNK_SIZE);
+	dirty = calloc(sectors_total, 1);
+
+	if (!image || !buf || !dirty) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	memset(image, 0xff, sectors_total * info.sector_size);
+
+	if (read(fh, image, fip_size) != fip_size) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Failed to read data from file (%d)\n", ret);
+		goto exit;
+	}
+
+	ret = fip_parse_toc(image, fip_size, fip_size, &new_toc);
+	if (ret) {
+		fprintf(stderr, "ERROR: File \"%s\" is not a valid FIP image\n", path);
+		goto exit;
+	}
+
+	baikal_scp_sha256(image, fip_size, new_digest);
+	report_digest(new_digest);
+
+	report_phase_begin("compare");
+
+	old_valid = !fip_read_toc(part_offset, part_size, &old_toc);
+	if (!old_valid && !quiet)
+		printf("No valid FIP found on flash, all sectors will be written\n");
+
+	/* ToC area: from the beginning of FIP to the first image */
+	toc_end = fip_size;
+	for (i = 0; i < new_toc.count; i++) {
+		if (new_toc.entries[i].offset_address < toc_end)
+			toc_end = (unsigned int)new_toc.entries[i].offset_address;
+	}
+
+	if (toc_end < new_toc.toc_size)
+		toc_end = new_toc.toc_size;
+
+	if (!old_valid) {
+		fip_mark_dirty(dirty, 0, fip_size, info.sector_size);
+	}
+	else {
+		ret = fip_hash_flash(part_offset, toc_end, old_digest, buf);
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+			goto exit;
+		}
+
+		baikal_scp_sha256(image, toc_end, new_digest);
+
+		if (memcmp(old_digest, new_digest, sizeof(new_digest)))
+			fip_mark_dirty(dirty, 0, toc_end, info.sector_size);
+	}
+
+	/* Images (including padding up to the next image) */
+	for (i = 0; i < new_toc.count; i++) {
+		const fip_toc_entry_t *new_entry = &new_toc.entries[i];
+		const fip_toc_entry_t *old_entry;
+		unsigned int start = (unsigned int)new_entry->offset_address;
+		unsigned int end = fip_size;
+		unsigned int j;
+		char uuid[EFI_GUID_STR_SIZE];
+
+		for (j = 0; j < new_toc.count; j++) {
+			unsigned int next = (unsigned int)new_toc.entries[j].offset_address;
+
+			if ((next > start) && (next < end))
+				end = next;
+		}
+
+		if (end <= start)
+			continue;
+
+		if (old_valid) {
+			old_entry = fip_find_entry(&old_toc, new_entry->uuid);
+
+			if (old_entry &&
+			    (old_entry->offset_address == new_entry->offset_address) &&
+			    (old_entry->size == new_entry->size)) {
+				ret = fip_hash_flash(part_offset + start, end - start, old_digest, buf);
+				if (ret) {
+					fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+					goto exit;
+				}
+
+				baikal_scp_sha256(image + start, end - start, new_digest);
+
+				if (!memcmp(old_digest, new_digest, sizeof(new_digest)))
+					continue;
+			}
+		}
+
+		entries_changed++;
+		fip_mark_dirty(dirty, start, end, info.sector_size);
+
+		if (!quiet) {
+			fip_uuid_format(new_entry->uuid, uuid);
+			printf("Changed image: %s %s (offset 0x%x, size 0x%llx)\n",
+				uuid, fip_image_name(new_entry->uuid), start,
+				(unsigned long long)new_entry->size);
+		}
+	}
+
+	report_phase_end();
+
+	for (s = 0; s < sectors_total; s++)
+		sectors_dirty += dirty[s];
+
+	report_sectors(sectors_total, sectors_total - sectors_dirty);
+	report_phase_begin("update");
+
+	if (!quiet) {
+		printf("FIP images changed: %u of %u, sectors to rewrite: %u of %u\n",
+			entries_changed, new_toc.count, sectors_dirty, sectors_total);
+	}
+
+	for (s = 0; s < sectors_total; s++) {
+		unsigned int sector_offset = part_offset + s * info.sector_size;
+		unsigned char *data = image + s * info.sector_size;
+		unsigned int write_size = info.sector_size;
+
+		if (!dirty[s])
+			continue;
+
+		if (!quiet) {
+			printf("\rUpdating: sector 0x%08x [%u / %u]",
+				sector_offset, sectors_done + 1, sectors_dirty);
+			fflush(stdout);
+		}
+
+		ret = baikal_scp_flash_erase(sector_offset, info.sector_size, NULL);
+		if (ret) {
+			fprintf(stderr, "\nERROR: Failed to erase flash data (%d)\n", ret);
+			goto exit;
+		}
+
+		/* Erased flash is already filled with 0xff */
+		while (write_size && (data[write_size - 1] == 0xff))
+			write_size--;
+
+		write_size = ALIGN(write_size, alignment);
+
+		if (write_size) {
+			ret = baikal_scp_flash_write(sector_offset, write_size, data, NULL);
+			if (ret) {
+				fprintf(stderr, "\nERROR: Failed to write data to flash (%d)\n", ret);
+				goto exit;
+			}
+		}
+
+		if (!no_verify) {
+			ret = baikal_scp_flash_read(sector_offset, info.sector_size, buf, NULL);
+			if (ret) {
+				fprintf(stderr, "\nERROR: Failed to read data from flash (%d)\n", ret);
+				goto exit;
+			}
+
+			if (memcmp(buf, data, info.sector_size)) {
+				fprintf(stderr, "\nERROR: Verification failed at offset 0x%x\n", sector_offset);
+				ret = EIO;
+				goto exit;
+			}
+		}
+
+		sectors_done++;
+	}
+
+	report_phase_end();
+
+	if (!quiet) {
+		if (sectors_done)
+			printf("\n");
+
+		printf("OK: Success\n");
+	}
+
+exit:
+	close(fh);
+	free(dirty);
+	free(buf);
+	free(image);
+	return ret;
+}
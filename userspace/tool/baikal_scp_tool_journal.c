@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+#include <libgen.h>
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Write progress journal (--resume option)
+ *
+ * The journal keeps the written image digest and range and one flags
+ * byte per flash sector covered by the range. The written and verified
+ * flags are only set after the sector has been completely written or
+ * verified (or found identical to the image) and the file is
+ * flushed at most once per JOURNAL_FLUSH_INTERVAL seconds, so a sector
+ * marked in the journal is always done, while the sectors done after
+ * the last flush are simply written once more on resume.
+ */
+
+#define JOURNAL_MAGIC   0x4a435342 /* "BSCJ" */
+#define JOURNAL_VERSION 1
+
+#define JOURNAL_FLUSH_INTERVAL 1.0
+
+typedef struct journal_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t sector_size;
+	uint32_t sector_count;
+	uint8_t  digest[BAIKAL_SCP_SHA256_SIZE];
+} journal_header_t;
+
+typedef struct journal {
+	int               fd;    /* -1 if the journal file is not available */
+	const char       *path;
+	journal_header_t  header;
+	unsigned char    *flags;
+	unsigned int      first; /* Index of the first sector on flash */
+	int               dirty;
+	double            flushed;
+} journal_t;
+
+static journal_t journal = { .fd = -1 };
+
+static double journal_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Part of the sector covered by the journal range
+ */
+static void journal_sector(unsigned int i, unsigned int *offset, unsigned int *size)
+{
+	unsigned int start = (journal.first + i) * journal.header.sector_size;
+	unsigned int end = start + journal.header.sector_size;
+
+	if (start < journal.header.offset)
+		start = journal.header.offset;
+
+	if (end > journal.header.offset + journal.header.size)
+		end = journal.header.offset + journal.header.size;
+
+	*offset = start;
+	*size = end - start;
+}
+
+static int journal_load(void)
+{
+	journal_header_t header;
+	unsigned int count = journal.header.sector_count;
+
+	if ((pread(journal.fd, &header, sizeof(header), 0) != sizeof(header)) ||
+	    (header.magic != JOURNAL_MAGIC) ||
+	    (header.version != JOURNAL_VERSION) ||
+	    memcmp(&header, &journal.header, sizeof(header)))
+		return ENOENT;
+
+	if (pread(journal.fd, journal.flags, count, sizeof(header)) != count)
+		return ENOENT;
+
+	return 0;
+}
+
+/*
+ * Compare SHA-256 digests of the sectors marked as done with the digests
+ * of the image data and clear the flags of the sectors that do not match.
+ * The flash digest is calculated by the flash service daemon if it is
+ * running, so the sector data is not transferred.
+ */
+static int journal_check(const unsigned char *data, unsigned int *skipped)
+{
+	int ret;
+	unsigned int i;
+	unsigned char flash_digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned char image_digest[BAIKAL_SCP_SHA256_SIZE];
+
+	*skipped = 0;
+
+	for (i = 0; i < journal.header.sector_count; i++) {
+		unsigned int sector_offset, sector_size;
+
+		if (!(journal.flags[i] & JOURNAL_SECTOR_WRITTEN))
+			continue;
+
+		journal_sector(i, &sector_offset, &sector_size);
+
+		ret = baikal_scp_flash_sha256(sector_offset, sector_size, flash_digest);
+		if (ret)
+			return ret;
+
+		baikal_scp_sha256(data + (sector_offset - journal.header.offset),
+			sector_size, image_digest);
+
+		if (!memcmp(flash_digest, image_digest, sizeof(flash_digest))) {
+			(*skipped)++;
+			continue;
+		}
+
+		journal.flags[i] = 0;
+		journal.dirty = 1;
+	}
+
+	return 0;
+}
+
+int journal_open(const char *path, unsigned int offset, unsigned int size,
+	const void *data, const unsigned char *digest, int resume, int dry_run, int quiet)
+{
+	int ret;
+	baikal_scp_flash_info_t flash_info;
+	unsigned int skipped = 0;
+	char *dir;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to get flash information (%d)\n", ret);
+		return ret;
+	}
+
+	memset(&journal.header, 0, sizeof(journal.header));
+	journal.header.magic        = JOURNAL_MAGIC;
+	journal.header.version      = JOURNAL_VERSION;
+	journal.header.offset       = offset;
+	journal.header.size         = size;
+	journal.header.sector_size  = flash_info.sector_size;
+	journal.header.sector_count = (offset + size - 1) / flash_info.sector_size -
+		offset / flash_info.sector_size + 1;
+	memcpy(journal.header.digest, digest, BAIKAL_SCP_SHA256_SIZE);
+
+	journal.first   = offset / flash_info.sector_size;
+	journal.path    = path;
+	journal.dirty   = 1;
+	journal.flushed = 0;
+
+	journal.flags = calloc(journal.header.sector_count, 1);
+	if (!journal.flags) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return ENOMEM;
+	}
+
+	if (resume) {
+		/* The journal file is left intact if the resume fails */
+		journal.fd = open(path, dry_run ? O_RDONLY : O_RDWR);
+		if ((journal.fd == -1) || journal_load()) {
+			fprintf(stderr, "ERROR: No journal of writing this image to this flash "
+				"area found in \"%s\"\n", path);
+			journal.dirty = 0;
+			journal_close(0);
+			return ENOENT;
+		}
+
+		report_phase_begin("check");
+		ret = journal_check(data, &skipped);
+		report_phase_end();
+
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+			journal.dirty = 0;
+			journal_close(0);
+			return ret;
+		}
+
+		if (!quiet) {
+			printf("Resuming: %u of %u sectors already written\n",
+				skipped, journal.header.sector_count);
+		}
+
+		/* Dry run only uses the journal contents */
+		if (dry_run) {
+			close(journal.fd);
+			journal.fd = -1;
+		}
+
+		return 0;
+	}
+
+	if (dry_run)
+		return 0;
+
+	/* The default journal directory may not exist yet */
+	dir = strdup(path);
+	if (dir) {
+		mkdir(dirname(dir), 0700);
+		free(dir);
+	}
+
+	journal.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if ((journal.fd == -1) || journal_flush(1)) {
+		fprintf(stderr, "WARNING: Cannot create journal \"%s\" (%d), "
+			"the write will not be resumable\n", path, errno);
+
+		if (journal.fd != -1) {
+			close(journal.fd);
+			unlink(path);
+			journal.fd = -1;
+		}
+	}
+
+	return 0;
+}
+
+int journal_flush(int force)
+{
+	double now;
+	unsigned int count = journal.header.sector_count;
+
+	if ((journal.fd == -1) || !journal.dirty)
+		return 0;
+
+	now = journal_now();
+	if (!force && (now - journal.flushed < JOURNAL_FLUSH_INTERVAL))
+		return 0;
+
+	if ((pwrite(journal.fd, &journal.header, sizeof(journal.header), 0) != sizeof(journal.header)) ||
+	    (pwrite(journal.fd, journal.flags, count, sizeof(journal.header)) != count) ||
+	    fdatasync(journal.fd))
+		return errno ? errno : EIO;
+
+	journal.dirty = 0;
+	journal.flushed = now;
+	return 0;
+}
+
+/*
+ * Find the first run of consecutive sectors without any of the flags starting
+ * at or after the flash offset. Returns 0 if there are no such sectors.
+ */
+int journal_run(unsigned int from, unsigned char flag,
+	unsigned int *run_offset, unsigned int *run_size)
+{
+	unsigned int i, j;
+	unsigned int sector_offset, sector_size;
+
+	for (i = 0; i < journal.header.sector_count; i++) {
+		journal_sector(i, &sector_offset, &sector_size);
+		if ((sector_offset >= from) && !(journal.flags[i] & flag))
+			break;
+	}
+
+	if (i == journal.header.sector_count)
+		return 0;
+
+	for (j = i; (j < journal.header.sector_count) && !(journal.flags[j] & flag); j++);
+
+	*run_offset = sector_offset;
+	journal_sector(j - 1, &sector_offset, &sector_size);
+	*run_size = sector_offset + sector_size - *run_offset;
+	return 1;
+}
+
+/*
+ * Count sectors without any of the flags
+ */
+unsigned int journal_count(unsigned char flag)
+{
+	unsigned int i;
+	unsigned int count = 0;
+
+	for (i = 0; i < journal.header.sector_count; i++) {
+		if (!(journal.flags[i] & flag))
+			count++;
+	}
+
+	return count;
+}
+
+/*
+ * Count bytes of the sectors without any of the flags
+ */
+unsigned int journal_bytes(unsigned char flag)
+{
+	unsigned int i;
+	unsigned int sector_offset, sector_size;
+	unsigned int bytes = 0;
+
+	for (i = 0; i < journal.header.sector_count; i++) {
+		journal_sector(i, &sector_offset, &sector_size);
+		if (!(journal.flags[i] & flag))
+			bytes += sector_size;
+	}
+
+	return bytes;
+}
+
+/*
+ * Set (or clear, if set is 0) the flags for the sectors that
+ * are completely covered by the flash area
+ */
+void journal_mark(unsigned int offset, unsigned int size, unsigned char flag, int set)
+{
+	unsigned int i;
+	unsigned int sector_offset, sector_size;
+
+	for (i = 0; i < journal.header.sector_count; i++) {
+		journal_sector(i, &sector_offset, &sector_size);
+
+		if ((sector_offset < offset) ||
+		    (sector_offset + sector_size > offset + size))
+			continue;
+
+		if (set)
+			journal.flags[i] |= flag;
+		else
+			journal.flags[i] &= ~flag;
+
+		journal.dirty = 1;
+	}
+}
+
+/*
+ * Close the journal, the file is removed when the write is complete.
+ * Returns non-zero if the journal file is kept.
+ */
+int journal_close(int remove)
+{
+	int kept = 0;
+
+	if (journal.fd != -1) {
+		if (remove)
+			unlink(journal.path);
+		else
+			kept = !journal_flush(1);
+
+		close(journal.fd);
+		journal.fd = -1;
+	}
+
+	free(journal.flags);
+	journal.flags = NULL;
+
+	return kept;
+}
@@ -0,0 +1,814 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Binary delta patches (--patch and --patch-create options)
+ *
+ * A patch describes the new image as a sequence of commands: copy a block
+ * of the current (source) contents of the flash area or insert the data
+ * stored in the patch. The patch also holds SHA-256 digests of the source
+ * blocks referenced by the copies and of the whole new image.
+ *
+ * The patch is applied sector by sector. Only the source blocks referenced
+ * by the patch are read; sectors made of unmoved source data are skipped
+ * without reading them and sectors whose new contents equal the current
+ * ones are not erased. The source blocks are checked against their digests
+ * before anything is written, so a patch created for other flash contents
+ * is rejected. Old contents of the rewritten sectors still needed by the
+ * following copies are kept in memory until their last use.
+ *
+ * File layout (host byte order):
+ *   patch_header_t
+ *   patch_block_t   x block_count
+ *   patch_command_t x command_count, each insert followed by its data
+ */
+
+#define PATCH_MAGIC   0x48435042 /* "BPCH" */
+#define PATCH_VERSION 1
+
+/* Size of the source blocks checked before applying the patch */
+#define PATCH_BLOCK_SIZE (64 * 1024)
+
+/* Shortest copy found by the generator */
+#define PATCH_MATCH_SIZE 64
+
+/* Multiplier of the generator rolling hash */
+#define PATCH_HASH_PRIME 0x01000193u
+
+#define PATCH_COPY   1
+#define PATCH_INSERT 2
+
+typedef struct patch_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t source_size;   /* Size of the source area */
+	uint32_t target_size;   /* Size of the new image */
+	uint32_t block_size;    /* Size of the checked source blocks */
+	uint32_t block_count;   /* Checked source blocks */
+	uint32_t command_count;
+	uint32_t reserved;
+	uint8_t  target_digest[BAIKAL_SCP_SHA256_SIZE];
+} patch_header_t;
+
+typedef struct patch_block {
+	uint32_t index;
+	uint8_t  digest[BAIKAL_SCP_SHA256_SIZE];
+} patch_block_t;
+
+typedef struct patch_command {
+	uint32_t type;
+	uint32_t offset; /* Source offset of the copy */
+	uint32_t size;
+} patch_command_t;
+
+/* Parsed command with its position in the new image */
+typedef struct patch_op {
+	unsigned int         type;
+	unsigned int         src;
+	unsigned int         dst;
+	unsigned int         size;
+	const unsigned char *data;
+} patch_op_t;
+
+typedef struct patch {
+	unsigned char  *file;
+	patch_header_t  header;
+	patch_block_t  *blocks;
+	patch_op_t     *ops;
+	unsigned int    op_count;
+	unsigned int    op_next;     /* First op that may overlap the next sector */
+
+	unsigned int    offset;      /* Flash offset of the area */
+	unsigned int    sector_size;
+	unsigned int    sector_count;
+	unsigned char **saved;       /* Old contents of the rewritten source sectors */
+	unsigned int   *last_use;    /* Last sector built from the source sector */
+} patch_t;
+
+static int patch_load_file(const char *path, unsigned char **data, unsigned int *size)
+{
+	int fh;
+	int ret = 0;
+	struct stat st;
+
+	if ((fh = open(path, O_RDONLY)) == -1) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for reading (%d)\n", path, ret);
+		return ret;
+	}
+
+	if (fstat(fh, &st) || !st.st_size || (st.st_size > UINT32_MAX)) {
+		fprintf(stderr, "ERROR: Invalid size of file \"%s\"\n", path);
+		close(fh);
+		return EINVAL;
+	}
+
+	*size = (unsigned int)st.st_size;
+	*data = malloc(*size);
+	if (!*data) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		close(fh);
+		return ENOMEM;
+	}
+
+	if (read(fh, *data, *size) != *size) {
+		ret = errno ? errno : EIO;
+		fprintf(stderr, "ERROR: Failed to read data from file \"%s\" (%d)\n", path, ret);
+		free(*data);
+		*data = NULL;
+	}
+
+	close(fh);
+	return ret;
+}
+
+static int patch_parse(patch_t *p, unsigned int file_size)
+{
+	unsigned int pos;
+	unsigned int dst = 0;
+	unsigned int i;
+	patch_command_t cmd;
+
+	if (file_size < sizeof(p->header))
+		return EINVAL;
+
+	memcpy(&p->header, p->file, sizeof(p->header));
+
+	if ((p->header.magic != PATCH_MAGIC) ||
+	    (p->header.version != PATCH_VERSION) ||
+	    !p->header.target_size || !p->header.block_size ||
+	    (p->header.block_count > DIV_ROUND_UP(p->header.source_size, p->header.block_size)))
+		return EINVAL;
+
+	pos = sizeof(p->header);
+	if (file_size - pos < p->header.block_count * sizeof(patch_block_t))
+		return EINVAL;
+
+	p->blocks = (patch_block_t *)(p->file + pos);
+	pos += p->header.block_count * sizeof(patch_block_t);
+
+	for (i = 0; i < p->header.block_count; i++) {
+		if (p->blocks[i].index >= DIV_ROUND_UP(p->header.source_size, p->header.block_size))
+			return EINVAL;
+	}
+
+	p->ops = calloc(p->header.command_count ? p->header.command_count : 1, sizeof(patch_op_t));
+	if (!p->ops)
+		return ENOMEM;
+
+	for (i = 0; i < p->header.command_count; i++) {
+		patch_op_t *op = &p->ops[i];
+
+		if (file_size - pos < sizeof(cmd))
+			return EINVAL;
+
+		memcpy(&cmd, p->file + pos, sizeof(cmd));
+		pos += sizeof(cmd);
+
+		if (!cmd.size || (cmd.size > p->header.target_size - dst))
+			return EINVAL;
+
+		op->type = cmd.type;
+		op->src  = cmd.offset;
+		op->dst  = dst;
+		op->size = cmd.size;
+
+		if (cmd.type == PATCH_COPY) {
+			if ((cmd.offset >= p->header.source_size) ||
+			    (cmd.size > p->header.source_size - cmd.offset))
+				return EINVAL;
+		}
+		else if (cmd.type == PATCH_INSERT) {
+			if (file_size - pos < cmd.size)
+				return EINVAL;
+
+			op->data = p->file + pos;
+			pos += cmd.size;
+		}
+		else
+			return EINVAL;
+
+		dst += cmd.size;
+	}
+
+	p->op_count = p->header.command_count;
+
+	return (dst == p->header.target_size) ? 0 : EINVAL;
+}
+
+/* Check the source blocks referenced by the patch against the flash contents */
+static int patch_check_source(patch_t *p)
+{
+	int ret;
+	unsigned int i;
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+
+	for (i = 0; i < p->header.block_count; i++) {
+		unsigned int start = p->blocks[i].index * p->header.block_size;
+		unsigned int size = p->header.source_size - start;
+
+		if (size > p->header.block_size)
+			size = p->header.block_size;
+
+		ret = baikal_scp_flash_sha256(p->offset + start, size, digest);
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+			return ret;
+		}
+
+		if (memcmp(digest, p->blocks[i].digest, sizeof(digest))) {
+			fprintf(stderr, "ERROR: Flash contents at offset 0x%x do not match the patch source\n",
+				p->offset + start);
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int patch_read_source(patch_t *p, unsigned int src, unsigned int size, unsigned char *out)
+{
+	int ret;
+
+	while (size) {
+		unsigned int sector = src / p->sector_size;
+		unsigned int pos = src % p->sector_size;
+		unsigned int part = p->sector_size - pos;
+
+		if (part > size)
+			part = size;
+
+		if (p->saved[sector])
+			memcpy(out, p->saved[sector] + pos, part);
+		else {
+			ret = baikal_scp_flash_read(p->offset + src, part, out, NULL);
+			if (ret)
+				return ret;
+		}
+
+		src  += part;
+		size -= part;
+		out  += part;
+	}
+
+	return 0;
+}
+
+/*
+ * Check whether the area of the new image consists of the source data
+ * copied to the same position (the flash contents do not change there)
+ */
+static int patch_area_unchanged(patch_t *p, unsigned int start, unsigned int end)
+{
+	unsigned int i;
+
+	while ((p->op_next < p->op_count) &&
+	       (p->ops[p->op_next].dst + p->ops[p->op_next].size <= start))
+		p->op_next++;
+
+	for (i = p->op_next; (i < p->op_count) && (p->ops[i].dst < end); i++) {
+		if ((p->ops[i].type != PATCH_COPY) || (p->ops[i].src != p->ops[i].dst))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Build the area of the new image */
+static int patch_build(patch_t *p, unsigned int start, unsigned int end, unsigned char *out)
+{
+	int ret;
+	unsigned int i;
+
+	for (i = p->op_next; (i < p->op_count) && (p->ops[i].dst < end); i++) {
+		const patch_op_t *op = &p->ops[i];
+		unsigned int a = (op->dst > start) ? op->dst : start;
+		unsigned int b = (op->dst + op->size < end) ? op->dst + op->size : end;
+
+		if (op->type == PATCH_INSERT)
+			memcpy(out + (a - start), op->data + (a - op->dst), b - a);
+		else {
+			ret = patch_read_source(p, op->src + (a - op->dst), b - a, out + (a - start));
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void patch_free(patch_t *p)
+{
+	unsigned int i;
+
+	if (p->saved) {
+		for (i = 0; i < p->sector_count; i++)
+			free(p->saved[i]);
+	}
+
+	free(p->saved);
+	free(p->last_use);
+	free(p->ops);
+	free(p->file);
+}
+
+/*
+ * Apply the patch to the flash area at the offset. The size of the new
+ * image is returned in target_size.
+ */
+int patch_apply(unsigned int offset, unsigned int max_size, const char *path,
+	int no_verify, int quiet, unsigned int *target_size)
+{
+	int ret;
+	patch_t p;
+	baikal_scp_flash_info_t info;
+	unsigned int file_size;
+	unsigned int area_size;
+	unsigned int sectors_total;
+	unsigned int sectors_skipped = 0;
+	unsigned int sectors_written = 0;
+	unsigned int s, k;
+	unsigned char *cur = NULL;
+	unsigned char *new = NULL;
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+	unsigned int alignment = baikal_scp_flash_alignment();
+
+	memset(&p, 0, sizeof(p));
+
+	ret = baikal_scp_flash_info(&info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to retrieve flash information (%d)\n", ret);
+		return ret;
+	}
+
+	if (offset % info.sector_size) {
+		fprintf(stderr, "ERROR: Patched area must start at the flash sector boundary\n");
+		return EINVAL;
+	}
+
+	ret = patch_load_file(path, &p.file, &file_size);
+	if (ret)
+		return ret;
+
+	ret = patch_parse(&p, file_size);
+	if (ret) {
+		if (ret == EINVAL)
+			fprintf(stderr, "ERROR: File \"%s\" is not a valid patch\n", path);
+		goto exit;
+	}
+
+	*target_size = p.header.target_size;
+	area_size = (p.header.source_size > p.header.target_size)
+		? p.header.source_size : p.header.target_size;
+
+	if ((offset >= info.total_size) || (area_size > info.total_size - offset) ||
+	    (max_size && (p.header.target_size > max_size))) {
+		fprintf(stderr, "ERROR: Patched image does not fit the flash area\n");
+		ret = EINVAL;
+		goto exit;
+	}
+
+	report_digest(p.header.target_digest);
+
+	p.offset       = offset;
+	p.sector_size  = info.sector_size;
+	p.sector_count = DIV_ROUND_UP(area_size, info.sector_size);
+	sectors_total  = DIV_ROUND_UP(p.header.target_size, info.sector_size);
+
+	p.saved    = calloc(p.sector_count, sizeof(*p.saved));
+	p.last_use = calloc(p.sector_count, sizeof(*p.last_use));
+	cur = malloc(info.sector_size);
+	new = malloc(info.sector_size);
+
+	if (!p.saved || !p.last_use || !cur || !new) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	for (s = 0; s < p.op_count; s++) {
+		const patch_op_t *op = &p.ops[s];
+		unsigned int use = (op->dst + op->size - 1) / info.sector_size;
+
+		if (op->type != PATCH_COPY)
+			continue;
+
+		for (k = op->src / info.sector_size; k <= (op->src + op->size - 1) / info.sector_size; k++) {
+			if (p.last_use[k] < use)
+				p.last_use[k] = use;
+		}
+	}
+
+	if (!quiet) {
+		printf("Applying patch \"%s\" (%u commands, %u source blocks) to 0x%x bytes "
+			"of SPI Boot Flash at offset 0x%x\n", path, p.op_count,
+			p.header.block_count, p.header.target_size, offset);
+	}
+
+	report_phase_begin("check");
+	ret = patch_check_source(&p);
+	report_phase_end();
+
+	if (ret)
+		goto exit;
+
+	report_phase_begin("update");
+
+	for (s = 0; s < sectors_total; s++) {
+		unsigned int start = s * info.sector_size;
+		unsigned int end = start + info.sector_size;
+		unsigned int sector_offset = offset + start;
+		unsigned int write_size = info.sector_size;
+
+		if (end > p.header.target_size)
+			end = p.header.target_size;
+
+		/* Old sector contents are not needed anymore */
+		for (k = 0; k < s; k++) {
+			if (p.saved[k] && (p.last_use[k] < s)) {
+				free(p.saved[k]);
+				p.saved[k] = NULL;
+			}
+		}
+
+		if (patch_area_unchanged(&p, start, end)) {
+			sectors_skipped++;
+			continue;
+		}
+
+		if (!quiet) {
+			printf("\rPatching: sector 0x%08x [%u / %u]", sector_offset, s + 1, sectors_total);
+			fflush(stdout);
+		}
+
+		ret = baikal_scp_flash_read(sector_offset, info.sector_size, cur, NULL);
+		if (ret) {
+			fprintf(stderr, "\nERROR: Failed to read data from flash (%d)\n", ret);
+			goto exit_update;
+		}
+
+		/* Data after the end of the new image is kept */
+		memcpy(new, cur, info.sector_size);
+
+		if (s < p.sector_count)
+			p.saved[s] = cur;
+
+		ret = patch_build(&p, start, end, new);
+
+		if (s < p.sector_count)
+			p.saved[s] = NULL;
+
+		if (ret) {
+			fprintf(stderr, "\nERROR: Failed to read data from flash (%d)\n", ret);
+			goto exit_update;
+		}
+
+		if (!memcmp(cur, new, info.sector_size)) {
+			sectors_skipped++;
+			continue;
+		}
+
+		/* The following sectors are built from the old contents */
+		if ((s < p.sector_count) && (p.last_use[s] > s)) {
+			p.saved[s] = cur;
+
+			cur = malloc(info.sector_size);
+			if (!cur) {
+				fprintf(stderr, "\nERROR: Out of memory\n");
+				ret = ENOMEM;
+				goto exit_update;
+			}
+		}
+
+		ret = baikal_scp_flash_erase(sector_offset, info.sector_size, NULL);
+		if (ret) {
+			fprintf(stderr, "\nERROR: Failed to erase flash data (%d)\n", ret);
+			goto exit_update;
+		}
+
+		/* Erased flash is already filled with 0xff */
+		while (write_size && (new[write_size - 1] == 0xff))
+			write_size--;
+
+		write_size = ALIGN(write_size, alignment);
+
+		if (write_size) {
+			ret = baikal_scp_flash_write(sector_offset, write_size, new, NULL);
+			if (ret) {
+				fprintf(stderr, "\nERROR: Failed to write data to flash (%d)\n", ret);
+				goto exit_update;
+			}
+		}
+
+		sectors_written++;
+	}
+
+	if (!quiet) {
+		printf("%sSectors rewritten: %u of %u\n", sectors_written ? "\n" : "",
+			sectors_written, sectors_total);
+	}
+
+exit_update:
+	report_phase_end();
+	report_sectors(sectors_total, sectors_skipped);
+
+	if (ret)
+		goto exit;
+
+	if (!no_verify) {
+		report_phase_begin("verify");
+		ret = baikal_scp_flash_sha256(offset, p.header.target_size, digest);
+		report_phase_end();
+
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to read data from flash (%d)\n", ret);
+			goto exit;
+		}
+
+		if (memcmp(digest, p.header.target_digest, sizeof(digest))) {
+			fprintf(stderr, "ERROR: Verification failed, patched image digest mismatch\n");
+			ret = EIO;
+			goto exit;
+		}
+	}
+
+	if (!quiet)
+		printf("OK: Success\n");
+
+exit:
+	free(cur);
+	free(new);
+	patch_free(&p);
+	return ret;
+}
+
+/* ---------------------------------------------------------------------------------- */
+
+typedef struct patch_writer {
+	patch_command_t *cmds;
+	const unsigned char **data;
+	unsigned int count;
+	unsigned int alloc;
+	unsigned long long inserted;
+} patch_writer_t;
+
+static int patch_emit(patch_writer_t *w, unsigned int type, unsigned int offset,
+	unsigned int size, const unsigned char *data)
+{
+	if (!size)
+		return 0;
+
+	if (w->count == w->alloc) {
+		unsigned int alloc = w->alloc ? w->alloc * 2 : 256;
+		void *cmds = realloc(w->cmds, alloc * sizeof(*w->cmds));
+		void *ptrs;
+
+		if (!cmds)
+			return ENOMEM;
+
+		w->cmds = cmds;
+
+		ptrs = realloc(w->data, alloc * sizeof(*w->data));
+		if (!ptrs)
+			return ENOMEM;
+
+		w->data = ptrs;
+		w->alloc = alloc;
+	}
+
+	w->cmds[w->count].type   = type;
+	w->cmds[w->count].offset = offset;
+	w->cmds[w->count].size   = size;
+	w->data[w->count]        = data;
+	w->count++;
+
+	if (type == PATCH_INSERT)
+		w->inserted += size;
+
+	return 0;
+}
+
+static uint32_t patch_hash(const unsigned char *data)
+{
+	uint32_t h = 0;
+	unsigned int i;
+
+	for (i = 0; i < PATCH_MATCH_SIZE; i++)
+		h = h * PATCH_HASH_PRIME + data[i];
+
+	return h;
+}
+
+/*
+ * Create the patch transforming the source image into the target image.
+ * Copies are found by hashing the source blocks of PATCH_MATCH_SIZE bytes
+ * and rolling the hash over the target, unmoved data is preferred.
+ */
+int patch_create(const char *source_path, const char *target_path,
+	const char *output, int quiet)
+{
+	int ret;
+	FILE *f = NULL;
+	unsigned char *src = NULL;
+	unsigned char *dst = NULL;
+	unsigned int src_size = 0;
+	unsigned int dst_size = 0;
+	uint32_t *table = NULL;
+	uint32_t mask = 0;
+	uint32_t h = 0;
+	uint32_t pow = 1;
+	unsigned char *used = NULL;
+	unsigned int block_count = 0;
+	unsigned int pos = 0;
+	unsigned int pending = 0;
+	unsigned int i;
+	patch_writer_t w;
+	patch_header_t header;
+	patch_block_t block;
+	long patch_size;
+
+	memset(&w, 0, sizeof(w));
+
+	if (!source_path || !output) {
+		fprintf(stderr, "ERROR: Source image (-I, --input) and patch file (-O, --output) "
+			"must be specified\n");
+		return EINVAL;
+	}
+
+	ret = patch_load_file(source_path, &src, &src_size);
+	if (!ret)
+		ret = patch_load_file(target_path, &dst, &dst_size);
+	if (ret)
+		goto exit;
+
+	/* Hash table of the source blocks, the first block with the hash wins */
+	for (mask = 1; mask < 2 * (src_size / PATCH_MATCH_SIZE); mask <<= 1)
+		;
+
+	table = calloc(mask, sizeof(*table));
+	used = calloc(DIV_ROUND_UP(src_size, PATCH_BLOCK_SIZE), 1);
+	if (!table || !used) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	mask--;
+
+	for (i = 0; i + PATCH_MATCH_SIZE <= src_size; i += PATCH_MATCH_SIZE) {
+		uint32_t *slot = &table[patch_hash(src + i) & mask];
+
+		if (!*slot)
+			*slot = i + 1;
+	}
+
+	for (i = 1; i < PATCH_MATCH_SIZE; i++)
+		pow *= PATCH_HASH_PRIME;
+
+	if (dst_size >= PATCH_MATCH_SIZE)
+		h = patch_hash(dst);
+
+	while (pos < dst_size) {
+		unsigned int match = 0;
+		unsigned int match_src = 0;
+
+		if (pos + PATCH_MATCH_SIZE <= dst_size) {
+			/* Unmoved data first */
+			if ((pos + PATCH_MATCH_SIZE <= src_size) &&
+			    !memcmp(dst + pos, src + pos, PATCH_MATCH_SIZE)) {
+				match = 1;
+				match_src = pos;
+			}
+			else if (table[h & mask]) {
+				match_src = table[h & mask] - 1;
+				match = !memcmp(dst + pos, src + match_src, PATCH_MATCH_SIZE);
+			}
+		}
+
+		if (!match) {
+			if (pos + PATCH_MATCH_SIZE < dst_size)
+				h = (h - dst[pos] * pow) * PATCH_HASH_PRIME + dst[pos + PATCH_MATCH_SIZE];
+
+			pending++;
+			pos++;
+			continue;
+		}
+
+		/* Extend the match backwards into the pending insert and forwards */
+		while (pending && match_src && (dst[pos - 1] == src[match_src - 1])) {
+			pending--;
+			pos--;
+			match_src--;
+		}
+
+		ret = patch_emit(&w, PATCH_INSERT, 0, pending, dst + pos - pending);
+		if (ret)
+			goto exit_nomem;
+
+		pending = 0;
+
+		for (match = 0; (pos + match < dst_size) && (match_src + match < src_size) &&
+		     (dst[pos + match] == src[match_src + match]); match++)
+			;
+
+		/* Continue the previous copy */
+		if (w.count && (w.cmds[w.count - 1].type == PATCH_COPY) &&
+		    (w.cmds[w.count - 1].offset + w.cmds[w.count - 1].size == match_src))
+			w.cmds[w.count - 1].size += match;
+		else {
+			ret = patch_emit(&w, PATCH_COPY, match_src, match, NULL);
+			if (ret)
+				goto exit_nomem;
+		}
+
+		for (i = match_src / PATCH_BLOCK_SIZE; i <= (match_src + match - 1) / PATCH_BLOCK_SIZE; i++)
+			used[i] = 1;
+
+		pos += match;
+
+		if (pos + PATCH_MATCH_SIZE <= dst_size)
+			h = patch_hash(dst + pos);
+	}
+
+	ret = patch_emit(&w, PATCH_INSERT, 0, pending, dst + pos - pending);
+	if (ret)
+		goto exit_nomem;
+
+	for (i = 0; i < DIV_ROUND_UP(src_size, PATCH_BLOCK_SIZE); i++)
+		block_count += used[i];
+
+	memset(&header, 0, sizeof(header));
+	header.magic         = PATCH_MAGIC;
+	header.version       = PATCH_VERSION;
+	header.source_size   = src_size;
+	header.target_size   = dst_size;
+	header.block_size    = PATCH_BLOCK_SIZE;
+	header.block_count   = block_count;
+	header.command_count = w.count;
+	baikal_scp_sha256(dst, dst_size, header.target_digest);
+
+	f = fopen(output, "wb");
+	if (!f) {
+		ret = errno;
+		fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", output, ret);
+		goto exit;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+
+	for (i = 0; i < DIV_ROUND_UP(src_size, PATCH_BLOCK_SIZE); i++) {
+		unsigned int start = i * PATCH_BLOCK_SIZE;
+
+		if (!used[i])
+			continue;
+
+		memset(&block, 0, sizeof(block));
+		block.index = i;
+		baikal_scp_sha256(src + start, (src_size - start < PATCH_BLOCK_SIZE)
+			? src_size - start : PATCH_BLOCK_SIZE, block.digest);
+		fwrite(&block, sizeof(block), 1, f);
+	}
+
+	for (i = 0; i < w.count; i++) {
+		fwrite(&w.cmds[i], sizeof(w.cmds[i]), 1, f);
+
+		if (w.cmds[i].type == PATCH_INSERT)
+			fwrite(w.data[i], 1, w.cmds[i].size, f);
+	}
+
+	patch_size = ftell(f);
+	ret = ferror(f);
+
+	if (fclose(f) || ret) {
+		ret = errno ? errno : EIO;
+		fprintf(stderr, "ERROR: Failed to write patch \"%s\" (%d)\n", output, ret);
+		goto exit;
+	}
+
+	if (!quiet) {
+		printf("Patch \"%s\": %u commands, %llu bytes inserted, %u source blocks, "
+			"%ld bytes (%.1f%% of the image)\n", output, w.count, w.inserted,
+			block_count, patch_size, (double)patch_size * 100.0 / dst_size);
+	}
+
+	goto exit;
+
+exit_nomem:
+	fprintf(stderr, "ERROR: Out of memory\n");
+
+exit:
+	free(w.cmds);
+	free(w.data);
+	free(used);
+	free(table);
+	free(dst);
+	free(src);
+	return ret;
+}
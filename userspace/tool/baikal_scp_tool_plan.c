@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Dry-run planner (--plan option)
+ *
+ * The operation collects the flash operations it would perform instead
+ * of performing them. The wall time of each operation is predicted from
+ * the throughput profile.
+ */
+
+/*
+ * Built-in throughput profile (MiB/s), a rough estimate
+ * used when no measured profile is available
+ */
+#define PLAN_DEFAULT_READ_RATE  2.0
+#define PLAN_DEFAULT_WRITE_RATE 0.5
+#define PLAN_DEFAULT_ERASE_RATE 1.0
+
+typedef struct plan_op {
+	const char  *name;
+	unsigned int offset;
+	unsigned int size;
+} plan_op_t;
+
+typedef struct plan {
+	int          enabled;
+	int          json;
+	const char  *path;  /* NULL for stdout */
+	const char  *operation;
+	unsigned int offset;
+	unsigned int size;
+
+	plan_op_t   *ops;
+	unsigned int op_count;
+	unsigned int op_alloc;
+
+	int          has_sectors;
+	unsigned int sectors_total;
+	unsigned int sectors_identical;
+	unsigned int sectors_no_erase;
+	unsigned int sectors_erase;
+
+	const char  *profile;  /* NULL for the built-in profile */
+	double       read_rate;
+	double       write_rate;
+	double       erase_rate;
+
+	/* Best request sizes, 0 if not measured */
+	unsigned int read_chunk;
+	unsigned int write_chunk;
+	unsigned int erase_chunk;
+} plan_t;
+
+static plan_t plan = {
+	.read_rate  = PLAN_DEFAULT_READ_RATE,
+	.write_rate = PLAN_DEFAULT_WRITE_RATE,
+	.erase_rate = PLAN_DEFAULT_ERASE_RATE,
+};
+
+/*
+ * Parse plan specification in form "[json[:<filepath>]]"
+ */
+int plan_init(const char *spec)
+{
+	if (spec) {
+		if (strncmp(spec, "json", 4) || (spec[4] && (spec[4] != ':')))
+			return EINVAL;
+
+		plan.json = 1;
+		plan.path = (spec[4] == ':' && spec[5]) ? spec + 5 : NULL;
+	}
+
+	plan.enabled = 1;
+	return 0;
+}
+
+int plan_enabled(void)
+{
+	return plan.enabled;
+}
+
+/*
+ * Plan output goes to stdout unless it is a JSON file
+ */
+int plan_uses_stdout(void)
+{
+	return plan.enabled && !plan.path;
+}
+
+/*
+ * Load throughput profile. Each line is "<read|write|erase> <MiB/s>
+ * [<request size>]", empty lines and lines starting with '#' are ignored.
+ * The missing default profile is not an error.
+ */
+int plan_profile_load(const char *path, int required)
+{
+	FILE *f;
+	char line[128];
+	unsigned int n = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		if (!required && (errno == ENOENT))
+			return 0;
+
+		fprintf(stderr, "ERROR: Cannot open profile \"%s\" (%d)\n", path, errno);
+		return errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char name[16];
+		double rate;
+		unsigned int chunk = 0;
+
+		n++;
+
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+
+		if ((sscanf(line, "%15s %lf %u", name, &rate, &chunk) < 2) || (rate <= 0)) {
+			fprintf(stderr, "ERROR: Invalid profile line %u in \"%s\"\n", n, path);
+			fclose(f);
+			return EINVAL;
+		}
+
+		if (!strcmp(name, "read")) {
+			plan.read_rate = rate;
+			plan.read_chunk = chunk;
+		}
+		else if (!strcmp(name, "write")) {
+			plan.write_rate = rate;
+			plan.write_chunk = chunk;
+		}
+		else if (!strcmp(name, "erase")) {
+			plan.erase_rate = rate;
+			plan.erase_chunk = chunk;
+		}
+	}
+
+	fclose(f);
+	plan.profile = path;
+	return 0;
+}
+
+/*
+ * Current rate of the operation type (MiB/s)
+ */
+double plan_profile_rate(const char *name)
+{
+	if (!strcmp(name, "write"))
+		return plan.write_rate;
+	else if (!strcmp(name, "erase"))
+		return plan.erase_rate;
+
+	return plan.read_rate;
+}
+
+/*
+ * Best request size of the operation type, 0 if it is not measured
+ */
+unsigned int plan_profile_chunk(const char *name)
+{
+	if (!strcmp(name, "write"))
+		return plan.write_chunk;
+	else if (!strcmp(name, "erase"))
+		return plan.erase_chunk;
+
+	return plan.read_chunk;
+}
+
+/*
+ * Split the flash operations into requests of the best measured sizes.
+ * The library keeps its default size for the operations not measured
+ * or with a request size it does not accept.
+ */
+void plan_profile_apply(void)
+{
+	if (plan.read_chunk)
+		baikal_scp_flash_set_part_size(BAIKAL_SCP_FLASH_READ, plan.read_chunk);
+
+	if (plan.write_chunk)
+		baikal_scp_flash_set_part_size(BAIKAL_SCP_FLASH_WRITE, plan.write_chunk);
+
+	if (plan.erase_chunk)
+		baikal_scp_flash_set_part_size(BAIKAL_SCP_FLASH_ERASE, plan.erase_chunk);
+}
+
+void plan_operation(const char *operation, unsigned int offset, unsigned int size)
+{
+	plan.operation = operation;
+	plan.offset    = offset;
+	plan.size      = size;
+}
+
+void plan_sectors(unsigned int total, unsigned int identical,
+	unsigned int no_erase, unsigned int erase)
+{
+	plan.has_sectors       = 1;
+	plan.sectors_total     = total;
+	plan.sectors_identical = identical;
+	plan.sectors_no_erase  = no_erase;
+	plan.sectors_erase     = erase;
+}
+
+/*
+ * Add flash operation: "compare", "erase", "write" or "verify"
+ */
+int plan_add(const char *name, unsigned int offset, unsigned int size)
+{
+	if (plan.op_count == plan.op_alloc) {
+		unsigned int alloc = plan.op_alloc ? plan.op_alloc * 2 : 16;
+		plan_op_t *ops = realloc(plan.ops, alloc * sizeof(plan_op_t));
+
+		if (!ops)
+			return ENOMEM;
+
+		plan.ops = ops;
+		plan.op_alloc = alloc;
+	}
+
+	plan.ops[plan.op_count].name   = name;
+	plan.ops[plan.op_count].offset = offset;
+	plan.ops[plan.op_count].size   = size;
+	plan.op_count++;
+	return 0;
+}
+
+static double plan_time(const plan_op_t *op)
+{
+	double rate = plan.read_rate;
+
+	if (!strcmp(op->name, "write"))
+		rate = plan.write_rate;
+	else if (!strcmp(op->name, "erase"))
+		rate = plan.erase_rate;
+
+	return ((double)op->size / (1024.0 * 1024.0)) / rate;
+}
+
+/*
+ * Total bytes and time of the operations with the name
+ */
+static double plan_total(const char *name, unsigned long long *bytes)
+{
+	unsigned int i;
+	double time = 0;
+
+	*bytes = 0;
+
+	for (i = 0; i < plan.op_count; i++) {
+		if (strcmp(plan.ops[i].name, name))
+			continue;
+
+		*bytes += plan.ops[i].size;
+		time += plan_time(&plan.ops[i]);
+	}
+
+	return time;
+}
+
+static const char *plan_types[] = { "compare", "erase", "write", "verify" };
+
+static void plan_emit_text(FILE *f)
+{
+	unsigned int i;
+	unsigned long long bytes;
+	double total = 0;
+
+	fprintf(f, "Plan: %s 0x%x bytes at offset 0x%x\n",
+		plan.operation ? plan.operation : "", plan.size, plan.offset);
+
+	if (plan.has_sectors) {
+		fprintf(f, "  Sectors total:                 %u\n", plan.sectors_total);
+		fprintf(f, "  Sectors identical (skipped):   %u\n", plan.sectors_identical);
+		fprintf(f, "  Sectors written without erase: %u\n", plan.sectors_no_erase);
+		fprintf(f, "  Sectors erased and written:    %u\n", plan.sectors_erase);
+	}
+
+	fprintf(f, "\nOperations:\n");
+
+	for (i = 0; i < plan.op_count; i++) {
+		fprintf(f, "  %-7s [+0x%08x] 0x%08x bytes  %8.2f s\n",
+			plan.ops[i].name, plan.ops[i].offset, plan.ops[i].size,
+			plan_time(&plan.ops[i]));
+	}
+
+	fprintf(f, "\nEstimated time:\n");
+
+	for (i = 0; i < sizeof(plan_types) / sizeof(plan_types[0]); i++) {
+		double time = plan_total(plan_types[i], &bytes);
+
+		if (bytes) {
+			fprintf(f, "  %-7s 0x%08llx bytes  %8.2f s\n", plan_types[i], bytes, time);
+			total += time;
+		}
+	}
+
+	fprintf(f, "  Total                     %8.2f s (profile: %s)\n",
+		total, plan.profile ? plan.profile : "built-in");
+}
+
+static void plan_emit_json(FILE *f)
+{
+	unsigned int i;
+	unsigned long long bytes;
+	double total = 0;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"operation\": \"%s\",\n", plan.operation ? plan.operation : "");
+	fprintf(f, "  \"offset\": %u,\n", plan.offset);
+	fprintf(f, "  \"size\": %u,\n", plan.size);
+
+	if (plan.has_sectors) {
+		fprintf(f, "  \"sectors_total\": %u,\n", plan.sectors_total);
+		fprintf(f, "  \"sectors_identical\": %u,\n", plan.sectors_identical);
+		fprintf(f, "  \"sectors_no_erase\": %u,\n", plan.sectors_no_erase);
+		fprintf(f, "  \"sectors_erase\": %u,\n", plan.sectors_erase);
+	}
+
+	fprintf(f, "  \"profile\": { \"path\": \"%s\", \"read_mib_per_sec\": %.3f,"
+		" \"write_mib_per_sec\": %.3f, \"erase_mib_per_sec\": %.3f },\n",
+		plan.profile ? plan.profile : "", plan.read_rate, plan.write_rate, plan.erase_rate);
+
+	fprintf(f, "  \"totals\": {");
+
+	for (i = 0; i < sizeof(plan_types) / sizeof(plan_types[0]); i++) {
+		double time = plan_total(plan_types[i], &bytes);
+
+		fprintf(f, "%s\n    \"%s\": { \"bytes\": %llu, \"time\": %.3f }",
+			i ? "," : "", plan_types[i], bytes, time);
+		total += time;
+	}
+
+	fprintf(f, "\n  },\n");
+	fprintf(f, "  \"time\": %.3f,\n", total);
+	fprintf(f, "  \"operations\": [");
+
+	for (i = 0; i < plan.op_count; i++) {
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"offset\": %u, \"size\": %u, \"time\": %.3f }",
+			i ? "," : "", plan.ops[i].name, plan.ops[i].offset, plan.ops[i].size,
+			plan_time(&plan.ops[i]));
+	}
+
+	fprintf(f, "%s]\n}\n", plan.op_count ? "\n  " : "");
+}
+
+int plan_emit(void)
+{
+	FILE *f = stdout;
+
+	if (plan.path) {
+		f = fopen(plan.path, "w");
+		if (!f) {
+			fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", plan.path, errno);
+			return errno;
+		}
+	}
+
+	if (plan.json)
+		plan_emit_json(f);
+	else
+		plan_emit_text(f);
+
+	if (f != stdout)
+		fclose(f);
+
+	free(plan.ops);
+	plan.ops = NULL;
+	plan.op_count = plan.op_alloc = 0;
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Machine-readable operation report (--report option)
+ */
+
+#define REPORT_MAX_PHASES 8
+
+typedef struct report_phase {
+	const char        *name;
+	double             time;
+	unsigned long long bytes;
+	unsigned long long ioctls;
+	unsigned long long retries;
+} report_phase_t;
+
+typedef struct report {
+	int          enabled;
+	const char  *path;   /* NULL for stderr */
+	const char  *operation;
+	unsigned int offset;
+	unsigned int size;
+
+	double       start;
+	double       phase_start;
+	baikal_scp_flash_counters_t phase_counters;
+	int          phase_active;
+
+	unsigned int   phase_count;
+	report_phase_t phases[REPORT_MAX_PHASES];
+
+	int          has_sectors;
+	unsigned int sectors_total;
+	unsigned int sectors_skipped;
+
+	int           has_digest;
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+} report_t;
+
+static report_t report;
+
+static double report_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report_counters(baikal_scp_flash_counters_t *counters)
+{
+	if (baikal_scp_flash_counters(counters))
+		memset(counters, 0, sizeof(*counters));
+}
+
+/*
+ * Parse report specification in form "json[:<filepath>]"
+ */
+int report_init(const char *spec)
+{
+	if (strncmp(spec, "json", 4) || (spec[4] && (spec[4] != ':')))
+		return EINVAL;
+
+	report.enabled = 1;
+	report.path = (spec[4] == ':' && spec[5]) ? spec + 5 : NULL;
+	report.start = report_now();
+
+	return 0;
+}
+
+void report_operation(const char *operation, unsigned int offset, unsigned int size)
+{
+	report.operation = operation;
+	report.offset    = offset;
+	report.size      = size;
+}
+
+void report_phase_begin(const char *name)
+{
+	if (!report.enabled)
+		return;
+
+	if (report.phase_active)
+		report_phase_end();
+
+	if (report.phase_count == REPORT_MAX_PHASES)
+		return;
+
+	report.phases[report.phase_count].name = name;
+	report.phase_start = report_now();
+	report.phase_active = 1;
+	report_counters(&report.phase_counters);
+}
+
+static unsigned long long report_bytes(const baikal_scp_flash_counters_t *counters)
+{
+	return counters->bytes_read + counters->bytes_written + counters->bytes_erased;
+}
+
+/*
+ * Phase bytes are taken from the library counters, so the phase
+ * interrupted by a failure reports the amount actually transferred
+ */
+void report_phase_end(void)
+{
+	report_phase_t *phase;
+	baikal_scp_flash_counters_t counters;
+
+	if (!report.enabled || !report.phase_active)
+		return;
+
+	report_counters(&counters);
+
+	phase = &report.phases[report.phase_count++];
+	phase->time    = report_now() - report.phase_start;
+	phase->bytes   = report_bytes(&counters) - report_bytes(&report.phase_counters);
+	phase->ioctls  = counters.ioctls - report.phase_counters.ioctls;
+	phase->retries = counters.retries - report.phase_counters.retries;
+
+	report.phase_active = 0;
+}
+
+void report_sectors(unsigned int total, unsigned int skipped)
+{
+	report.has_sectors     = 1;
+	report.sectors_total   = total;
+	report.sectors_skipped = skipped;
+}
+
+void report_digest(const unsigned char *digest)
+{
+	report.has_digest = 1;
+	memcpy(report.digest, digest, BAIKAL_SCP_SHA256_SIZE);
+}
+
+static double report_rate(unsigned long long bytes, double time)
+{
+	return (time > 0) ? ((double)bytes / (1024.0 * 1024.0)) / time : 0;
+}
+
+/* Per-request-type counters of the library, request latencies in microseconds */
+static void report_requests(FILE *f, const baikal_scp_flash_counters_t *counters)
+{
+	static const char *names[BAIKAL_SCP_STATS_OPS] = {
+		"read", "write", "erase", "copy", "fill"
+	};
+
+	unsigned int i, j, n = 0;
+
+	fprintf(f, "  \"requests\": [");
+
+	for (i = 0; i < BAIKAL_SCP_STATS_OPS; i++) {
+		const baikal_scp_stats_entry_t *e = &counters->op[i];
+
+		if (!e->requests)
+			continue;
+
+		fprintf(f, "%s\n    { \"type\": \"%s\", \"count\": %llu, \"errors\": %llu,"
+			" \"retries\": %llu, \"bytes\": %llu, \"avg_us\": %.1f, \"max_us\": %.1f,"
+			" \"histogram\": [", n++ ? "," : "", names[i], e->requests, e->errors,
+			e->retries, e->bytes, (double)e->total_ns / e->requests / 1000.0,
+			(double)e->max_ns / 1000.0);
+
+		for (j = 0; j < BAIKAL_SCP_STATS_HIST_BUCKETS; j++)
+			fprintf(f, "%s%llu", j ? ", " : "", e->hist[j]);
+
+		fprintf(f, "] }");
+	}
+
+	fprintf(f, "%s]\n", n ? "\n  " : "");
+}
+
+/*
+ * Output the report. Called on both success and failure,
+ * the phase interrupted by the failure is reported as well.
+ */
+int report_emit(int result)
+{
+	FILE *f = stderr;
+	unsigned int i;
+	baikal_scp_flash_counters_t counters;
+
+	if (!report.enabled)
+		return 0;
+
+	if (report.phase_active)
+		report_phase_end();
+
+	if (report.path) {
+		f = fopen(report.path, "w");
+		if (!f) {
+			fprintf(stderr, "ERROR: Cannot open \"%s\" for writing (%d)\n", report.path, errno);
+			return errno;
+		}
+	}
+
+	report_counters(&counters);
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"operation\": \"%s\",\n", report.operation ? report.operation : "");
+	fprintf(f, "  \"offset\": %u,\n", report.offset);
+	fprintf(f, "  \"size\": %u,\n", report.size);
+	fprintf(f, "  \"result\": %d,\n", result);
+	fprintf(f, "  \"error\": \"%s\",\n", result ? strerror(result > 0 ? result : errno) : "");
+	fprintf(f, "  \"time\": %.6f,\n", report_now() - report.start);
+	fprintf(f, "  \"ioctls\": %llu,\n", counters.ioctls);
+	fprintf(f, "  \"retries\": %llu,\n", counters.retries);
+
+	if (report.has_sectors) {
+		fprintf(f, "  \"sectors_total\": %u,\n", report.sectors_total);
+		fprintf(f, "  \"sectors_skipped\": %u,\n", report.sectors_skipped);
+	}
+
+	if (report.has_digest) {
+		fprintf(f, "  \"sha256\": \"");
+		for (i = 0; i < BAIKAL_SCP_SHA256_SIZE; i++)
+			fprintf(f, "%02x", report.digest[i]);
+		fprintf(f, "\",\n");
+	}
+
+	fprintf(f, "  \"phases\": [");
+
+	for (i = 0; i < report.phase_count; i++) {
+		const report_phase_t *phase = &report.phases[i];
+
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"time\": %.6f, \"bytes\": %llu,"
+			" \"mib_per_sec\": %.3f, \"ioctls\": %llu, \"retries\": %llu }",
+			i ? "," : "", phase->name, phase->time, phase->bytes,
+			report_rate(phase->bytes, phase->time), phase->ioctls, phase->retries);
+	}
+
+	fprintf(f, "%s],\n", report.phase_count ? "\n  " : "");
+
+	report_requests(f, &counters);
+
+	fprintf(f, "}\n");
+
+	if (f != stderr)
+		fclose(f);
+
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2021-2022 Tano Systems LLC, All rights reserved.
+ *
+ * Author: Anton Kikin <a.kikin@tano-systems.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+#include <signal.h>
+#include <libgen.h>
+
+#include "baikal_scp_tool.h"
+
+/*
+ * Background flash scrubber (--scrub option)
+ *
+ * Walks the flash sector by sector at a limited rate and compares the
+ * SHA-256 digest of each sector with the baseline kept in the manifest.
+ * The first digest of a sector becomes its baseline. Changed and
+ * unreadable sectors are reported on each pass until the changed
+ * contents are accepted (--scrub-accept). The manifest also keeps the
+ * position of the walk, so an interrupted or time limited run is
+ * continued by the next run.
+ *
+ * The scrubber yields to the foreground flash users: the device is only
+ * opened for the time of a single sector, the requests sent to the flash
+ * service daemon are background requests and the reads are throttled by
+ * the driver duty cycle limit.
+ */
+
+#define SCRUB_MAGIC   0x4d435342 /* "BSCM" */
+#define SCRUB_VERSION 1
+
+#define SCRUB_FLUSH_INTERVAL 5.0
+
+/* Delay before the next attempt to open the device held by another process */
+#define SCRUB_BUSY_DELAY 1.0
+
+#define SCRUB_SECTOR_BASELINE   0x01 /* Digest is the baseline */
+#define SCRUB_SECTOR_CHANGED    0x02 /* Contents differ from the baseline */
+#define SCRUB_SECTOR_UNREADABLE 0x04 /* Last read failed */
+
+typedef struct scrub_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sector_size;
+	uint32_t sector_count;
+	uint32_t next;   /* Sector the next run starts from */
+	uint32_t passes; /* Completed passes */
+} scrub_header_t;
+
+typedef struct scrub_sector {
+	uint8_t flags;
+	uint8_t reserved[3];
+	uint8_t digest[BAIKAL_SCP_SHA256_SIZE];
+} scrub_sector_t;
+
+typedef struct scrub_manifest {
+	int             fd;
+	scrub_header_t  header;
+	scrub_sector_t *sectors;
+} scrub_manifest_t;
+
+static volatile sig_atomic_t scrub_stop = 0;
+
+static double scrub_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void scrub_sleep(double seconds)
+{
+	struct timespec ts;
+
+	if (seconds <= 0)
+		return;
+
+	ts.tv_sec  = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+
+	/* Interrupted by a signal, the loop checks scrub_stop */
+	nanosleep(&ts, NULL);
+}
+
+static void scrub_signal(int sig)
+{
+	scrub_stop = 1;
+}
+
+/*
+ * Open the manifest. A missing manifest or a manifest of a flash with
+ * different geometry is started anew when create is set.
+ */
+static int scrub_manifest_open(scrub_manifest_t *m, const char *path,
+	const baikal_scp_flash_info_t *flash_info, int create, int quiet)
+{
+	scrub_header_t header;
+	unsigned int count = flash_info->sector_count;
+	size_t sectors_size = count * sizeof(scrub_sector_t);
+	char *dir;
+
+	memset(&m->header, 0, sizeof(m->header));
+	m->header.magic        = SCRUB_MAGIC;
+	m->header.version      = SCRUB_VERSION;
+	m->header.sector_size  = flash_info->sector_size;
+	m->header.sector_count = count;
+
+	m->sectors = calloc(count, sizeof(scrub_sector_t));
+	if (!m->sectors) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return ENOMEM;
+	}
+
+	m->fd = open(path, O_RDWR);
+	if (m->fd != -1) {
+		if ((pread(m->fd, &header, sizeof(header), 0) == sizeof(header)) &&
+		    (header.magic == SCRUB_MAGIC) &&
+		    (header.version == SCRUB_VERSION) &&
+		    (header.sector_size == m->header.sector_size) &&
+		    (header.sector_count == m->header.sector_count) &&
+		    (pread(m->fd, m->sectors, sectors_size, sizeof(header)) == sectors_size)) {
+			m->header = header;
+
+			if (m->header.next >= count)
+				m->header.next = 0;
+
+			return 0;
+		}
+
+		if (!create) {
+			close(m->fd);
+			m->fd = -1;
+			return ENOENT;
+		}
+
+		if (!quiet)
+			printf("Manifest \"%s\" does not match the flash, starting a new baseline\n", path);
+
+		memset(m->sectors, 0, sectors_size);
+		return 0;
+	}
+
+	if (!create)
+		return ENOENT;
+
+	/* The default manifest directory may not exist yet */
+	dir = strdup(path);
+	if (dir) {
+		mkdir(dirname(dir), 0700);
+		free(dir);
+	}
+
+	m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (m->fd == -1) {
+		fprintf(stderr, "ERROR: Cannot create manifest \"%s\" (%d)\n", path, errno);
+		return errno;
+	}
+
+	return 0;
+}
+
+static int scrub_manifest_flush(scrub_manifest_t *m)
+{
+	size_t sectors_size = m->header.sector_count * sizeof(scrub_sector_t);
+
+	if ((pwrite(m->fd, &m->header, sizeof(m->header), 0) != sizeof(m->header)) ||
+	    (pwrite(m->fd, m->sectors, sectors_size, sizeof(m->header)) != sectors_size) ||
+	    fdatasync(m->fd))
+		return errno ? errno : EIO;
+
+	return 0;
+}
+
+static void scrub_manifest_close(scrub_manifest_t *m)
+{
+	if (m->fd != -1) {
+		close(m->fd);
+		m->fd = -1;
+	}
+
+	free(m->sectors);
+	m->sectors = NULL;
+}
+
+/*
+ * Hash a single sector, the device is only held by the library while the
+ * sector is read. Returns the device open error (EBUSY if the device is held
+ * by another process), the result of the hash is stored to *result.
+ */
+static int scrub_sector(unsigned int offset, unsigned int size,
+	unsigned char digest[BAIKAL_SCP_SHA256_SIZE], int *result)
+{
+	int ret;
+
+	ret = baikal_scp_resume();
+	if (ret)
+		return ret;
+
+	*result = baikal_scp_flash_sha256(offset, size, digest);
+	baikal_scp_suspend();
+
+	return 0;
+}
+
+/*
+ * Scrub the sectors of the flash area. The rate is limited to rate KiB/s,
+ * the run is stopped after max_time seconds (0 for no limit) and continued
+ * from the same sector by the next run. Returns EIO if any changed or
+ * unreadable sector is found.
+ */
+int scrub_run(const char *path, unsigned int offset, unsigned int size,
+	unsigned int rate, unsigned int max_time, int accept, int quiet)
+{
+	int ret;
+	int open_ret = 0;
+	int result;
+	scrub_manifest_t m = { .fd = -1 };
+	baikal_scp_flash_info_t flash_info;
+	unsigned int first, last, i;
+	unsigned int scrubbed = 0, changed = 0, unreadable = 0, baseline = 0;
+	double begin, flushed;
+	struct sigaction sa = { .sa_handler = scrub_signal };
+	struct sigaction old_int, old_term;
+
+	ret = baikal_scp_flash_info(&flash_info);
+	if (ret) {
+		fprintf(stderr, "ERROR: Failed to get flash information (%d)\n", ret);
+		return ret;
+	}
+
+	if (!size)
+		size = flash_info.total_size - offset;
+
+	if ((offset >= flash_info.total_size) || (size > flash_info.total_size - offset)) {
+		fprintf(stderr, "ERROR: Invalid size or offset value or its combination\n");
+		return EINVAL;
+	}
+
+	ret = scrub_manifest_open(&m, path, &flash_info, 1, quiet);
+	if (ret)
+		return ret;
+
+	/*
+	 * The device is only opened for each sector from now on, the library
+	 * keeps the flash operation counters of the whole scrub for the report
+	 */
+	baikal_scp_set_background(1);
+	baikal_scp_suspend();
+
+	first = offset / flash_info.sector_size;
+	last  = (offset + size - 1) / flash_info.sector_size;
+
+	i = m.header.next;
+	if ((i < first) || (i > last))
+		i = first;
+
+	if (!quiet) {
+		printf("Scrubbing sectors %u-%u at %u KiB/s, starting from sector %u\n",
+			first, last, rate, i);
+	}
+
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	report_phase_begin("scrub");
+
+	begin = flushed = scrub_now();
+
+	while (!scrub_stop) {
+		unsigned char digest[BAIKAL_SCP_SHA256_SIZE];
+		scrub_sector_t *s = &m.sectors[i];
+		unsigned int sector_offset = i * flash_info.sector_size;
+		double start = scrub_now();
+
+		if (max_time && (start - begin >= max_time))
+			break;
+
+		ret = scrub_sector(sector_offset, flash_info.sector_size, digest, &result);
+		if (ret == EBUSY) {
+			/* Foreground flash user, try again later */
+			scrub_sleep(SCRUB_BUSY_DELAY);
+			continue;
+		}
+
+		/* Any other failure to open the device is not going to go away */
+		if (ret) {
+			fprintf(stderr, "ERROR: Failed to open SCP device (%d)\n", ret);
+			open_ret = ret;
+			break;
+		}
+
+		if (result) {
+			s->flags |= SCRUB_SECTOR_UNREADABLE;
+			unreadable++;
+
+			fprintf(stderr, "Sector %u [+0x%08x]: unreadable (%d)\n", i, sector_offset, result);
+		}
+		else {
+			s->flags &= ~SCRUB_SECTOR_UNREADABLE;
+
+			if (!(s->flags & SCRUB_SECTOR_BASELINE)) {
+				memcpy(s->digest, digest, sizeof(s->digest));
+				s->flags |= SCRUB_SECTOR_BASELINE;
+				baseline++;
+			}
+			else if (memcmp(s->digest, digest, sizeof(s->digest))) {
+				if (accept) {
+					memcpy(s->digest, digest, sizeof(s->digest));
+					s->flags &= ~SCRUB_SECTOR_CHANGED;
+					baseline++;
+				}
+				else {
+					s->flags |= SCRUB_SECTOR_CHANGED;
+					changed++;
+
+					fprintf(stderr, "Sector %u [+0x%08x]: contents differ from the baseline\n",
+						i, sector_offset);
+				}
+			}
+			else {
+				s->flags &= ~SCRUB_SECTOR_CHANGED;
+			}
+		}
+
+		scrubbed++;
+
+		if (i == last) {
+			i = first;
+			m.header.passes++;
+		}
+		else {
+			i++;
+		}
+
+		m.header.next = i;
+
+		if (scrub_now() - flushed >= SCRUB_FLUSH_INTERVAL) {
+			scrub_manifest_flush(&m);
+			flushed = scrub_now();
+		}
+
+		/* A whole pass is done, the next run continues */
+		if (i == first)
+			break;
+
+		scrub_sleep(start + ((double)flash_info.sector_size / 1024.0) / rate - scrub_now());
+	}
+
+	report_phase_end();
+
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+
+	ret = scrub_manifest_flush(&m);
+	if (ret)
+		fprintf(stderr, "ERROR: Failed to write manifest \"%s\" (%d)\n", path, ret);
+
+	report_sectors(scrubbed, 0);
+
+	if (!quiet) {
+		printf("Scrubbed %u sectors in %.1f s: %u changed, %u unreadable, %u new baseline\n",
+			scrubbed, scrub_now() - begin, changed, unreadable, baseline);
+		printf("Next run starts from sector %u, %u passes completed\n",
+			m.header.next, m.header.passes);
+	}
+
+	scrub_manifest_close(&m);
+
+	if (!ret && open_ret)
+		ret = open_ret;
+
+	if (!ret && (changed || unreadable))
+		ret = EIO;
+
+	return ret;
+}
+
+/*
+ * Drop the baseline of the sectors in the flash area modified by the tool,
+ * so the intended changes are not reported by the scrubber
+ */
+void scrub_forget(const char *path, unsigned int offset, unsigned int size)
+{
+	scrub_manifest_t m = { .fd = -1 };
+	baikal_scp_flash_info_t flash_info;
+	unsigned int i;
+
+	if (!size || baikal_scp_flash_info(&flash_info))
+		return;
+
+	if (scrub_manifest_open(&m, path, &flash_info, 0, 1)) {
+		scrub_manifest_close(&m);
+		return;
+	}
+
+	for (i = offset / flash_info.sector_size;
+	     (i < flash_info.sector_count) && (i * flash_info.sector_size < offset + size); i++)
+		m.sectors[i].flags &= ~(SCRUB_SECTOR_BASELINE | SCRUB_SECTOR_CHANGED);
+
+	scrub_manifest_flush(&m);
+	scrub_manifest_close(&m);
+}